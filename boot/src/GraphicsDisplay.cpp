@@ -67,14 +67,14 @@ void GraphicsDisplay::InitSurfaces()
     if (pixelFormat == mtl::PixelFormat::Unknown)
         m_frontbuffer.reset();
     else
-        m_frontbuffer = mtl::make_shared<mtl::Surface>(width, height, info->pixelsPerScanLine * GetPixelSize(pixelFormat),
-                                                       pixelFormat, (void*)(uintptr_t)mode->framebufferBase);
+        m_frontbuffer = mtl::make_intrusive<mtl::Surface>(width, height, info->pixelsPerScanLine * GetPixelSize(pixelFormat),
+                                                          pixelFormat, (void*)(uintptr_t)mode->framebufferBase);
 
     // Backbuffer
     if (m_backbuffer && m_backbuffer->width == width && m_backbuffer->height == height)
         return;
 
-    m_backbuffer = mtl::make_shared<mtl::Surface>(width, height, mtl::PixelFormat::X8R8G8B8);
+    m_backbuffer = mtl::make_intrusive<mtl::Surface>(width, height, mtl::PixelFormat::X8R8G8B8);
 }
 
 int GraphicsDisplay::GetModeCount() const
@@ -125,14 +125,14 @@ bool GraphicsDisplay::SetMode(int index)
     return true;
 }
 
-mtl::shared_ptr<mtl::Surface> GraphicsDisplay::GetFrontbuffer()
+mtl::Surface* GraphicsDisplay::GetFrontbuffer()
 {
-    return m_frontbuffer;
+    return m_frontbuffer.get();
 }
 
-mtl::shared_ptr<mtl::Surface> GraphicsDisplay::GetBackbuffer()
+mtl::Surface& GraphicsDisplay::GetBackbuffer()
 {
-    return m_backbuffer;
+    return *m_backbuffer;
 }
 
 void GraphicsDisplay::Blit(int x, int y, int width, int height)
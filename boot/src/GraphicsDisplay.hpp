@@ -51,8 +51,8 @@ public:
     void GetCurrentMode(mtl::GraphicsMode* mode) const override;
     bool GetMode(int index, mtl::GraphicsMode* mode) const override;
     bool SetMode(int index) override;
-    mtl::shared_ptr<mtl::Surface> GetFrontbuffer() override;
-    mtl::shared_ptr<mtl::Surface> GetBackbuffer() override;
+    mtl::Surface* GetFrontbuffer() override;
+    mtl::Surface& GetBackbuffer() override;
     void Blit(int x, int y, int width, int height) override;
     // bool GetEdid(mtl::Edid* edid) const override;
 
@@ -62,6 +62,6 @@ private:
     efi::GraphicsOutputProtocol* m_gop; // Can't be null
     efi::EdidProtocol* m_edid;          // Can be null
 
-    mtl::shared_ptr<mtl::Surface> m_frontbuffer;
-    mtl::shared_ptr<mtl::Surface> m_backbuffer;
+    mtl::intrusive_ptr<mtl::Surface> m_frontbuffer;
+    mtl::intrusive_ptr<mtl::Surface> m_backbuffer;
 };
@@ -34,6 +34,9 @@
 
 PageTable::PageTable()
 {
+    // With a 4 KB granule, level 1 blocks (1 GB) are always supported
+    m_hugePages = true;
+
     auto root = AllocateZeroedPages(1, efi::MemoryType::KernelData);
     pml4 = reinterpret_cast<uint64_t*>(root);
 
@@ -55,16 +58,74 @@ void* PageTable::GetRaw() const
     return (void*)descriptor;
 }
 
-void PageTable::Map(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, size_t pageCount, mtl::PageFlags flags)
+size_t PageTable::GetTableCount(uintptr_t virtualAddress, size_t pageCount)
+{
+    if (pageCount == 0)
+        return 0;
+
+    // Count how many 2 MB, 1 GB and 512 GB regions the range touches, that is one table per region at each level
+    const auto first = virtualAddress;
+    const auto last = virtualAddress + (pageCount << mtl::kMemoryPageShift) - 1;
+
+    size_t count = 0;
+    for (int shift = mtl::kMemoryLargePageShift; shift <= 39; shift += 9)
+    {
+        count += (last >> shift) - (first >> shift) + 1;
+    }
+
+    return count;
+}
+
+void PageTable::Reserve(size_t tableCount)
+{
+    // Whatever is left of a previous reservation stays allocated, but this is only a few pages at most
+    m_pool = AllocateZeroedPages(tableCount, efi::MemoryType::KernelData);
+    m_poolSize = tableCount;
+}
+
+mtl::PhysicalAddress PageTable::AllocateTable()
+{
+    if (m_poolSize == 0)
+        return AllocateZeroedPages(1, efi::MemoryType::KernelData);
+
+    const auto table = m_pool;
+    m_pool += mtl::kMemoryPageSize;
+    --m_poolSize;
+    return table;
+}
+
+void PageTable::Map(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, size_t pageCount, mtl::PageFlags flags,
+                    bool allowLargePages)
 {
     assert(mtl::IsAligned(physicalAddress, mtl::kMemoryPageSize));
     assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
 
-    while (pageCount-- > 0)
+    constexpr size_t kLargePageCount = mtl::kMemoryLargePageSize >> mtl::kMemoryPageShift;
+    constexpr size_t kHugePageCount = mtl::kMemoryHugePageSize >> mtl::kMemoryPageShift;
+
+    while (pageCount > 0)
     {
-        MapPage(physicalAddress, virtualAddress, flags);
-        physicalAddress += mtl::kMemoryPageSize;
-        virtualAddress += mtl::kMemoryPageSize;
+        const auto alignment = physicalAddress | virtualAddress;
+        size_t count = 1;
+
+        if (allowLargePages && m_hugePages && pageCount >= kHugePageCount && mtl::IsAligned(alignment, mtl::kMemoryHugePageSize))
+        {
+            MapLeaf(physicalAddress, virtualAddress, 3, flags);
+            count = kHugePageCount;
+        }
+        else if (allowLargePages && pageCount >= kLargePageCount && mtl::IsAligned(alignment, mtl::kMemoryLargePageSize))
+        {
+            MapLeaf(physicalAddress, virtualAddress, 2, flags);
+            count = kLargePageCount;
+        }
+        else
+        {
+            MapPage(physicalAddress, virtualAddress, flags);
+        }
+
+        physicalAddress += count << mtl::kMemoryPageShift;
+        virtualAddress += count << mtl::kMemoryPageShift;
+        pageCount -= count;
     }
 }
 
@@ -73,41 +134,48 @@ void PageTable::MapPage(mtl::PhysicalAddress physicalAddress, uintptr_t virtualA
     assert(mtl::IsAligned(physicalAddress, mtl::kMemoryPageSize));
     assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
 
+    MapLeaf(physicalAddress, virtualAddress, 1, flags);
+}
+
+uint64_t& PageTable::GetEntry(uintptr_t virtualAddress, int level)
+{
     // We should only be mapping pages to high address space.
     assert(virtualAddress >= 0xFFFF000000000000ull);
 
-    const int i4 = (virtualAddress >> 39) & 0x1FF;
-    const int i3 = (virtualAddress >> 30) & 0x1FF;
-    const int i2 = (virtualAddress >> 21) & 0x1FF;
-    const int i1 = (virtualAddress >> 12) & 0x1FF;
-
-    if (!(pml4[i4] & mtl::PageFlags::Valid))
+    uint64_t* table = pml4;
+    for (int i = 4; i != level; --i)
     {
-        const auto page = AllocateZeroedPages(1, efi::MemoryType::KernelData);
-        pml4[i4] = page | mtl::PageFlags::PageTable;
+        auto& entry = table[(virtualAddress >> (12 + 9 * (i - 1))) & 0x1FF];
+        if (!(entry & mtl::PageFlags::Valid))
+        {
+            entry = AllocateTable() | mtl::PageFlags::PageTable;
+        }
+        else if (!(entry & mtl::PageFlags::Table))
+        {
+            MTL_LOG(Fatal) << "PageTable::GetEntry() - There is already a block at " << mtl::hex(virtualAddress)
+                           << " (entry = " << mtl::hex(entry) << ")";
+            std::abort();
+        }
+
+        table = (uint64_t*)(entry & mtl::AddressMask);
     }
 
-    uint64_t* pml3 = (uint64_t*)(pml4[i4] & mtl::AddressMask);
-    if (!(pml3[i3] & mtl::PageFlags::Valid))
-    {
-        const auto page = AllocateZeroedPages(1, efi::MemoryType::KernelData);
-        pml3[i3] = page | mtl::PageFlags::PageTable;
-    }
-
-    uint64_t* pml2 = (uint64_t*)(pml3[i3] & mtl::AddressMask);
-    if (!(pml2[i2] & mtl::PageFlags::Valid))
-    {
-        const auto page = AllocateZeroedPages(1, efi::MemoryType::KernelData);
-        pml2[i2] = page | mtl::PageFlags::PageTable;
-    }
+    return table[(virtualAddress >> (12 + 9 * (level - 1))) & 0x1FF];
+}
 
-    uint64_t* pml1 = (uint64_t*)(pml2[i2] & mtl::AddressMask);
-    if (pml1[i1] & mtl::PageFlags::Valid)
+void PageTable::MapLeaf(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, int level, mtl::PageFlags flags)
+{
+    auto& entry = GetEntry(virtualAddress, level);
+    if (entry & mtl::PageFlags::Valid)
     {
-        MTL_LOG(Fatal) << "PageTable::MapPage() - There is already something there! (i1 = " << i1
-                       << ", entry = " << mtl::hex(pml1[i1]) << ")";
+        MTL_LOG(Fatal) << "PageTable::MapLeaf() - There is already something there! (address = " << mtl::hex(virtualAddress)
+                       << ", level = " << level << ", entry = " << mtl::hex(entry) << ")";
         std::abort();
     }
 
-    pml1[i1] = physicalAddress | flags;
+    // Level 1 and 2 blocks are encoded like pages without the Page bit
+    if (level > 1)
+        entry = physicalAddress | (flags & ~mtl::PageFlags::Page);
+    else
+        entry = physicalAddress | flags;
 }
@@ -34,12 +34,31 @@ class PageTable
 public:
     PageTable();
 
-    void Map(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, size_t pageCount, mtl::PageFlags flags);
+    // Upper bound on the number of page tables needed to map a range of virtual memory
+    static size_t GetTableCount(uintptr_t virtualAddress, size_t pageCount);
+
+    // Pre-allocate page tables so that mapping memory doesn't need to call into the firmware for each table
+    void Reserve(size_t tableCount);
+
+    // Map a range of memory, using 2 MB / 1 GB pages where both addresses are suitably aligned unless 'allowLargePages' is false
+    void Map(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, size_t pageCount, mtl::PageFlags flags,
+             bool allowLargePages = true);
 
     void MapPage(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, mtl::PageFlags flags);
 
     void* GetRaw() const;
 
 private:
+    // Return the entry for 'virtualAddress' in the table at 'level' (1 = 4 KB pages, 2 = 2 MB pages, 3 = 1 GB pages),
+    // allocating any missing tables along the way
+    uint64_t& GetEntry(uintptr_t virtualAddress, int level);
+
+    mtl::PhysicalAddress AllocateTable();
+
+    void MapLeaf(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, int level, mtl::PageFlags flags);
+
     uint64_t* pml4;
+    bool m_hugePages;              // Are 1 GB pages supported?
+    mtl::PhysicalAddress m_pool{}; // Reserved page tables
+    size_t m_poolSize{};           // Number of reserved page tables
 };
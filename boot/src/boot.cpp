@@ -30,6 +30,9 @@
 #include "LogFile.hpp"
 #include "PageTable.hpp"
 #include "elf.hpp"
+#include "modules.hpp"
+#include "timing.hpp"
+#include <algorithm>
 #include <cassert>
 #include <metal/graphics/GraphicsConsole.hpp>
 #include <metal/graphics/SimpleDisplay.hpp>
@@ -50,7 +53,21 @@ static mtl::shared_ptr<Console> g_logConsole;
 static mtl::shared_ptr<LogFile> g_logFile;
 static mtl::vector<efi::MemoryDescriptor> g_customMemoryTypes;
 
+mtl::arena g_scratchArena;
+
+// Allocations at least this big are cleared with non-temporal stores
+static constexpr size_t kNonTemporalClearPageCount = 16;
+
 mtl::PhysicalAddress AllocatePages(size_t pageCount, efi::MemoryType memoryType)
+{
+    if (auto memory = TryAllocatePages(pageCount, memoryType))
+        return *memory;
+
+    MTL_LOG(Fatal) << "Out of memory";
+    std::abort();
+}
+
+mtl::optional<mtl::PhysicalAddress> TryAllocatePages(size_t pageCount, efi::MemoryType memoryType)
 {
     auto bootServices = g_efiSystemTable->bootServices;
 
@@ -68,18 +85,14 @@ mtl::PhysicalAddress AllocatePages(size_t pageCount, efi::MemoryType memoryType)
                 // custom memory types (i.e. kernel code and data) ourselves.
                 SetCustomMemoryType(memory, pageCount, memoryType);
             }
-            return memory;
+            return mtl::make_optional(memory);
         }
     }
 
     if (g_memoryMap)
-    {
-        if (auto memory = g_memoryMap->AllocatePages(pageCount, memoryType))
-            return *memory;
-    }
+        return g_memoryMap->AllocatePages(pageCount, memoryType);
 
-    MTL_LOG(Fatal) << "Out of memory";
-    std::abort();
+    return {};
 }
 
 void SetCustomMemoryType(mtl::PhysicalAddress address, size_t pageCount, efi::MemoryType memoryType)
@@ -95,7 +108,14 @@ void SetCustomMemoryType(mtl::PhysicalAddress address, size_t pageCount, efi::Me
 mtl::PhysicalAddress AllocateZeroedPages(size_t pageCount, efi::MemoryType memoryType)
 {
     const auto pages = AllocatePages(pageCount, memoryType);
-    memset((void*)(uintptr_t)pages, 0, pageCount * mtl::kMemoryPageSize);
+
+    // Large allocations (i.e. an executable's bss) are not accessed until the kernel runs, don't fill the cache with them.
+    // Small ones are page tables that are about to be written.
+    if (pageCount >= kNonTemporalClearPageCount)
+        mtl::ClearMemoryNonTemporal((void*)(uintptr_t)pages, pageCount * mtl::kMemoryPageSize);
+    else
+        memset((void*)(uintptr_t)pages, 0, pageCount * mtl::kMemoryPageSize);
+
     return pages;
 }
 
@@ -131,8 +151,9 @@ mtl::vector<GraphicsDisplay> InitializeDisplays(efi::BootServices* bootServices)
 {
     mtl::vector<GraphicsDisplay> displays;
 
+    mtl::arena::scope scratch(g_scratchArena);
     efi::uintn_t size{0};
-    mtl::vector<efi::Handle> handles;
+    ScratchVector<efi::Handle> handles(g_scratchArena);
     efi::Status status;
 
     // LocateHandle() should only be called twice... But I don't want to write it twice :)
@@ -249,52 +270,10 @@ mtl::expected<mtl::shared_ptr<LogFile>, efi::Status> InitializeLogFile(efi::File
     return g_logFile;
 }
 
-mtl::expected<Module, efi::Status> LoadModule(efi::FileProtocol* fileSystem, mtl::string_view name,
-                                              efi::MemoryType memoryType = efi::MemoryType::BootModule)
-{
-    // Technically we should be doing "proper" conversion to u16string here,
-    // but we know that "name" will always be valid ASCII. So we take a shortcut.
-    mtl::u16string path(name.begin(), name.end());
-
-    efi::FileProtocol* file;
-    auto status = fileSystem->Open(fileSystem, &file, path.c_str(), efi::OpenMode::Read, 0);
-    if (efi::Error(status))
-    {
-        MTL_LOG(Debug) << "Failed to open file \"" << path << "\": " << mtl::hex(status);
-        return mtl::unexpected(status);
-    }
-
-    mtl::vector<char> infoBuffer;
-    efi::uintn_t infoSize = 0;
-    while ((status = file->GetInfo(file, &efi::kFileInfoGuid, &infoSize, infoBuffer.data())) == efi::Status::BufferTooSmall)
-    {
-        infoBuffer.resize(infoSize);
-    }
-    if (efi::Error(status))
-    {
-        MTL_LOG(Debug) << "Failed to retrieve info about file \"" << path << "\": " << mtl::hex(status);
-        return mtl::unexpected(status);
-    }
-
-    const efi::FileInfo& info = *(const efi::FileInfo*)infoBuffer.data();
-
-    // Allocate page-aligned memory for the module. This is required for ELF files.
-    const int pageCount = mtl::AlignUp(info.fileSize, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
-    const auto fileAddress = AllocatePages(pageCount, memoryType);
-
-    efi::uintn_t fileSize = info.fileSize;
-    status = file->Read(file, &fileSize, (void*)(uintptr_t)fileAddress);
-    if (efi::Error(status))
-    {
-        MTL_LOG(Debug) << "Failed to load file \"" << path << "\": " << mtl::hex(status);
-        return mtl::unexpected(status);
-    }
-
-    return Module{fileAddress, fileSize};
-}
-
 mtl::expected<mtl::shared_ptr<MemoryMap>, efi::Status> ExitBootServices(efi::Handle hImage, efi::SystemTable* systemTable)
 {
+    ScopedBootPhase phase("ExitBootServices");
+
     efi::uintn_t bufferSize = 0;
     efi::MemoryDescriptor* descriptors = nullptr;
     efi::uintn_t memoryMapKey = 0;
@@ -314,7 +293,8 @@ mtl::expected<mtl::shared_ptr<MemoryMap>, efi::Status> ExitBootServices(efi::Han
 
     // 1) Retrieve the memory map from the firmware
     efi::Status status;
-    mtl::vector<char> buffer;
+    mtl::arena::scope scratch(g_scratchArena);
+    ScratchVector<char> buffer(g_scratchArena);
     while ((status = bootServices->GetMemoryMap(&bufferSize, descriptors, &memoryMapKey, &descriptorSize, &descriptorVersion)) ==
            efi::Status::BufferTooSmall)
     {
@@ -394,6 +374,8 @@ mtl::expected<mtl::shared_ptr<MemoryMap>, efi::Status> ExitBootServices(efi::Han
 
 efi::Status Boot(efi::Handle hImage, efi::SystemTable* systemTable)
 {
+    InitializeTiming(systemTable->bootServices);
+
     auto fileSystem = InitializeFileSystem(hImage, systemTable->bootServices);
     if (!fileSystem)
     {
@@ -416,16 +398,20 @@ efi::Status Boot(efi::Handle hImage, efi::SystemTable* systemTable)
         return efi::Status::Unsupported;
     }
 
-    auto kernel = LoadModule(*fileSystem, "kernel", efi::MemoryType::KernelData);
-    if (!kernel)
+    const mtl::vector<ModuleRequest> requests{{"kernel", efi::MemoryType::KernelData, false},
+                                              {"initrd", efi::MemoryType::BootModule, true}};
+    auto modules = LoadModules(systemTable->bootServices, *fileSystem, requests);
+    if (!modules)
     {
-        MTL_LOG(Fatal) << "Failed to load kernel image: " << mtl::hex(kernel.error());
-        return kernel.error();
+        MTL_LOG(Fatal) << "Failed to load modules: " << mtl::hex(modules.error());
+        return modules.error();
     }
-    MTL_LOG(Info) << "Kernel size: " << kernel->size << " bytes";
+
+    const auto& kernel = (*modules)[0];
+    MTL_LOG(Info) << "Kernel size: " << kernel.size << " bytes";
 
     PageTable pageTable;
-    auto kernelEntryPoint = ElfLoad(*kernel, pageTable);
+    auto kernelEntryPoint = ElfLoad(kernel, pageTable);
     if (!kernelEntryPoint)
     {
         MTL_LOG(Fatal) << "Failed to load kernel module";
@@ -453,7 +439,8 @@ efi::Status Boot(efi::Handle hImage, efi::SystemTable* systemTable)
     mtl::shared_ptr<mtl::GraphicsConsole> console;
     if (!displays.empty() && displays[0].GetFrontbuffer())
     {
-        display.reset(new mtl::SimpleDisplay(displays[0].GetFrontbuffer(), displays[0].GetBackbuffer()));
+        display.reset(new mtl::SimpleDisplay(mtl::intrusive_ptr(displays[0].GetFrontbuffer()),
+                                             mtl::intrusive_ptr(&displays[0].GetBackbuffer())));
         console.reset(new mtl::GraphicsConsole(display));
     }
 
@@ -473,7 +460,25 @@ efi::Status Boot(efi::Handle hImage, efi::SystemTable* systemTable)
                                  .memoryMapLength = (uint32_t)(*memoryMap)->size(),
                                  .memoryMap = (uintptr_t)(*memoryMap)->data(),
                                  .uefiSystemTable = (uintptr_t)systemTable,
-                                 .framebuffer = {}};
+                                 .framebuffer = {},
+                                 .timing = GetBootTiming(),
+                                 .moduleCount = 0,
+                                 .reserved = 0,
+                                 .modules = {}};
+
+    for (size_t i = 0; i != requests.size() && bootInfo->moduleCount != BootModule::kMaxModules; ++i)
+    {
+        const auto& module = (*modules)[i];
+        if (!module.size)
+            continue;
+
+        auto& entry = bootInfo->modules[bootInfo->moduleCount++];
+        const auto length = std::min(requests[i].name.size(), sizeof(entry.name) - 1);
+        memcpy(entry.name, requests[i].name.data(), length);
+        entry.name[length] = '\0';
+        entry.address = module.address;
+        entry.size = module.size;
+    }
 
     if (!displays.empty())
     {
@@ -496,6 +501,9 @@ efi::Status Boot(efi::Handle hImage, efi::SystemTable* systemTable)
 
 efi::Status EfiMain(efi::Handle hImage, efi::SystemTable* systemTable)
 {
+    // The timestamp counter starts at reset, everything before this point is firmware time
+    RecordBootPhase("Firmware", 0, ReadTimestamp());
+
     auto console = InitializeConsole(systemTable);
 
     auto status = Boot(hImage, systemTable);
@@ -28,6 +28,7 @@
 
 #include "MemoryMap.hpp"
 #include <metal/arch.hpp>
+#include <metal/arena.hpp>
 #include <rainbow/uefi.hpp>
 
 // Maximum memory address to use for allocations. We to do this to prevent allocations that would overlap with the kernel's address
@@ -35,11 +36,21 @@
 // it during initialization.
 constexpr mtl::PhysicalAddress kMaxAllocationAddress = 1ull << 32;
 
+// Scratch memory for temporary allocations. Open an mtl::arena::scope before using it: everything allocated from the
+// arena is released in one shot when the scope ends.
+extern mtl::arena g_scratchArena;
+
+template <typename T>
+using ScratchVector = mtl::vector<T, mtl::arena_allocator<T>>;
+
 // Allocate pages of memory (below kMaxAllocationAddress).
 // This function will not return on out-of-memory conditions.
 // A return value of 0 is valid and doesn't represent an error condition.
 mtl::PhysicalAddress AllocatePages(size_t pageCount, efi::MemoryType memoryType);
 
+// Like AllocatePages(), but returns an empty optional on out-of-memory conditions
+mtl::optional<mtl::PhysicalAddress> TryAllocatePages(size_t pageCount, efi::MemoryType memoryType);
+
 // Like allocate pages, but clears the memory
 mtl::PhysicalAddress AllocateZeroedPages(size_t pageCount, efi::MemoryType memoryType);
 
@@ -27,6 +27,7 @@
 #include "elf.hpp"
 #include "PageTable.hpp"
 #include "boot.hpp"
+#include "timing.hpp"
 #include <cstring>
 #include <elf.h>
 #include <metal/helpers.hpp>
@@ -46,6 +47,8 @@ inline constexpr uint16_t kElfMachine = EM_AARCH64;
 
 void* ElfLoad(const Module& module, PageTable& pageTable)
 {
+    ScopedBootPhase phase("ElfLoad");
+
     // Validate the ELF header
     if (module.size < sizeof(Elf_Ehdr))
     {
@@ -76,6 +79,20 @@ void* ElfLoad(const Module& module, PageTable& pageTable)
         return nullptr;
     }
 
+    // Reserve all the page tables we need up front instead of allocating them one at a time
+    size_t tableCount = 0;
+    for (int i = 0; i != ehdr.e_phnum; ++i)
+    {
+        const auto& phdr = *reinterpret_cast<const Elf_Phdr*>(image + ehdr.e_phoff + i * ehdr.e_phentsize);
+        if (phdr.p_type != PT_LOAD)
+            continue;
+
+        const auto pageCount = mtl::AlignUp<uintptr_t>(phdr.p_memsz, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+        tableCount += PageTable::GetTableCount(phdr.p_vaddr, pageCount);
+    }
+
+    pageTable.Reserve(tableCount);
+
     // Parse program headers
     for (int i = 0; i != ehdr.e_phnum; ++i)
     {
@@ -94,6 +111,9 @@ void* ElfLoad(const Module& module, PageTable& pageTable)
         mtl::PageFlags pageFlags;
         efi::MemoryType memoryType;
 
+        // Writable segments hold the boot stack, which the kernel releases one page at a time
+        const bool allowLargePages = !(phdr.p_flags & PF_W);
+
         if (phdr.p_flags & PF_X)
         {
             pageFlags = mtl::PageFlags::KernelCode;
@@ -118,7 +138,7 @@ void* ElfLoad(const Module& module, PageTable& pageTable)
             const auto virtualAddress = phdr.p_vaddr;
             const auto pageCount = fileSize >> mtl::kMemoryPageShift;
 
-            pageTable.Map(physicalAddress, virtualAddress, pageCount, pageFlags);
+            pageTable.Map(physicalAddress, virtualAddress, pageCount, pageFlags, allowLargePages);
 
             // Not sure if I need to clear the rest of the last page, but I'd rather play safe.
             if (phdr.p_memsz > phdr.p_filesz)
@@ -137,7 +157,7 @@ void* ElfLoad(const Module& module, PageTable& pageTable)
             const auto zeroSize = memorySize - fileSize;
             const auto physicalAddress = AllocateZeroedPages(zeroSize >> mtl::kMemoryPageShift, memoryType);
             const auto virtualAddress = phdr.p_vaddr + fileSize;
-            pageTable.Map(physicalAddress, virtualAddress, zeroSize >> mtl::kMemoryPageShift, pageFlags);
+            pageTable.Map(physicalAddress, virtualAddress, zeroSize >> mtl::kMemoryPageShift, pageFlags, allowLargePages);
         }
     }
 
@@ -0,0 +1,423 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "modules.hpp"
+#include "boot.hpp"
+#include "timing.hpp"
+#include <algorithm>
+#include <metal/atomic.hpp>
+#include <metal/helpers.hpp>
+#include <metal/log.hpp>
+#include <metal/lz4.hpp>
+#include <metal/string.hpp>
+#include <rainbow/uefi/mp.hpp>
+
+// Files are read in chunks of this size, compressed files are decompressed one chunk at a time as they are read
+static constexpr size_t kReadChunkSize = 256 * 1024;
+
+// Where the time goes when loading a module
+struct LoadStatistics
+{
+    uint64_t bytesRead;
+    uint64_t ioTime;            // In timestamp ticks
+    uint64_t decompressionTime; // In timestamp ticks
+};
+
+// An open module with enough of it read to recognize compressed files
+struct ModuleFile
+{
+    efi::FileProtocol* file;
+    uint64_t size;
+    uint8_t header[mtl::Lz4FrameDecoder::kMaxHeaderSize];
+    size_t headerSize;
+};
+
+static efi::Status ReadFile(efi::FileProtocol* file, void* buffer, size_t& size, LoadStatistics& statistics)
+{
+    const auto start = ReadTimestamp();
+
+    efi::uintn_t count = size;
+    const auto status = file->Read(file, &count, buffer);
+    size = count;
+
+    statistics.bytesRead += count;
+    statistics.ioTime += ReadTimestamp() - start;
+
+    return status;
+}
+
+// Allocate page-aligned memory for a module. This is required for ELF files.
+static mtl::expected<mtl::PhysicalAddress, efi::Status> AllocateModule(uint64_t size, efi::MemoryType memoryType)
+{
+    const auto pageCount = mtl::AlignUp(size, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+    if (auto memory = TryAllocatePages(pageCount, memoryType))
+        return *memory;
+
+    MTL_LOG(Error) << "Not enough memory for a module of " << size << " bytes";
+    return mtl::unexpected(efi::Status::OutOfResource);
+}
+
+static mtl::expected<ModuleFile, efi::Status> OpenModule(efi::FileProtocol* fileSystem, mtl::string_view name,
+                                                         LoadStatistics& statistics)
+{
+    mtl::arena::scope scratch(g_scratchArena);
+
+    // Technically we should be doing "proper" conversion to u16string here,
+    // but we know that "name" will always be valid ASCII. So we take a shortcut.
+    mtl::basic_string<char16_t, mtl::arena_allocator<char16_t>> path(name.begin(), name.end(), g_scratchArena);
+
+    ModuleFile module;
+    auto status = fileSystem->Open(fileSystem, &module.file, path.c_str(), efi::OpenMode::Read, 0);
+    if (efi::Error(status))
+    {
+        MTL_LOG(Debug) << "Failed to open file \"" << path << "\": " << mtl::hex(status);
+        return mtl::unexpected(status);
+    }
+
+    ScratchVector<char> infoBuffer(g_scratchArena);
+    efi::uintn_t infoSize = 0;
+    while ((status = module.file->GetInfo(module.file, &efi::kFileInfoGuid, &infoSize, infoBuffer.data())) ==
+           efi::Status::BufferTooSmall)
+    {
+        infoBuffer.resize(infoSize);
+    }
+    if (efi::Error(status))
+    {
+        MTL_LOG(Debug) << "Failed to retrieve info about file \"" << path << "\": " << mtl::hex(status);
+        module.file->Close(module.file);
+        return mtl::unexpected(status);
+    }
+
+    module.size = ((const efi::FileInfo*)infoBuffer.data())->fileSize;
+    module.headerSize = std::min<size_t>(sizeof(module.header), module.size);
+    status = ReadFile(module.file, module.header, module.headerSize, statistics);
+    if (efi::Error(status))
+    {
+        MTL_LOG(Debug) << "Failed to load file \"" << path << "\": " << mtl::hex(status);
+        module.file->Close(module.file);
+        return mtl::unexpected(status);
+    }
+
+    return module;
+}
+
+static mtl::expected<Module, efi::Status> LoadUncompressedModule(const ModuleFile& file, efi::MemoryType memoryType,
+                                                                 LoadStatistics& statistics)
+{
+    const auto allocation = AllocateModule(file.size, memoryType);
+    if (!allocation)
+        return mtl::unexpected(allocation.error());
+
+    const auto fileAddress = *allocation;
+    memcpy((void*)(uintptr_t)fileAddress, file.header, file.headerSize);
+
+    size_t remaining = file.size - file.headerSize;
+    const auto status = ReadFile(file.file, (void*)(uintptr_t)(fileAddress + file.headerSize), remaining, statistics);
+    if (efi::Error(status))
+        return mtl::unexpected(status);
+
+    return Module{fileAddress, file.headerSize + remaining};
+}
+
+// Decompress an LZ4 frame straight into the module's final memory
+static mtl::expected<Module, efi::Status> LoadCompressedModule(const ModuleFile& file, efi::MemoryType memoryType,
+                                                               LoadStatistics& statistics)
+{
+    const auto info = mtl::Lz4FrameDecoder::ParseHeader(file.header, file.headerSize);
+    if (!info)
+    {
+        MTL_LOG(Debug) << "Invalid or unsupported LZ4 frame: " << (int)info.error();
+        return mtl::unexpected(efi::Status::LoadError);
+    }
+
+    const auto allocation = AllocateModule(info->contentSize, memoryType);
+    if (!allocation)
+        return mtl::unexpected(allocation.error());
+
+    const auto moduleAddress = *allocation;
+    mtl::Lz4FrameDecoder decoder(*info, (void*)(uintptr_t)moduleAddress, info->contentSize);
+
+    // The staging buffer holds a chunk and whatever incomplete block was left over from the previous one
+    mtl::arena::scope scratch(g_scratchArena);
+    ScratchVector<uint8_t> staging(g_scratchArena);
+    staging.resize(decoder.GetMaxChunkSize() + kReadChunkSize);
+    size_t pending = file.headerSize - info->headerSize;
+    memcpy(staging.data(), file.header + info->headerSize, pending);
+
+    while (!decoder.IsFinished())
+    {
+        size_t count = std::min(kReadChunkSize, staging.size() - pending);
+        const auto status = ReadFile(file.file, staging.data() + pending, count, statistics);
+        if (efi::Error(status))
+            return mtl::unexpected(status);
+
+        pending += count;
+
+        const auto start = ReadTimestamp();
+        const auto consumed = decoder.Decode(staging.data(), pending);
+        statistics.decompressionTime += ReadTimestamp() - start;
+
+        if (!consumed)
+        {
+            MTL_LOG(Debug) << "Failed to decompress LZ4 frame: " << (int)consumed.error();
+            return mtl::unexpected(efi::Status::LoadError);
+        }
+
+        if (count == 0 && *consumed == 0)
+        {
+            MTL_LOG(Debug) << "Truncated LZ4 frame";
+            return mtl::unexpected(efi::Status::LoadError);
+        }
+
+        // Keep the incomplete block for the next round
+        std::copy(staging.data() + *consumed, staging.data() + pending, staging.data());
+        pending -= *consumed;
+    }
+
+    return Module{moduleAddress, info->contentSize};
+}
+
+static void LogModule(mtl::string_view name, const Module& module, const LoadStatistics& statistics)
+{
+    MTL_LOG(Info) << "Loaded \"" << name << "\": " << statistics.bytesRead << " bytes read, " << module.size
+                  << " bytes loaded, I/O " << Milliseconds{statistics.ioTime} << ", decompression "
+                  << Milliseconds{statistics.decompressionTime};
+}
+
+mtl::expected<Module, efi::Status> LoadModule(efi::FileProtocol* fileSystem, mtl::string_view name, efi::MemoryType memoryType)
+{
+    ScopedBootPhase phase("LoadModule");
+
+    LoadStatistics statistics{};
+
+    const auto file = OpenModule(fileSystem, name, statistics);
+    if (!file)
+        return mtl::unexpected(file.error());
+
+    mtl::expected<Module, efi::Status> module;
+    if (mtl::Lz4FrameDecoder::IsFrame(file->header, file->headerSize))
+        module = LoadCompressedModule(*file, memoryType, statistics);
+    else
+        module = LoadUncompressedModule(*file, memoryType, statistics);
+
+    file->file->Close(file->file);
+
+    if (!module)
+    {
+        MTL_LOG(Debug) << "Failed to load file \"" << name << "\": " << mtl::hex(module.error());
+        return module;
+    }
+
+    LogModule(name, *module, statistics);
+
+    return module;
+}
+
+// A compressed module read in memory, waiting to be decompressed
+struct DecompressionJob
+{
+    DecompressionJob(size_t index, const mtl::Lz4FrameDecoder::FrameInfo& info, void* output)
+        : index(index), input(g_scratchArena), decoder(info, output, info.contentSize)
+    {
+    }
+
+    size_t index;                // Index of the module request
+    ScratchVector<uint8_t> input; // Everything after the frame header
+    mtl::Lz4FrameDecoder decoder;
+    bool success{false};
+    uint64_t time{0}; // In timestamp ticks
+};
+
+// Processors take jobs in order until there are none left
+struct DecompressionQueue
+{
+    DecompressionJob* jobs;
+    size_t count;
+    mtl::atomic<size_t> next;
+};
+
+// This runs on application processors: it must not call into the firmware, and that includes logging.
+static void EFIAPI DecompressModules(void* argument)
+{
+    auto& queue = *static_cast<DecompressionQueue*>(argument);
+
+    for (auto i = queue.next.fetch_add(1); i < queue.count; i = queue.next.fetch_add(1))
+    {
+        auto& job = queue.jobs[i];
+
+        const auto start = ReadTimestamp();
+        const auto consumed = job.decoder.Decode(job.input.data(), job.input.size());
+        job.success = consumed && job.decoder.IsFinished();
+        job.time = ReadTimestamp() - start;
+    }
+}
+
+mtl::expected<mtl::vector<Module>, efi::Status> LoadModules(efi::BootServices* bootServices, efi::FileProtocol* fileSystem,
+                                                            const mtl::vector<ModuleRequest>& requests)
+{
+    ScopedBootPhase phase("LoadModules");
+
+    mtl::vector<Module> modules;
+
+    efi::MpServicesProtocol* mp = nullptr;
+    efi::uintn_t processorCount = 0;
+    efi::uintn_t enabledProcessorCount = 0;
+    if (efi::Error(bootServices->LocateProtocol(&efi::kMpServicesProtocolGuid, nullptr, (void**)&mp)) ||
+        efi::Error(mp->GetNumberOfProcessors(mp, &processorCount, &enabledProcessorCount)) || enabledProcessorCount < 2)
+    {
+        MTL_LOG(Info) << "No application processors available, loading modules sequentially";
+
+        for (const auto& request : requests)
+        {
+            auto module = LoadModule(fileSystem, request.name, request.memoryType);
+            if (!module && !(request.optional && module.error() == efi::Status::NotFound))
+                return mtl::unexpected(module.error());
+
+            modules.push_back(module ? *module : Module{});
+        }
+
+        return modules;
+    }
+
+    // Boot services can't be used from application processors. Files are read on the BSP, only decompression runs in parallel.
+    modules.resize(requests.size());
+
+    // Everything but the modules is released when we are done
+    mtl::arena::scope scratch(g_scratchArena);
+
+    ScratchVector<LoadStatistics> statistics(g_scratchArena);
+    statistics.resize(requests.size());
+
+    ScratchVector<DecompressionJob> jobs(g_scratchArena);
+    jobs.reserve(requests.size());
+
+    for (size_t i = 0; i != requests.size(); ++i)
+    {
+        const auto& request = requests[i];
+
+        const auto file = OpenModule(fileSystem, request.name, statistics[i]);
+        if (!file)
+        {
+            if (request.optional && file.error() == efi::Status::NotFound)
+                continue;
+
+            return mtl::unexpected(file.error());
+        }
+
+        auto status = efi::Status::Success;
+        if (mtl::Lz4FrameDecoder::IsFrame(file->header, file->headerSize))
+        {
+            const auto info = mtl::Lz4FrameDecoder::ParseHeader(file->header, file->headerSize);
+            if (!info)
+            {
+                MTL_LOG(Debug) << "Invalid or unsupported LZ4 frame: " << (int)info.error();
+                status = efi::Status::LoadError;
+            }
+            else if (const auto allocation = AllocateModule(info->contentSize, request.memoryType); !allocation)
+            {
+                status = allocation.error();
+            }
+            else
+            {
+                const auto moduleAddress = *allocation;
+                auto& job = jobs.emplace_back(i, *info, (void*)(uintptr_t)moduleAddress);
+
+                // The header buffer might already hold the start of the first block
+                const size_t pending = file->headerSize - info->headerSize;
+                size_t size = file->size - file->headerSize;
+                job.input.resize(pending + size);
+                memcpy(job.input.data(), file->header + info->headerSize, pending);
+                status = ReadFile(file->file, job.input.data() + pending, size, statistics[i]);
+
+                modules[i] = Module{moduleAddress, info->contentSize};
+            }
+        }
+        else if (auto module = LoadUncompressedModule(*file, request.memoryType, statistics[i]))
+        {
+            modules[i] = *module;
+        }
+        else
+        {
+            status = module.error();
+        }
+
+        file->file->Close(file->file);
+
+        if (efi::Error(status))
+        {
+            MTL_LOG(Debug) << "Failed to load file \"" << request.name << "\": " << mtl::hex(status);
+            return mtl::unexpected(status);
+        }
+    }
+
+    if (!jobs.empty())
+    {
+        DecompressionQueue queue{jobs.data(), jobs.size(), 0};
+
+        // Start the application processors without waiting for them so that the BSP can take jobs as well
+        efi::Event event = nullptr;
+        auto status = bootServices->CreateEvent(0, efi::Tpl::Application, nullptr, nullptr, &event);
+        if (efi::Success(status))
+            status = mp->StartupAllAPs(mp, DecompressModules, false, event, 0, &queue, nullptr);
+
+        if (efi::Error(status))
+            MTL_LOG(Warning) << "Failed to start application processors, decompressing on the BSP: " << mtl::hex(status);
+
+        // If the application processors didn't start, the BSP ends up doing all the work
+        DecompressModules(&queue);
+
+        if (efi::Success(status))
+        {
+            efi::uintn_t index;
+            bootServices->WaitForEvent(1, &event, &index);
+        }
+
+        if (event)
+            bootServices->CloseEvent(event);
+
+        for (const auto& job : jobs)
+        {
+            if (!job.success)
+            {
+                MTL_LOG(Debug) << "Failed to decompress \"" << requests[job.index].name << "\"";
+                return mtl::unexpected(efi::Status::LoadError);
+            }
+
+            statistics[job.index].decompressionTime = job.time;
+        }
+    }
+
+    for (size_t i = 0; i != requests.size(); ++i)
+    {
+        if (modules[i].size)
+            LogModule(requests[i].name, modules[i], statistics[i]);
+    }
+
+    MTL_LOG(Info) << "Loaded " << requests.size() << " modules, " << jobs.size() << " decompressed on up to "
+                  << enabledProcessorCount << " processors";
+
+    return modules;
+}
@@ -0,0 +1,50 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <metal/expected.hpp>
+#include <metal/string_view.hpp>
+#include <metal/vector.hpp>
+#include <rainbow/boot.hpp>
+#include <rainbow/uefi.hpp>
+#include <rainbow/uefi/filesystem.hpp>
+
+struct ModuleRequest
+{
+    mtl::string_view name;
+    efi::MemoryType memoryType;
+    bool optional; // A missing optional module is returned with a size of 0
+};
+
+// Load a module from the file system, decompressing it if it is an LZ4 frame
+mtl::expected<Module, efi::Status> LoadModule(efi::FileProtocol* fileSystem, mtl::string_view name,
+                                              efi::MemoryType memoryType = efi::MemoryType::BootModule);
+
+// Load several modules, returned in the same order as the requests. When the firmware provides EFI_MP_SERVICES_PROTOCOL, compressed
+// modules are decompressed in parallel on application processors. Otherwise this is the same as calling LoadModule() for each one.
+mtl::expected<mtl::vector<Module>, efi::Status> LoadModules(efi::BootServices* bootServices, efi::FileProtocol* fileSystem,
+                                                            const mtl::vector<ModuleRequest>& requests);
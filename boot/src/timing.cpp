@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "timing.hpp"
+#include <metal/arch.hpp>
+
+static uint64_t g_ticksPerMillisecond;
+static BootTiming g_bootTiming;
+
+void InitializeTiming(efi::BootServices* bootServices)
+{
+#if defined(__aarch64__)
+    (void)bootServices;
+    g_ticksPerMillisecond = mtl::Read_CNTFRQ_EL0() / 1000;
+#else
+    // The TSC frequency isn't architecturally discoverable, measure it against the firmware's delay
+    const auto start = ReadTimestamp();
+    bootServices->Stall(10000);
+    g_ticksPerMillisecond = (ReadTimestamp() - start) / 10;
+#endif
+
+    g_bootTiming.frequency = g_ticksPerMillisecond * 1000;
+}
+
+uint64_t ReadTimestamp()
+{
+#if defined(__aarch64__)
+    return mtl::Read_CNTVCT_EL0();
+#else
+    return mtl::x86_rdtsc();
+#endif
+}
+
+uint64_t TimestampToMicroseconds(uint64_t ticks)
+{
+    return g_ticksPerMillisecond ? ticks * 1000 / g_ticksPerMillisecond : 0;
+}
+
+mtl::LogStream& operator<<(mtl::LogStream& stream, const Milliseconds& duration)
+{
+    const auto us = TimestampToMicroseconds(duration.ticks);
+    stream.Format("{}.{:03} ms", us / 1000, us % 1000);
+    return stream;
+}
+
+void RecordBootPhase(const char* name, uint64_t start, uint64_t end)
+{
+    g_bootTiming.AddPhase(name, start, end);
+}
+
+const BootTiming& GetBootTiming()
+{
+    return g_bootTiming;
+}
@@ -34,27 +34,52 @@
 
 PageTable::PageTable()
 {
+    // 1 GB pages are optional on x86_64
+    uint32_t eax, ebx, ecx, edx;
+    mtl::x86_cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001)
+    {
+        mtl::x86_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        m_hugePages = edx & (1 << 26);
+    }
+    else
+    {
+        m_hugePages = false;
+    }
+
     // To keep things simple, we are going to identity-map the first 4 GB of memory.
     // The kernel will be mapped outside of the first 4 GB of memory.
     pml4 = (uint64_t*)AllocateZeroedPages(1, efi::MemoryType::KernelData);
-    auto pml3 = (uint64_t*)AllocateZeroedPages(5, efi::MemoryType::LoaderData);
-    auto pml2 = mtl::AdvancePointer(pml3, mtl::kMemoryPageSize);
+    auto pml3 = (uint64_t*)AllocateZeroedPages(m_hugePages ? 1 : 5, efi::MemoryType::LoaderData);
 
     const auto identityPageFlags = mtl::PageFlags::Present | mtl::PageFlags::Write | mtl::PageFlags::WriteBack;
 
     // 1 entry = 512 GB
     pml4[0] = (uintptr_t)pml3 | identityPageFlags;
 
-    // 4 entries = 4 x 1GB = 4 GB
-    pml3[0] = (uintptr_t)&pml2[0] | identityPageFlags;
-    pml3[1] = (uintptr_t)&pml2[512] | identityPageFlags;
-    pml3[2] = (uintptr_t)&pml2[1024] | identityPageFlags;
-    pml3[3] = (uintptr_t)&pml2[1536] | identityPageFlags;
-
-    // 2048 entries = 2048 * 2 MB = 4 GB
-    for (uint64_t i = 0; i != 2048; ++i)
+    if (m_hugePages)
+    {
+        // 4 entries = 4 x 1GB = 4 GB
+        for (uint64_t i = 0; i != 4; ++i)
+        {
+            pml3[i] = i * mtl::kMemoryHugePageSize | identityPageFlags | mtl::PageFlags::Size;
+        }
+    }
+    else
     {
-        pml2[i] = i * 512 * mtl::kMemoryPageSize | identityPageFlags | mtl::PageFlags::Size;
+        auto pml2 = mtl::AdvancePointer(pml3, mtl::kMemoryPageSize);
+
+        // 4 entries = 4 x 1GB = 4 GB
+        pml3[0] = (uintptr_t)&pml2[0] | identityPageFlags;
+        pml3[1] = (uintptr_t)&pml2[512] | identityPageFlags;
+        pml3[2] = (uintptr_t)&pml2[1024] | identityPageFlags;
+        pml3[3] = (uintptr_t)&pml2[1536] | identityPageFlags;
+
+        // 2048 entries = 2048 * 2 MB = 4 GB
+        for (uint64_t i = 0; i != 2048; ++i)
+        {
+            pml2[i] = i * 512 * mtl::kMemoryPageSize | identityPageFlags | mtl::PageFlags::Size;
+        }
     }
 
     // Setup recursive mapping
@@ -67,16 +92,74 @@ PageTable::PageTable()
     pml4[510] = (uintptr_t)pml4 | mtl::PageFlags::Present | mtl::PageFlags::NX | mtl::PageFlags::Write | mtl::PageFlags::Global;
 }
 
-void PageTable::Map(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, size_t pageCount, mtl::PageFlags flags)
+size_t PageTable::GetTableCount(uintptr_t virtualAddress, size_t pageCount)
+{
+    if (pageCount == 0)
+        return 0;
+
+    // Count how many 2 MB, 1 GB and 512 GB regions the range touches, that is one table per region at each level
+    const auto first = virtualAddress;
+    const auto last = virtualAddress + (pageCount << mtl::kMemoryPageShift) - 1;
+
+    size_t count = 0;
+    for (int shift = mtl::kMemoryLargePageShift; shift <= 39; shift += 9)
+    {
+        count += (last >> shift) - (first >> shift) + 1;
+    }
+
+    return count;
+}
+
+void PageTable::Reserve(size_t tableCount)
+{
+    // Whatever is left of a previous reservation stays allocated, but this is only a few pages at most
+    m_pool = AllocateZeroedPages(tableCount, efi::MemoryType::KernelData);
+    m_poolSize = tableCount;
+}
+
+mtl::PhysicalAddress PageTable::AllocateTable()
+{
+    if (m_poolSize == 0)
+        return AllocateZeroedPages(1, efi::MemoryType::KernelData);
+
+    const auto table = m_pool;
+    m_pool += mtl::kMemoryPageSize;
+    --m_poolSize;
+    return table;
+}
+
+void PageTable::Map(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, size_t pageCount, mtl::PageFlags flags,
+                    bool allowLargePages)
 {
     assert(mtl::IsAligned(physicalAddress, mtl::kMemoryPageSize));
     assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
 
-    while (pageCount-- > 0)
+    constexpr size_t kLargePageCount = mtl::kMemoryLargePageSize >> mtl::kMemoryPageShift;
+    constexpr size_t kHugePageCount = mtl::kMemoryHugePageSize >> mtl::kMemoryPageShift;
+
+    while (pageCount > 0)
     {
-        MapPage(physicalAddress, virtualAddress, flags);
-        physicalAddress += mtl::kMemoryPageSize;
-        virtualAddress += mtl::kMemoryPageSize;
+        const auto alignment = physicalAddress | virtualAddress;
+        size_t count = 1;
+
+        if (allowLargePages && m_hugePages && pageCount >= kHugePageCount && mtl::IsAligned(alignment, mtl::kMemoryHugePageSize))
+        {
+            MapLeaf(physicalAddress, virtualAddress, 3, flags);
+            count = kHugePageCount;
+        }
+        else if (allowLargePages && pageCount >= kLargePageCount && mtl::IsAligned(alignment, mtl::kMemoryLargePageSize))
+        {
+            MapLeaf(physicalAddress, virtualAddress, 2, flags);
+            count = kLargePageCount;
+        }
+        else
+        {
+            MapPage(physicalAddress, virtualAddress, flags);
+        }
+
+        physicalAddress += count << mtl::kMemoryPageShift;
+        virtualAddress += count << mtl::kMemoryPageShift;
+        pageCount -= count;
     }
 }
 
@@ -85,41 +168,56 @@ void PageTable::MapPage(mtl::PhysicalAddress physicalAddress, uintptr_t virtualA
     assert(mtl::IsAligned(physicalAddress, mtl::kMemoryPageSize));
     assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
 
+    MapLeaf(physicalAddress, virtualAddress, 1, flags);
+}
+
+uint64_t& PageTable::GetEntry(uintptr_t virtualAddress, int level)
+{
     // We should only be mapping pages to high address space.
     assert(virtualAddress >= 0xFFFF000000000000ull);
 
-    const int i4 = (virtualAddress >> 39) & 0x1FF;
-    const int i3 = (virtualAddress >> 30) & 0x1FF;
-    const int i2 = (virtualAddress >> 21) & 0x1FF;
-    const int i1 = (virtualAddress >> 12) & 0x1FF;
-
-    if (!(pml4[i4] & mtl::PageFlags::Present))
+    uint64_t* table = pml4;
+    for (int i = 4; i != level; --i)
     {
-        const auto page = AllocateZeroedPages(1, efi::MemoryType::KernelData);
-        pml4[i4] = page | mtl::PageFlags::PageTable | mtl::PageFlags::Global;
+        auto& entry = table[(virtualAddress >> (12 + 9 * (i - 1))) & 0x1FF];
+        if (!(entry & mtl::PageFlags::Present))
+        {
+            entry = AllocateTable() | mtl::PageFlags::PageTable | mtl::PageFlags::Global;
+        }
+        else if (entry & mtl::PageFlags::Size)
+        {
+            MTL_LOG(Fatal) << "PageTable::GetEntry() - There is already a large page at " << mtl::hex(virtualAddress)
+                           << " (entry = " << mtl::hex(entry) << ")";
+            std::abort();
+        }
+
+        table = (uint64_t*)(entry & mtl::AddressMask);
     }
 
-    uint64_t* pml3 = (uint64_t*)(pml4[i4] & mtl::AddressMask);
-    if (!(pml3[i3] & mtl::PageFlags::Present))
+    return table[(virtualAddress >> (12 + 9 * (level - 1))) & 0x1FF];
+}
+
+void PageTable::MapLeaf(mtl::PhysicalAddress physicalAddress, uintptr_t virtualAddress, int level, mtl::PageFlags flags)
+{
+    auto& entry = GetEntry(virtualAddress, level);
+    if (entry & mtl::PageFlags::Present)
     {
-        const auto page = AllocateZeroedPages(1, efi::MemoryType::KernelData);
-        pml3[i3] = page | mtl::PageFlags::PageTable | mtl::PageFlags::Global;
+        MTL_LOG(Fatal) << "PageTable::MapLeaf() - There is already something there! (address = " << mtl::hex(virtualAddress)
+                       << ", level = " << level << ", entry = " << mtl::hex(entry) << ")";
+        std::abort();
     }
 
-    uint64_t* pml2 = (uint64_t*)(pml3[i3] & mtl::AddressMask);
-    if (!(pml2[i2] & mtl::PageFlags::Present))
+    if (level > 1)
     {
-        const auto page = AllocateZeroedPages(1, efi::MemoryType::KernelData);
-        pml2[i2] = page | mtl::PageFlags::PageTable | mtl::PageFlags::Global;
-    }
+        // Large pages use bit 7 for Size, their PAT bit is moved to bit 12
+        uint64_t leafFlags = (flags & ~mtl::PageFlags::PAT) | mtl::PageFlags::Size | mtl::PageFlags::Global;
+        if (flags & mtl::PageFlags::PAT)
+            leafFlags |= mtl::PageFlags::LargePAT;
 
-    uint64_t* pml1 = (uint64_t*)(pml2[i2] & mtl::AddressMask);
-    if (pml1[i1] & mtl::PageFlags::Present)
+        entry = physicalAddress | leafFlags;
+    }
+    else
     {
-        MTL_LOG(Fatal) << "PageTable::MapPage() - There is already something there! (i1 = " << i1
-                       << ", entry = " << mtl::hex(pml1[i1]) << ")";
-        std::abort();
+        entry = physicalAddress | flags | mtl::PageFlags::Global;
     }
-
-    pml1[i1] = physicalAddress | flags | mtl::PageFlags::Global;
-}
\ No newline at end of file
+}
@@ -32,7 +32,7 @@
 
 using PhysicalAddress = mtl::PhysicalAddress;
 
-static constexpr uint32_t kRainbowBootVersion = 1;
+static constexpr uint32_t kRainbowBootVersion = 3;
 
 struct Framebuffer
 {
@@ -51,6 +51,57 @@ struct Module
     PhysicalAddress size;
 };
 
+// A module loaded by the bootloader (kernel, initrd, ...). The kernel's memory is of type efi::MemoryType::KernelData,
+// the other modules' memory is of type efi::MemoryType::BootModule.
+struct BootModule
+{
+    static constexpr int kMaxModules = 8;
+
+    char name[24]; // Null terminated
+    PhysicalAddress address;
+    PhysicalAddress size;
+};
+
+static_assert(sizeof(BootModule) == 24 + 2 * sizeof(PhysicalAddress));
+
+// A named boot phase, timestamps are raw counter values (TSC on x86_64, CNTVCT_EL0 on aarch64)
+struct BootPhase
+{
+    char name[24]; // Null terminated
+    uint64_t start;
+    uint64_t end;
+};
+
+static_assert(sizeof(BootPhase) == 40);
+
+// Boot phases recorded by the bootloader, the kernel appends its own
+struct BootTiming
+{
+    static constexpr uint32_t kMaxPhases = 16;
+
+    uint64_t frequency; // Counter ticks per second (0 if unknown)
+    uint32_t phaseCount;
+    uint32_t reserved;
+    BootPhase phases[kMaxPhases];
+
+    // Phases that don't fit in the table are dropped
+    void AddPhase(const char* name, uint64_t start, uint64_t end)
+    {
+        if (phaseCount == kMaxPhases)
+            return;
+
+        auto& phase = phases[phaseCount++];
+        unsigned i = 0;
+        for (; name[i] && i < sizeof(phase.name) - 1; ++i)
+            phase.name[i] = name[i];
+        phase.name[i] = '\0';
+        phase.start = start;
+        phase.end = end;
+    }
+};
+
+static_assert(sizeof(BootTiming) == 16 + BootTiming::kMaxPhases * sizeof(BootPhase));
+
 struct BootInfo
 {
     uint32_t version;                // Version (kRainbowBootVersion)
@@ -58,8 +109,13 @@ struct BootInfo
     PhysicalAddress memoryMap;       // Memory descriptors
     PhysicalAddress uefiSystemTable; // UEFI System Table
     Framebuffer framebuffer;         // Frame buffer (but not always be available!)
+    BootTiming timing;               // Boot phases (version 2)
+    uint32_t moduleCount;            // Number of loaded modules (version 3)
+    uint32_t reserved;
+    BootModule modules[BootModule::kMaxModules];
 };
 
 // Make sure the BootInfo structure layout and size is the same when compiling
 // the bootloader and the kernel. Otherwise things will just not work.
-static_assert(sizeof(BootInfo) == 8 + 2 * sizeof(PhysicalAddress) + sizeof(Framebuffer));
+static_assert(sizeof(BootInfo) == 8 + 2 * sizeof(PhysicalAddress) + sizeof(Framebuffer) + sizeof(BootTiming) + 8 +
+                                   BootModule::kMaxModules * sizeof(BootModule));
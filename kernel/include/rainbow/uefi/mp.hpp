@@ -0,0 +1,69 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "base.hpp"
+
+namespace efi
+{
+    // EFI_MP_SERVICES_PROTOCOL, defined in the UEFI Platform Initialization (PI) specification
+    static constexpr Guid kMpServicesProtocolGuid{0x3fdda605, 0xa76e, 0x4f46, {0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08}};
+
+    // Procedures running on application processors can't call boot services
+    using ApProcedure = EFIAPI void(void* argument);
+
+    enum ProcessorStatus : uint32_t
+    {
+        ProcessorAsBsp = 0x00000001,
+        ProcessorEnabled = 0x00000002,
+        ProcessorHealthy = 0x00000004,
+    };
+
+    struct ProcessorInformation
+    {
+        uint64_t processorId;
+        uint32_t statusFlag; // ProcessorStatus
+        uint32_t package;
+        uint32_t core;
+        uint32_t thread;
+    };
+
+    struct MpServicesProtocol
+    {
+        Status(EFIAPI* GetNumberOfProcessors)(MpServicesProtocol* self, uintn_t* numberOfProcessors,
+                                              uintn_t* numberOfEnabledProcessors);
+        Status(EFIAPI* GetProcessorInfo)(MpServicesProtocol* self, uintn_t processorNumber, ProcessorInformation* info);
+        Status(EFIAPI* StartupAllAPs)(MpServicesProtocol* self, ApProcedure* procedure, bool singleThread, Event waitEvent,
+                                      uintn_t timeoutInMicroseconds, void* argument, uintn_t** failedCpuList);
+        Status(EFIAPI* StartupThisAP)(MpServicesProtocol* self, ApProcedure* procedure, uintn_t processorNumber,
+                                      Event waitEvent, uintn_t timeoutInMicroseconds, void* argument, bool* finished);
+        Status(EFIAPI* SwitchBSP)(MpServicesProtocol* self, uintn_t processorNumber, bool enableOldBSP);
+        Status(EFIAPI* EnableDisableAP)(MpServicesProtocol* self, uintn_t processorNumber, bool enableAP, uint32_t* healthFlag);
+        Status(EFIAPI* WhoAmI)(MpServicesProtocol* self, uintn_t* processorNumber);
+    };
+
+} // namespace efi
@@ -0,0 +1,335 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "AddressSpace.hpp"
+#include "Cpu.hpp"
+#include "Task.hpp"
+#include "arch.hpp"
+#include "memory.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <metal/helpers.hpp>
+#include <metal/log.hpp>
+
+// AllocateRegion() places kernel regions in the 512 GB below the recursive page tables
+AddressSpace g_kernelAddressSpace(0xFFFFFE8000000000ull, 0xFFFFFF0000000000ull);
+
+// Size of the window mapped around a fault
+static constexpr int kFaultAroundPages = 16;
+
+static mtl::PageFlags GetPageFlags(int protection)
+{
+    const bool user = protection & VmUser;
+
+    if (protection & VmExecute)
+        return user ? mtl::PageFlags::UserCode : mtl::PageFlags::KernelCode;
+
+    if (protection & VmWrite)
+        return user ? mtl::PageFlags::UserData_RW : mtl::PageFlags::KernelData_RW;
+
+    return user ? mtl::PageFlags::UserData_RO : mtl::PageFlags::KernelData_RO;
+}
+
+// Allocate a frame and fill it with a copy of 'source'
+static mtl::expected<PhysicalAddress, ErrorCode> AllocPrivateFrame(PhysicalAddress source)
+{
+    // No need to read the zero page to know what's in it
+    const auto zeroPage = MemoryGetZeroPage();
+    if (zeroPage && source == *zeroPage)
+        return AllocZeroedFrame();
+
+    const auto frame = AllocFrames(1);
+    if (!frame)
+        return mtl::unexpected(frame.error());
+
+    const auto page = ArchMapSystemMemory(*frame, 1, mtl::PageFlags::KernelData_RW);
+    if (!page)
+    {
+        FreeFrames(*frame, 1);
+        return mtl::unexpected(page.error());
+    }
+
+    memcpy(*page, ArchGetSystemMemory(source), mtl::kMemoryPageSize);
+
+    return *frame;
+}
+
+// Nodes are allocated and freed without holding the lock: growing the heap looks up regions
+mtl::expected<void, ErrorCode> AddressSpace::AddRegion(VmRegion region)
+{
+    auto node = mtl::make_unique<VmRegionTree::Node>(std::move(region));
+    if (!node)
+        return mtl::unexpected(ErrorCode::OutOfMemory);
+
+    m_lock.Lock();
+    const auto result = m_regions.Add(std::move(node));
+    m_lock.Unlock();
+
+    return result;
+}
+
+mtl::expected<uintptr_t, ErrorCode> AddressSpace::AllocateRegion(size_t size, VmRegion region)
+{
+    auto node = mtl::make_unique<VmRegionTree::Node>(std::move(region));
+    if (!node)
+        return mtl::unexpected(ErrorCode::OutOfMemory);
+
+    m_lock.Lock();
+    const auto result = m_regions.Allocate(size, std::move(node));
+    m_lock.Unlock();
+
+    return result;
+}
+
+mtl::expected<void, ErrorCode> AddressSpace::RemoveRegion(uintptr_t address)
+{
+    m_lock.Lock();
+    const auto node = m_regions.Remove(address);
+    m_lock.Unlock();
+
+    if (!node)
+        return mtl::unexpected(node.error());
+
+    return {};
+}
+
+mtl::expected<void, ErrorCode> AddressSpace::AddProgram(const ElfProgram& program)
+{
+    for (const auto& elfRegion : program.regions)
+    {
+        int protection = VmUser;
+        if (elfRegion.flags & PF_R)
+            protection |= VmRead;
+        if (elfRegion.flags & PF_W)
+            protection |= VmWrite;
+        if (elfRegion.flags & PF_X)
+            protection |= VmExecute;
+
+        auto result = AddRegion(VmRegion{.start = elfRegion.start,
+                                         .end = elfRegion.end,
+                                         .protection = protection,
+                                         .type = VmRegionType::Executable,
+                                         .executable = program.executable,
+                                         .loadBias = program.loadBias});
+        if (!result)
+            return result;
+    }
+
+    return {};
+}
+
+mtl::expected<VmRegion, ErrorCode> AddressSpace::FindRegion(uintptr_t address) const
+{
+    mtl::expected<VmRegion, ErrorCode> result = mtl::unexpected(ErrorCode::NotFound);
+
+    m_lock.Lock();
+    if (const auto region = m_regions.Find(address))
+        result = *region;
+    m_lock.Unlock();
+
+    return result;
+}
+
+mtl::expected<uintptr_t, ErrorCode> AddressSpace::FindFreeRange(size_t size) const
+{
+    m_lock.Lock();
+    const auto result = m_regions.FindFreeRange(size);
+    m_lock.Unlock();
+
+    return result;
+}
+
+mtl::expected<PageFault, ErrorCode> AddressSpace::HandlePageFault(uintptr_t address, int faultFlags)
+{
+    if (faultFlags & PageFaultReserved)
+        return mtl::unexpected(ErrorCode::Unexpected);
+
+    // Work on a copy, the region can be removed while the fault is resolved
+    const auto region = FindRegion(address);
+    if (!region)
+        return mtl::unexpected(region.error());
+
+    // Committed memory is mapped up front, faulting on it is a bug
+    if (region->type == VmRegionType::Committed)
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const bool write = faultFlags & PageFaultWrite;
+    if ((write && !(region->protection & VmWrite)) ||
+        ((faultFlags & PageFaultExecute) && !(region->protection & VmExecute)) ||
+        ((faultFlags & PageFaultUser) && !(region->protection & VmUser)))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto page = mtl::AlignDown(address, mtl::kMemoryPageSize);
+    if (const auto mapping = GetPageMapping((void*)page))
+    {
+        // Someone else resolved the fault already
+        if (!write || mapping->writable)
+            return PageFault::Minor;
+
+        // Copy-on-write
+        const auto frame = AllocPrivateFrame(mapping->physicalAddress);
+        if (!frame)
+            return mtl::unexpected(frame.error());
+
+        if (auto result = RemapPage(*frame, (void*)page, GetPageFlags(region->protection)); !result)
+            return mtl::unexpected(result.error());
+
+        return PageFault::Minor;
+    }
+
+    const auto fault = MapPage(*region, page, write);
+    if (fault && !write && region->type != VmRegionType::Anonymous)
+        FaultAround(*region, page);
+
+    return fault;
+}
+
+mtl::expected<PageFault, ErrorCode> AddressSpace::MapPage(const VmRegion& region, uintptr_t address, bool write)
+{
+    // Frames the region doesn't own are mapped as shared so that unmapping them doesn't free them
+    auto pageFlags = GetPageFlags(region.protection);
+    const auto sharedPageFlags = (mtl::PageFlags)(GetPageFlags(region.protection & ~VmWrite) | mtl::PageFlags::Shared);
+
+    PhysicalAddress frame;
+    auto fault = PageFault::Minor;
+
+    switch (region.type)
+    {
+    case VmRegionType::Anonymous:
+    {
+        // Reads get the zero page, the first write gets a private copy
+        const auto zeroPage = MemoryGetZeroPage();
+        if (!zeroPage)
+            return mtl::unexpected(zeroPage.error());
+
+        if (write)
+        {
+            const auto copy = AllocPrivateFrame(*zeroPage);
+            if (!copy)
+                return mtl::unexpected(copy.error());
+
+            frame = *copy;
+        }
+        else
+        {
+            frame = *zeroPage;
+            pageFlags = sharedPageFlags;
+        }
+        break;
+    }
+
+    case VmRegionType::Physical:
+        frame = region.physicalAddress + (address - region.start);
+        pageFlags = (mtl::PageFlags)(pageFlags | mtl::PageFlags::Shared);
+        break;
+
+    case VmRegionType::Executable:
+    {
+        const auto page = region.executable->GetPage(address - region.loadBias, region.loadBias);
+        if (!page)
+            return mtl::unexpected(page.error());
+
+        if (page->read)
+            fault = PageFault::Major;
+
+        frame = page->frame;
+
+        // Shared pages are copied on write
+        if (page->shared && write)
+        {
+            const auto copy = AllocPrivateFrame(page->frame);
+            if (!copy)
+                return mtl::unexpected(copy.error());
+
+            frame = *copy;
+        }
+        else if (page->shared)
+        {
+            pageFlags = sharedPageFlags;
+        }
+        break;
+    }
+
+    default:
+        return mtl::unexpected(ErrorCode::Unexpected);
+    }
+
+    if (auto result = MapPages(frame, (void*)address, 1, pageFlags); !result)
+        return mtl::unexpected(result.error());
+
+    return fault;
+}
+
+void AddressSpace::FaultAround(const VmRegion& region, uintptr_t address)
+{
+    const uintptr_t windowSize = kFaultAroundPages * mtl::kMemoryPageSize;
+    const auto window = mtl::AlignDown(address, windowSize);
+    const auto start = std::max(window, region.start);
+    const auto end = std::min(window + windowSize, region.end);
+
+    for (auto page = start; page != end; page += mtl::kMemoryPageSize)
+    {
+        if (page == address || GetPageMapping((void*)page))
+            continue;
+
+        // This is only an optimization, errors will come back if the page is actually accessed
+        if (!MapPage(region, page, false))
+            break;
+    }
+}
+
+mtl::expected<void, ErrorCode> HandlePageFault(const void* address, int faultFlags)
+{
+    // Resolving the fault needs the page tables. There is only one CPU, so if they are locked, the code holding the
+    // lock is what faulted and waiting for it would hang forever.
+    if (ArePageTablesLocked())
+    {
+        MTL_LOG(Fatal) << "[KRNL] Page fault at " << address << " while the page tables are locked";
+        std::abort();
+    }
+
+    const auto task = CpuGetTask();
+
+    AddressSpace* addressSpace = nullptr;
+    if (IsKernelAddress((uintptr_t)address))
+        addressSpace = &g_kernelAddressSpace;
+    else if (task)
+        addressSpace = task->GetAddressSpace().get();
+
+    if (!addressSpace)
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    const auto fault = addressSpace->HandlePageFault((uintptr_t)address, faultFlags);
+    if (!fault)
+        return mtl::unexpected(fault.error());
+
+    if (task)
+        task->CountPageFault(*fault == PageFault::Major);
+
+    return {};
+}
@@ -0,0 +1,99 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include "Spinlock.hpp"
+#include "VmRegionTree.hpp"
+#include "elf/ElfLoader.hpp"
+#include <cstdint>
+#include <metal/expected.hpp>
+
+// What caused a page fault, these are the same bits as the x86 page fault error code
+enum PageFaultFlags
+{
+    PageFaultPresent = 1,  // The page is mapped, the access violated its protection
+    PageFaultWrite = 2,    // Write access (read otherwise)
+    PageFaultUser = 4,     // Access from user space
+    PageFaultReserved = 8, // Reserved bit set in a page table entry
+    PageFaultExecute = 16, // Instruction fetch
+};
+
+// How a page fault was resolved
+enum class PageFault
+{
+    Minor, // Nothing had to be read: zero page, page already read, copy-on-write
+    Major, // The content of the page had to be read
+};
+
+// A virtual address space and the regions that make it up. Pages are mapped on demand as they are accessed.
+//
+// Regions are only looked at with the lock held, callers get copies.
+class AddressSpace
+{
+public:
+    // 'start' and 'end' delimit where AllocateRegion() places regions
+    constexpr AddressSpace(uintptr_t start, uintptr_t end) : m_regions(start, end) {}
+
+    // Add a region, it can't overlap existing ones
+    mtl::expected<void, ErrorCode> AddRegion(VmRegion region);
+
+    // Add a region of 'size' bytes at the lowest free address, ignoring region.start and region.end
+    mtl::expected<uintptr_t, ErrorCode> AllocateRegion(size_t size, VmRegion region);
+
+    // Remove the region starting at 'address'. Pages are not unmapped, this is the caller's job.
+    mtl::expected<void, ErrorCode> RemoveRegion(uintptr_t address);
+
+    // Add regions for an executable
+    mtl::expected<void, ErrorCode> AddProgram(const ElfProgram& program);
+
+    // Find the region containing 'address', NotFound if there is none
+    mtl::expected<VmRegion, ErrorCode> FindRegion(uintptr_t address) const;
+
+    // Find the lowest free range of 'size' bytes, OutOfMemory if there is none
+    mtl::expected<uintptr_t, ErrorCode> FindFreeRange(size_t size) const;
+
+    // Resolve a page fault at 'address', which fails if there is no region there or if the access isn't allowed
+    mtl::expected<PageFault, ErrorCode> HandlePageFault(uintptr_t address, int faultFlags);
+
+private:
+    // Map the page at 'address', which isn't mapped yet
+    mtl::expected<PageFault, ErrorCode> MapPage(const VmRegion& region, uintptr_t address, bool write);
+
+    // Map the pages around 'address' that aren't mapped yet, as sequential access is likely to need them next
+    void FaultAround(const VmRegion& region, uintptr_t address);
+
+    mutable Spinlock m_lock;
+    VmRegionTree m_regions;
+};
+
+// The kernel's address space (upper half)
+extern AddressSpace g_kernelAddressSpace;
+
+// Resolve a page fault for the current task, in the kernel's address space or in the task's address space. Fault counters
+// of the task are updated. Exception handlers call this and only report failures.
+mtl::expected<void, ErrorCode> HandlePageFault(const void* address, int faultFlags);
@@ -0,0 +1,78 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "Scheduler.hpp"
+#include <metal/ring.hpp>
+#include <utility>
+
+// Wraps one of the metal rings (mtl::spsc_ring, mtl::mpsc_ring or mtl::mpmc_ring) so that tasks can wait on it.
+// Push() waits while the queue is full and Pop() waits while it is empty, giving the CPU to other tasks meanwhile.
+//
+// Interrupt handlers must not wait: they should use TryPush() and drop or count what doesn't fit.
+//
+// TODO: the scheduler doesn't have wait queues yet, waiting tasks poll the ring every time they get the CPU.
+template <typename Ring>
+class BlockingQueue
+{
+public:
+    using T = typename Ring::value_type;
+
+    template <typename U>
+    bool TryPush(U&& value)
+    {
+        return m_ring.try_push(std::forward<U>(value));
+    }
+
+    bool TryPop(T& value) { return m_ring.try_pop(value); }
+
+    template <typename U>
+    void Push(U&& value)
+    {
+        // try_push() leaves 'value' alone when it fails, so it is fine to forward it more than once
+        while (!m_ring.try_push(std::forward<U>(value)))
+            SchedulerYield();
+    }
+
+    void Pop(T& value)
+    {
+        while (!m_ring.try_pop(value))
+            SchedulerYield();
+    }
+
+    T Pop()
+    {
+        T value{};
+        Pop(value);
+        return value;
+    }
+
+    bool IsEmpty() const { return m_ring.empty(); }
+
+private:
+    Ring m_ring;
+};
@@ -36,6 +36,7 @@ enum class ErrorCode
     Conflict,
     OutOfMemory,
     Unsupported,
+    NotFound,
 };
 
 inline mtl::LogStream& operator<<(mtl::LogStream& stream, ErrorCode error)
@@ -27,11 +27,9 @@
 #include "Scheduler.hpp"
 #include "Cpu.hpp"
 #include <cassert>
-#include <list>
 #include <metal/log.hpp>
 
-typedef std::list<Task*> ReadyQueue; // TODO: inefficient
-static ReadyQueue g_readyQueue;      // Tasks ready to run
+static Task::Queue g_readyQueue; // Tasks ready to run
 
 void SchedulerInitialize(Task* initialTask)
 {
@@ -40,7 +38,7 @@ void SchedulerInitialize(Task* initialTask)
 
 void SchedulerAddTask(Task* task)
 {
-    g_readyQueue.emplace_back(task);
+    g_readyQueue.push_back(*task);
 }
 
 void SchedulerYield()
@@ -49,10 +47,10 @@ void SchedulerYield()
         return;
 
     const auto currentTask = CpuGetTask();
-    const auto nextTask = g_readyQueue.front();
+    const auto nextTask = &g_readyQueue.front();
 
     g_readyQueue.pop_front();
-    g_readyQueue.push_back(currentTask); // TODO: make sure this cannot fail (out of memory)
+    g_readyQueue.push_back(*currentTask);
 
     currentTask->SwitchTo(nextTask);
 }
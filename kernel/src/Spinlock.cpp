@@ -25,43 +25,151 @@
 */
 
 #include "Spinlock.hpp"
+#include "timing.hpp"
+#include <algorithm>
 #include <cassert>
 #include <metal/arch.hpp>
+#include <metal/log.hpp>
 
 // TODO: ensure the task with the lock doesn't yield / is not preempted using asserts
 
+// Statistics of locks that were acquired at least once
+static mtl::atomic<SpinlockStats*> g_spinlockStats{nullptr};
+
+void SpinlockStats::RecordLock(uint32_t spinCount)
+{
+    if (!m_registered)
+    {
+        // We hold the lock, so no one else can be registering these stats
+        m_registered = true;
+        m_next = g_spinlockStats.load(mtl::memory_order_relaxed);
+        while (!g_spinlockStats.compare_exchange_weak(m_next, this, mtl::memory_order_release, mtl::memory_order_relaxed))
+        {
+        }
+    }
+
+    ++acquisitions;
+    if (spinCount)
+    {
+        ++contentions;
+        spins += spinCount;
+    }
+}
+
+void SpinlockStats::RecordUnlock(uint64_t lockTime)
+{
+    maxHoldTime = std::max(maxHoldTime, TimingReadTimestamp() - lockTime);
+}
+
+void SpinlockLogStats()
+{
+    for (auto stats = g_spinlockStats.load(mtl::memory_order_acquire); stats; stats = stats->m_next)
+    {
+        MTL_LOG(Info).Format("[KRNL] Lock {:<16} acquisitions {:>10}  contended {:>8}  spins {:>12}  max hold {} ticks",
+                             stats->name, stats->acquisitions, stats->contentions, stats->spins, stats->maxHoldTime);
+    }
+}
+
 void Spinlock::Lock()
 {
-    m_reenableInterrupts = mtl::InterruptsEnabled();
-    if (m_reenableInterrupts)
+    const auto reenableInterrupts = mtl::InterruptsEnabled();
+    if (reenableInterrupts)
         mtl::DisableInterrupts();
 
-    while (m_lock.load(mtl::memory_order::relaxed) || m_lock.exchange(true, mtl::memory_order::acquire))
+    const auto spins = m_lock.lock();
+
+    // Only touch the lock's state once we own it, other CPUs could be waiting on it
+    m_reenableInterrupts = reenableInterrupts;
+    if (m_stats)
     {
-        mtl::CpuPause();
+        m_stats->RecordLock(spins);
+        m_lockTime = TimingReadTimestamp();
     }
 }
 
 bool Spinlock::TryLock()
 {
-    m_reenableInterrupts = mtl::InterruptsEnabled();
-    if (m_reenableInterrupts)
+    const auto reenableInterrupts = mtl::InterruptsEnabled();
+    if (reenableInterrupts)
         mtl::DisableInterrupts();
 
-    auto locked = !m_lock.exchange(true, mtl::memory_order::acquire);
+    if (!m_lock.try_lock())
+    {
+        if (reenableInterrupts)
+            mtl::EnableInterrupts();
+        return false;
+    }
 
-    if (!locked && m_reenableInterrupts)
-        mtl::EnableInterrupts();
+    m_reenableInterrupts = reenableInterrupts;
+    if (m_stats)
+    {
+        m_stats->RecordLock(0);
+        m_lockTime = TimingReadTimestamp();
+    }
 
-    return locked;
+    return true;
 }
 
 void Spinlock::Unlock()
 {
-    assert(m_lock);
+    assert(m_lock.is_locked());
+
+    if (m_stats)
+        m_stats->RecordUnlock(m_lockTime);
+
+    const auto reenableInterrupts = m_reenableInterrupts;
+    m_lock.unlock();
+
+    if (reenableInterrupts)
+        mtl::EnableInterrupts();
+}
+
+void McsSpinlock::Lock(Node& node)
+{
+    node.reenableInterrupts = mtl::InterruptsEnabled();
+    if (node.reenableInterrupts)
+        mtl::DisableInterrupts();
+
+    const auto spins = m_lock.lock(node.node);
+
+    if (m_stats)
+    {
+        m_stats->RecordLock(spins);
+        node.lockTime = TimingReadTimestamp();
+    }
+}
+
+bool McsSpinlock::TryLock(Node& node)
+{
+    node.reenableInterrupts = mtl::InterruptsEnabled();
+    if (node.reenableInterrupts)
+        mtl::DisableInterrupts();
+
+    if (!m_lock.try_lock(node.node))
+    {
+        if (node.reenableInterrupts)
+            mtl::EnableInterrupts();
+        return false;
+    }
+
+    if (m_stats)
+    {
+        m_stats->RecordLock(0);
+        node.lockTime = TimingReadTimestamp();
+    }
+
+    return true;
+}
+
+void McsSpinlock::Unlock(Node& node)
+{
+    assert(m_lock.is_locked());
+
+    if (m_stats)
+        m_stats->RecordUnlock(node.lockTime);
 
-    m_lock.store(false, mtl::memory_order::release);
+    m_lock.unlock(node.node);
 
-    if (m_reenableInterrupts)
+    if (node.reenableInterrupts)
         mtl::EnableInterrupts();
 }
@@ -26,7 +26,8 @@
 
 #pragma once
 
-#include <metal/atomic.hpp>
+#include <cstdint>
+#include <metal/spinlock.hpp>
 
 // Spinlocks implement busy-waiting. This means the current CPU will loop until
 // it can obtain the lock and will not block / yield to another task.
@@ -37,17 +38,98 @@
 //
 // To prevent deadlocks, a task holding the spinlock must not yield to another task.
 //
-// Spinlocks are not "fair". Multiple CPUs trying to lock the same spinlock
-// could cause starvation for the current task / CPU.
+// Spinlocks are fair: CPUs get the lock in the order they asked for it.
 
+// Optional contention statistics for a lock. Counters are only updated by the CPU holding
+// the lock, so they don't need to be atomic.
+struct SpinlockStats
+{
+    constexpr explicit SpinlockStats(const char* name) : name(name) {}
+
+    SpinlockStats(const SpinlockStats&) = delete;
+    SpinlockStats& operator=(const SpinlockStats&) = delete;
+
+    void RecordLock(uint32_t spins);
+    void RecordUnlock(uint64_t lockTime);
+
+    const char* const name;
+    uint64_t acquisitions{0};
+    uint64_t contentions{0}; // Acquisitions that had to wait
+    uint64_t spins{0};       // Total number of times waiters looked at the lock
+    uint64_t maxHoldTime{0}; // In timestamp counter ticks
+
+private:
+    friend void SpinlockLogStats();
+
+    bool m_registered{false};
+    SpinlockStats* m_next{nullptr};
+};
+
+// Log the statistics of all locks that were acquired at least once
+void SpinlockLogStats();
+
+// Ticket lock, for locks that are not shared by many CPUs or that need Lock() and Unlock()
+// to be called from different places.
 class Spinlock
 {
 public:
+    constexpr Spinlock() = default;
+    constexpr explicit Spinlock(SpinlockStats& stats) : m_stats(&stats) {}
+
+    Spinlock(const Spinlock&) = delete;
+    Spinlock& operator=(const Spinlock&) = delete;
+
     void Lock();
     bool TryLock();
     void Unlock();
 
+    // Whether some CPU holds the lock
+    bool IsLocked() const { return m_lock.is_locked(); }
+
+    // Start collecting statistics, the lock must not be held
+    void EnableStats(SpinlockStats& stats) { m_stats = &stats; }
+
+private:
+    mtl::ticket_lock m_lock;
+    SpinlockStats* m_stats{nullptr};
+
+    // These are only written by the CPU holding the lock
+    bool m_reenableInterrupts{false};
+    uint64_t m_lockTime{0};
+};
+
+// MCS queue lock, for locks shared by many CPUs. Each waiter spins on its own Node, which
+// also keeps the interrupt state of the caller. The Node must live until Unlock() returns,
+// usually on the caller's stack:
+//
+//     McsSpinlock::Node node;
+//     lock.Lock(node);
+//     ...
+//     lock.Unlock(node);
+class McsSpinlock
+{
+public:
+    struct Node
+    {
+        mtl::mcs_lock::node node;
+        bool reenableInterrupts{false};
+        uint64_t lockTime{0};
+    };
+
+    constexpr McsSpinlock() = default;
+    constexpr explicit McsSpinlock(SpinlockStats& stats) : m_stats(&stats) {}
+
+    McsSpinlock(const McsSpinlock&) = delete;
+    McsSpinlock& operator=(const McsSpinlock&) = delete;
+
+    void Lock(Node& node);
+    bool TryLock(Node& node);
+    void Unlock(Node& node);
+
+    // Start collecting statistics, the lock must not be held
+    void EnableStats(SpinlockStats& stats) { m_stats = &stats; }
+
 private:
-    mtl::atomic<bool> m_lock{false};
-    bool m_reenableInterrupts;
+    mtl::mcs_lock m_lock;
+    SpinlockStats* m_stats{nullptr};
 };
@@ -82,6 +82,14 @@ void Task::Entry(Task* task, EntryPoint entryPoint, const void* args)
         ;
 }
 
+void Task::CountPageFault(bool major)
+{
+    if (major)
+        ++m_majorFaults;
+    else
+        ++m_minorFaults;
+}
+
 void Task::SwitchTo(Task* nextTask)
 {
     CpuSetTask(nextTask);
@@ -27,8 +27,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <metal/arch.hpp>
+#include <metal/intrusive_list.hpp>
+#include <metal/shared_ptr.hpp>
 
+class AddressSpace;
 class CpuContext;
 
 enum class TaskState
@@ -61,6 +65,15 @@ public:
     int GetId() const { return m_id; }
     TaskState GetState() const { return m_state; }
 
+    // Address space for user space addresses, null for kernel tasks
+    const mtl::shared_ptr<AddressSpace>& GetAddressSpace() const { return m_addressSpace; }
+    void SetAddressSpace(mtl::shared_ptr<AddressSpace> addressSpace) { m_addressSpace = std::move(addressSpace); }
+
+    // Page faults resolved for this task. Major faults had to read the page's content, minor faults didn't.
+    uint64_t GetMinorFaultCount() const { return m_minorFaults; }
+    uint64_t GetMajorFaultCount() const { return m_majorFaults; }
+    void CountPageFault(bool major);
+
     // Switch task
     void SwitchTo(Task* newTask);
 
@@ -80,4 +93,12 @@ private:
     const Id m_id;
     TaskState m_state{TaskState::Init};
     CpuContext* m_context{}; // Saved CPU context (on the task's stack)
+    mtl::shared_ptr<AddressSpace> m_addressSpace;
+    uint64_t m_minorFaults{};
+    uint64_t m_majorFaults{};
+    mtl::list_hook m_queueHook; // Link in the queue the task is waiting in (ready queue, wait queues)
+
+public:
+    // Queue of tasks, linked through the tasks themselves. A task can be in only one queue at a time.
+    using Queue = mtl::intrusive_list<Task, &Task::m_queueHook>;
 };
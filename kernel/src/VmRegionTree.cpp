@@ -0,0 +1,173 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "VmRegionTree.hpp"
+#include <algorithm>
+#include <metal/helpers.hpp>
+
+void VmRegionTree::AugmentNode::operator()(Node& node, const Node* left, const Node* right) const
+{
+    node.subtreeStart = left ? left->subtreeStart : node.region.start;
+    node.subtreeEnd = right ? right->subtreeEnd : node.region.end;
+    node.subtreeGap = 0;
+
+    if (left)
+        node.subtreeGap = std::max(left->subtreeGap, node.region.start - left->subtreeEnd);
+
+    if (right)
+        node.subtreeGap = std::max(std::max(node.subtreeGap, right->subtreeGap), right->subtreeStart - node.region.end);
+}
+
+VmRegionTree::~VmRegionTree()
+{
+    while (auto node = m_regions.root())
+    {
+        m_regions.erase(*node);
+        delete node;
+    }
+}
+
+mtl::expected<void, ErrorCode> VmRegionTree::Add(mtl::unique_ptr<Node>&& node)
+{
+    if (auto result = Insert(*node); !result)
+        return result;
+
+    node.release();
+
+    return {};
+}
+
+mtl::expected<uintptr_t, ErrorCode> VmRegionTree::Allocate(size_t size, mtl::unique_ptr<Node>&& node)
+{
+    if (!size || !mtl::IsAligned(size, mtl::kMemoryPageSize))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto address = FindFreeRange(size);
+    if (!address)
+        return mtl::unexpected(address.error());
+
+    node->region.start = *address;
+    node->region.end = *address + size;
+
+    if (auto result = Insert(*node); !result)
+        return mtl::unexpected(result.error());
+
+    node.release();
+
+    return *address;
+}
+
+mtl::expected<void, ErrorCode> VmRegionTree::Insert(Node& node)
+{
+    const auto& region = node.region;
+
+    if (region.start >= region.end || !mtl::IsAligned(region.start, mtl::kMemoryPageSize) ||
+        !mtl::IsAligned(region.end, mtl::kMemoryPageSize))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    // User regions live in the lower half, kernel regions in the upper half
+    const bool user = region.protection & VmUser;
+    if (IsKernelAddress(region.start) == user || IsKernelAddress(region.end - 1) == user)
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    // Writable code isn't supported
+    if ((region.protection & VmWrite) && (region.protection & VmExecute))
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    const auto next = FindEndingAfter(region.start);
+    if (next && next->region.start < region.end)
+        return mtl::unexpected(ErrorCode::Conflict);
+
+    m_regions.insert(node);
+
+    return {};
+}
+
+mtl::expected<mtl::unique_ptr<VmRegionTree::Node>, ErrorCode> VmRegionTree::Remove(uintptr_t address)
+{
+    const auto node = FindEndingAfter(address);
+    if (!node || node->region.start != address)
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    m_regions.erase(*node);
+
+    return mtl::unique_ptr<Node>(node);
+}
+
+const VmRegion* VmRegionTree::Find(uintptr_t address) const
+{
+    const auto node = FindEndingAfter(address);
+    if (!node || address < node->region.start)
+        return nullptr;
+
+    return &node->region;
+}
+
+VmRegionTree::Node* VmRegionTree::FindEndingAfter(uintptr_t address) const
+{
+    return m_regions.partition_point([address](const Node& node) { return node.region.end <= address; });
+}
+
+mtl::expected<uintptr_t, ErrorCode> VmRegionTree::FindFreeRange(size_t size) const
+{
+    if (!size)
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    uintptr_t address = m_start;
+    if (FindFreeRange(m_regions.root(), size, address))
+        return address;
+
+    // Free space after the last region
+    if (address < m_end && m_end - address >= size)
+        return address;
+
+    return mtl::unexpected(ErrorCode::OutOfMemory);
+}
+
+bool VmRegionTree::FindFreeRange(const Node* node, size_t size, uintptr_t& address) const
+{
+    if (!node || address >= m_end)
+        return false;
+
+    // Skip subtrees that are before 'address' or that don't have a large enough free range
+    const auto gapBefore = node->subtreeStart > address ? node->subtreeStart - address : 0;
+    if (node->subtreeEnd <= address || (gapBefore < size && node->subtreeGap < size))
+    {
+        address = std::max(address, node->subtreeEnd);
+        return false;
+    }
+
+    if (FindFreeRange(RegionTree::left(*node), size, address))
+        return true;
+
+    // Free range just before this region
+    const auto gapEnd = std::min(node->region.start, m_end);
+    if (gapEnd > address && gapEnd - address >= size)
+        return true;
+
+    address = std::max(address, node->region.end);
+    return FindFreeRange(RegionTree::right(*node), size, address);
+}
@@ -0,0 +1,143 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include "arch.hpp"
+#include <cstdint>
+#include <metal/expected.hpp>
+#include <metal/rbtree.hpp>
+#include <metal/shared_ptr.hpp>
+#include <metal/unique_ptr.hpp>
+
+class ElfExecutable;
+
+// Access allowed to a region
+enum VmProtection
+{
+    VmRead = 1,
+    VmWrite = 2,
+    VmExecute = 4,
+    VmUser = 8, // Accessible from user space
+};
+
+// Where the content of a region comes from
+enum class VmRegionType
+{
+    Anonymous,  // Zero-initialized memory private to the address space
+    Physical,   // Existing physical memory such as a boot module, writes go to that memory
+    Executable, // An executable's pages, copied on write
+    Committed,  // Pages are mapped explicitly (VirtualAlloc(), AllocPages()), faults are errors
+};
+
+// A range of virtual memory. Unless the region is committed, nothing is mapped until pages are accessed.
+struct VmRegion
+{
+    uintptr_t start;                             // Page aligned
+    uintptr_t end;                               // Page aligned
+    int protection;                              // VmProtection flags
+    VmRegionType type;                           // Where the content comes from
+    PhysicalAddress physicalAddress{};           // Physical: memory mapped at 'start'
+    mtl::shared_ptr<ElfExecutable> executable{}; // Executable: where the content comes from
+    uintptr_t loadBias{};                        // Executable: region address minus link-time address
+};
+
+// The kernel lives in the upper half of the address space
+constexpr bool IsKernelAddress(uintptr_t address)
+{
+    return address >> 63;
+}
+
+// The regions of an address space, kept in a red-black tree where each node also tracks the largest gap in its
+// subtree. Finding the region at an address, detecting overlaps and finding free space are all O(log n).
+//
+// There is no locking, this is the owner's job. Nodes are allocated and freed by the owner too, so that it can do
+// it without holding its lock: growing the heap looks up regions.
+class VmRegionTree
+{
+public:
+    struct Node
+    {
+        explicit Node(VmRegion region) : region(std::move(region)) {}
+
+        VmRegion region;
+        mtl::rbtree_hook hook{};
+        uintptr_t subtreeStart{}; // Lowest start in this subtree
+        uintptr_t subtreeEnd{};   // Highest end in this subtree
+        uintptr_t subtreeGap{};   // Largest free range between two regions of this subtree
+    };
+
+    // 'start' and 'end' delimit where Allocate() places regions
+    constexpr VmRegionTree(uintptr_t start, uintptr_t end) : m_start(start), m_end(end) {}
+    ~VmRegionTree();
+
+    VmRegionTree(const VmRegionTree&) = delete;
+    VmRegionTree& operator=(const VmRegionTree&) = delete;
+
+    // Add a region, it can't overlap existing ones. The tree only takes 'node' on success.
+    mtl::expected<void, ErrorCode> Add(mtl::unique_ptr<Node>&& node);
+
+    // Add a region of 'size' bytes at the lowest free address, ignoring its start and end. The tree only takes 'node'
+    // on success.
+    mtl::expected<uintptr_t, ErrorCode> Allocate(size_t size, mtl::unique_ptr<Node>&& node);
+
+    // Remove the region starting at 'address' and give its node back
+    mtl::expected<mtl::unique_ptr<Node>, ErrorCode> Remove(uintptr_t address);
+
+    // Find the region containing 'address', nullptr if there is none
+    const VmRegion* Find(uintptr_t address) const;
+
+    // Find the lowest free range of 'size' bytes, OutOfMemory if there is none
+    mtl::expected<uintptr_t, ErrorCode> FindFreeRange(size_t size) const;
+
+private:
+    // Validate 'node' and insert it in the tree
+    mtl::expected<void, ErrorCode> Insert(Node& node);
+
+    // First region that ends after 'address', nullptr if there is none
+    Node* FindEndingAfter(uintptr_t address) const;
+
+    // Search the subtree at 'node' for a free range of 'size' bytes at or after 'address'. On success, 'address'
+    // is the start of the range. Otherwise it is the end of the subtree, where the search continues.
+    bool FindFreeRange(const Node* node, size_t size, uintptr_t& address) const;
+
+    struct CompareNodes
+    {
+        bool operator()(const Node& a, const Node& b) const { return a.region.start < b.region.start; }
+    };
+
+    struct AugmentNode
+    {
+        void operator()(Node& node, const Node* left, const Node* right) const;
+    };
+
+    using RegionTree = mtl::rbtree<Node, &Node::hook, CompareNodes, AugmentNode>;
+
+    const uintptr_t m_start; // Where Allocate() can place regions
+    const uintptr_t m_end;
+    RegionTree m_regions;
+};
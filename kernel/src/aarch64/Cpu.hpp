@@ -43,6 +43,18 @@ inline void CpuSetTask(Task* task)
     mtl::Write_TPIDR_EL1(reinterpret_cast<uintptr_t>(task));
 }
 
+// Number of CPUs running the kernel and index of the current one, in [0, CpuGetCount()). Only the boot CPU runs the
+// kernel until SMP is brought up.
+inline int CpuGetCount()
+{
+    return 1;
+}
+
+inline int CpuGetIndex()
+{
+    return 0;
+}
+
 // Get/set the GICC. Every GICC is at the same physical address.
 GicCpuInterface* CpuGetGicCpuInterface();
 void CpuSetGicCpuInterface(mtl::unique_ptr<GicCpuInterface> gicc);
@@ -25,6 +25,8 @@
 */
 
 #include "memory.hpp"
+#include "Spinlock.hpp"
+#include <algorithm>
 
 // See how these numbers are determined in x86_64/PageTable.cpp (the same numbers apply to 4-level aarch64)
 static uint64_t* const vmm_pml4 = (uint64_t*)0xFFFFFF7FBFDFE000ull;
@@ -48,6 +50,216 @@ static void InvalidatePage(const void* address)
     mtl::aarch64_tlbi_vae1(address); // Broadcast TLB invalidation
 }
 
+static constexpr int kEntriesPerTable = 512;
+
+// Protects the page tables: UnmapPages() frees intermediate tables once they are empty, MapPages() must not be
+// populating them at the same time. The lock is released while allocating frames for new tables as that can recurse
+// into MapPages() through the heap.
+static Spinlock g_pageTableLock;
+
+// A frame for a new page table, allocated with the lock released
+struct SpareFrame
+{
+    PhysicalAddress frame{0};
+    bool zeroed{false};
+};
+
+// Make sure 'entry' points to a page table, using 'spare' for a new one. 'table' is where the table is found in the
+// recursive mapping. Called with the lock held.
+//
+// Without a spare frame, the lock is released to allocate one and the result is false: tables can be freed in the
+// meantime, so the entries walked so far can't be trusted anymore and the walk has to start over.
+static mtl::expected<bool, ErrorCode> EnsurePageTable(uint64_t* entry, void* table, uint64_t flags, SpareFrame& spare)
+{
+    if (*entry & mtl::PageFlags::Valid)
+        return true;
+
+    if (!spare.frame)
+    {
+        g_pageTableLock.Unlock();
+
+        // Pre-zeroed frames save clearing the table here
+        auto frame = TakeZeroedFrame();
+        spare.zeroed = frame.has_value();
+        if (!spare.zeroed)
+            frame = AllocFrames(1);
+
+        g_pageTableLock.Lock();
+
+        if (!frame)
+            return mtl::unexpected(ErrorCode::OutOfMemory);
+
+        spare.frame = *frame;
+        return false;
+    }
+
+    // TODO: add nG bit for user space
+    *entry = spare.frame | mtl::PageFlags::PageTable | flags;
+    SyncTableEntry(entry);
+    if (!spare.zeroed)
+        memset(table, 0, mtl::kMemoryPageSize);
+
+    spare.frame = 0;
+    return true;
+}
+
+// Make sure the page tables for 'addr' exist, down to PML1 unless a large page maps it. Called with the lock held.
+static mtl::expected<void, ErrorCode> EnsurePageTables(uint64_t addr, uint64_t flags, SpareFrame& spare)
+{
+    const auto i4 = (addr >> 39) & 0x1FF;
+    const auto i3 = (addr >> 30) & 0x3FFFF;
+    const auto i2 = (addr >> 21) & 0x7FFFFFF;
+
+    for (;;)
+    {
+        auto ready = EnsurePageTable(&vmm_pml4[i4], (char*)vmm_pml3 + (i4 << 12), flags, spare);
+        if (ready && *ready)
+            ready = EnsurePageTable(&vmm_pml3[i3], (char*)vmm_pml2 + (i3 << 12), flags, spare);
+        if (ready && *ready && (vmm_pml3[i3] & mtl::PageFlags::Table))
+            ready = EnsurePageTable(&vmm_pml2[i2], (char*)vmm_pml1 + (i2 << 12), flags, spare);
+
+        if (!ready)
+            return mtl::unexpected(ready.error());
+
+        if (*ready)
+            return {};
+    }
+}
+
+static bool IsEmptyPageTable(const uint64_t* table)
+{
+    return std::find_if(table, table + kEntriesPerTable, [](uint64_t entry) { return entry != 0; }) ==
+           table + kEntriesPerTable;
+}
+
+// Make cleared table entries visible to the MMU
+static void SyncTableEntries(const uint64_t* entries, int count)
+{
+    for (int i = 0; i != count; ++i)
+        mtl::aarch64_dc_civac(&entries[i]);
+
+    mtl::aarch64_dsb_st();
+    mtl::aarch64_isb_sy();
+}
+
+static void FlushTlb()
+{
+    mtl::aarch64_dsb_sy();
+    mtl::aarch64_tlbi_vmalle1();
+    mtl::aarch64_dsb_sy();
+    mtl::aarch64_isb_sy();
+}
+
+// Frames released by UnmapPages(). They can only be freed once the TLB doesn't reference them anymore, so TLB
+// invalidation is deferred until the batch is full or the unmap is complete. Physically contiguous frames are freed
+// together. This doesn't allocate memory as the heap shrinks through UnmapPages().
+class UnmapBatch
+{
+public:
+    // A page was unmapped at 'address'. Its frame is freed unless the mapping doesn't own it.
+    void AddPage(uint64_t entry, uintptr_t address)
+    {
+        if (!(entry & mtl::PageFlags::Shared))
+            AddFrame(entry & mtl::PageFlags::AddressMask);
+        m_first = std::min(m_first, address);
+        m_last = std::max(m_last, address);
+    }
+
+    // A page table was removed, 'table' is where it used to be in the recursive mapping
+    void AddPageTable(PhysicalAddress frame, const void* table)
+    {
+        AddFrame(frame);
+        if (m_tableCount < kMaxTables)
+            m_tables[m_tableCount] = table;
+        ++m_tableCount;
+    }
+
+    void Flush()
+    {
+        if (!m_runCount && m_first > m_last)
+            return;
+
+        const bool fullFlush =
+            m_tableCount > kMaxTables || (m_first <= m_last && ((m_last - m_first) >> mtl::kMemoryPageShift) >= kMaxInvalidations);
+
+        // TODO: TLB shootdown (SMP)
+        if (fullFlush)
+        {
+            FlushTlb();
+        }
+        else
+        {
+            mtl::aarch64_dsb_sy();
+
+            for (auto address = m_first; address <= m_last; address += mtl::kMemoryPageSize)
+                mtl::aarch64_tlbi_vae1((void*)address);
+
+            for (int i = 0; i != m_tableCount; ++i)
+                mtl::aarch64_tlbi_vae1(m_tables[i]);
+
+            mtl::aarch64_dsb_sy();
+            mtl::aarch64_isb_sy();
+        }
+
+        for (int i = 0; i != m_runCount; ++i)
+            FreeFrames(m_runs[i].frame, m_runs[i].count);
+
+        m_runCount = 0;
+        m_tableCount = 0;
+        m_first = ~0ull;
+        m_last = 0;
+    }
+
+private:
+    static constexpr int kMaxRuns = 16;
+    static constexpr int kMaxTables = 8;
+    static constexpr int kMaxInvalidations = 32; // Past this many pages, flushing the whole TLB is cheaper
+
+    void AddFrame(PhysicalAddress frame)
+    {
+        if (m_runCount)
+        {
+            auto& run = m_runs[m_runCount - 1];
+            if (run.frame + run.count * mtl::kMemoryPageSize == frame)
+            {
+                ++run.count;
+                return;
+            }
+        }
+
+        if (m_runCount == kMaxRuns)
+            Flush();
+
+        m_runs[m_runCount++] = FrameRun{frame, 1};
+    }
+
+    struct FrameRun
+    {
+        PhysicalAddress frame;
+        int count;
+    };
+
+    FrameRun m_runs[kMaxRuns];
+    int m_runCount{0};
+    const void* m_tables[kMaxTables];
+    int m_tableCount{0};
+    uintptr_t m_first{~0ull}; // Range of unmapped pages to invalidate
+    uintptr_t m_last{0};
+};
+
+// The bootloader maps some memory with large pages (i.e. the framebuffer). Mapping a page that is already covered by one is
+// fine as long as it maps to the same physical address.
+static void CheckLargePage(uint64_t entry, uint64_t largePageSize, efi::PhysicalAddress physicalAddress, const void* virtualAddress)
+{
+    const auto base = entry & mtl::PageFlags::AddressMask & ~(largePageSize - 1);
+    if (base + ((uintptr_t)virtualAddress & (largePageSize - 1)) != physicalAddress)
+    {
+        MTL_LOG(Fatal) << "Failed to map " << mtl::hex(physicalAddress) << " to " << virtualAddress;
+        MTL_LOG(Fatal) << "Large page entry: " << mtl::hex(entry);
+        assert(0 && "There is already a large page mapped at this address");
+    }
+}
+
 mtl::expected<void, ErrorCode> MapPages(efi::PhysicalAddress physicalAddress, const void* virtualAddress, int pageCount,
                                         mtl::PageFlags pageFlags)
 {
@@ -57,70 +269,39 @@ mtl::expected<void, ErrorCode> MapPages(efi::PhysicalAddress physicalAddress, co
     assert(mtl::IsAligned(physicalAddress, mtl::kMemoryPageSize));
     assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
 
-    // TODO: need critical sections here
-
     // On aarch64, we can only map pages in high address space. I don't believe we have a need to map anything in low address space.
     // We assert to make sure we don't get any surprises.
     assert((uintptr_t)virtualAddress >= 0xFFFF000000000000ull);
 
-    for (auto page = 0; page != pageCount; ++page)
+    SpareFrame spare;
+
+    g_pageTableLock.Lock();
+
+    for (auto page = 0; page != pageCount; ++page, physicalAddress += mtl::kMemoryPageSize,
+              virtualAddress = mtl::AdvancePointer(virtualAddress, mtl::kMemoryPageSize))
     {
         const auto addr = (uint64_t)virtualAddress;
 
-        const auto i4 = (addr >> 39) & 0x1FF;
         const auto i3 = (addr >> 30) & 0x3FFFF;
         const auto i2 = (addr >> 21) & 0x7FFFFFF;
         const auto i1 = (addr >> 12) & 0xFFFFFFFFFul;
 
-        if (!(vmm_pml4[i4] & mtl::PageFlags::Valid))
+        if (auto result = EnsurePageTables(addr, 0, spare); !result)
         {
-            if (const auto frame = AllocFrames(1))
-            {
-                // TODO: add nG bit for user space
-                vmm_pml4[i4] = *frame | mtl::PageFlags::PageTable;
-                SyncTableEntry(&vmm_pml4[i4]);
-
-                volatile auto p = (char*)vmm_pml3 + (i4 << 12);
-                memset(p, 0, mtl::kMemoryPageSize);
-            }
-            else
-            {
-                return mtl::unexpected(ErrorCode::OutOfMemory);
-            }
+            g_pageTableLock.Unlock();
+            return result;
         }
 
-        if (!(vmm_pml3[i3] & mtl::PageFlags::Valid))
+        if (!(vmm_pml3[i3] & mtl::PageFlags::Table)) [[unlikely]]
         {
-            if (const auto frame = AllocFrames(1))
-            {
-                // TODO: add nG bit for user space
-                vmm_pml3[i3] = *frame | mtl::PageFlags::PageTable;
-                SyncTableEntry(&vmm_pml3[i3]);
-
-                volatile auto p = (char*)vmm_pml2 + (i3 << 12);
-                memset(p, 0, mtl::kMemoryPageSize);
-            }
-            else
-            {
-                return mtl::unexpected(ErrorCode::OutOfMemory);
-            }
+            CheckLargePage(vmm_pml3[i3], mtl::kMemoryHugePageSize, physicalAddress, virtualAddress);
+            continue;
         }
 
-        if (!(vmm_pml2[i2] & mtl::PageFlags::Valid))
+        if (!(vmm_pml2[i2] & mtl::PageFlags::Table)) [[unlikely]]
         {
-            if (const auto frame = AllocFrames(1))
-            {
-                // TODO: add nG bit for user space
-                vmm_pml2[i2] = *frame | mtl::PageFlags::PageTable;
-                SyncTableEntry(&vmm_pml2[i2]);
-
-                volatile auto p = (char*)vmm_pml1 + (i2 << 12);
-                memset(p, 0, mtl::kMemoryPageSize);
-            }
-            else
-            {
-                return mtl::unexpected(ErrorCode::OutOfMemory);
-            }
+            CheckLargePage(vmm_pml2[i2], mtl::kMemoryLargePageSize, physicalAddress, virtualAddress);
+            continue;
         }
 
         if (vmm_pml1[i1] & mtl::PageFlags::Valid) [[unlikely]]
@@ -139,36 +320,198 @@ mtl::expected<void, ErrorCode> MapPages(efi::PhysicalAddress physicalAddress, co
             vmm_pml1[i1] = physicalAddress | pageFlags;
             SyncTableEntry(&vmm_pml1[i1]);
         }
-
-        // Next page...
-        physicalAddress += mtl::kMemoryPageSize;
-        virtualAddress = mtl::AdvancePointer(virtualAddress, mtl::kMemoryPageSize);
     }
 
+    g_pageTableLock.Unlock();
+
+    // Someone else created the table while the lock was released
+    if (spare.frame)
+        FreeFrames(spare.frame, 1);
+
     return {};
 }
 
+// Number of pages from 'address' to the next multiple of 'size'
+static uint64_t PagesToBoundary(uint64_t address, uint64_t size)
+{
+    // Wraps around to the right value for the last slot of the address space
+    return (((address | (size - 1)) + 1) - address) >> mtl::kMemoryPageShift;
+}
+
 mtl::expected<void, ErrorCode> UnmapPages(const void* virtualAddress, int pageCount)
 {
     assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
-    // TODO: validate that the memory we are trying to free is part of the heap!
 
-    // TODO: need critical section here...
-    // TODO: need to update memory map region and track holes
-    // TODO: check if we can free page tables (pml1, pml2, pml3)
-    const auto addr = (uint64_t)virtualAddress;
-    auto i1 = (addr >> 12) & 0xFFFFFFFFFul;
+    if (pageCount <= 0)
+        return {};
+
+    UnmapBatch batch;
+    uint64_t addr = (uint64_t)virtualAddress;
+    uint64_t remaining = pageCount;
+
+    g_pageTableLock.Lock();
 
-    for (; pageCount > 0; --pageCount, ++i1)
+    // Walk the page tables once, skipping over missing tables. Large pages are left alone: only the bootloader creates
+    // them, for memory that is never unmapped.
+    while (remaining > 0)
     {
-        if (vmm_pml1[i1] & mtl::PageFlags::Valid) // TODO: should be an assert?
+        const auto i4 = (addr >> 39) & 0x1FF;
+        const auto i3 = (addr >> 30) & 0x3FFFF;
+        const auto i2 = (addr >> 21) & 0x7FFFFFF;
+        const auto i1 = (addr >> 12) & 0xFFFFFFFFFul;
+
+        uint64_t count;
+        if (!(vmm_pml4[i4] & mtl::PageFlags::Valid))
+            count = PagesToBoundary(addr, 1ull << 39);
+        else if (!(vmm_pml3[i3] & mtl::PageFlags::Valid) || !(vmm_pml3[i3] & mtl::PageFlags::Table))
+            count = PagesToBoundary(addr, mtl::kMemoryHugePageSize);
+        else if (!(vmm_pml2[i2] & mtl::PageFlags::Valid) || !(vmm_pml2[i2] & mtl::PageFlags::Table))
+            count = PagesToBoundary(addr, mtl::kMemoryLargePageSize);
+        else
         {
-            // TODO: free multiple frames at once if possible
-            FreeFrames(vmm_pml1[i1] & mtl::PageFlags::AddressMask, 1);
-            vmm_pml1[i1] = 0;
-            InvalidatePage(virtualAddress);
+            count = std::min(remaining, PagesToBoundary(addr, mtl::kMemoryLargePageSize));
+
+            for (uint64_t page = 0; page != count; ++page)
+            {
+                auto& entry = vmm_pml1[i1 + page];
+                if (entry & mtl::PageFlags::Valid)
+                {
+                    batch.AddPage(entry, addr + (page << mtl::kMemoryPageShift));
+                    entry = 0;
+                }
+            }
+
+            SyncTableEntries(&vmm_pml1[i1], count);
+
+            // Free page tables that are now empty. Only kernel space is mapped here and its PML3 tables stay, as they
+            // will be shared by all address spaces.
+            const auto pml1 = vmm_pml1 + (i1 & ~(kEntriesPerTable - 1ull));
+            const auto pml2 = vmm_pml2 + (i2 & ~(kEntriesPerTable - 1ull));
+
+            if (IsEmptyPageTable(pml1))
+            {
+                batch.AddPageTable(vmm_pml2[i2] & mtl::PageFlags::AddressMask, pml1);
+                vmm_pml2[i2] = 0;
+                SyncTableEntry(&vmm_pml2[i2]);
+
+                if (IsEmptyPageTable(pml2))
+                {
+                    batch.AddPageTable(vmm_pml3[i3] & mtl::PageFlags::AddressMask, pml2);
+                    vmm_pml3[i3] = 0;
+                    SyncTableEntry(&vmm_pml3[i3]);
+                }
+            }
         }
+
+        count = std::min(remaining, count);
+        remaining -= count;
+        addr += count << mtl::kMemoryPageShift;
+    }
+
+    batch.Flush();
+
+    g_pageTableLock.Unlock();
+
+    return {};
+}
+
+// Called with the lock held
+static mtl::expected<PageMapping, ErrorCode> GetPageMappingLocked(const void* virtualAddress)
+{
+    const auto addr = (uint64_t)virtualAddress;
+    const auto i4 = (addr >> 39) & 0x1FF;
+    const auto i3 = (addr >> 30) & 0x3FFFF;
+    const auto i2 = (addr >> 21) & 0x7FFFFFF;
+    const auto i1 = (addr >> 12) & 0xFFFFFFFFFul;
+
+    if (!(vmm_pml4[i4] & mtl::PageFlags::Valid) || !(vmm_pml3[i3] & mtl::PageFlags::Valid))
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    if (!(vmm_pml3[i3] & mtl::PageFlags::Table))
+    {
+        const auto base = vmm_pml3[i3] & mtl::PageFlags::AddressMask & ~(mtl::kMemoryHugePageSize - 1ull);
+        return PageMapping{base + (addr & (mtl::kMemoryHugePageSize - 1) & ~(mtl::kMemoryPageSize - 1ull)),
+                           !(vmm_pml3[i3] & mtl::PageFlags::ReadOnly)};
     }
 
+    if (!(vmm_pml2[i2] & mtl::PageFlags::Valid))
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    if (!(vmm_pml2[i2] & mtl::PageFlags::Table))
+    {
+        const auto base = vmm_pml2[i2] & mtl::PageFlags::AddressMask & ~(mtl::kMemoryLargePageSize - 1ull);
+        return PageMapping{base + (addr & (mtl::kMemoryLargePageSize - 1) & ~(mtl::kMemoryPageSize - 1ull)),
+                           !(vmm_pml2[i2] & mtl::PageFlags::ReadOnly)};
+    }
+
+    if (!(vmm_pml1[i1] & mtl::PageFlags::Valid))
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    return PageMapping{vmm_pml1[i1] & mtl::PageFlags::AddressMask, !(vmm_pml1[i1] & mtl::PageFlags::ReadOnly)};
+}
+
+bool ArePageTablesLocked()
+{
+    return g_pageTableLock.IsLocked();
+}
+
+mtl::expected<PageMapping, ErrorCode> GetPageMapping(const void* virtualAddress)
+{
+    g_pageTableLock.Lock();
+    const auto mapping = GetPageMappingLocked(virtualAddress);
+    g_pageTableLock.Unlock();
+
+    return mapping;
+}
+
+// Called with the lock held
+static mtl::expected<void, ErrorCode> RemapPageLocked(efi::PhysicalAddress physicalAddress, const void* virtualAddress,
+                                                      mtl::PageFlags pageFlags)
+{
+    assert(mtl::IsAligned(physicalAddress, mtl::kMemoryPageSize));
+    assert(mtl::IsAligned(virtualAddress, mtl::kMemoryPageSize));
+
+    const auto addr = (uint64_t)virtualAddress;
+    const auto i4 = (addr >> 39) & 0x1FF;
+    const auto i3 = (addr >> 30) & 0x3FFFF;
+    const auto i2 = (addr >> 21) & 0x7FFFFFF;
+    const auto i1 = (addr >> 12) & 0xFFFFFFFFFul;
+
+    // One level at a time: a table can only be read once the entry above says it exists. Blocks would have to be split
+    // first.
+    if (!(vmm_pml4[i4] & mtl::PageFlags::Valid) || !(vmm_pml3[i3] & mtl::PageFlags::Valid))
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    if (!(vmm_pml3[i3] & mtl::PageFlags::Table))
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    if (!(vmm_pml2[i2] & mtl::PageFlags::Valid))
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    if (!(vmm_pml2[i2] & mtl::PageFlags::Table))
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    if (!(vmm_pml1[i1] & mtl::PageFlags::Valid))
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    // Break-before-make: the old entry must be invalidated before the new one is written
+    vmm_pml1[i1] = 0;
+    SyncTableEntry(&vmm_pml1[i1]);
+    InvalidatePage(virtualAddress);
+
+    // TODO: add nG bit for user space
+    vmm_pml1[i1] = physicalAddress | pageFlags;
+    SyncTableEntry(&vmm_pml1[i1]);
+
     return {};
 }
+
+mtl::expected<void, ErrorCode> RemapPage(efi::PhysicalAddress physicalAddress, const void* virtualAddress,
+                                         mtl::PageFlags pageFlags)
+{
+    g_pageTableLock.Lock();
+    const auto result = RemapPageLocked(physicalAddress, virtualAddress, pageFlags);
+    g_pageTableLock.Unlock();
+
+    return result;
+}
@@ -24,6 +24,7 @@
     OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "AddressSpace.hpp"
 #include "Cpu.hpp"
 #include "interrupt.hpp"
 
@@ -63,6 +64,53 @@ static void LogException(const char* exception, const InterruptContext* context)
         std::abort();                                                                                                              \
     }
 
+// Resolve data and instruction aborts caused by page faults
+static bool HandleAbort(bool user)
+{
+    const auto esr = mtl::Read_ESR_EL1();
+    const auto exceptionClass = (esr >> 26) & 0x3F;
+    const auto faultStatus = esr & 0x3F;
+
+    int faultFlags = 0;
+    if (user)
+        faultFlags |= PageFaultUser;
+
+    if (exceptionClass == 0x20 || exceptionClass == 0x21)
+    {
+        // Instruction abort (from a lower or the current EL)
+        faultFlags |= PageFaultExecute;
+    }
+    else if (exceptionClass == 0x24 || exceptionClass == 0x25)
+    {
+        // Data abort (from a lower or the current EL), WnR is set for writes
+        if (esr & (1 << 6))
+            faultFlags |= PageFaultWrite;
+    }
+    else
+    {
+        return false;
+    }
+
+    // Translation faults (0b0001xx) are missing pages, permission faults (0b0011xx) are protection violations
+    if ((faultStatus & 0x3C) == 0x0C)
+        faultFlags |= PageFaultPresent;
+    else if ((faultStatus & 0x3C) != 0x04)
+        return false;
+
+    return (bool)HandlePageFault((void*)mtl::Read_FAR_EL1(), faultFlags);
+}
+
+#define SYNCHRONOUS_EXCEPTION(name, user)                                                                                          \
+    extern "C" void Exception_##name(InterruptContext* context)                                                                    \
+    {                                                                                                                              \
+        if (HandleAbort(user))                                                                                                     \
+            return;                                                                                                                \
+                                                                                                                                   \
+        LogException(#name, context);                                                                                              \
+        MTL_LOG(Fatal) << "Unhandled CPU exception: " << #name;                                                                    \
+        std::abort();                                                                                                              \
+    }
+
 // Current EL with SP0
 UNHANDLED_EXCEPTION(EL1t_SP0_Synchronous)
 UNHANDLED_EXCEPTION(EL1t_SP0_IRQ)
@@ -70,13 +118,13 @@ UNHANDLED_EXCEPTION(EL1t_SP0_FIQ)
 UNHANDLED_EXCEPTION(EL1t_SP0_SystemError)
 
 // Current EL with SPx
-UNHANDLED_EXCEPTION(EL1h_SPx_Synchronous)
+SYNCHRONOUS_EXCEPTION(EL1h_SPx_Synchronous, false)
 // UNHANDLED_EXCEPTION(EL1h_SPx_IRQ)
 UNHANDLED_EXCEPTION(EL1h_SPx_FIQ)
 UNHANDLED_EXCEPTION(EL1h_SPx_SystemError)
 
 // Lower EL using aarch64
-UNHANDLED_EXCEPTION(EL0_64_Synchronous)
+SYNCHRONOUS_EXCEPTION(EL0_64_Synchronous, true)
 UNHANDLED_EXCEPTION(EL0_64_IRQ)
 UNHANDLED_EXCEPTION(EL0_64_FIQ)
 UNHANDLED_EXCEPTION(EL0_64_SystemError)
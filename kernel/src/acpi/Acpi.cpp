@@ -28,6 +28,7 @@
 #include "AcpiImpl.hpp"
 #include "Interrupt.hpp"
 #include "lai.hpp"
+#include "timing.hpp"
 #include <lai/helpers/pm.h>
 #include <lai/helpers/sci.h>
 #include <metal/arch.hpp>
@@ -119,6 +120,8 @@ static bool AcpiHandleInterrupt(InterruptContext*)
 
 mtl::expected<void, ErrorCode> AcpiInitialize(const AcpiRsdp& rsdp)
 {
+    ScopedBootPhase phase("AcpiInitialize");
+
     if (g_initialized)
     {
         MTL_LOG(Error) << "[ACPI] ACPI is already initialized";
@@ -154,7 +157,11 @@ mtl::expected<void, ErrorCode> AcpiInitialize(const AcpiRsdp& rsdp)
     }
 
     lai_set_acpi_revision(rsdp.revision);
-    lai_create_namespace();
+
+    {
+        ScopedBootPhase phase("lai_create_namespace");
+        lai_create_namespace();
+    }
 
     g_initialized = true;
     return {};
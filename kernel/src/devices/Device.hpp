@@ -28,13 +28,23 @@
 
 #include <metal/log.hpp>
 
+struct IBlockDevice;
+struct INetworkDevice;
+
+namespace mtl
+{
+    class IDisplay;
+}
+
 class Device
 {
 public:
     enum Class
     {
         Unknown = 0,
-        Display
+        Display,
+        Storage,
+        Network,
     };
 
     Device(Class cls) : m_class(cls) {}
@@ -42,6 +52,15 @@ public:
     virtual const char* GetDescription() const { return "Unknown device"; }
     virtual void Write(mtl::LogStream& stream) const = 0;
 
+    // Returns the display interface of display devices, nullptr if the device can't be used as a display
+    virtual mtl::IDisplay* GetDisplay() { return nullptr; }
+
+    // Returns the block interface of storage devices, nullptr if the device can't be used for block I/O
+    virtual IBlockDevice* GetBlockDevice() { return nullptr; }
+
+    // Returns the packet interface of network devices, nullptr if the device can't send or receive packets
+    virtual INetworkDevice* GetNetworkDevice() { return nullptr; }
+
     Class GetClass() const { return m_class; }
 
 private:
@@ -36,9 +36,9 @@ void DeviceManager::AddDevice(mtl::shared_ptr<Device> device)
     m_devices.emplace_back(std::move(device));
 }
 
-mtl::vector<mtl::shared_ptr<Device>> DeviceManager::GetDisplays() const
+DeviceManager::DisplayList DeviceManager::GetDisplays() const
 {
-    mtl::vector<mtl::shared_ptr<Device>> displays;
+    DisplayList displays;
     std::copy_if(m_devices.begin(), m_devices.end(), std::back_inserter(displays),
                  [](const mtl::shared_ptr<Device>& device) { return device->GetClass() == Device::Class::Display; });
     return displays;
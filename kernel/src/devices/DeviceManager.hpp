@@ -32,9 +32,12 @@
 class DeviceManager
 {
 public:
+    // Systems rarely have more than a few displays
+    using DisplayList = mtl::small_vector<mtl::shared_ptr<Device>, 4>;
+
     void AddDevice(mtl::shared_ptr<Device> device);
 
-    mtl::vector<mtl::shared_ptr<Device>> GetDisplays() const;
+    DisplayList GetDisplays() const;
 
 private:
     mtl::vector<mtl::shared_ptr<Device>> m_devices;
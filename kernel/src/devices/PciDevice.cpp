@@ -25,16 +25,49 @@
 */
 
 #include "PciDevice.hpp"
+#include "pci/Nvme.hpp"
 #include "pci/Vga.hpp"
+#include "pci/VirtioBlock.hpp"
 #include "pci/VirtioGpu.hpp"
+#include "pci/VirtioNet.hpp"
 
 mtl::shared_ptr<PciDevice> PciDevice::Create(volatile PciConfigSpace* configSpace)
 {
     // Check specific vendor / device id pairs
     if (configSpace->vendorId == 0x1af4 && configSpace->deviceId == 0x1050)
-        return mtl::make_shared<VirtioGpu>(configSpace);
+    {
+        auto gpu = mtl::make_shared<VirtioGpu>(configSpace);
+        if (auto result = gpu->Initialize(); !result)
+            MTL_LOG(Error) << "[PCI] Failed to initialize virtio GPU: " << result.error();
+        return gpu;
+    }
+
+    // Transitional (0x1001) devices also expose the modern interface
+    if (configSpace->vendorId == 0x1af4 && (configSpace->deviceId == 0x1001 || configSpace->deviceId == 0x1042))
+    {
+        auto block = mtl::make_shared<VirtioBlock>(configSpace);
+        if (auto result = block->Initialize(); !result)
+            MTL_LOG(Error) << "[PCI] Failed to initialize virtio block device: " << result.error();
+        return block;
+    }
+
+    if (configSpace->vendorId == 0x1af4 && (configSpace->deviceId == 0x1000 || configSpace->deviceId == 0x1041))
+    {
+        auto net = mtl::make_shared<VirtioNet>(configSpace);
+        if (auto result = net->Initialize(); !result)
+            MTL_LOG(Error) << "[PCI] Failed to initialize virtio network device: " << result.error();
+        return net;
+    }
 
     // Check class codes
+    if (configSpace->baseClass == 0x01 && configSpace->subClass == 0x08 && configSpace->progInterface == 0x02)
+    {
+        auto nvme = mtl::make_shared<Nvme>(configSpace);
+        if (auto result = nvme->Initialize(); !result)
+            MTL_LOG(Error) << "[PCI] Failed to initialize NVMe controller: " << result.error();
+        return nvme;
+    }
+
     // if (configSpace->baseClass == 0x03 && configSpace->subClass == 0x00 && configSpace->progInterface == 0x00)
     //     return mtl::make_shared<Vga>(configSpace);
 
@@ -46,3 +79,57 @@ void PciDevice::Write(mtl::LogStream& stream) const
     stream << "PCI Device " << mtl::hex(m_configSpace->vendorId) << ':' << mtl::hex(m_configSpace->deviceId) << " ("
            << GetDescription() << ')';
 }
+
+void PciDevice::EnableBusMastering()
+{
+    m_configSpace->command = m_configSpace->command | PciCommand_MemorySpace | PciCommand_BusMaster;
+}
+
+PhysicalAddress PciDevice::GetBarAddress(int index) const
+{
+    if (index < 0 || index > 5 || (m_configSpace->headerType & 0x7F) != 0) [[unlikely]]
+        return 0;
+
+    const auto config = static_cast<volatile PciConfigSpaceType0*>(m_configSpace);
+    const uint32_t bar = config->bar[index];
+
+    // I/O space BAR
+    if (bar & 1)
+        return 0;
+
+    PhysicalAddress address = bar & ~0xFull;
+
+    // 64 bits BAR
+    if (((bar >> 1) & 3) == 2)
+    {
+        if (index == 5) [[unlikely]]
+            return 0;
+
+        address |= (PhysicalAddress)config->bar[index + 1] << 32;
+    }
+
+    return address;
+}
+
+int PciDevice::FindCapability(PciCapabilityId id, int offset) const
+{
+    if (!(m_configSpace->status & PciStatus_CapabilitiesList))
+        return 0;
+
+    if (offset == 0)
+        offset = static_cast<volatile PciConfigSpaceType0*>(m_configSpace)->capabilitiesPointer;
+    else
+        offset = *GetConfigSpace<uint8_t>(offset + 1);
+
+    // Bound the walk in case the list is corrupted
+    for (int i = 0; i != 48 && offset >= 0x40; ++i)
+    {
+        offset &= ~3;
+        if (*GetConfigSpace<PciCapabilityId>(offset) == id)
+            return offset;
+
+        offset = *GetConfigSpace<uint8_t>(offset + 1);
+    }
+
+    return 0;
+}
@@ -27,7 +27,9 @@
 #pragma once
 
 #include "Device.hpp"
+#include "memory.hpp"
 #include "pci.hpp"
+#include <metal/helpers.hpp>
 
 class PciDevice : public Device
 {
@@ -38,6 +40,23 @@ public:
 
     void Write(mtl::LogStream& stream) const override;
 
-private:
+protected:
+    // Enable memory space decoding and bus mastering (DMA)
+    void EnableBusMastering();
+
+    // Returns the physical address of a memory BAR or 0 if the BAR isn't a memory BAR
+    PhysicalAddress GetBarAddress(int index) const;
+
+    // Find a capability starting after 'offset' (0 to start from the beginning of the list)
+    // Returns the capability's offset in the configuration space or 0 if it wasn't found.
+    int FindCapability(PciCapabilityId id, int offset = 0) const;
+
+    // Access the configuration space at the specified byte offset
+    template <typename T>
+    volatile T* GetConfigSpace(int offset) const
+    {
+        return reinterpret_cast<volatile T*>(mtl::AdvancePointer(m_configSpace, offset));
+    }
+
     volatile PciConfigSpace* m_configSpace;
 };
@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "NvmeDataPointer.hpp"
+#include <metal/helpers.hpp>
+
+bool NvmeBuildPrp(const BlockRequest::Segment* segments, int segmentCount, uint64_t* prpList,
+                  mtl::PhysicalAddress prpListAddress, NvmeDataPointer& data)
+{
+    if (segmentCount <= 0)
+        return false;
+
+    // The first page is described by PRP1 and can start anywhere, all the following ones must be whole pages
+    int count = 0;
+
+    for (int i = 0; i != segmentCount; ++i)
+    {
+        const auto start = segments[i].address;
+        const auto end = start + segments[i].length;
+
+        if (segments[i].length == 0 || !mtl::IsAligned(start, 4))
+            return false;
+
+        if (i > 0 && !mtl::IsAligned(start, kNvmePageSize))
+            return false;
+
+        if (i < segmentCount - 1 && !mtl::IsAligned(end, kNvmePageSize))
+            return false;
+
+        for (auto page = mtl::AlignDown(start, kNvmePageSize); page < end; page += kNvmePageSize)
+        {
+            if (i == 0 && page <= start)
+                continue;
+
+            if (count == kNvmeMaxPrpEntries)
+                return false;
+
+            prpList[count++] = page;
+        }
+    }
+
+    data.prp1 = segments[0].address;
+
+    // PRP2 is either the second page or a pointer to the list (section 4.3)
+    if (count == 0)
+        data.prp2 = 0;
+    else if (count == 1)
+        data.prp2 = prpList[0];
+    else
+        data.prp2 = prpListAddress;
+
+    return true;
+}
+
+bool NvmeBuildSgl(const BlockRequest::Segment* segments, int segmentCount, NvmeSglDescriptor* sglList,
+                  mtl::PhysicalAddress sglListAddress, NvmeDataPointer& data)
+{
+    if (segmentCount <= 0 || segmentCount > kNvmeMaxSglDescriptors)
+        return false;
+
+    for (int i = 0; i != segmentCount; ++i)
+    {
+        if (segments[i].length == 0 || !mtl::IsAligned(segments[i].address, 4))
+            return false;
+    }
+
+    // A single segment fits in the command
+    if (segmentCount == 1)
+    {
+        data.sgl = {segments[0].address, segments[0].length, {}, NvmeSgl_DataBlock};
+        return true;
+    }
+
+    for (int i = 0; i != segmentCount; ++i)
+        sglList[i] = {segments[i].address, segments[i].length, {}, NvmeSgl_DataBlock};
+
+    data.sgl = {sglListAddress, static_cast<uint32_t>(segmentCount * sizeof(NvmeSglDescriptor)), {}, NvmeSgl_LastSegment};
+
+    return true;
+}
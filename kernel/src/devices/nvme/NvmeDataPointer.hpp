@@ -0,0 +1,54 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "devices/nvme/nvme.hpp"
+#include "interfaces/IBlockDevice.hpp"
+
+/*
+    Data pointers are built straight from the caller's segments: the data itself is never copied. Each command owns
+    one memory page that is used for the PRP list or the SGL segment when the data pointer doesn't fit in the command.
+*/
+
+// Memory page size used with the controller
+static constexpr int kNvmePageShift = 12;
+static constexpr int kNvmePageSize = 1 << kNvmePageShift;
+
+// Number of entries that fit in a command's list page
+static constexpr int kNvmeMaxPrpEntries = kNvmePageSize / sizeof(uint64_t);
+static constexpr int kNvmeMaxSglDescriptors = kNvmePageSize / sizeof(NvmeSglDescriptor);
+
+// Describe 'segments' using PRP entries. 'prpList' / 'prpListAddress' point to the command's list page.
+// Returns false if the segments can't be described with PRPs: only the start of the first segment and the end of the
+// last one can be unaligned, and addresses must be dword aligned.
+bool NvmeBuildPrp(const BlockRequest::Segment* segments, int segmentCount, uint64_t* prpList,
+                  mtl::PhysicalAddress prpListAddress, NvmeDataPointer& data);
+
+// Describe 'segments' using an SGL. 'sglList' / 'sglListAddress' point to the command's list page.
+// Returns false if there are too many segments or if an address isn't dword aligned.
+bool NvmeBuildSgl(const BlockRequest::Segment* segments, int segmentCount, NvmeSglDescriptor* sglList,
+                  mtl::PhysicalAddress sglListAddress, NvmeDataPointer& data);
@@ -0,0 +1,201 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// NVM Express base specification 1.4
+
+// Controller registers (section 3.1)
+struct NvmeRegisters
+{
+    uint64_t capabilities;         // CAP
+    uint32_t version;              // VS
+    uint32_t interruptMaskSet;     // INTMS
+    uint32_t interruptMaskClear;   // INTMC
+    uint32_t configuration;        // CC
+    uint32_t reserved;
+    uint32_t status;               // CSTS
+    uint32_t subsystemReset;       // NSSR
+    uint32_t adminQueueAttributes; // AQA
+    uint64_t adminSubmissionQueue; // ASQ
+    uint64_t adminCompletionQueue; // ACQ
+} __attribute__((packed));
+
+static_assert(sizeof(NvmeRegisters) == 0x38);
+
+// Doorbells start at this offset in BAR0 (section 3.1.24)
+static constexpr int kNvmeDoorbellOffset = 0x1000;
+
+// Fields of NvmeRegisters::capabilities
+static inline int NvmeCapMaxQueueEntries(uint64_t cap) { return (cap & 0xFFFF) + 1; }
+static inline int NvmeCapTimeout(uint64_t cap) { return (cap >> 24) & 0xFF; } // In 500 ms units
+static inline int NvmeCapDoorbellStride(uint64_t cap) { return 4 << ((cap >> 32) & 0xF); }
+static inline bool NvmeCapNvmCommandSet(uint64_t cap) { return (cap >> 37) & 1; }
+static inline int NvmeCapMinPageShift(uint64_t cap) { return 12 + ((cap >> 48) & 0xF); }
+static inline int NvmeCapMaxPageShift(uint64_t cap) { return 12 + ((cap >> 52) & 0xF); }
+
+enum NvmeConfiguration : uint32_t
+{
+    NvmeConfiguration_Enable = 1 << 0,
+    NvmeConfiguration_NvmCommandSet = 0 << 4,
+    NvmeConfiguration_PageSize4K = 0 << 7,
+    NvmeConfiguration_SubmissionEntrySize = 6 << 16, // 2^6 = 64 bytes
+    NvmeConfiguration_CompletionEntrySize = 4 << 20, // 2^4 = 16 bytes
+};
+
+enum NvmeStatus : uint32_t
+{
+    NvmeStatus_Ready = 1 << 0,
+    NvmeStatus_FatalError = 1 << 1,
+};
+
+enum NvmeAdminOpcode : uint8_t
+{
+    NvmeAdmin_DeleteSubmissionQueue = 0x00,
+    NvmeAdmin_CreateSubmissionQueue = 0x01,
+    NvmeAdmin_DeleteCompletionQueue = 0x04,
+    NvmeAdmin_CreateCompletionQueue = 0x05,
+    NvmeAdmin_Identify = 0x06,
+    NvmeAdmin_SetFeatures = 0x09,
+};
+
+enum NvmeIoOpcode : uint8_t
+{
+    NvmeIo_Flush = 0x00,
+    NvmeIo_Write = 0x01,
+    NvmeIo_Read = 0x02,
+};
+
+enum NvmeIdentify : uint32_t
+{
+    NvmeIdentify_Namespace = 0,
+    NvmeIdentify_Controller = 1,
+    NvmeIdentify_ActiveNamespaces = 2,
+};
+
+enum NvmeFeature : uint32_t
+{
+    NvmeFeature_QueueCount = 0x07,
+};
+
+// Flags in 'dword11' of queue creation commands
+enum NvmeQueueFlags : uint32_t
+{
+    NvmeQueue_PhysicallyContiguous = 1 << 0,
+    NvmeQueue_InterruptsEnabled = 1 << 1, // Completion queues only
+};
+
+// Scatter gather list descriptor (section 4.4)
+struct NvmeSglDescriptor
+{
+    uint64_t address;
+    uint32_t length;
+    uint8_t reserved[3];
+    uint8_t type; // Descriptor type in the upper 4 bits
+};
+
+static_assert(sizeof(NvmeSglDescriptor) == 16);
+
+enum NvmeSglType : uint8_t
+{
+    NvmeSgl_DataBlock = 0x00,
+    NvmeSgl_LastSegment = 0x30,
+};
+
+// Data pointer of a command, either two PRP entries or an SGL descriptor
+union NvmeDataPointer
+{
+    struct
+    {
+        uint64_t prp1;
+        uint64_t prp2;
+    };
+    NvmeSglDescriptor sgl;
+};
+
+static_assert(sizeof(NvmeDataPointer) == 16);
+
+// Submission queue entry (section 4.2)
+struct NvmeCommand
+{
+    uint8_t opcode;
+    uint8_t flags; // Fused operation and PRP/SGL selection
+    uint16_t commandId;
+    uint32_t namespaceId;
+    uint32_t reserved[2];
+    uint64_t metadata;
+    NvmeDataPointer data;
+    uint32_t dword10;
+    uint32_t dword11;
+    uint32_t dword12;
+    uint32_t dword13;
+    uint32_t dword14;
+    uint32_t dword15;
+};
+
+static_assert(sizeof(NvmeCommand) == 64);
+
+enum NvmeCommandFlags : uint8_t
+{
+    NvmeCommand_Prp = 0 << 6,
+    NvmeCommand_Sgl = 1 << 6,
+};
+
+// Completion queue entry (section 4.6)
+struct NvmeCompletion
+{
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t submissionQueueHead;
+    uint16_t submissionQueueId;
+    uint16_t commandId;
+    uint16_t status; // Phase tag in bit 0, status field in bits 1-15
+};
+
+static_assert(sizeof(NvmeCompletion) == 16);
+
+// Offsets of the Identify Controller fields we need (figure 247)
+static constexpr int kNvmeIdentifyMaxTransferSize = 77; // uint8_t, in units of the minimum page size, as a power of 2
+static constexpr int kNvmeIdentifyNamespaceCount = 516; // uint32_t
+static constexpr int kNvmeIdentifyWriteCache = 525;     // uint8_t
+static constexpr int kNvmeIdentifySglSupport = 536;     // uint32_t
+
+// Identify Namespace data structure (figure 245), up to the LBA formats
+struct NvmeNamespace
+{
+    uint64_t size;            // NSZE, in logical blocks
+    uint64_t capacity;        // NCAP
+    uint64_t used;            // NUSE
+    uint8_t features;         // NSFEAT
+    uint8_t formatCount;
+    uint8_t formattedLbaSize; // FLBAS, index of the LBA format in use in the low 4 bits
+    uint8_t reserved[101];
+    uint32_t lbaFormats[16];  // LBA data size as a power of 2 in bits 16-23
+};
+
+static_assert(sizeof(NvmeNamespace) == 192);
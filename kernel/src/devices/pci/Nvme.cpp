@@ -0,0 +1,632 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "Nvme.hpp"
+#include "Cpu.hpp"
+#include "Interrupt.hpp"
+#include "arch.hpp"
+#include "devices/nvme/NvmeDataPointer.hpp"
+#include <algorithm>
+#include <metal/log.hpp>
+
+// Queue depth of I/O queues. Each command needs a page for its PRP list / SGL.
+static constexpr int kMaxQueueSize = 64;
+// Admin commands are executed one at a time, the list page of the only command doubles as their data buffer
+static constexpr int kAdminQueueSize = 2;
+
+// Drivers don't have access to a clock yet, timeouts are approximated with a number of polls
+static constexpr int kPollsPerTimeoutUnit = 5'000'000;
+
+// Bounds for the hybrid polling spin budget
+static constexpr int kMinPollSpins = 64;
+static constexpr int kMaxPollSpins = 64 * 1024;
+
+static constexpr uint32_t kSectorShift = 9;
+
+// Status field of a completion (section 4.6.1)
+static ErrorCode GetErrorCode(uint16_t status)
+{
+    const auto code = (status >> 1) & 0xFF;
+    const auto type = (status >> 9) & 0x7;
+
+    if (code == 0 && type == 0)
+        return ErrorCode::NoError;
+
+    if (type == 0 && code == 0x01) // Invalid Command Opcode
+        return ErrorCode::Unsupported;
+
+    if (type == 0 && (code == 0x02 || code == 0x80)) // Invalid Field in Command, LBA Out of Range
+        return ErrorCode::InvalidArguments;
+
+    return ErrorCode::Unexpected;
+}
+
+Nvme::Nvme(volatile PciConfigSpace* configSpace) : PciDevice(Class::Storage, configSpace)
+{
+}
+
+mtl::expected<void, ErrorCode> Nvme::Initialize()
+{
+    const auto bar = GetBarAddress(0);
+    if (!bar)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    // The registers fit in the first page, the doorbells follow
+    static_assert(kNvmeDoorbellOffset == mtl::kMemoryPageSize);
+
+    auto registers = ArchMapSystemMemory(bar, 1, mtl::PageFlags::MMIO);
+    if (!registers)
+        return mtl::unexpected(registers.error());
+
+    m_registers = static_cast<volatile NvmeRegisters*>(*registers);
+
+    const uint64_t capabilities = m_registers->capabilities;
+    if (!NvmeCapNvmCommandSet(capabilities) || NvmeCapMinPageShift(capabilities) > kNvmePageShift ||
+        NvmeCapMaxPageShift(capabilities) < kNvmePageShift)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    m_doorbellStride = NvmeCapDoorbellStride(capabilities);
+    m_timeout = std::max(NvmeCapTimeout(capabilities), 1);
+
+    // One I/O queue pair per CPU
+    const int cpuCount = CpuGetCount();
+
+    // Map the doorbells of the admin queue and of all the I/O queues we could use
+    const auto doorbellsSize = 2 * (cpuCount + 1) * m_doorbellStride;
+    auto doorbells = ArchMapSystemMemory(bar + kNvmeDoorbellOffset,
+                                         mtl::AlignUp(doorbellsSize, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift,
+                                         mtl::PageFlags::MMIO);
+    if (!doorbells)
+        return mtl::unexpected(doorbells.error());
+
+    m_doorbells = static_cast<volatile uint8_t*>(*doorbells);
+
+    EnableBusMastering();
+
+    if (auto result = Disable(); !result)
+        return result;
+
+    // Admin queues
+    if (auto result = InitializeQueue(m_adminQueue, 0, kAdminQueueSize); !result)
+        return result;
+
+    m_registers->adminQueueAttributes = ((kAdminQueueSize - 1) << 16) | (kAdminQueueSize - 1);
+    m_registers->adminSubmissionQueue = m_adminQueue.submissionsAddress;
+    m_registers->adminCompletionQueue = m_adminQueue.completionsAddress;
+
+    // Interrupts are masked until the I/O queues are ready
+    m_registers->interruptMaskSet = 1;
+
+    if (auto result = Enable(); !result)
+        return result;
+
+    if (auto result = Identify(); !result)
+        return result;
+
+    // Ask for one queue pair per CPU, the controller might allocate less. Counts are 0 based (section 5.21.1.7).
+    NvmeCommand setQueueCount{};
+    setQueueCount.opcode = NvmeAdmin_SetFeatures;
+    setQueueCount.dword10 = NvmeFeature_QueueCount;
+    setQueueCount.dword11 = ((cpuCount - 1) << 16) | (cpuCount - 1);
+    const auto allocated = ExecuteAdmin(setQueueCount);
+    if (!allocated)
+        return mtl::unexpected(allocated.error());
+
+    const int queueCount = std::min(cpuCount, std::min(int(*allocated & 0xFFFF), int(*allocated >> 16)) + 1);
+    const int queueSize = std::min(kMaxQueueSize, NvmeCapMaxQueueEntries(capabilities));
+
+    // Only the legacy INTx interrupt is supported, it is shared by all completion queues
+    const auto interruptLine = static_cast<volatile PciConfigSpaceType0*>(m_configSpace)->interruptLine;
+    bool interrupts = interruptLine != 0xFF;
+
+    for (int i = 1; i <= queueCount; ++i)
+    {
+        auto queue = mtl::unique_ptr<Queue>(new Queue{});
+        if (!queue)
+            return mtl::unexpected(ErrorCode::OutOfMemory);
+
+        if (auto result = CreateIoQueue(*queue, i, queueSize, interrupts); !result)
+            return result;
+
+        m_ioQueues.emplace_back(std::move(queue));
+    }
+
+    m_ready = true;
+
+    if (interrupts)
+    {
+        m_configSpace->command = m_configSpace->command & ~PciCommand_InterruptDisable;
+        if (auto result = InterruptRegisterHandler(interruptLine, this); result)
+            m_registers->interruptMaskClear = 1;
+        else
+            interrupts = false;
+    }
+
+    if (!interrupts)
+        MTL_LOG(Warning) << "[NVME] Interrupts not available, requests must be polled";
+
+    MTL_LOG(Info) << "[NVME] Namespace " << m_namespaceId << ": " << m_sectorCount << " sectors, "
+                  << (1 << m_lbaShift) << " bytes blocks, " << m_ioQueues.size() << " queue(s)";
+
+    return {};
+}
+
+mtl::expected<void, ErrorCode> Nvme::Disable()
+{
+    m_registers->configuration = m_registers->configuration & ~NvmeConfiguration_Enable;
+    return WaitReady(false);
+}
+
+mtl::expected<void, ErrorCode> Nvme::Enable()
+{
+    m_registers->configuration = NvmeConfiguration_Enable | NvmeConfiguration_NvmCommandSet |
+                                 NvmeConfiguration_PageSize4K | NvmeConfiguration_SubmissionEntrySize |
+                                 NvmeConfiguration_CompletionEntrySize;
+    return WaitReady(true);
+}
+
+mtl::expected<void, ErrorCode> Nvme::WaitReady(bool ready)
+{
+    for (int i = 0; i != m_timeout * kPollsPerTimeoutUnit; ++i)
+    {
+        const uint32_t status = m_registers->status;
+        if (status & NvmeStatus_FatalError)
+        {
+            MTL_LOG(Error) << "[NVME] Controller fatal error";
+            return mtl::unexpected(ErrorCode::Unexpected);
+        }
+
+        if (bool(status & NvmeStatus_Ready) == ready)
+            return {};
+
+        mtl::CpuPause();
+    }
+
+    MTL_LOG(Error) << "[NVME] Timed out waiting for the controller";
+    return mtl::unexpected(ErrorCode::Unexpected);
+}
+
+mtl::expected<void, ErrorCode> Nvme::InitializeQueue(Queue& queue, int id, int size)
+{
+    // One allocation holds the submission queue, the completion queue and the list pages
+    const auto queuesSize = mtl::AlignUp(size * (sizeof(NvmeCommand) + sizeof(NvmeCompletion)), mtl::kMemoryPageSize);
+    const int commandCount = size - 1; // A queue is full when the tail is right behind the head
+    const int pageCount = (queuesSize >> mtl::kMemoryPageShift) + commandCount;
+
+    auto memory = AllocDmaMemory(pageCount);
+    if (!memory)
+        return mtl::unexpected(memory.error());
+
+    queue.id = id;
+    queue.size = size;
+    queue.submissions = static_cast<NvmeCommand*>(memory->address);
+    queue.completions = reinterpret_cast<volatile NvmeCompletion*>(queue.submissions + size);
+    queue.submissionsAddress = memory->physicalAddress;
+    queue.completionsAddress = memory->physicalAddress + size * sizeof(NvmeCommand);
+    queue.submissionDoorbell = reinterpret_cast<volatile uint32_t*>(m_doorbells + (2 * id) * m_doorbellStride);
+    queue.completionDoorbell = reinterpret_cast<volatile uint32_t*>(m_doorbells + (2 * id + 1) * m_doorbellStride);
+    queue.submissionTail = 0;
+    queue.doorbellTail = 0;
+    queue.completionHead = 0;
+    queue.phase = 1;
+    queue.pollSpins = kMinPollSpins;
+
+    queue.commands.resize(commandCount);
+    queue.freeIds.reserve(commandCount);
+    for (int i = 0; i != commandCount; ++i)
+    {
+        const auto offset = queuesSize + i * mtl::kMemoryPageSize;
+        queue.commands[i] = {nullptr, mtl::AdvancePointer(memory->address, offset), memory->physicalAddress + offset};
+        queue.freeIds.push_back(commandCount - 1 - i);
+    }
+
+    return {};
+}
+
+mtl::expected<void, ErrorCode> Nvme::CreateIoQueue(Queue& queue, int id, int size, bool interrupts)
+{
+    if (auto result = InitializeQueue(queue, id, size); !result)
+        return result;
+
+    // The completion queue must exist before the submission queue is attached to it (section 7.6.1)
+    NvmeCommand createCompletionQueue{};
+    createCompletionQueue.opcode = NvmeAdmin_CreateCompletionQueue;
+    createCompletionQueue.data.prp1 = queue.completionsAddress;
+    createCompletionQueue.dword10 = ((size - 1) << 16) | id;
+    createCompletionQueue.dword11 = NvmeQueue_PhysicallyContiguous;
+    if (interrupts)
+        createCompletionQueue.dword11 |= NvmeQueue_InterruptsEnabled;
+    if (auto result = ExecuteAdmin(createCompletionQueue); !result)
+        return mtl::unexpected(result.error());
+
+    NvmeCommand createSubmissionQueue{};
+    createSubmissionQueue.opcode = NvmeAdmin_CreateSubmissionQueue;
+    createSubmissionQueue.data.prp1 = queue.submissionsAddress;
+    createSubmissionQueue.dword10 = ((size - 1) << 16) | id;
+    createSubmissionQueue.dword11 = (id << 16) | NvmeQueue_PhysicallyContiguous;
+    if (auto result = ExecuteAdmin(createSubmissionQueue); !result)
+        return mtl::unexpected(result.error());
+
+    return {};
+}
+
+mtl::expected<uint32_t, ErrorCode> Nvme::ExecuteAdmin(NvmeCommand& command)
+{
+    auto& queue = m_adminQueue;
+    queue.lock.Lock();
+
+    command.commandId = 0;
+    PushCommand(queue, command);
+    RingDoorbell(queue);
+
+    NvmeCompletion completion;
+    bool completed = false;
+    for (int i = 0; i != m_timeout * kPollsPerTimeoutUnit && !completed; ++i)
+    {
+        completed = PopCompletion(queue, completion);
+        if (!completed)
+            mtl::CpuPause();
+    }
+
+    if (completed)
+        *queue.completionDoorbell = queue.completionHead;
+
+    queue.lock.Unlock();
+
+    if (!completed)
+    {
+        MTL_LOG(Error) << "[NVME] Admin command " << mtl::hex(command.opcode) << " timed out";
+        return mtl::unexpected(ErrorCode::Unexpected);
+    }
+
+    if (const auto error = GetErrorCode(completion.status); error != ErrorCode::NoError)
+    {
+        MTL_LOG(Error) << "[NVME] Admin command " << mtl::hex(command.opcode) << " failed with status "
+                       << mtl::hex(completion.status);
+        return mtl::unexpected(error);
+    }
+
+    return completion.result;
+}
+
+mtl::expected<void, ErrorCode> Nvme::Identify()
+{
+    const auto& buffer = m_adminQueue.commands[0];
+    const auto data = static_cast<const uint8_t*>(buffer.list);
+
+    NvmeCommand identify{};
+    identify.opcode = NvmeAdmin_Identify;
+    identify.data.prp1 = buffer.listAddress;
+    identify.dword10 = NvmeIdentify_Controller;
+    if (auto result = ExecuteAdmin(identify); !result)
+        return mtl::unexpected(result.error());
+
+    // Transfers are limited by the size of a command's PRP list and by the controller
+    m_maxTransferSize = kNvmeMaxPrpEntries * kNvmePageSize;
+    if (const int maxTransferShift = data[kNvmeIdentifyMaxTransferSize])
+    {
+        const auto shift = maxTransferShift + NvmeCapMinPageShift(m_registers->capabilities);
+        if (shift < 32)
+            m_maxTransferSize = std::min(m_maxTransferSize, 1u << shift);
+    }
+
+    m_sglSupported = *reinterpret_cast<const uint32_t*>(data + kNvmeIdentifySglSupport) & 3;
+
+    // Use the first active namespace
+    identify.dword10 = NvmeIdentify_ActiveNamespaces;
+    if (auto result = ExecuteAdmin(identify); !result)
+        return mtl::unexpected(result.error());
+
+    m_namespaceId = *reinterpret_cast<const uint32_t*>(data);
+    if (!m_namespaceId)
+    {
+        MTL_LOG(Warning) << "[NVME] No active namespace";
+        return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    identify.namespaceId = m_namespaceId;
+    identify.dword10 = NvmeIdentify_Namespace;
+    if (auto result = ExecuteAdmin(identify); !result)
+        return mtl::unexpected(result.error());
+
+    const auto ns = reinterpret_cast<const NvmeNamespace*>(data);
+    m_lbaShift = (ns->lbaFormats[ns->formattedLbaSize & 0xF] >> 16) & 0xFF;
+    if (m_lbaShift < int(kSectorShift) || m_lbaShift > kNvmePageShift)
+    {
+        MTL_LOG(Warning) << "[NVME] Unsupported logical block size: 2^" << m_lbaShift;
+        return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    m_sectorCount = ns->size << (m_lbaShift - kSectorShift);
+
+    return {};
+}
+
+Nvme::Queue& Nvme::GetCurrentQueue()
+{
+    return *m_ioQueues[CpuGetIndex() % m_ioQueues.size()];
+}
+
+mtl::expected<void, ErrorCode> Nvme::Submit(BlockRequest* request)
+{
+    if (!request || !request->callback) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    NvmeCommand command{};
+    command.namespaceId = m_namespaceId;
+
+    if (request->operation == BlockRequest::Operation::Flush)
+    {
+        command.opcode = NvmeIo_Flush;
+    }
+    else
+    {
+        if (request->segmentCount <= 0 || !request->segments) [[unlikely]]
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        uint64_t length = 0;
+        for (int i = 0; i != request->segmentCount; ++i)
+            length += request->segments[i].length;
+
+        // Requests must cover whole logical blocks
+        const uint64_t blockMask = (1u << (m_lbaShift - kSectorShift)) - 1;
+        if (length == 0 || length > m_maxTransferSize || !mtl::IsAligned(length, 1u << m_lbaShift) ||
+            (request->sector & blockMask)) [[unlikely]]
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        if (request->sector > m_sectorCount || (length >> kSectorShift) > m_sectorCount - request->sector) [[unlikely]]
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        const uint64_t lba = request->sector >> (m_lbaShift - kSectorShift);
+        command.opcode = request->operation == BlockRequest::Operation::Write ? NvmeIo_Write : NvmeIo_Read;
+        command.dword10 = lba;
+        command.dword11 = lba >> 32;
+        command.dword12 = (length >> m_lbaShift) - 1;
+    }
+
+    request->next = nullptr;
+
+    auto& queue = GetCurrentQueue();
+    queue.lock.Lock();
+
+    const int id = AllocateCommand(queue);
+    auto& slot = queue.commands[id];
+
+    // Prefer PRPs, they are mandatory and controllers are optimized for them
+    if (request->operation != BlockRequest::Operation::Flush)
+    {
+        if (NvmeBuildPrp(request->segments, request->segmentCount, static_cast<uint64_t*>(slot.list), slot.listAddress,
+                         command.data))
+        {
+            command.flags = NvmeCommand_Prp;
+        }
+        else if (m_sglSupported && NvmeBuildSgl(request->segments, request->segmentCount,
+                                                static_cast<NvmeSglDescriptor*>(slot.list), slot.listAddress,
+                                                command.data))
+        {
+            command.flags = NvmeCommand_Sgl;
+        }
+        else
+        {
+            queue.freeIds.push_back(id);
+            queue.lock.Unlock();
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+        }
+    }
+
+    slot.request = request;
+    command.commandId = id;
+    PushCommand(queue, command);
+
+    queue.lock.Unlock();
+
+    return {};
+}
+
+int Nvme::AllocateCommand(Queue& queue)
+{
+    // All commands are in flight, wait for the controller to complete some
+    while (queue.freeIds.empty())
+    {
+        RingDoorbell(queue);
+        queue.lock.Unlock();
+        mtl::CpuPause();
+        ProcessCompletions(queue);
+        queue.lock.Lock();
+    }
+
+    const int id = queue.freeIds.back();
+    queue.freeIds.pop_back();
+    return id;
+}
+
+void Nvme::PushCommand(Queue& queue, const NvmeCommand& command)
+{
+    queue.submissions[queue.submissionTail] = command;
+    if (++queue.submissionTail == queue.size)
+        queue.submissionTail = 0;
+}
+
+void Nvme::RingDoorbell(Queue& queue)
+{
+    if (queue.submissionTail == queue.doorbellTail)
+        return;
+
+    // Make sure the controller sees the commands before the new tail
+    mtl::atomic_thread_fence(mtl::memory_order_release);
+
+    *queue.submissionDoorbell = queue.submissionTail;
+    queue.doorbellTail = queue.submissionTail;
+}
+
+bool Nvme::PopCompletion(Queue& queue, NvmeCompletion& completion)
+{
+    const auto& entry = queue.completions[queue.completionHead];
+
+    // The controller inverts the phase tag each time it wraps around the queue
+    const uint16_t status = entry.status;
+    if ((status & 1) != queue.phase)
+        return false;
+
+    // Read the rest of the entry after the phase tag
+    mtl::atomic_thread_fence(mtl::memory_order_acquire);
+
+    completion.result = entry.result;
+    completion.submissionQueueHead = entry.submissionQueueHead;
+    completion.submissionQueueId = entry.submissionQueueId;
+    completion.commandId = entry.commandId;
+    completion.status = status;
+
+    if (++queue.completionHead == queue.size)
+    {
+        queue.completionHead = 0;
+        queue.phase ^= 1;
+    }
+
+    return true;
+}
+
+int Nvme::ProcessCompletions(Queue& queue, bool* idle)
+{
+    // Callbacks are invoked without holding the lock so that they can submit new requests
+    BlockRequest* first = nullptr;
+    BlockRequest* last = nullptr;
+    int count = 0;
+
+    queue.lock.Lock();
+
+    NvmeCompletion completion;
+    while (PopCompletion(queue, completion))
+    {
+        const int id = completion.commandId;
+        if (id >= (int)queue.commands.size() || !queue.commands[id].request) [[unlikely]]
+        {
+            MTL_LOG(Error) << "[NVME] Completion for unknown command " << id << " on queue " << queue.id;
+            continue;
+        }
+
+        auto request = queue.commands[id].request;
+        queue.commands[id].request = nullptr;
+        queue.freeIds.push_back(id);
+
+        request->status = GetErrorCode(completion.status);
+        if (last)
+            last->next = request;
+        else
+            first = request;
+        last = request;
+
+        ++count;
+    }
+
+    // Release the completion queue entries, once per batch
+    if (count)
+        *queue.completionDoorbell = queue.completionHead;
+
+    if (idle)
+        *idle = queue.freeIds.size() == queue.commands.size();
+
+    queue.lock.Unlock();
+
+    while (first)
+    {
+        auto request = first;
+        first = request->next;
+        request->callback(request);
+    }
+
+    return count;
+}
+
+void Nvme::HybridPoll(Queue& queue)
+{
+    // The queue state, including the spin statistics, is only looked at with the lock held
+    queue.lock.Lock();
+    const bool idle = queue.freeIds.size() == queue.commands.size();
+    const int pollSpins = queue.pollSpins;
+    queue.lock.Unlock();
+
+    if (idle)
+        return;
+
+    // Spin for up to twice the usual completion time
+    const int budget = std::min(2 * pollSpins, kMaxPollSpins);
+
+    int spins = 1;
+    for (; spins <= budget; ++spins)
+    {
+        bool drained;
+        if (ProcessCompletions(queue, &drained))
+            break;
+
+        // Nothing left to wait for, this doesn't say anything about the device latency
+        if (drained)
+            return;
+
+        mtl::CpuPause();
+    }
+
+    queue.lock.Lock();
+    if (spins <= budget)
+        queue.pollSpins = std::max((queue.pollSpins * 7 + spins) / 8, kMinPollSpins);
+    else
+        queue.pollSpins = std::max(queue.pollSpins / 2, kMinPollSpins); // Leave it to the interrupt, spin less next time
+    queue.lock.Unlock();
+}
+
+void Nvme::Kick()
+{
+    for (auto& queue : m_ioQueues)
+    {
+        queue->lock.Lock();
+        RingDoorbell(*queue);
+        queue->lock.Unlock();
+
+        if (m_hybridPolling)
+            HybridPoll(*queue);
+    }
+}
+
+void Nvme::Poll()
+{
+    for (auto& queue : m_ioQueues)
+        ProcessCompletions(*queue);
+}
+
+bool Nvme::HandleInterrupt(InterruptContext* context)
+{
+    (void)context;
+
+    // The interrupt is shared by all completion queues
+    bool handled = false;
+    for (auto& queue : m_ioQueues)
+    {
+        if (ProcessCompletions(*queue))
+            handled = true;
+    }
+
+    return handled;
+}
@@ -0,0 +1,151 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "Spinlock.hpp"
+#include "devices/PciDevice.hpp"
+#include "devices/nvme/nvme.hpp"
+#include "interfaces/IBlockDevice.hpp"
+#include "interfaces/IInterruptHandler.hpp"
+#include <metal/unique_ptr.hpp>
+#include <metal/vector.hpp>
+
+/*
+    NVMe controller (NVM Express base specification 1.4).
+
+    Each CPU gets its own I/O submission / completion queue pair when the controller has enough of them. Submit() only
+    writes the command in the submission queue: the doorbell is rung once per batch by Kick(). The same goes for
+    completions, the completion queue head doorbell is written once per batch.
+
+    The kernel has no MSI-X support: all completion queues share the legacy interrupt line, or are polled when there is
+    none.
+
+    Only the first active namespace is exposed.
+*/
+
+class Nvme : public PciDevice, public IBlockDevice, public IInterruptHandler
+{
+public:
+    Nvme(volatile PciConfigSpace* configSpace);
+
+    const char* GetDescription() const override { return "NVMe controller"; }
+    IBlockDevice* GetBlockDevice() override { return m_ready ? this : nullptr; }
+
+    // Initialize the controller and create the I/O queues
+    mtl::expected<void, ErrorCode> Initialize();
+
+    // In hybrid polling mode, Kick() spins on the completion queue for a short time before relying on interrupts. The
+    // spin time adapts to the observed latency of the device. This trades CPU time for latency on fast devices.
+    void SetHybridPolling(bool enabled) { m_hybridPolling = enabled; }
+
+    // IBlockDevice
+    uint64_t GetSectorCount() const override { return m_sectorCount; }
+    mtl::expected<void, ErrorCode> Submit(BlockRequest* request) override;
+    void Kick() override;
+    void Poll() override;
+
+    // IInterruptHandler
+    bool HandleInterrupt(InterruptContext* context) override;
+
+private:
+    // In flight command, indexed by command id
+    struct Command
+    {
+        BlockRequest* request;
+        void* list; // PRP list or SGL segment
+        PhysicalAddress listAddress;
+    };
+
+    struct Queue
+    {
+        int id;
+        int size;
+        NvmeCommand* submissions;
+        volatile NvmeCompletion* completions;
+        PhysicalAddress submissionsAddress;
+        PhysicalAddress completionsAddress;
+        volatile uint32_t* submissionDoorbell;
+        volatile uint32_t* completionDoorbell;
+        int submissionTail;
+        int doorbellTail;   // Last tail written to the doorbell
+        int completionHead;
+        uint16_t phase;     // Expected phase tag of the next completion
+        mtl::vector<Command> commands;
+        mtl::vector<uint16_t> freeIds;
+        int pollSpins;      // Average number of polls before a completion shows up (hybrid polling)
+        Spinlock lock;
+    };
+
+    mtl::expected<void, ErrorCode> Disable();
+    mtl::expected<void, ErrorCode> Enable();
+    mtl::expected<void, ErrorCode> WaitReady(bool ready);
+
+    mtl::expected<void, ErrorCode> InitializeQueue(Queue& queue, int id, int size);
+    mtl::expected<void, ErrorCode> CreateIoQueue(Queue& queue, int id, int size, bool interrupts);
+
+    // Execute an admin command synchronously and return the command specific result
+    mtl::expected<uint32_t, ErrorCode> ExecuteAdmin(NvmeCommand& command);
+
+    // Identify the controller and the first active namespace
+    mtl::expected<void, ErrorCode> Identify();
+
+    // Queue to use for submissions from the current CPU
+    Queue& GetCurrentQueue();
+
+    // Get a free command id, queue lock must be held
+    int AllocateCommand(Queue& queue);
+
+    // Write a command in the submission queue, queue lock must be held
+    void PushCommand(Queue& queue, const NvmeCommand& command);
+
+    // Tell the controller about new submissions, queue lock must be held
+    void RingDoorbell(Queue& queue);
+
+    // Fetch the next completion if the controller posted one, queue lock must be held
+    bool PopCompletion(Queue& queue, NvmeCompletion& completion);
+
+    // Complete finished requests and invoke their callbacks. Returns the number of completed requests. If 'idle' is
+    // provided, it tells whether or not commands were left in flight.
+    int ProcessCompletions(Queue& queue, bool* idle = nullptr);
+
+    // Spin on the completion queue until the device catches up or the spin budget runs out
+    void HybridPoll(Queue& queue);
+
+    volatile NvmeRegisters* m_registers{};
+    volatile uint8_t* m_doorbells{};
+    int m_doorbellStride{};
+    int m_timeout{};              // In 500 ms units
+    Queue m_adminQueue{};
+    mtl::vector<mtl::unique_ptr<Queue>> m_ioQueues;
+    bool m_ready{};               // The I/O queues are ready
+    uint32_t m_namespaceId{};
+    int m_lbaShift{};             // Logical block size as a power of 2
+    uint64_t m_sectorCount{};
+    uint32_t m_maxTransferSize{}; // In bytes
+    bool m_sglSupported{};
+    bool m_hybridPolling{};
+};
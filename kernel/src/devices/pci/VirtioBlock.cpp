@@ -0,0 +1,392 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "VirtioBlock.hpp"
+#include "Cpu.hpp"
+#include <algorithm>
+#include <cassert>
+#include <metal/static_vector.hpp>
+
+// Virtio block protocol (virtio spec section 5.2)
+enum VirtioBlockFeature : uint64_t
+{
+    VirtioBlockFeature_SegmentMax = 1ull << 2,
+    VirtioBlockFeature_ReadOnly = 1ull << 5,
+    VirtioBlockFeature_Flush = 1ull << 9,
+    VirtioBlockFeature_MultiQueue = 1ull << 12,
+};
+
+enum VirtioBlockRequestType : uint32_t
+{
+    VirtioBlockRequest_In = 0,
+    VirtioBlockRequest_Out = 1,
+    VirtioBlockRequest_Flush = 4,
+};
+
+enum VirtioBlockStatus : uint8_t
+{
+    VirtioBlockStatus_Ok = 0,
+    VirtioBlockStatus_IoError = 1,
+    VirtioBlockStatus_Unsupported = 2,
+};
+
+struct VirtioBlockConfig
+{
+    uint64_t capacity; // In 512 bytes sectors
+    uint32_t sizeMax;
+    uint32_t segmentMax;
+    uint16_t cylinders;
+    uint8_t heads;
+    uint8_t sectors;
+    uint32_t blockSize;
+    uint8_t physicalBlockExponent;
+    uint8_t alignmentOffset;
+    uint16_t minIoSize;
+    uint32_t optimalIoSize;
+    uint8_t writeback;
+    uint8_t unused;
+    uint16_t queueCount;
+} __attribute__((packed));
+
+static_assert(sizeof(VirtioBlockConfig) == 36);
+
+struct VirtioBlockRequestHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+// A command sent to the device, made of one or more merged requests
+struct alignas(64) VirtioBlock::Command
+{
+    // Read by the device
+    VirtioBlockRequestHeader header;
+
+    // Written by the device
+    uint8_t status;
+
+    // Driver state
+    BlockRequest* first;
+    BlockRequest* last;
+    uint64_t nextSector; // Sector following the last merged request
+    int segmentCount;
+    Command* next;       // Free list
+};
+
+static constexpr int kMaxQueueSize = 256;
+
+// Bounds the size of the descriptor list built on the stack in Dispatch()
+static constexpr int kMaxSegments = 32;
+
+static constexpr uint32_t kSectorSize = 512;
+
+VirtioBlock::VirtioBlock(volatile PciConfigSpace* configSpace) : VirtioDevice(Class::Storage, configSpace)
+{
+}
+
+mtl::expected<void, ErrorCode> VirtioBlock::Initialize()
+{
+    const auto features = InitializeTransport(VirtioBlockFeature_SegmentMax | VirtioBlockFeature_ReadOnly |
+                                              VirtioBlockFeature_Flush | VirtioBlockFeature_MultiQueue);
+    if (!features)
+        return mtl::unexpected(features.error());
+
+    const auto config = GetDeviceConfig<VirtioBlockConfig>();
+    if (!config)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    m_sectorCount = config->capacity;
+    m_readOnly = *features & VirtioBlockFeature_ReadOnly;
+    m_canFlush = *features & VirtioBlockFeature_Flush;
+
+    // One queue per CPU, as long as the device has enough of them
+    const int deviceQueueCount = (*features & VirtioBlockFeature_MultiQueue) ? std::max<int>(config->queueCount, 1) : 1;
+    const int queueCount = std::min(deviceQueueCount, CpuGetCount());
+
+    for (int i = 0; i != queueCount; ++i)
+    {
+        auto virtqueue = CreateQueue(i, kMaxQueueSize);
+        if (!virtqueue)
+            return mtl::unexpected(virtqueue.error());
+
+        // One command per queue entry, the device can't have more in flight
+        const int commandCount = (*virtqueue)->GetSize();
+        const auto pageCount = mtl::AlignUp(commandCount * sizeof(Command), mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+        auto commandMemory = AllocDmaMemory(pageCount);
+        if (!commandMemory)
+            return mtl::unexpected(commandMemory.error());
+
+        auto queue = mtl::unique_ptr<Queue>(new Queue);
+        if (!queue)
+            return mtl::unexpected(ErrorCode::OutOfMemory);
+
+        queue->virtqueue = *virtqueue;
+        queue->commandMemory = *commandMemory;
+
+        const auto commands = static_cast<Command*>(commandMemory->address);
+        for (int j = 0; j != commandCount; ++j)
+        {
+            commands[j].next = queue->freeCommands;
+            queue->freeCommands = &commands[j];
+        }
+
+        m_queues.emplace_back(std::move(queue));
+    }
+
+    // Leave room for the header and status descriptors
+    m_maxSegments = std::min(kMaxSegments, m_queues[0]->virtqueue->GetSize() - 2);
+    if ((*features & VirtioBlockFeature_SegmentMax) && config->segmentMax > 0)
+        m_maxSegments = std::min<int>(m_maxSegments, config->segmentMax);
+
+    SetDriverOk();
+
+    if (auto result = EnableInterrupts(); !result)
+    {
+        MTL_LOG(Warning) << "[VIRTIO] Block device interrupts not available, requests must be polled";
+        for (auto& queue : m_queues)
+            queue->virtqueue->DisableInterrupts();
+    }
+
+    MTL_LOG(Info) << "[VIRTIO] Block device: " << m_sectorCount << " sectors, " << m_queues.size() << " queue(s)"
+                  << (m_readOnly ? ", read-only" : "");
+
+    return {};
+}
+
+VirtioBlock::Queue& VirtioBlock::GetCurrentQueue()
+{
+    return *m_queues[CpuGetIndex() % m_queues.size()];
+}
+
+mtl::expected<void, ErrorCode> VirtioBlock::Submit(BlockRequest* request)
+{
+    if (!request || !request->callback) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    uint64_t length = 0;
+    if (request->operation == BlockRequest::Operation::Flush)
+    {
+        if (!m_canFlush)
+            return mtl::unexpected(ErrorCode::Unsupported);
+    }
+    else
+    {
+        if (request->segmentCount <= 0 || request->segmentCount > m_maxSegments || !request->segments) [[unlikely]]
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        for (int i = 0; i != request->segmentCount; ++i)
+        {
+            if (request->segments[i].length == 0 || request->segments[i].length % kSectorSize) [[unlikely]]
+                return mtl::unexpected(ErrorCode::InvalidArguments);
+            length += request->segments[i].length;
+        }
+
+        if (request->sector > m_sectorCount || length / kSectorSize > m_sectorCount - request->sector) [[unlikely]]
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        if (request->operation == BlockRequest::Operation::Write && m_readOnly)
+            return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    request->next = nullptr;
+
+    auto& queue = GetCurrentQueue();
+    queue.lock.Lock();
+
+    // Waiting for the device runs completion callbacks, which can submit requests and leave a new pending command
+    // behind. Loop until there is no pending command and a free one is available, with the lock held.
+    for (;;)
+    {
+        if (auto pending = queue.pending)
+        {
+            // Merge with the pending command if the request is adjacent
+            if (request->operation != BlockRequest::Operation::Flush && pending->first->operation == request->operation &&
+                pending->nextSector == request->sector && pending->segmentCount + request->segmentCount <= m_maxSegments)
+            {
+                pending->last->next = request;
+                pending->last = request;
+                pending->nextSector += length / kSectorSize;
+                pending->segmentCount += request->segmentCount;
+
+                queue.lock.Unlock();
+                return {};
+            }
+
+            Dispatch(queue);
+        }
+        else if (queue.freeCommands)
+        {
+            break;
+        }
+        else
+        {
+            // All commands are in flight
+            WaitForCompletions(queue);
+        }
+    }
+
+    auto command = queue.freeCommands;
+    queue.freeCommands = command->next;
+
+    switch (request->operation)
+    {
+    case BlockRequest::Operation::Read:
+        command->header.type = VirtioBlockRequest_In;
+        break;
+    case BlockRequest::Operation::Write:
+        command->header.type = VirtioBlockRequest_Out;
+        break;
+    case BlockRequest::Operation::Flush:
+        command->header.type = VirtioBlockRequest_Flush;
+        break;
+    }
+
+    command->header.reserved = 0;
+    command->header.sector = request->operation == BlockRequest::Operation::Flush ? 0 : request->sector;
+    command->status = 0xFF;
+    command->first = request;
+    command->last = request;
+    command->nextSector = request->sector + length / kSectorSize;
+    command->segmentCount = request->operation == BlockRequest::Operation::Flush ? 0 : request->segmentCount;
+
+    assert(!queue.pending);
+    queue.pending = command;
+    queue.lock.Unlock();
+
+    return {};
+}
+
+void VirtioBlock::Dispatch(Queue& queue)
+{
+    auto command = queue.pending;
+    if (!command)
+        return;
+
+    queue.pending = nullptr;
+
+    const auto physicalAddress = queue.commandMemory.physicalAddress + (reinterpret_cast<uintptr_t>(command) -
+                                                                         reinterpret_cast<uintptr_t>(queue.commandMemory.address));
+
+    // Header, data segments of all merged requests, status
+    mtl::static_vector<VirtqBuffer, kMaxSegments + 2> buffers;
+    buffers.push_back({physicalAddress + offsetof(Command, header), sizeof(VirtioBlockRequestHeader)});
+
+    if (command->segmentCount > 0)
+    {
+        for (auto request = command->first; request; request = request->next)
+        {
+            for (int i = 0; i != request->segmentCount; ++i)
+                buffers.push_back({request->segments[i].address, request->segments[i].length});
+        }
+    }
+
+    buffers.push_back({physicalAddress + offsetof(Command, status), 1});
+
+    const int dataCount = buffers.size() - 2;
+    const bool toDevice = command->header.type == VirtioBlockRequest_Out;
+    const int readableCount = toDevice ? 1 + dataCount : 1;
+    const int writableCount = buffers.size() - readableCount;
+
+    // Descriptors run out before commands do when indirect descriptors are not available. The command is no longer
+    // pending, so requests submitted by completion callbacks in the meantime can't be merged into it.
+    while (!queue.virtqueue->AddBuffers(buffers.data(), readableCount, writableCount, command))
+        WaitForCompletions(queue);
+}
+
+void VirtioBlock::WaitForCompletions(Queue& queue)
+{
+    queue.virtqueue->Kick();
+    queue.lock.Unlock();
+    mtl::CpuPause();
+    ProcessCompletions(queue);
+    queue.lock.Lock();
+}
+
+void VirtioBlock::Kick()
+{
+    for (auto& queue : m_queues)
+    {
+        queue->lock.Lock();
+        Dispatch(*queue);
+        queue->virtqueue->Kick();
+        queue->lock.Unlock();
+    }
+}
+
+void VirtioBlock::ProcessCompletions(Queue& queue)
+{
+    // Callbacks are invoked without holding the lock so that they can submit new requests
+    BlockRequest* completed = nullptr;
+
+    queue.lock.Lock();
+
+    while (auto command = static_cast<Command*>(queue.virtqueue->GetUsed()))
+    {
+        ErrorCode status;
+        switch (command->status)
+        {
+        case VirtioBlockStatus_Ok:
+            status = ErrorCode::NoError;
+            break;
+        case VirtioBlockStatus_Unsupported:
+            status = ErrorCode::Unsupported;
+            break;
+        default:
+            status = ErrorCode::Unexpected;
+            break;
+        }
+
+        for (auto request = command->first; request; request = request->next)
+            request->status = status;
+
+        command->last->next = completed;
+        completed = command->first;
+
+        command->next = queue.freeCommands;
+        queue.freeCommands = command;
+    }
+
+    queue.lock.Unlock();
+
+    while (completed)
+    {
+        auto request = completed;
+        completed = request->next;
+        request->callback(request);
+    }
+}
+
+void VirtioBlock::Poll()
+{
+    for (auto& queue : m_queues)
+        ProcessCompletions(*queue);
+}
+
+void VirtioBlock::OnQueueInterrupt()
+{
+    Poll();
+}
@@ -0,0 +1,93 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "Spinlock.hpp"
+#include "devices/virtio/VirtioDevice.hpp"
+#include "interfaces/IBlockDevice.hpp"
+
+/*
+    Virtio block device (virtio spec section 5.2).
+
+    Each CPU submits to its own queue when the device supports enough of them. Requests submitted to the same queue are
+    merged when they are adjacent on disk, in which case the data segments of all merged requests are sent to the device
+    in a single command. Data is never copied: segments are handed to the device as they are.
+
+    The kernel has no MSI-X support: all queues share the legacy interrupt line, or are polled when there is none.
+*/
+
+class VirtioBlock : public VirtioDevice, public IBlockDevice
+{
+public:
+    VirtioBlock(volatile PciConfigSpace* configSpace);
+
+    const char* GetDescription() const override { return "Virtio block device"; }
+    IBlockDevice* GetBlockDevice() override { return m_queues.empty() ? nullptr : this; }
+
+    // Initialize the device and its queues
+    mtl::expected<void, ErrorCode> Initialize();
+
+    // IBlockDevice
+    uint64_t GetSectorCount() const override { return m_sectorCount; }
+    mtl::expected<void, ErrorCode> Submit(BlockRequest* request) override;
+    void Kick() override;
+    void Poll() override;
+
+private:
+    struct Command;
+
+    struct Queue
+    {
+        Virtqueue* virtqueue{};
+        DmaMemory commandMemory{};
+        Command* freeCommands{};
+        Command* pending{}; // Last command built, not yet sent to the device. It can still absorb adjacent requests.
+        Spinlock lock;
+    };
+
+    // VirtioDevice
+    void OnQueueInterrupt() override;
+
+    // Queue to use for submissions from the current CPU
+    Queue& GetCurrentQueue();
+
+    // Send the pending command to the device, queue lock must be held
+    void Dispatch(Queue& queue);
+
+    // Let the device complete some commands. The queue lock must be held, it is released while completion callbacks
+    // run, so the queue state must be looked at again afterwards.
+    void WaitForCompletions(Queue& queue);
+
+    // Complete finished requests and invoke their callbacks
+    void ProcessCompletions(Queue& queue);
+
+    mtl::vector<mtl::unique_ptr<Queue>> m_queues;
+    uint64_t m_sectorCount{};
+    int m_maxSegments{}; // Maximum number of data segments per command
+    bool m_readOnly{};
+    bool m_canFlush{};
+};
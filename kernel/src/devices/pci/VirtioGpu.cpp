@@ -25,7 +25,396 @@
 */
 
 #include "VirtioGpu.hpp"
+#include <algorithm>
+#include <cstring>
+#include <metal/graphics/Surface.hpp>
 
-VirtioGpu::VirtioGpu(volatile PciConfigSpace* configSpace) : PciDevice(Class::Display, configSpace)
+// Virtio GPU protocol (virtio spec section 5.7.6)
+enum VirtioGpuCommandType : uint32_t
 {
+    // 2D commands
+    VirtioGpuCommand_GetDisplayInfo = 0x0100,
+    VirtioGpuCommand_ResourceCreate2D,
+    VirtioGpuCommand_ResourceUnref,
+    VirtioGpuCommand_SetScanout,
+    VirtioGpuCommand_ResourceFlush,
+    VirtioGpuCommand_TransferToHost2D,
+    VirtioGpuCommand_ResourceAttachBacking,
+    VirtioGpuCommand_ResourceDetachBacking,
+
+    // Success responses
+    VirtioGpuResponse_OkNoData = 0x1100,
+    VirtioGpuResponse_OkDisplayInfo,
+
+    // Error responses
+    VirtioGpuResponse_ErrorUnspecified = 0x1200,
+};
+
+enum VirtioGpuFormat : uint32_t
+{
+    VirtioGpuFormat_B8G8R8X8 = 2, // Matches mtl::PixelFormat::X8R8G8B8 in memory
+};
+
+static constexpr int kVirtioGpuMaxScanouts = 16;
+
+struct VirtioGpuControlHeader
+{
+    uint32_t type;
+    uint32_t flags;
+    uint64_t fenceId;
+    uint32_t contextId;
+    uint8_t ringIndex;
+    uint8_t padding[3];
+};
+
+static_assert(sizeof(VirtioGpuControlHeader) == 24);
+
+// Header with every field but the command type zeroed
+static constexpr VirtioGpuControlHeader MakeControlHeader(VirtioGpuCommandType type)
+{
+    return {.type = type, .flags = 0, .fenceId = 0, .contextId = 0, .ringIndex = 0, .padding = {}};
+}
+
+struct VirtioGpuRect
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct VirtioGpuDisplayInfo
+{
+    VirtioGpuControlHeader header;
+    struct
+    {
+        VirtioGpuRect rect;
+        uint32_t enabled;
+        uint32_t flags;
+    } modes[kVirtioGpuMaxScanouts];
+};
+
+struct VirtioGpuResourceCreate2D
+{
+    VirtioGpuControlHeader header;
+    uint32_t resourceId;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct VirtioGpuResourceAttachBacking
+{
+    VirtioGpuControlHeader header;
+    uint32_t resourceId;
+    uint32_t entryCount;
+
+    // Followed by 'entryCount' entries
+    struct Entry
+    {
+        uint64_t address;
+        uint32_t length;
+        uint32_t padding;
+    } entries[1];
+};
+
+struct VirtioGpuSetScanout
+{
+    VirtioGpuControlHeader header;
+    VirtioGpuRect rect;
+    uint32_t scanoutId;
+    uint32_t resourceId;
+};
+
+struct VirtioGpuResourceFlush
+{
+    VirtioGpuControlHeader header;
+    VirtioGpuRect rect;
+    uint32_t resourceId;
+    uint32_t padding;
+};
+
+struct VirtioGpuTransferToHost2D
+{
+    VirtioGpuControlHeader header;
+    VirtioGpuRect rect;
+    uint64_t offset;
+    uint32_t resourceId;
+    uint32_t padding;
+};
+
+struct VirtioGpuConfig
+{
+    uint32_t eventsRead;
+    uint32_t eventsClear;
+    uint32_t scanoutCount;
+    uint32_t capsetCount;
+};
+
+// Request and response buffers for asynchronous commands
+struct alignas(64) VirtioGpu::Command
+{
+    union
+    {
+        VirtioGpuControlHeader header;
+        VirtioGpuResourceFlush flush;
+        VirtioGpuTransferToHost2D transfer;
+    } request;
+
+    VirtioGpuControlHeader response;
+};
+
+// Control queue size, bounds how many commands can be in flight
+static constexpr int kControlQueueSize = 64;
+
+// Resource id of the scanout (0 is reserved)
+static constexpr uint32_t kScanoutResourceId = 1;
+
+static constexpr size_t kSyncResponseOffset = mtl::kMemoryPageSize / 2;
+
+VirtioGpu::VirtioGpu(volatile PciConfigSpace* configSpace) : VirtioDevice(Class::Display, configSpace)
+{
+}
+
+mtl::expected<void, ErrorCode> VirtioGpu::Initialize()
+{
+    const auto features = InitializeTransport(VirtioFeature_Version1);
+    if (!features)
+        return mtl::unexpected(features.error());
+
+    auto queue = CreateQueue(0, kControlQueueSize);
+    if (!queue)
+        return mtl::unexpected(queue.error());
+    m_controlQueue = *queue;
+
+    // Completions are polled when we need command buffers
+    m_controlQueue->DisableInterrupts();
+
+    SetDriverOk();
+
+    auto syncMemory = AllocDmaMemory(1);
+    if (!syncMemory)
+        return mtl::unexpected(syncMemory.error());
+    m_syncMemory = *syncMemory;
+
+    // Each command takes 2 descriptors, keep one pair for Execute()
+    const int commandCount = m_controlQueue->GetSize() / 2 - 1;
+    const auto commandPages = mtl::AlignUp(commandCount * sizeof(Command), mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+    auto commandMemory = AllocDmaMemory(commandPages);
+    if (!commandMemory)
+        return mtl::unexpected(commandMemory.error());
+    m_commandMemory = *commandMemory;
+
+    m_freeCommands.reserve(commandCount);
+    for (int i = 0; i != commandCount; ++i)
+        m_freeCommands.push_back(static_cast<Command*>(m_commandMemory.address) + i);
+
+    // Pick the first enabled scanout
+    auto getDisplayInfo = MakeControlHeader(VirtioGpuCommand_GetDisplayInfo);
+    auto response = Execute(&getDisplayInfo, sizeof(getDisplayInfo), sizeof(VirtioGpuDisplayInfo));
+    if (!response)
+        return mtl::unexpected(response.error());
+
+    const auto& displayInfo = *static_cast<const VirtioGpuDisplayInfo*>(*response);
+    const int scanoutCount = std::min<int>(GetDeviceConfig<VirtioGpuConfig>()->scanoutCount, kVirtioGpuMaxScanouts);
+
+    VirtioGpuRect rect{};
+    for (int i = 0; i != scanoutCount; ++i)
+    {
+        if (displayInfo.modes[i].enabled)
+        {
+            m_scanoutId = i;
+            rect = displayInfo.modes[i].rect;
+            break;
+        }
+    }
+
+    if (!rect.width || !rect.height)
+    {
+        MTL_LOG(Warning) << "[VIRTIO] GPU doesn't have any enabled scanout";
+        return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    // Allocate the backing store
+    const auto pitch = rect.width * 4;
+    const auto framebufferPages = mtl::AlignUp(pitch * rect.height, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+    auto framebufferMemory = AllocDmaMemory(framebufferPages);
+    if (!framebufferMemory)
+        return mtl::unexpected(framebufferMemory.error());
+    m_framebufferMemory = *framebufferMemory;
+
+    // Create the scanout resource
+    VirtioGpuResourceCreate2D create{.header = MakeControlHeader(VirtioGpuCommand_ResourceCreate2D),
+                                     .resourceId = kScanoutResourceId,
+                                     .format = VirtioGpuFormat_B8G8R8X8,
+                                     .width = rect.width,
+                                     .height = rect.height};
+    if (auto result = Execute(&create, sizeof(create), sizeof(VirtioGpuControlHeader)); !result)
+        return mtl::unexpected(result.error());
+
+    VirtioGpuResourceAttachBacking attach{.header = MakeControlHeader(VirtioGpuCommand_ResourceAttachBacking),
+                                          .resourceId = kScanoutResourceId,
+                                          .entryCount = 1,
+                                          .entries = {{.address = m_framebufferMemory.physicalAddress,
+                                                       .length = (uint32_t)(framebufferPages << mtl::kMemoryPageShift),
+                                                       .padding = 0}}};
+    if (auto result = Execute(&attach, sizeof(attach), sizeof(VirtioGpuControlHeader)); !result)
+        return mtl::unexpected(result.error());
+
+    VirtioGpuSetScanout setScanout{.header = MakeControlHeader(VirtioGpuCommand_SetScanout),
+                                   .rect = rect,
+                                   .scanoutId = m_scanoutId,
+                                   .resourceId = kScanoutResourceId};
+    if (auto result = Execute(&setScanout, sizeof(setScanout), sizeof(VirtioGpuControlHeader)); !result)
+        return mtl::unexpected(result.error());
+
+    m_resourceId = kScanoutResourceId;
+    m_backbuffer = mtl::make_intrusive<mtl::Surface>(rect.width, rect.height, pitch, mtl::PixelFormat::X8R8G8B8,
+                                                     m_framebufferMemory.address);
+
+    MTL_LOG(Info) << "[VIRTIO] GPU scanout " << m_scanoutId << " is " << rect.width << " x " << rect.height;
+
+    return {};
+}
+
+mtl::expected<const void*, ErrorCode> VirtioGpu::Execute(const void* request, size_t requestSize, size_t responseSize)
+{
+    assert(requestSize <= kSyncResponseOffset && responseSize <= mtl::kMemoryPageSize - kSyncResponseOffset);
+
+    while (m_controlQueue->GetFreeCount() < 2)
+        ProcessCompletions();
+
+    const auto requestBuffer = m_syncMemory.address;
+    const auto responseBuffer = mtl::AdvancePointer(m_syncMemory.address, kSyncResponseOffset);
+    memcpy(requestBuffer, request, requestSize);
+    memset(responseBuffer, 0, responseSize);
+
+    const VirtqBuffer buffers[] = {{m_syncMemory.physicalAddress, (uint32_t)requestSize},
+                                   {m_syncMemory.physicalAddress + kSyncResponseOffset, (uint32_t)responseSize}};
+
+    if (auto result = m_controlQueue->AddBuffers(buffers, 1, 1, requestBuffer); !result)
+        return mtl::unexpected(result.error());
+
+    m_controlQueue->Kick();
+
+    // Wait for completion, recycling asynchronous commands along the way
+    for (;;)
+    {
+        const auto token = m_controlQueue->GetUsed();
+        if (token == requestBuffer)
+            break;
+
+        if (token)
+            m_freeCommands.push_back(static_cast<Command*>(token));
+        else
+            mtl::CpuPause();
+    }
+
+    const auto type = static_cast<const VirtioGpuControlHeader*>(responseBuffer)->type;
+    if (type < VirtioGpuResponse_OkNoData || type >= VirtioGpuResponse_ErrorUnspecified)
+    {
+        MTL_LOG(Error) << "[VIRTIO] GPU command " << mtl::hex(static_cast<const VirtioGpuControlHeader*>(request)->type)
+                       << " failed with " << mtl::hex(type);
+        return mtl::unexpected(ErrorCode::Unexpected);
+    }
+
+    return responseBuffer;
+}
+
+void VirtioGpu::ProcessCompletions()
+{
+    while (const auto token = m_controlQueue->GetUsed())
+    {
+        const auto command = static_cast<Command*>(token);
+        if (command->response.type >= VirtioGpuResponse_ErrorUnspecified) [[unlikely]]
+            MTL_LOG(Warning) << "[VIRTIO] GPU command " << mtl::hex(command->request.header.type) << " failed with "
+                             << mtl::hex(command->response.type);
+
+        m_freeCommands.push_back(command);
+    }
+}
+
+VirtioGpu::Command* VirtioGpu::AllocateCommand()
+{
+    if (m_freeCommands.empty())
+        ProcessCompletions();
+
+    // The device works asynchronously, we only get here if all commands are in flight
+    while (m_freeCommands.empty())
+    {
+        mtl::CpuPause();
+        ProcessCompletions();
+    }
+
+    const auto command = m_freeCommands.back();
+    m_freeCommands.pop_back();
+
+    memset(command, 0, sizeof(*command));
+    return command;
+}
+
+void VirtioGpu::Submit(Command* command, size_t requestSize)
+{
+    const auto offset = reinterpret_cast<uintptr_t>(command) - reinterpret_cast<uintptr_t>(m_commandMemory.address);
+    const auto physicalAddress = m_commandMemory.physicalAddress + offset;
+
+    const VirtqBuffer buffers[] = {{physicalAddress, (uint32_t)requestSize},
+                                   {physicalAddress + offsetof(Command, response), sizeof(VirtioGpuControlHeader)}};
+
+    // Commands and descriptors are allocated in lockstep, so this can't fail
+    const auto result = m_controlQueue->AddBuffers(buffers, 1, 1, command);
+    assert(result);
+    (void)result;
+}
+
+void VirtioGpu::GetCurrentMode(mtl::GraphicsMode* mode) const
+{
+    GetMode(0, mode);
+}
+
+bool VirtioGpu::GetMode(int index, mtl::GraphicsMode* mode) const
+{
+    if (index != 0 || !m_backbuffer)
+        return false;
+
+    mode->width = m_backbuffer->width;
+    mode->height = m_backbuffer->height;
+    mode->format = m_backbuffer->format;
+    return true;
+}
+
+void VirtioGpu::Blit(int x, int y, int width, int height)
+{
+    if (!m_backbuffer)
+        return;
+
+    // Clip the damage rectangle to the scanout
+    const auto left = std::max(x, 0);
+    const auto top = std::max(y, 0);
+    const auto right = std::min(x + width, m_backbuffer->width);
+    const auto bottom = std::min(y + height, m_backbuffer->height);
+    if (left >= right || top >= bottom)
+        return;
+
+    const VirtioGpuRect rect{(uint32_t)left, (uint32_t)top, (uint32_t)(right - left), (uint32_t)(bottom - top)};
+
+    // Copy the damaged pixels to the host resource, then flush them to the scanout. The device processes control
+    // commands in order, so both can be queued without waiting.
+    const auto transfer = AllocateCommand();
+    transfer->request.transfer = {.header = MakeControlHeader(VirtioGpuCommand_TransferToHost2D),
+                                  .rect = rect,
+                                  .offset = (uint64_t)top * m_backbuffer->pitch + left * 4,
+                                  .resourceId = m_resourceId,
+                                  .padding = 0};
+    Submit(transfer, sizeof(VirtioGpuTransferToHost2D));
+
+    const auto flush = AllocateCommand();
+    flush->request.flush = {.header = MakeControlHeader(VirtioGpuCommand_ResourceFlush),
+                            .rect = rect,
+                            .resourceId = m_resourceId,
+                            .padding = 0};
+    Submit(flush, sizeof(VirtioGpuResourceFlush));
+
+    // One notification for the whole batch
+    m_controlQueue->Kick();
 }
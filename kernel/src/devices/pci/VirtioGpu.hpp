@@ -26,14 +26,58 @@
 
 #pragma once
 
-#include "devices/PciDevice.hpp"
+#include "devices/virtio/VirtioDevice.hpp"
+#include <metal/graphics/IDisplay.hpp>
 
-class VirtioGpu : public PciDevice
+/*
+    Virtio GPU, 2D mode only (virtio spec section 5.7).
+
+    The backbuffer is the guest memory backing the scanout resource. Blit() doesn't copy any pixels: it queues a
+    transfer and a flush of the damaged rectangle and returns without waiting for the device.
+*/
+
+class VirtioGpu : public VirtioDevice, public mtl::IDisplay
 {
 public:
     VirtioGpu(volatile PciConfigSpace* configSpace);
 
     const char* GetDescription() const override { return "Virtio GPU"; }
+    mtl::IDisplay* GetDisplay() override { return m_backbuffer ? this : nullptr; }
+
+    // Initialize the device and set up the scanout
+    mtl::expected<void, ErrorCode> Initialize();
+
+    // IDisplay
+    int GetModeCount() const override { return 1; }
+    void GetCurrentMode(mtl::GraphicsMode* mode) const override;
+    bool GetMode(int index, mtl::GraphicsMode* mode) const override;
+    bool SetMode(int index) override { return index == 0; }
+    mtl::Surface* GetFrontbuffer() override { return nullptr; }
+    mtl::Surface& GetBackbuffer() override { return *m_backbuffer; }
+    void Blit(int x, int y, int width, int height) override;
 
 private:
+    struct Command;
+
+    // Submit a command and wait for its completion, used during initialization
+    // Returns the device's response.
+    mtl::expected<const void*, ErrorCode> Execute(const void* request, size_t requestSize, size_t responseSize);
+
+    // Get a command buffer for asynchronous submission, reclaiming completed ones as needed
+    Command* AllocateCommand();
+
+    // Queue an asynchronous command, the device isn't notified until the queue is kicked
+    void Submit(Command* command, size_t requestSize);
+
+    // Reclaim completed commands
+    void ProcessCompletions();
+
+    Virtqueue* m_controlQueue{};
+    DmaMemory m_commandMemory{};          // Commands used for asynchronous submissions
+    mtl::vector<Command*> m_freeCommands; // Commands available for submission
+    DmaMemory m_syncMemory{};             // Request and response for Execute()
+    DmaMemory m_framebufferMemory{};      // Backing store for the scanout resource
+    mtl::intrusive_ptr<mtl::Surface> m_backbuffer;
+    uint32_t m_scanoutId{};
+    uint32_t m_resourceId{};
 };
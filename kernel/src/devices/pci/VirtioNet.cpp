@@ -0,0 +1,564 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "VirtioNet.hpp"
+#include "Cpu.hpp"
+#include <algorithm>
+#include <cstring>
+#include <metal/static_vector.hpp>
+
+// Virtio network protocol (virtio spec section 5.1)
+enum VirtioNetFeature : uint64_t
+{
+    VirtioNetFeature_Checksum = 1ull << 0,
+    VirtioNetFeature_GuestChecksum = 1ull << 1,
+    VirtioNetFeature_Mtu = 1ull << 3,
+    VirtioNetFeature_Mac = 1ull << 5,
+    VirtioNetFeature_HostTso4 = 1ull << 11,
+    VirtioNetFeature_HostTso6 = 1ull << 12,
+    VirtioNetFeature_MergeableBuffers = 1ull << 15,
+    VirtioNetFeature_ControlQueue = 1ull << 17,
+    VirtioNetFeature_MultiQueue = 1ull << 22,
+};
+
+struct VirtioNetConfig
+{
+    uint8_t mac[6];
+    uint16_t status;
+    uint16_t maxQueuePairs;
+    uint16_t mtu;
+} __attribute__((packed));
+
+// Header preceding each packet. The 'bufferCount' field is always present with VIRTIO_F_VERSION_1.
+struct VirtioNetHeader
+{
+    uint8_t flags;
+    uint8_t gsoType;
+    uint16_t headerLength;
+    uint16_t gsoSize;
+    uint16_t checksumStart;
+    uint16_t checksumOffset;
+    uint16_t bufferCount;
+};
+
+static_assert(sizeof(VirtioNetHeader) == 12);
+
+enum VirtioNetHeaderFlags : uint8_t
+{
+    VirtioNetHeader_NeedsChecksum = 1,
+    VirtioNetHeader_DataValid = 2,
+};
+
+enum VirtioNetGsoType : uint8_t
+{
+    VirtioNetGso_None = 0,
+    VirtioNetGso_TcpIpv4 = 1,
+    VirtioNetGso_TcpIpv6 = 4,
+};
+
+// Control queue command to set the number of queue pairs (section 5.1.6.5.5)
+struct VirtioNetControlQueuePairs
+{
+    uint8_t commandClass;
+    uint8_t command;
+    uint16_t queuePairs;
+    uint8_t ack;
+};
+
+static constexpr uint8_t kVirtioNetControlMultiQueue = 4;
+static constexpr uint8_t kVirtioNetControlSetQueuePairs = 0;
+static constexpr uint8_t kVirtioNetControlOk = 0;
+
+static constexpr int kMaxQueueSize = 256;
+static constexpr int kControlQueueSize = 16;
+
+// Packets and their header fit in an indirect table, so they take a single descriptor when indirect descriptors are
+// available
+static constexpr int kMaxTransmitSegments = NetworkTransmitRequest::kMaxSegments;
+static_assert(kMaxTransmitSegments + 1 <= Virtqueue::kMaxIndirectBuffers);
+
+// Receive buffers, two per page. This is enough for a standard MTU packet without merging buffers.
+static constexpr int kReceiveBufferSize = 2048;
+static constexpr int kDefaultMtu = 1500;
+
+// Transmit headers are padded to keep them naturally aligned
+static constexpr int kTransmitHeaderStride = 16;
+
+VirtioNet::VirtioNet(volatile PciConfigSpace* configSpace) : VirtioDevice(Class::Network, configSpace)
+{
+}
+
+mtl::expected<void, ErrorCode> VirtioNet::Initialize()
+{
+    const auto features = InitializeTransport(VirtioNetFeature_Checksum | VirtioNetFeature_GuestChecksum |
+                                              VirtioNetFeature_Mtu | VirtioNetFeature_Mac | VirtioNetFeature_HostTso4 |
+                                              VirtioNetFeature_HostTso6 | VirtioNetFeature_MergeableBuffers |
+                                              VirtioNetFeature_ControlQueue | VirtioNetFeature_MultiQueue);
+    if (!features)
+        return mtl::unexpected(features.error());
+
+    const auto config = GetDeviceConfig<VirtioNetConfig>();
+    if (!config)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    if (*features & VirtioNetFeature_Mac)
+    {
+        for (int i = 0; i != 6; ++i)
+            m_macAddress[i] = config->mac[i];
+    }
+
+    m_mtu = (*features & VirtioNetFeature_Mtu) ? std::min<int>(config->mtu, kDefaultMtu) : kDefaultMtu;
+    m_mergeableBuffers = *features & VirtioNetFeature_MergeableBuffers;
+    m_transmitChecksum = *features & VirtioNetFeature_Checksum;
+    m_segmentationIpv4 = m_transmitChecksum && (*features & VirtioNetFeature_HostTso4);
+    m_segmentationIpv6 = m_transmitChecksum && (*features & VirtioNetFeature_HostTso6);
+
+    // One queue pair per CPU, as long as the device has enough of them
+    const bool controlQueue = *features & VirtioNetFeature_ControlQueue;
+    const bool multiQueue = controlQueue && (*features & VirtioNetFeature_MultiQueue);
+    const int maxQueuePairs = multiQueue ? std::max<int>(config->maxQueuePairs, 1) : 1;
+    const int queuePairCount = std::min(maxQueuePairs, CpuGetCount());
+
+    for (int i = 0; i != queuePairCount; ++i)
+    {
+        auto pair = mtl::unique_ptr<QueuePair>(new QueuePair);
+        if (!pair)
+            return mtl::unexpected(ErrorCode::OutOfMemory);
+
+        if (auto result = InitializeQueuePair(*pair, i); !result)
+            return result;
+
+        m_queuePairs.emplace_back(std::move(pair));
+    }
+
+    // The control queue follows the last queue pair the device supports (section 5.1.2). Queues must be set up before
+    // the driver is ready, commands can only be sent after.
+    if (controlQueue)
+    {
+        auto queue = CreateQueue(2 * maxQueuePairs, kControlQueueSize);
+        if (!queue)
+            return mtl::unexpected(queue.error());
+
+        auto memory = AllocDmaMemory(1);
+        if (!memory)
+            return mtl::unexpected(memory.error());
+
+        m_controlQueue = *queue;
+        m_controlQueue->DisableInterrupts();
+        m_controlMemory = *memory;
+    }
+
+    SetDriverOk();
+
+    // The device uses a single queue pair until told otherwise
+    if (queuePairCount > 1)
+    {
+        if (auto result = SetQueuePairCount(queuePairCount); !result)
+            return result;
+    }
+
+    const bool interrupts = EnableInterrupts().has_value();
+    if (!interrupts)
+        MTL_LOG(Warning) << "[VIRTIO] Network device interrupts not available, packets must be polled";
+
+    for (auto& pair : m_queuePairs)
+    {
+        if (!interrupts)
+            pair->receiveQueue->DisableInterrupts();
+
+        pair->receiveLock.Lock();
+        Refill(*pair);
+        pair->receiveLock.Unlock();
+    }
+
+    m_ready = true;
+
+    MTL_LOG(Info) << "[VIRTIO] Network device: MAC " << mtl::hex(m_macAddress[0]) << ':' << mtl::hex(m_macAddress[1])
+                  << ':' << mtl::hex(m_macAddress[2]) << ':' << mtl::hex(m_macAddress[3]) << ':'
+                  << mtl::hex(m_macAddress[4]) << ':' << mtl::hex(m_macAddress[5]) << ", MTU " << m_mtu << ", "
+                  << m_queuePairs.size() << " queue pair(s)";
+
+    return {};
+}
+
+mtl::expected<void, ErrorCode> VirtioNet::InitializeQueuePair(QueuePair& pair, int index)
+{
+    // Queues are interleaved: receiveq1, transmitq1, receiveq2, transmitq2, ... (section 5.1.2)
+    auto receiveQueue = CreateQueue(2 * index, kMaxQueueSize);
+    if (!receiveQueue)
+        return mtl::unexpected(receiveQueue.error());
+
+    auto transmitQueue = CreateQueue(2 * index + 1, kMaxQueueSize);
+    if (!transmitQueue)
+        return mtl::unexpected(transmitQueue.error());
+
+    pair.receiveQueue = *receiveQueue;
+    pair.transmitQueue = *transmitQueue;
+
+    // Transmit completions are reclaimed lazily, there is no need to interrupt the CPU for them
+    pair.transmitQueue->DisableInterrupts();
+
+    // Allocate enough receive buffers to fill the queue while consumers hold as many
+    const int bufferCount = 2 * pair.receiveQueue->GetSize();
+    constexpr int buffersPerPage = mtl::kMemoryPageSize / kReceiveBufferSize;
+
+    pair.buffers.reserve(bufferCount);
+    pair.freeBuffers.reserve(bufferCount);
+    for (int i = 0; i != bufferCount / buffersPerPage; ++i)
+    {
+        auto page = AllocDmaMemory(1);
+        if (!page)
+            return mtl::unexpected(page.error());
+
+        for (int j = 0; j != buffersPerPage; ++j)
+        {
+            pair.freeBuffers.push_back(pair.buffers.size());
+            pair.buffers.push_back(
+                {mtl::AdvancePointer(page->address, j * kReceiveBufferSize), page->physicalAddress + j * kReceiveBufferSize});
+        }
+    }
+
+    const int slotCount = pair.transmitQueue->GetSize();
+    const auto pageCount = mtl::AlignUp(slotCount * kTransmitHeaderStride, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+    auto headers = AllocDmaMemory(pageCount);
+    if (!headers)
+        return mtl::unexpected(headers.error());
+
+    pair.transmitHeaders = *headers;
+    pair.transmitRequests.resize(slotCount);
+    pair.freeTransmitSlots.reserve(slotCount);
+    for (int i = 0; i != slotCount; ++i)
+        pair.freeTransmitSlots.push_back(slotCount - 1 - i);
+
+    return {};
+}
+
+mtl::expected<void, ErrorCode> VirtioNet::SetQueuePairCount(int count)
+{
+    if (!m_controlQueue)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    auto command = static_cast<VirtioNetControlQueuePairs*>(m_controlMemory.address);
+    command->commandClass = kVirtioNetControlMultiQueue;
+    command->command = kVirtioNetControlSetQueuePairs;
+    command->queuePairs = count;
+    command->ack = 0xFF;
+
+    const auto address = m_controlMemory.physicalAddress;
+    const VirtqBuffer buffers[] = {
+        {address + offsetof(VirtioNetControlQueuePairs, commandClass), 2},
+        {address + offsetof(VirtioNetControlQueuePairs, queuePairs), sizeof(uint16_t)},
+        {address + offsetof(VirtioNetControlQueuePairs, ack), sizeof(uint8_t)},
+    };
+
+    if (auto result = m_controlQueue->AddBuffers(buffers, 2, 1, command); !result)
+        return result;
+
+    m_controlQueue->Kick();
+
+    while (!m_controlQueue->GetUsed())
+        mtl::CpuPause();
+
+    if (command->ack != kVirtioNetControlOk)
+    {
+        MTL_LOG(Error) << "[VIRTIO] Network device refused to use " << count << " queue pairs";
+        return mtl::unexpected(ErrorCode::Unexpected);
+    }
+
+    return {};
+}
+
+void VirtioNet::GetMacAddress(uint8_t address[6]) const
+{
+    memcpy(address, m_macAddress, sizeof(m_macAddress));
+}
+
+VirtioNet::QueuePair& VirtioNet::GetCurrentQueuePair()
+{
+    return *m_queuePairs[CpuGetIndex() % m_queuePairs.size()];
+}
+
+mtl::expected<void, ErrorCode> VirtioNet::Transmit(NetworkTransmitRequest* request)
+{
+    if (!request || !request->callback || !request->segments || request->segmentCount <= 0 ||
+        request->segmentCount > kMaxTransmitSegments) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto& offload = request->offload;
+    if (offload.partialChecksum && !m_transmitChecksum)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    VirtioNetHeader header{};
+    switch (offload.segmentation)
+    {
+    case NetworkOffload::Segmentation::None:
+        header.gsoType = VirtioNetGso_None;
+        break;
+    case NetworkOffload::Segmentation::TcpIpv4:
+        if (!m_segmentationIpv4 || !offload.partialChecksum)
+            return mtl::unexpected(ErrorCode::Unsupported);
+        header.gsoType = VirtioNetGso_TcpIpv4;
+        break;
+    case NetworkOffload::Segmentation::TcpIpv6:
+        if (!m_segmentationIpv6 || !offload.partialChecksum)
+            return mtl::unexpected(ErrorCode::Unsupported);
+        header.gsoType = VirtioNetGso_TcpIpv6;
+        break;
+    }
+
+    if (offload.partialChecksum)
+    {
+        header.flags = VirtioNetHeader_NeedsChecksum;
+        header.checksumStart = offload.checksumStart;
+        header.checksumOffset = offload.checksumOffset;
+    }
+
+    if (header.gsoType != VirtioNetGso_None)
+    {
+        header.headerLength = offload.headerLength;
+        header.gsoSize = offload.segmentSize;
+    }
+
+    request->next = nullptr;
+
+    auto& pair = GetCurrentQueuePair();
+    pair.transmitLock.Lock();
+
+    // The device doesn't signal transmit completions, reclaim them whenever the packet doesn't fit
+    const int descriptorCount = pair.transmitQueue->GetDescriptorCount(1 + request->segmentCount);
+    NetworkTransmitRequest* completed = nullptr;
+    if (pair.freeTransmitSlots.empty() || pair.transmitQueue->GetFreeCount() < descriptorCount)
+        completed = ReclaimTransmitSlots(pair);
+
+    mtl::expected<void, ErrorCode> result = mtl::unexpected(ErrorCode::OutOfMemory);
+    if (!pair.freeTransmitSlots.empty() && pair.transmitQueue->GetFreeCount() >= descriptorCount)
+    {
+        const int slot = pair.freeTransmitSlots.back();
+        const auto offset = slot * kTransmitHeaderStride;
+        *static_cast<VirtioNetHeader*>(mtl::AdvancePointer(pair.transmitHeaders.address, offset)) = header;
+
+        mtl::static_vector<VirtqBuffer, kMaxTransmitSegments + 1> buffers;
+        buffers.push_back({pair.transmitHeaders.physicalAddress + offset, sizeof(VirtioNetHeader)});
+        for (int i = 0; i != request->segmentCount; ++i)
+            buffers.push_back({request->segments[i].address, request->segments[i].length});
+
+        result = pair.transmitQueue->AddBuffers(buffers.data(), buffers.size(), 0, &pair.transmitRequests[slot]);
+        if (result)
+        {
+            pair.transmitRequests[slot] = request;
+            pair.freeTransmitSlots.pop_back();
+        }
+    }
+    else
+    {
+        // Make sure the device knows about the queued packets, or it would never free any room
+        pair.transmitQueue->Kick();
+    }
+
+    pair.transmitLock.Unlock();
+
+    CompleteTransmitRequests(completed);
+
+    // The queue is full, let the caller retry after the device made progress
+    if (!result)
+        return mtl::unexpected(ErrorCode::OutOfMemory);
+
+    return {};
+}
+
+NetworkTransmitRequest* VirtioNet::ReclaimTransmitSlots(QueuePair& pair)
+{
+    NetworkTransmitRequest* first = nullptr;
+    NetworkTransmitRequest** last = &first;
+
+    while (auto token = static_cast<NetworkTransmitRequest**>(pair.transmitQueue->GetUsed()))
+    {
+        const int slot = token - pair.transmitRequests.data();
+        auto request = pair.transmitRequests[slot];
+        pair.transmitRequests[slot] = nullptr;
+        pair.freeTransmitSlots.push_back(slot);
+
+        request->status = ErrorCode::NoError;
+        *last = request;
+        last = &request->next;
+    }
+
+    return first;
+}
+
+void VirtioNet::CompleteTransmitRequests(NetworkTransmitRequest* requests)
+{
+    while (requests)
+    {
+        auto request = requests;
+        requests = request->next;
+        request->callback(request);
+    }
+}
+
+void VirtioNet::Kick()
+{
+    for (auto& pair : m_queuePairs)
+    {
+        pair->transmitLock.Lock();
+        pair->transmitQueue->Kick();
+        pair->transmitLock.Unlock();
+    }
+}
+
+void VirtioNet::Refill(QueuePair& pair)
+{
+    bool added = false;
+
+    while (!pair.freeBuffers.empty())
+    {
+        // Tokens can't be null, buffer ids are offset by one
+        const int id = pair.freeBuffers.back();
+        const VirtqBuffer buffer{pair.buffers[id].address, kReceiveBufferSize};
+        if (!pair.receiveQueue->AddBuffers(&buffer, 0, 1, reinterpret_cast<void*>(id + 1)))
+            break;
+
+        pair.freeBuffers.pop_back();
+        added = true;
+    }
+
+    if (added)
+        pair.receiveQueue->Kick();
+}
+
+int VirtioNet::Receive(NetworkPacket* packets, int maxCount)
+{
+    int count = 0;
+
+    for (int queue = 0; queue != (int)m_queuePairs.size() && count < maxCount; ++queue)
+    {
+        auto& pair = *m_queuePairs[queue];
+        pair.receiveLock.Lock();
+
+        uint32_t length;
+        while (count < maxCount)
+        {
+            auto token = pair.receiveQueue->GetUsed(&length);
+            if (!token)
+                break;
+
+            int id = reinterpret_cast<uintptr_t>(token) - 1;
+            const auto header = static_cast<const VirtioNetHeader*>(pair.buffers[id].data);
+            const int bufferCount = m_mergeableBuffers ? std::max<int>(header->bufferCount, 1) : 1;
+
+            auto& packet = packets[count];
+            packet.queue = queue;
+            packet.fragmentCount = 0;
+            packet.checksumValid = header->flags & VirtioNetHeader_DataValid;
+
+            // The header is only in the first buffer. With mergeable buffers, the other buffers of the packet follow
+            // in the used ring (section 5.1.6.4).
+            bool valid = length > sizeof(VirtioNetHeader);
+            uint32_t offset = sizeof(VirtioNetHeader);
+            for (int i = 0; i != bufferCount; ++i)
+            {
+                if (i > 0)
+                {
+                    token = pair.receiveQueue->GetUsed(&length);
+                    if (!token)
+                    {
+                        valid = false;
+                        break;
+                    }
+
+                    id = reinterpret_cast<uintptr_t>(token) - 1;
+                    offset = 0;
+                }
+
+                if (packet.fragmentCount == NetworkPacket::kMaxFragments || length <= offset)
+                {
+                    valid = false;
+                    pair.freeBuffers.push_back(id);
+                    continue;
+                }
+
+                packet.fragments[packet.fragmentCount] = {mtl::AdvancePointer(pair.buffers[id].data, offset), length - offset};
+                packet.buffers[packet.fragmentCount] = id;
+                ++packet.fragmentCount;
+            }
+
+            if (valid)
+            {
+                ++count;
+            }
+            else
+            {
+                // Drop the packet
+                for (int i = 0; i != packet.fragmentCount; ++i)
+                    pair.freeBuffers.push_back(packet.buffers[i]);
+            }
+        }
+
+        Refill(pair);
+        pair.receiveLock.Unlock();
+    }
+
+    return count;
+}
+
+void VirtioNet::Release(const NetworkPacket& packet)
+{
+    auto& pair = *m_queuePairs[packet.queue];
+    pair.receiveLock.Lock();
+
+    for (int i = 0; i != packet.fragmentCount; ++i)
+        pair.freeBuffers.push_back(packet.buffers[i]);
+
+    // Don't let the device run dry if the consumer holds on to packets for a while
+    if (pair.receiveQueue->GetFreeCount() > pair.receiveQueue->GetSize() / 2)
+        Refill(pair);
+
+    pair.receiveLock.Unlock();
+}
+
+void VirtioNet::SetReceiveCallback(ReceiveCallback* callback, void* context)
+{
+    m_receiveContext = context;
+    m_receiveCallback = callback;
+}
+
+void VirtioNet::Poll()
+{
+    for (auto& pair : m_queuePairs)
+    {
+        pair->transmitLock.Lock();
+        auto completed = ReclaimTransmitSlots(*pair);
+        pair->transmitLock.Unlock();
+
+        CompleteTransmitRequests(completed);
+    }
+}
+
+void VirtioNet::OnQueueInterrupt()
+{
+    if (m_receiveCallback)
+        m_receiveCallback(this, m_receiveContext);
+}
@@ -0,0 +1,122 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "Spinlock.hpp"
+#include "devices/virtio/VirtioDevice.hpp"
+#include "interfaces/INetworkDevice.hpp"
+
+/*
+    Virtio network device (virtio spec section 5.1).
+
+    Each CPU gets its own pair of receive / transmit queues when the device supports enough of them. The number of
+    pairs in use is set through the control queue. Receive buffers come from a pool of DMA pages that is allocated once:
+    buffers go from the device to the consumer and back to the device without ever being returned to the frame
+    allocator, and without any data being copied.
+
+    The kernel has no MSI-X support: all queues share the legacy interrupt line, or are polled when there is none.
+
+    Transmit completions are not signaled by the device, they are reclaimed when the queue needs room or on Poll().
+*/
+
+class VirtioNet : public VirtioDevice, public INetworkDevice
+{
+public:
+    VirtioNet(volatile PciConfigSpace* configSpace);
+
+    const char* GetDescription() const override { return "Virtio network device"; }
+    INetworkDevice* GetNetworkDevice() override { return m_ready ? this : nullptr; }
+
+    // Initialize the device, its queues and the receive buffers
+    mtl::expected<void, ErrorCode> Initialize();
+
+    // INetworkDevice
+    void GetMacAddress(uint8_t address[6]) const override;
+    int GetMtu() const override { return m_mtu; }
+    mtl::expected<void, ErrorCode> Transmit(NetworkTransmitRequest* request) override;
+    void Kick() override;
+    int Receive(NetworkPacket* packets, int maxCount) override;
+    void Release(const NetworkPacket& packet) override;
+    void SetReceiveCallback(ReceiveCallback* callback, void* context) override;
+    void Poll() override;
+
+private:
+    struct ReceiveBuffer
+    {
+        void* data;
+        PhysicalAddress address;
+    };
+
+    struct QueuePair
+    {
+        // Receive buffers are either posted to the device, held by a consumer or in 'freeBuffers'
+        Virtqueue* receiveQueue{};
+        mtl::vector<ReceiveBuffer> buffers;
+        mtl::vector<uint16_t> freeBuffers;
+        Spinlock receiveLock;
+
+        // Each transmitted packet uses a slot for its virtio header
+        Virtqueue* transmitQueue{};
+        DmaMemory transmitHeaders{};
+        mtl::vector<NetworkTransmitRequest*> transmitRequests;
+        mtl::vector<uint16_t> freeTransmitSlots;
+        Spinlock transmitLock;
+    };
+
+    // VirtioDevice
+    void OnQueueInterrupt() override;
+
+    mtl::expected<void, ErrorCode> InitializeQueuePair(QueuePair& pair, int index);
+
+    // Tell the device how many queue pairs to use, through the control queue
+    mtl::expected<void, ErrorCode> SetQueuePairCount(int count);
+
+    // Queue pair to use for transmissions from the current CPU
+    QueuePair& GetCurrentQueuePair();
+
+    // Post free receive buffers to the device, receive lock must be held
+    void Refill(QueuePair& pair);
+
+    // Reclaim the slots of transmitted packets, transmit lock must be held.
+    // Returns the completed requests, their callbacks must be invoked once the lock is released.
+    NetworkTransmitRequest* ReclaimTransmitSlots(QueuePair& pair);
+
+    static void CompleteTransmitRequests(NetworkTransmitRequest* requests);
+
+    mtl::vector<mtl::unique_ptr<QueuePair>> m_queuePairs;
+    Virtqueue* m_controlQueue{};
+    DmaMemory m_controlMemory{}; // Control commands are sent one at a time, during initialization
+    bool m_ready{};              // The queues are ready
+    uint8_t m_macAddress[6]{};
+    int m_mtu{};
+    bool m_mergeableBuffers{};
+    bool m_transmitChecksum{};
+    bool m_segmentationIpv4{};
+    bool m_segmentationIpv6{};
+    ReceiveCallback* m_receiveCallback{};
+    void* m_receiveContext{};
+};
@@ -0,0 +1,234 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "PackedVirtqueue.hpp"
+#include <metal/atomic.hpp>
+#include <metal/helpers.hpp>
+
+size_t PackedVirtqueue::GetRingSize(int size)
+{
+    // Descriptor ring followed by the driver and device event suppression structures
+    return sizeof(VirtqPackedDescriptor) * size + sizeof(VirtqPackedEvent) * 2;
+}
+
+PackedVirtqueue::PackedVirtqueue(int index, int size, uint64_t features, void* memory, mtl::PhysicalAddress physicalAddress,
+                                 volatile uint16_t* notify)
+    : Virtqueue(index, size, features, memory, physicalAddress, notify, GetRingSize(size))
+{
+    m_nextFreeId.resize(size);
+    m_chainLength.resize(size);
+
+    for (int i = 0; i != size; ++i)
+        m_nextFreeId[i] = i + 1;
+}
+
+volatile VirtqPackedEvent* PackedVirtqueue::DriverEvent() const
+{
+    return static_cast<volatile VirtqPackedEvent*>(mtl::AdvancePointer(m_memory, m_size * sizeof(VirtqPackedDescriptor)));
+}
+
+uint16_t PackedVirtqueue::GetAvailableFlags() const
+{
+    // A descriptor is available when its Available bit matches the wrap counter and its Used bit doesn't
+    return m_availableWrap ? VirtqPackedDescriptor::Available : VirtqPackedDescriptor::Used;
+}
+
+mtl::expected<void, ErrorCode> PackedVirtqueue::AddBuffers(const VirtqBuffer* buffers, int readableCount, int writableCount,
+                                                           void* token)
+{
+    const auto count = readableCount + writableCount;
+    if (!buffers || readableCount < 0 || writableCount < 0 || count == 0 || !token) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const bool indirect = UseIndirect(count);
+    const int descriptorCount = indirect ? 1 : count;
+    if (descriptorCount > m_freeCount)
+        return mtl::unexpected(ErrorCode::OutOfMemory);
+
+    const auto id = m_freeId;
+    m_freeId = m_nextFreeId[id];
+
+    auto descriptors = Descriptors();
+    const auto head = m_nextAvailable;
+    uint16_t headFlags = 0;
+
+    for (int i = 0; i != descriptorCount; ++i)
+    {
+        auto& descriptor = descriptors[m_nextAvailable];
+        uint16_t flags = GetAvailableFlags();
+
+        if (indirect)
+        {
+            auto table = GetIndirectTable<VirtqPackedDescriptor>(id);
+            for (int j = 0; j != count; ++j)
+            {
+                table[j].address = buffers[j].address;
+                table[j].length = buffers[j].length;
+                table[j].id = 0;
+                table[j].flags = j >= readableCount ? VirtqPackedDescriptor::Write : 0;
+            }
+
+            descriptor.address = GetIndirectTableAddress(id);
+            descriptor.length = count * sizeof(VirtqPackedDescriptor);
+            flags |= VirtqPackedDescriptor::Indirect;
+        }
+        else
+        {
+            descriptor.address = buffers[i].address;
+            descriptor.length = buffers[i].length;
+            if (i >= readableCount)
+                flags |= VirtqPackedDescriptor::Write;
+            if (i + 1 < count)
+                flags |= VirtqPackedDescriptor::Next;
+        }
+
+        descriptor.id = id;
+
+        // The head's flags are written last to make the whole chain available at once
+        if (i == 0)
+            headFlags = flags;
+        else
+            descriptor.flags = flags;
+
+        if (++m_nextAvailable == m_size)
+        {
+            m_nextAvailable = 0;
+            m_availableWrap = !m_availableWrap;
+        }
+    }
+
+    m_chainLength[id] = descriptorCount;
+    m_tokens[id] = token;
+    m_freeCount -= descriptorCount;
+    m_pendingCount += descriptorCount;
+
+    mtl::atomic_thread_fence(mtl::memory_order_release);
+    descriptors[head].flags = headFlags;
+
+    return {};
+}
+
+void PackedVirtqueue::Kick()
+{
+    if (!m_pendingCount)
+        return;
+
+    // Descriptors must be visible before we read the device's notification suppression state
+    mtl::atomic_thread_fence(mtl::memory_order_seq_cst);
+
+    const auto event = DeviceEvent();
+    const uint16_t flags = event->flags;
+
+    bool notify;
+    if (flags == VirtqPackedEvent::Descriptor)
+    {
+        // See section 2.8.21.3.1 and Linux's virtqueue_kick_prepare_packed()
+        const uint16_t offsetWrap = event->offsetWrap;
+        uint16_t eventIndex = offsetWrap & 0x7FFF;
+        const bool eventWrap = offsetWrap >> 15;
+        if (eventWrap != m_availableWrap)
+            eventIndex -= m_size;
+
+        notify = VirtqNeedEvent(eventIndex, m_nextAvailable, m_nextAvailable - m_pendingCount);
+    }
+    else
+    {
+        notify = flags != VirtqPackedEvent::Disable;
+    }
+
+    m_pendingCount = 0;
+
+    if (notify)
+        Notify();
+}
+
+bool PackedVirtqueue::HasUsed() const
+{
+    const uint16_t flags = Descriptors()[m_nextUsed].flags;
+    const bool available = flags & VirtqPackedDescriptor::Available;
+    const bool used = flags & VirtqPackedDescriptor::Used;
+    return available == used && used == m_usedWrap;
+}
+
+void* PackedVirtqueue::GetUsed(uint32_t* length)
+{
+    if (!HasUsed())
+        return nullptr;
+
+    // Don't read the descriptor before its flags
+    mtl::atomic_thread_fence(mtl::memory_order_acquire);
+
+    const auto& descriptor = Descriptors()[m_nextUsed];
+    const uint16_t id = descriptor.id;
+    if (length)
+        *length = descriptor.length;
+
+    // The device writes a single used descriptor per request, skip the rest of the chain
+    const auto descriptorCount = m_chainLength[id];
+    m_nextUsed += descriptorCount;
+    if (m_nextUsed >= m_size)
+    {
+        m_nextUsed -= m_size;
+        m_usedWrap = !m_usedWrap;
+    }
+
+    m_nextFreeId[id] = m_freeId;
+    m_freeId = id;
+    m_freeCount += descriptorCount;
+
+    // Ask for an interrupt on the next completion
+    if (m_interruptsEnabled && m_eventIndex)
+        DriverEvent()->offsetWrap = m_nextUsed | (m_usedWrap << 15);
+
+    const auto token = m_tokens[id];
+    m_tokens[id] = nullptr;
+    return token;
+}
+
+void PackedVirtqueue::DisableInterrupts()
+{
+    m_interruptsEnabled = false;
+    DriverEvent()->flags = VirtqPackedEvent::Disable;
+}
+
+bool PackedVirtqueue::EnableInterrupts()
+{
+    m_interruptsEnabled = true;
+    if (m_eventIndex)
+    {
+        DriverEvent()->offsetWrap = m_nextUsed | (m_usedWrap << 15);
+        mtl::atomic_thread_fence(mtl::memory_order_release);
+        DriverEvent()->flags = VirtqPackedEvent::Descriptor;
+    }
+    else
+    {
+        DriverEvent()->flags = VirtqPackedEvent::Enable;
+    }
+
+    // Make sure the device sees the change before we check for completions
+    mtl::atomic_thread_fence(mtl::memory_order_seq_cst);
+    return !HasUsed();
+}
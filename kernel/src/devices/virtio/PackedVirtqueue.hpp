@@ -0,0 +1,68 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "Virtqueue.hpp"
+
+// Packed virtqueue (virtio spec section 2.8)
+class PackedVirtqueue : public Virtqueue
+{
+public:
+    static size_t GetRingSize(int size);
+
+    PackedVirtqueue(int index, int size, uint64_t features, void* memory, mtl::PhysicalAddress physicalAddress,
+                    volatile uint16_t* notify);
+
+    mtl::PhysicalAddress GetDriverAddress() const override { return m_physicalAddress + m_size * sizeof(VirtqPackedDescriptor); }
+    mtl::PhysicalAddress GetDeviceAddress() const override { return GetDriverAddress() + sizeof(VirtqPackedEvent); }
+
+    mtl::expected<void, ErrorCode> AddBuffers(const VirtqBuffer* buffers, int readableCount, int writableCount,
+                                              void* token) override;
+    void Kick() override;
+    bool HasUsed() const override;
+    void* GetUsed(uint32_t* length = nullptr) override;
+    void DisableInterrupts() override;
+    bool EnableInterrupts() override;
+
+private:
+    volatile VirtqPackedDescriptor* Descriptors() const { return static_cast<volatile VirtqPackedDescriptor*>(m_memory); }
+    volatile VirtqPackedEvent* DriverEvent() const;
+    volatile VirtqPackedEvent* DeviceEvent() const { return DriverEvent() + 1; }
+
+    // Flags marking a descriptor as available for the current wrap counter
+    uint16_t GetAvailableFlags() const;
+
+    uint16_t m_nextAvailable{0}; // Next descriptor to fill
+    bool m_availableWrap{true};  // Driver ring wrap counter
+    uint16_t m_nextUsed{0};      // Next descriptor the device will mark as used
+    bool m_usedWrap{true};       // Device ring wrap counter
+    uint16_t m_pendingCount{0};  // Descriptors added since the last Kick()
+    int m_freeId{0};             // First free request id
+
+    mtl::vector<uint16_t> m_nextFreeId;  // Free request ids list
+    mtl::vector<uint16_t> m_chainLength; // Number of ring descriptors used by each request id
+};
@@ -0,0 +1,229 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "SplitVirtqueue.hpp"
+#include <metal/atomic.hpp>
+#include <metal/helpers.hpp>
+
+static constexpr size_t GetAvailableOffset(int size)
+{
+    return sizeof(VirtqDescriptor) * size;
+}
+
+static constexpr size_t GetUsedOffset(int size)
+{
+    // Available ring: flags, index, ring[size], usedEvent
+    return mtl::AlignUp(GetAvailableOffset(size) + sizeof(uint16_t) * (3 + size), 4);
+}
+
+size_t SplitVirtqueue::GetRingSize(int size)
+{
+    // Used ring: flags, index, ring[size], availableEvent
+    return GetUsedOffset(size) + sizeof(uint16_t) * 3 + sizeof(VirtqUsedElement) * size;
+}
+
+SplitVirtqueue::SplitVirtqueue(int index, int size, uint64_t features, void* memory, mtl::PhysicalAddress physicalAddress,
+                               volatile uint16_t* notify)
+    : Virtqueue(index, size, features, memory, physicalAddress, notify, GetRingSize(size)),
+      m_availableOffset(GetAvailableOffset(size)), m_usedOffset(GetUsedOffset(size))
+{
+    // Chain all descriptors in the free list
+    auto descriptors = Descriptors();
+    for (int i = 0; i != size - 1; ++i)
+        descriptors[i].next = i + 1;
+}
+
+volatile VirtqAvailable* SplitVirtqueue::Available() const
+{
+    return static_cast<volatile VirtqAvailable*>(mtl::AdvancePointer(m_memory, m_availableOffset));
+}
+
+volatile uint16_t* SplitVirtqueue::AvailableRing() const
+{
+    return reinterpret_cast<volatile uint16_t*>(Available() + 1);
+}
+
+volatile VirtqUsed* SplitVirtqueue::Used() const
+{
+    return static_cast<volatile VirtqUsed*>(mtl::AdvancePointer(m_memory, m_usedOffset));
+}
+
+volatile VirtqUsedElement* SplitVirtqueue::UsedRing() const
+{
+    return reinterpret_cast<volatile VirtqUsedElement*>(Used() + 1);
+}
+
+mtl::expected<void, ErrorCode> SplitVirtqueue::AddBuffers(const VirtqBuffer* buffers, int readableCount, int writableCount,
+                                                          void* token)
+{
+    const auto count = readableCount + writableCount;
+    if (!buffers || readableCount < 0 || writableCount < 0 || count == 0 || !token) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const bool indirect = UseIndirect(count);
+    if ((indirect ? 1 : count) > m_freeCount)
+        return mtl::unexpected(ErrorCode::OutOfMemory);
+
+    auto descriptors = Descriptors();
+    const auto head = m_freeHead;
+
+    if (indirect)
+    {
+        // The request takes a single descriptor in the ring
+        auto table = GetIndirectTable<VirtqDescriptor>(head);
+        for (int i = 0; i != count; ++i)
+        {
+            table[i].address = buffers[i].address;
+            table[i].length = buffers[i].length;
+            table[i].flags = 0;
+            if (i >= readableCount)
+                table[i].flags |= VirtqDescriptor::Write;
+            if (i + 1 < count)
+                table[i].flags |= VirtqDescriptor::Next;
+            table[i].next = i + 1;
+        }
+
+        auto& descriptor = descriptors[head];
+        descriptor.address = GetIndirectTableAddress(head);
+        descriptor.length = count * sizeof(VirtqDescriptor);
+        descriptor.flags = VirtqDescriptor::Indirect;
+
+        m_freeHead = descriptor.next;
+        --m_freeCount;
+    }
+    else
+    {
+        auto last = head;
+        auto current = head;
+        for (int i = 0; i != count; ++i)
+        {
+            auto& descriptor = descriptors[current];
+            descriptor.address = buffers[i].address;
+            descriptor.length = buffers[i].length;
+            descriptor.flags = 0;
+            if (i >= readableCount)
+                descriptor.flags |= VirtqDescriptor::Write;
+            if (i + 1 < count)
+                descriptor.flags |= VirtqDescriptor::Next;
+
+            last = current;
+            current = descriptor.next;
+        }
+
+        m_freeHead = descriptors[last].next;
+        m_freeCount -= count;
+    }
+
+    m_tokens[head] = token;
+
+    // The device can't see the new entry before we update the available index in Kick()
+    AvailableRing()[m_availableIndex++ & (m_size - 1)] = head;
+    ++m_pendingCount;
+
+    return {};
+}
+
+void SplitVirtqueue::Kick()
+{
+    if (!m_pendingCount)
+        return;
+
+    // Descriptors and ring entries must be visible before the index
+    mtl::atomic_thread_fence(mtl::memory_order_release);
+    const uint16_t oldIndex = m_availableIndex - m_pendingCount;
+    Available()->index = m_availableIndex;
+    m_pendingCount = 0;
+
+    // The index must be visible before we read the device's notification suppression state
+    mtl::atomic_thread_fence(mtl::memory_order_seq_cst);
+
+    const bool notify =
+        m_eventIndex ? VirtqNeedEvent(*AvailableEvent(), m_availableIndex, oldIndex) : !(Used()->flags & VirtqUsed::NoNotify);
+    if (notify)
+        Notify();
+}
+
+bool SplitVirtqueue::HasUsed() const
+{
+    return m_lastUsedIndex != Used()->index;
+}
+
+void* SplitVirtqueue::GetUsed(uint32_t* length)
+{
+    if (!HasUsed())
+        return nullptr;
+
+    // Don't read the used element before the index
+    mtl::atomic_thread_fence(mtl::memory_order_acquire);
+
+    const auto& element = UsedRing()[m_lastUsedIndex++ & (m_size - 1)];
+    const auto head = element.id;
+    if (length)
+        *length = element.length;
+
+    // Return the descriptor chain to the free list
+    auto descriptors = Descriptors();
+    auto last = head;
+    int count = 1;
+    while (descriptors[last].flags & VirtqDescriptor::Next)
+    {
+        last = descriptors[last].next;
+        ++count;
+    }
+
+    descriptors[last].next = m_freeHead;
+    m_freeHead = head;
+    m_freeCount += count;
+
+    // Ask for an interrupt on the next completion
+    if (m_interruptsEnabled && m_eventIndex)
+        *UsedEvent() = m_lastUsedIndex;
+
+    const auto token = m_tokens[head];
+    m_tokens[head] = nullptr;
+    return token;
+}
+
+void SplitVirtqueue::DisableInterrupts()
+{
+    // With event indices, we simply stop moving UsedEvent() forward. This can result in one spurious interrupt.
+    m_interruptsEnabled = false;
+    if (!m_eventIndex)
+        Available()->flags = VirtqAvailable::NoInterrupt;
+}
+
+bool SplitVirtqueue::EnableInterrupts()
+{
+    m_interruptsEnabled = true;
+    if (m_eventIndex)
+        *UsedEvent() = m_lastUsedIndex;
+    else
+        Available()->flags = 0;
+
+    // Make sure the device sees the change before we check for completions
+    mtl::atomic_thread_fence(mtl::memory_order_seq_cst);
+    return !HasUsed();
+}
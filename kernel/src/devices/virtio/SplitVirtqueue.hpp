@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "Virtqueue.hpp"
+
+// Split virtqueue (virtio spec section 2.7)
+class SplitVirtqueue : public Virtqueue
+{
+public:
+    static size_t GetRingSize(int size);
+
+    SplitVirtqueue(int index, int size, uint64_t features, void* memory, mtl::PhysicalAddress physicalAddress,
+                   volatile uint16_t* notify);
+
+    mtl::PhysicalAddress GetDriverAddress() const override { return m_physicalAddress + m_availableOffset; }
+    mtl::PhysicalAddress GetDeviceAddress() const override { return m_physicalAddress + m_usedOffset; }
+
+    mtl::expected<void, ErrorCode> AddBuffers(const VirtqBuffer* buffers, int readableCount, int writableCount,
+                                              void* token) override;
+    void Kick() override;
+    bool HasUsed() const override;
+    void* GetUsed(uint32_t* length = nullptr) override;
+    void DisableInterrupts() override;
+    bool EnableInterrupts() override;
+
+private:
+    VirtqDescriptor* Descriptors() const { return static_cast<VirtqDescriptor*>(m_memory); }
+    volatile VirtqAvailable* Available() const;
+    volatile uint16_t* AvailableRing() const;
+    volatile uint16_t* UsedEvent() const { return AvailableRing() + m_size; }
+    volatile VirtqUsed* Used() const;
+    volatile VirtqUsedElement* UsedRing() const;
+    volatile uint16_t* AvailableEvent() const { return reinterpret_cast<volatile uint16_t*>(UsedRing() + m_size); }
+
+    const size_t m_availableOffset;
+    const size_t m_usedOffset;
+
+    int m_freeHead{0};            // First free descriptor
+    uint16_t m_availableIndex{0}; // Shadow of Available()->index
+    uint16_t m_pendingCount{0};   // Requests added since the last Kick()
+    uint16_t m_lastUsedIndex{0};  // Next used element to process
+};
@@ -0,0 +1,234 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "VirtioDevice.hpp"
+#include "Interrupt.hpp"
+#include "arch.hpp"
+#include <algorithm>
+#include <bit>
+#include <metal/helpers.hpp>
+
+mtl::expected<volatile void*, ErrorCode> VirtioDevice::MapCapability(const volatile VirtioPciCapability& capability)
+{
+    const auto bar = GetBarAddress(capability.bar);
+    if (!bar)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    const auto address = bar + capability.offset;
+    const auto start = mtl::AlignDown(address, mtl::kMemoryPageSize);
+    const auto end = mtl::AlignUp(address + capability.size, mtl::kMemoryPageSize);
+
+    const auto pages = ArchMapSystemMemory(start, (end - start) >> mtl::kMemoryPageShift, mtl::PageFlags::MMIO);
+    if (!pages)
+        return mtl::unexpected(pages.error());
+
+    return mtl::AdvancePointer(static_cast<volatile void*>(*pages), address - start);
+}
+
+mtl::expected<uint64_t, ErrorCode> VirtioDevice::InitializeTransport(uint64_t driverFeatures)
+{
+    // Locate the virtio structures
+    for (auto offset = FindCapability(PciCapabilityId::VendorSpecific); offset;
+         offset = FindCapability(PciCapabilityId::VendorSpecific, offset))
+    {
+        const auto& capability = *GetConfigSpace<VirtioPciCapability>(offset);
+
+        // Only the first capability of each type is used (section 4.1.4)
+        switch (capability.type)
+        {
+        case VirtioPciCapabilityType::CommonConfig:
+            if (!m_commonConfig)
+            {
+                if (auto config = MapCapability(capability))
+                    m_commonConfig = static_cast<volatile VirtioPciCommonConfig*>(*config);
+            }
+            break;
+
+        case VirtioPciCapabilityType::NotifyConfig:
+            if (!m_notifyBase)
+            {
+                if (auto notify = MapCapability(capability))
+                {
+                    m_notifyBase = static_cast<volatile uint8_t*>(*notify);
+                    m_notifyOffsetMultiplier = GetConfigSpace<VirtioPciNotifyCapability>(offset)->notifyOffsetMultiplier;
+                }
+            }
+            break;
+
+        case VirtioPciCapabilityType::IsrConfig:
+            if (!m_isr)
+            {
+                if (auto isr = MapCapability(capability))
+                    m_isr = static_cast<volatile uint8_t*>(*isr);
+            }
+            break;
+
+        case VirtioPciCapabilityType::DeviceConfig:
+            if (!m_deviceConfig)
+            {
+                if (auto config = MapCapability(capability))
+                    m_deviceConfig = *config;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (!m_commonConfig || !m_notifyBase)
+    {
+        MTL_LOG(Error) << "[VIRTIO] Device doesn't implement the modern virtio-pci interface";
+        return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    EnableBusMastering();
+
+    // Device initialization (section 3.1.1)
+    m_commonConfig->deviceStatus = 0;
+    while (m_commonConfig->deviceStatus != 0)
+        mtl::CpuPause();
+
+    m_commonConfig->deviceStatus = VirtioStatus_Acknowledge;
+    m_commonConfig->deviceStatus = VirtioStatus_Acknowledge | VirtioStatus_Driver;
+
+    m_commonConfig->deviceFeatureSelect = 0;
+    uint64_t deviceFeatures = m_commonConfig->deviceFeature;
+    m_commonConfig->deviceFeatureSelect = 1;
+    deviceFeatures |= (uint64_t)m_commonConfig->deviceFeature << 32;
+
+    // We don't support legacy devices
+    const auto features = deviceFeatures & (driverFeatures | Virtqueue::kSupportedFeatures | VirtioFeature_Version1);
+    if (!(features & VirtioFeature_Version1))
+    {
+        m_commonConfig->deviceStatus = VirtioStatus_Failed;
+        return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    m_commonConfig->driverFeatureSelect = 0;
+    m_commonConfig->driverFeature = features & 0xFFFFFFFF;
+    m_commonConfig->driverFeatureSelect = 1;
+    m_commonConfig->driverFeature = features >> 32;
+
+    m_commonConfig->deviceStatus = VirtioStatus_Acknowledge | VirtioStatus_Driver | VirtioStatus_FeaturesOk;
+    if (!(m_commonConfig->deviceStatus & VirtioStatus_FeaturesOk))
+    {
+        m_commonConfig->deviceStatus = VirtioStatus_Failed;
+        return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    m_features = features;
+    return features;
+}
+
+int VirtioDevice::GetQueueCount() const
+{
+    return m_commonConfig->queueCount;
+}
+
+mtl::expected<Virtqueue*, ErrorCode> VirtioDevice::CreateQueue(int index, int maxSize)
+{
+    if (index < 0 || index >= GetQueueCount() || maxSize <= 0) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    m_commonConfig->queueSelect = index;
+
+    // Split queue sizes are powers of 2, packed queue sizes don't have to be. Virtqueue wants a power of 2 for both,
+    // so use the largest one that fits both the device's maximum and ours.
+    const int limit = std::min<int>(m_commonConfig->queueSize, maxSize);
+    if (limit == 0)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    const int size = 1 << (31 - std::countl_zero((unsigned)limit));
+
+    const auto pageCount =
+        mtl::AlignUp(Virtqueue::GetMemorySize(size, m_features), mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+    const auto memory = AllocDmaMemory(pageCount);
+    if (!memory)
+        return mtl::unexpected(memory.error());
+
+    const auto notify =
+        reinterpret_cast<volatile uint16_t*>(m_notifyBase + m_commonConfig->queueNotifyOffset * m_notifyOffsetMultiplier);
+
+    auto result = Virtqueue::Create(index, size, m_features, memory->address, memory->physicalAddress, notify);
+    if (!result)
+    {
+        FreeDmaMemory(*memory, pageCount);
+        return mtl::unexpected(result.error());
+    }
+
+    auto queue = std::move(*result);
+
+    m_commonConfig->queueSize = size;
+    m_commonConfig->queueDescriptorLow = queue->GetDescriptorAddress() & 0xFFFFFFFF;
+    m_commonConfig->queueDescriptorHigh = queue->GetDescriptorAddress() >> 32;
+    m_commonConfig->queueDriverLow = queue->GetDriverAddress() & 0xFFFFFFFF;
+    m_commonConfig->queueDriverHigh = queue->GetDriverAddress() >> 32;
+    m_commonConfig->queueDeviceLow = queue->GetDeviceAddress() & 0xFFFFFFFF;
+    m_commonConfig->queueDeviceHigh = queue->GetDeviceAddress() >> 32;
+    m_commonConfig->queueEnable = 1;
+
+    m_queues.emplace_back(std::move(queue));
+    return m_queues.back().get();
+}
+
+void VirtioDevice::SetDriverOk()
+{
+    m_commonConfig->deviceStatus =
+        VirtioStatus_Acknowledge | VirtioStatus_Driver | VirtioStatus_FeaturesOk | VirtioStatus_DriverOk;
+}
+
+mtl::expected<void, ErrorCode> VirtioDevice::EnableInterrupts()
+{
+    if (!m_isr)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    const auto interruptLine = static_cast<volatile PciConfigSpaceType0*>(m_configSpace)->interruptLine;
+    if (interruptLine == 0xFF)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    m_configSpace->command = m_configSpace->command & ~PciCommand_InterruptDisable;
+
+    return InterruptRegisterHandler(interruptLine, this);
+}
+
+bool VirtioDevice::HandleInterrupt(InterruptContext* context)
+{
+    (void)context;
+
+    // Reading the ISR status acknowledges the interrupt (section 4.1.4.5)
+    const auto status = *m_isr;
+    if (!status)
+        return false;
+
+    if (status & 1)
+        OnQueueInterrupt();
+
+    if (status & 2)
+        OnConfigurationChange();
+
+    return true;
+}
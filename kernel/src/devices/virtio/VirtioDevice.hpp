@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "devices/PciDevice.hpp"
+#include "devices/virtio/Virtqueue.hpp"
+#include "interfaces/IInterruptHandler.hpp"
+#include <metal/unique_ptr.hpp>
+
+/*
+    Virtio over PCI transport, modern interface only (virtio spec section 4.1).
+
+    Drivers can poll their queues or call EnableInterrupts() to get OnQueueInterrupt() called when the device
+    signals completions. Only the legacy INTx interrupt is supported at this time.
+*/
+
+class VirtioDevice : public PciDevice, public IInterruptHandler
+{
+public:
+    VirtioDevice(PciDevice::Class cls, volatile PciConfigSpace* configSpace) : PciDevice(cls, configSpace) {}
+
+    // IInterruptHandler
+    bool HandleInterrupt(InterruptContext* context) override;
+
+protected:
+    // Reset the device, locate the virtio structures and negotiate features.
+    // The virtqueue features supported by the engine are added to 'driverFeatures'.
+    // Returns the features supported by both the device and the driver.
+    mtl::expected<uint64_t, ErrorCode> InitializeTransport(uint64_t driverFeatures);
+
+    // Number of virtqueues supported by the device
+    int GetQueueCount() const;
+
+    // Allocate and enable a virtqueue. The queue size is the device's maximum, capped to 'maxSize'.
+    mtl::expected<Virtqueue*, ErrorCode> CreateQueue(int index, int maxSize);
+
+    // Route the device's interrupt to HandleInterrupt()
+    mtl::expected<void, ErrorCode> EnableInterrupts();
+
+    // Called from interrupt context when the device signals used buffers
+    virtual void OnQueueInterrupt() {}
+
+    // Called from interrupt context when the device configuration changes
+    virtual void OnConfigurationChange() {}
+
+    // Tell the device that the driver is ready. Queues must be created before this is called.
+    void SetDriverOk();
+
+    // Device specific configuration structure
+    template <typename T>
+    volatile T* GetDeviceConfig() const
+    {
+        return static_cast<volatile T*>(m_deviceConfig);
+    }
+
+private:
+    mtl::expected<volatile void*, ErrorCode> MapCapability(const volatile VirtioPciCapability& capability);
+
+    volatile VirtioPciCommonConfig* m_commonConfig{};
+    volatile uint8_t* m_notifyBase{};
+    uint32_t m_notifyOffsetMultiplier{};
+    volatile uint8_t* m_isr{};
+    volatile void* m_deviceConfig{};
+    uint64_t m_features{};
+    mtl::vector<mtl::unique_ptr<Virtqueue>> m_queues;
+};
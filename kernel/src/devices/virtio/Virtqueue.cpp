@@ -0,0 +1,88 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "Virtqueue.hpp"
+#include "PackedVirtqueue.hpp"
+#include "SplitVirtqueue.hpp"
+#include <cstring>
+#include <metal/helpers.hpp>
+
+static size_t GetRingSize(int size, uint64_t features)
+{
+    return (features & VirtioFeature_RingPacked) ? PackedVirtqueue::GetRingSize(size) : SplitVirtqueue::GetRingSize(size);
+}
+
+size_t Virtqueue::GetMemorySize(int size, uint64_t features)
+{
+    auto memorySize = mtl::AlignUp(GetRingSize(size, features), kMemoryAlignment);
+
+    if (features & VirtioFeature_IndirectDescriptors)
+        memorySize += size * kMaxIndirectBuffers * 16;
+
+    return memorySize;
+}
+
+mtl::expected<mtl::unique_ptr<Virtqueue>, ErrorCode> Virtqueue::Create(int index, int size, uint64_t features, void* memory,
+                                                                     mtl::PhysicalAddress physicalAddress,
+                                                                     volatile uint16_t* notify)
+{
+    // Split queues sizes must be a power of 2, packed queues sizes are limited to 15 bits (sections 2.7 and 2.8)
+    if (size <= 0 || size > 32768 || (size & (size - 1)) != 0) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    if (!memory || !notify) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    if (!mtl::IsAligned(memory, kMemoryAlignment) || !mtl::IsAligned(physicalAddress, kMemoryAlignment)) [[unlikely]]
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    mtl::unique_ptr<Virtqueue> queue;
+    if (features & VirtioFeature_RingPacked)
+        queue.reset(new PackedVirtqueue(index, size, features, memory, physicalAddress, notify));
+    else
+        queue.reset(new SplitVirtqueue(index, size, features, memory, physicalAddress, notify));
+
+    if (!queue)
+        return mtl::unexpected(ErrorCode::OutOfMemory);
+
+    return queue;
+}
+
+Virtqueue::Virtqueue(int index, int size, uint64_t features, void* memory, mtl::PhysicalAddress physicalAddress,
+                     volatile uint16_t* notify, size_t ringSize)
+    : m_index(index), m_size(size), m_eventIndex(features & VirtioFeature_EventIndex), m_memory(memory),
+      m_physicalAddress(physicalAddress), m_freeCount(size), m_notify(notify)
+{
+    memset(memory, 0, GetMemorySize(size, features));
+    m_tokens.resize(size);
+
+    if (features & VirtioFeature_IndirectDescriptors)
+    {
+        const auto offset = mtl::AlignUp(ringSize, kMemoryAlignment);
+        m_indirectTables = mtl::AdvancePointer(memory, offset);
+        m_indirectTablesAddress = physicalAddress + offset;
+    }
+}
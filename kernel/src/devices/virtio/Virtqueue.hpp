@@ -0,0 +1,155 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include "devices/virtio/virtio.hpp"
+#include <metal/arch.hpp>
+#include <metal/expected.hpp>
+#include <metal/unique_ptr.hpp>
+#include <metal/vector.hpp>
+
+// A buffer (or part of a request) handed to the device
+struct VirtqBuffer
+{
+    mtl::PhysicalAddress address;
+    uint32_t length;
+};
+
+/*
+    Virtqueue engine shared by all virtio drivers.
+
+    The queue doesn't own its memory: the transport allocates GetMemorySize() bytes of DMA memory and hands it over.
+    Both the split and packed layouts are supported, selected by the negotiated features. VirtioFeature_EventIndex and
+    VirtioFeature_IndirectDescriptors are used when available.
+
+    Requests are made visible to the device by AddBuffers(), but the device is only notified on Kick(). This lets
+    callers batch several requests behind a single (expensive) notification.
+
+    Completions are retrieved with GetUsed(). Callers can either poll (after DisableInterrupts()) or wait for an
+    interrupt (after EnableInterrupts()).
+*/
+
+class Virtqueue
+{
+public:
+    // Queue features implemented by the engine
+    static constexpr uint64_t kSupportedFeatures =
+        VirtioFeature_EventIndex | VirtioFeature_IndirectDescriptors | VirtioFeature_RingPacked;
+
+    // Requests with more buffers than this are never made indirect
+    static constexpr int kMaxIndirectBuffers = 16;
+
+    // Required alignment and size of the memory backing a queue of 'size' entries
+    static constexpr size_t kMemoryAlignment = 16;
+    static size_t GetMemorySize(int size, uint64_t features);
+
+    // 'features' are the features negotiated with the device
+    // 'notify' is where the queue index is written to notify the device
+    static mtl::expected<mtl::unique_ptr<Virtqueue>, ErrorCode> Create(int index, int size, uint64_t features, void* memory,
+                                                                     mtl::PhysicalAddress physicalAddress,
+                                                                     volatile uint16_t* notify);
+
+    Virtqueue(const Virtqueue&) = delete;
+    Virtqueue& operator=(const Virtqueue&) = delete;
+    virtual ~Virtqueue() = default;
+
+    int GetIndex() const { return m_index; }
+    int GetSize() const { return m_size; }
+
+    // Number of descriptors available for new requests
+    int GetFreeCount() const { return m_freeCount; }
+
+    // Number of descriptors a request of 'count' buffers needs
+    int GetDescriptorCount(int count) const { return UseIndirect(count) ? 1 : count; }
+
+    // Is there any request that the device hasn't completed yet?
+    bool IsBusy() const { return m_freeCount != m_size; }
+
+    // Physical addresses to program in the transport
+    mtl::PhysicalAddress GetDescriptorAddress() const { return m_physicalAddress; }
+    virtual mtl::PhysicalAddress GetDriverAddress() const = 0;
+    virtual mtl::PhysicalAddress GetDeviceAddress() const = 0;
+
+    // Add a request made of 'readableCount' device-readable buffers followed by 'writableCount' device-writable ones.
+    // 'token' is returned by GetUsed() when the device is done with the request and must not be null.
+    virtual mtl::expected<void, ErrorCode> AddBuffers(const VirtqBuffer* buffers, int readableCount, int writableCount,
+                                                      void* token) = 0;
+
+    // Publish pending requests and notify the device unless it asked not to be
+    virtual void Kick() = 0;
+
+    // Is there a completed request waiting to be retrieved?
+    virtual bool HasUsed() const = 0;
+
+    // Retrieve the next completed request. Returns nullptr if there is none.
+    // 'length' receives the number of bytes the device wrote into the request's writable buffers.
+    virtual void* GetUsed(uint32_t* length = nullptr) = 0;
+
+    // Ask the device not to interrupt on completions, they will be polled
+    virtual void DisableInterrupts() = 0;
+
+    // Ask the device to interrupt on completions. Returns false if completions arrived in the meantime, in which case
+    // the caller should poll them as there might not be an interrupt for them.
+    virtual bool EnableInterrupts() = 0;
+
+protected:
+    Virtqueue(int index, int size, uint64_t features, void* memory, mtl::PhysicalAddress physicalAddress,
+              volatile uint16_t* notify, size_t ringSize);
+
+    // Should a request of 'count' buffers use an indirect table?
+    bool UseIndirect(int count) const { return m_indirectTables && count > 1 && count <= kMaxIndirectBuffers; }
+
+    // Each request id owns an indirect table
+    template <typename T>
+    T* GetIndirectTable(int id) const
+    {
+        return static_cast<T*>(m_indirectTables) + id * kMaxIndirectBuffers;
+    }
+
+    mtl::PhysicalAddress GetIndirectTableAddress(int id) const
+    {
+        return m_indirectTablesAddress + id * kMaxIndirectBuffers * 16;
+    }
+
+    void Notify() { *m_notify = m_index; }
+
+    const int m_index;
+    const int m_size;
+    const bool m_eventIndex;
+    void* const m_memory;
+    const mtl::PhysicalAddress m_physicalAddress;
+
+    int m_freeCount;                // Number of free descriptors
+    bool m_interruptsEnabled{true}; // Interrupts are enabled by default (section 2.7.7 and 2.8.10)
+    mtl::vector<void*> m_tokens;    // Indexed by request id
+
+private:
+    volatile uint16_t* const m_notify;
+    void* m_indirectTables{};
+    mtl::PhysicalAddress m_indirectTablesAddress{};
+};
@@ -0,0 +1,203 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// Virtio 1.2 specification structures and constants
+
+// Device status (section 2.1)
+enum VirtioStatus : uint8_t
+{
+    VirtioStatus_Acknowledge = 1,
+    VirtioStatus_Driver = 2,
+    VirtioStatus_DriverOk = 4,
+    VirtioStatus_FeaturesOk = 8,
+    VirtioStatus_NeedsReset = 64,
+    VirtioStatus_Failed = 128,
+};
+
+// Reserved feature bits (section 6)
+enum VirtioFeature : uint64_t
+{
+    VirtioFeature_IndirectDescriptors = 1ull << 28,
+    VirtioFeature_EventIndex = 1ull << 29,
+    VirtioFeature_Version1 = 1ull << 32,
+    VirtioFeature_AccessPlatform = 1ull << 33,
+    VirtioFeature_RingPacked = 1ull << 34,
+    VirtioFeature_InOrder = 1ull << 35,
+};
+
+// PCI capability types (section 4.1.4)
+enum class VirtioPciCapabilityType : uint8_t
+{
+    CommonConfig = 1,
+    NotifyConfig = 2,
+    IsrConfig = 3,
+    DeviceConfig = 4,
+    PciConfig = 5,
+};
+
+struct VirtioPciCapability
+{
+    uint8_t capabilityId; // PciCapabilityId::VendorSpecific
+    uint8_t next;
+    uint8_t length;
+    VirtioPciCapabilityType type;
+    uint8_t bar;
+    uint8_t id;
+    uint8_t padding[2];
+    uint32_t offset; // Offset within the bar
+    uint32_t size;   // Size of the structure
+} __attribute__((packed));
+
+static_assert(sizeof(VirtioPciCapability) == 16);
+
+struct VirtioPciNotifyCapability : VirtioPciCapability
+{
+    uint32_t notifyOffsetMultiplier;
+} __attribute__((packed));
+
+static_assert(sizeof(VirtioPciNotifyCapability) == 20);
+
+struct VirtioPciCommonConfig
+{
+    // Whole device
+    uint32_t deviceFeatureSelect;
+    uint32_t deviceFeature;
+    uint32_t driverFeatureSelect;
+    uint32_t driverFeature;
+    uint16_t configMsixVector;
+    uint16_t queueCount;
+    uint8_t deviceStatus;
+    uint8_t configGeneration;
+
+    // Selected queue
+    uint16_t queueSelect;
+    uint16_t queueSize;
+    uint16_t queueMsixVector;
+    uint16_t queueEnable;
+    uint16_t queueNotifyOffset;
+    uint32_t queueDescriptorLow;
+    uint32_t queueDescriptorHigh;
+    uint32_t queueDriverLow;
+    uint32_t queueDriverHigh;
+    uint32_t queueDeviceLow;
+    uint32_t queueDeviceHigh;
+} __attribute__((packed));
+
+static_assert(sizeof(VirtioPciCommonConfig) == 0x38);
+
+// Split virtqueue layout (section 2.7)
+struct VirtqDescriptor
+{
+    enum Flags : uint16_t
+    {
+        Next = 1,
+        Write = 2,
+        Indirect = 4,
+    };
+
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+};
+
+static_assert(sizeof(VirtqDescriptor) == 16);
+
+struct VirtqAvailable
+{
+    enum Flags : uint16_t
+    {
+        NoInterrupt = 1,
+    };
+
+    uint16_t flags;
+    uint16_t index;
+    // uint16_t ring[queueSize];
+    // uint16_t usedEvent; // Only if VirtioFeature_EventIndex
+};
+
+struct VirtqUsedElement
+{
+    uint32_t id;
+    uint32_t length;
+};
+
+struct VirtqUsed
+{
+    enum Flags : uint16_t
+    {
+        NoNotify = 1,
+    };
+
+    uint16_t flags;
+    uint16_t index;
+    // VirtqUsedElement ring[queueSize];
+    // uint16_t availableEvent; // Only if VirtioFeature_EventIndex
+};
+
+// Packed virtqueue layout (section 2.8)
+struct VirtqPackedDescriptor
+{
+    enum Flags : uint16_t
+    {
+        Next = 1,
+        Write = 2,
+        Indirect = 4,
+        Available = 1 << 7,
+        Used = 1 << 15,
+    };
+
+    uint64_t address;
+    uint32_t length;
+    uint16_t id;
+    uint16_t flags;
+};
+
+static_assert(sizeof(VirtqPackedDescriptor) == 16);
+
+// Event suppression structure, used for both the driver and device areas
+struct VirtqPackedEvent
+{
+    enum Flags : uint16_t
+    {
+        Enable = 0,
+        Disable = 1,
+        Descriptor = 2, // Only if VirtioFeature_EventIndex
+    };
+
+    uint16_t offsetWrap; // Descriptor ring offset (bits 0-14) and wrap counter (bit 15)
+    uint16_t flags;
+};
+
+// Returns whether an event should be triggered when moving from 'oldIndex' to 'newIndex' (section 2.7.10)
+inline bool VirtqNeedEvent(uint16_t eventIndex, uint16_t newIndex, uint16_t oldIndex)
+{
+    return (uint16_t)(newIndex - eventIndex - 1) < (uint16_t)(newIndex - oldIndex);
+}
@@ -26,6 +26,8 @@
 
 #include "display.hpp"
 #include "devices/DeviceManager.hpp"
+#include <metal/graphics/GraphicsConsole.hpp>
+#include <metal/graphics/IDisplay.hpp>
 
 void DisplayInitialize()
 {
@@ -36,4 +38,16 @@ void DisplayInitialize()
     {
         MTL_LOG(Info) << "    " << *device;
     }
+
+    // Attach a console to the first usable display
+    for (const auto& device : displays)
+    {
+        if (const auto display = device->GetDisplay())
+        {
+            auto console = mtl::make_shared<mtl::GraphicsConsole>(mtl::shared_ptr<mtl::IDisplay>(device, display));
+            console->Clear();
+            mtl::g_log.AddLogger(std::move(console));
+            break;
+        }
+    }
 }
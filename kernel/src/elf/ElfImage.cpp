@@ -0,0 +1,387 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ElfImage.hpp"
+#include <algorithm>
+#include <cstring>
+#include <elf.h>
+#include <metal/arch.hpp>
+#include <metal/helpers.hpp>
+
+#if __x86_64__
+inline constexpr uint16_t kElfMachine = EM_X86_64;
+inline constexpr uint32_t kRelocationNone = R_X86_64_NONE;
+inline constexpr uint32_t kRelocationAbsolute = R_X86_64_64;
+inline constexpr uint32_t kRelocationGlobalData = R_X86_64_GLOB_DAT;
+inline constexpr uint32_t kRelocationJumpSlot = R_X86_64_JUMP_SLOT;
+inline constexpr uint32_t kRelocationRelative = R_X86_64_RELATIVE;
+#elif __aarch64__
+inline constexpr uint16_t kElfMachine = EM_AARCH64;
+inline constexpr uint32_t kRelocationNone = R_AARCH64_NONE;
+inline constexpr uint32_t kRelocationAbsolute = R_AARCH64_ABS64;
+inline constexpr uint32_t kRelocationGlobalData = R_AARCH64_GLOB_DAT;
+inline constexpr uint32_t kRelocationJumpSlot = R_AARCH64_JUMP_SLOT;
+inline constexpr uint32_t kRelocationRelative = R_AARCH64_RELATIVE;
+#endif
+
+// The file isn't necessarily aligned (cpio archives only align files to 4 bytes), structures are copied before being used
+template <typename T>
+static T Read(const char* data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+bool ElfImage::Segment::IsWritable() const
+{
+    return flags & PF_W;
+}
+
+bool ElfImage::Segment::IsExecutable() const
+{
+    return flags & PF_X;
+}
+
+mtl::expected<mtl::unique_ptr<ElfImage>, ErrorCode> ElfImage::Create(const void* data, size_t size)
+{
+    const auto file = static_cast<const char*>(data);
+
+    // Validate the ELF header
+    if (size < sizeof(Elf64_Ehdr))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto ehdr = Read<Elf64_Ehdr>(file);
+    if (ehdr.e_ident[EI_MAG0] != ELFMAG0 || ehdr.e_ident[EI_MAG1] != ELFMAG1 || ehdr.e_ident[EI_MAG2] != ELFMAG2 ||
+        ehdr.e_ident[EI_MAG3] != ELFMAG3 || ehdr.e_ident[EI_DATA] != ELFDATA2LSB)
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    // Verify that this ELF file is for the current architecture
+    if (ehdr.e_ident[EI_CLASS] != ELFCLASS64 || ehdr.e_machine != kElfMachine || ehdr.e_version != EV_CURRENT)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    if (ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    if (ehdr.e_phentsize != sizeof(Elf64_Phdr) || ehdr.e_phoff > size ||
+        ehdr.e_phnum > (size - ehdr.e_phoff) / sizeof(Elf64_Phdr))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    mtl::unique_ptr<ElfImage> image(new ElfImage());
+    image->m_data = file;
+    image->m_size = size;
+    image->m_positionIndependent = ehdr.e_type == ET_DYN;
+    image->m_entryPoint = ehdr.e_entry;
+
+    // Parse program headers
+    bool hasDynamic = false;
+    Elf64_Phdr dynamic{};
+
+    for (int i = 0; i != ehdr.e_phnum; ++i)
+    {
+        const auto phdr = Read<Elf64_Phdr>(file + ehdr.e_phoff + i * sizeof(Elf64_Phdr));
+
+        // We don't have a dynamic linker
+        if (phdr.p_type == PT_INTERP)
+            return mtl::unexpected(ErrorCode::Unsupported);
+
+        if (phdr.p_type == PT_DYNAMIC)
+        {
+            hasDynamic = true;
+            dynamic = phdr;
+            continue;
+        }
+
+        if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0)
+            continue;
+
+        if (phdr.p_filesz > phdr.p_memsz || phdr.p_offset > size || phdr.p_filesz > size - phdr.p_offset ||
+            phdr.p_vaddr + phdr.p_memsz < phdr.p_vaddr)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        // Content must be at the same offset within a page in memory and in the file
+        if (!mtl::IsAligned(phdr.p_vaddr - phdr.p_offset, mtl::kMemoryPageSize))
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        image->m_segments.push_back(Segment{.address = phdr.p_vaddr,
+                                            .memorySize = phdr.p_memsz,
+                                            .fileOffset = phdr.p_offset,
+                                            .fileSize = phdr.p_filesz,
+                                            .flags = phdr.p_flags});
+    }
+
+    auto& segments = image->m_segments;
+    if (segments.empty())
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) { return a.address < b.address; });
+
+    // Each page is mapped with the permissions of a single segment
+    for (size_t i = 1; i != segments.size(); ++i)
+    {
+        const auto& previous = segments[i - 1];
+        const auto previousEnd = mtl::AlignUp(previous.address + previous.memorySize, mtl::kMemoryPageSize);
+        if (mtl::AlignDown(segments[i].address, mtl::kMemoryPageSize) < previousEnd)
+            return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    const auto& last = segments.back();
+    image->m_start = mtl::AlignDown(segments.front().address, mtl::kMemoryPageSize);
+    image->m_end = mtl::AlignUp(last.address + last.memorySize, mtl::kMemoryPageSize);
+
+    const auto entryPoint = image->FindSegment(image->m_entryPoint);
+    if (!entryPoint || !entryPoint->IsExecutable())
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    if (hasDynamic)
+    {
+        const Segment segment{.address = dynamic.p_vaddr,
+                              .memorySize = dynamic.p_memsz,
+                              .fileOffset = dynamic.p_offset,
+                              .fileSize = dynamic.p_filesz,
+                              .flags = dynamic.p_flags};
+        if (dynamic.p_offset > size || dynamic.p_filesz > size - dynamic.p_offset)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        if (auto result = image->ParseDynamic(segment); !result)
+            return mtl::unexpected(result.error());
+    }
+
+    return image;
+}
+
+mtl::expected<void, ErrorCode> ElfImage::ParseDynamic(const Segment& dynamic)
+{
+    uintptr_t relocations = 0;
+    size_t relocationsSize = 0;
+    size_t relocationSize = sizeof(Elf64_Rela);
+    uintptr_t pltRelocations = 0;
+    size_t pltRelocationsSize = 0;
+    uint64_t pltRelocationType = DT_RELA;
+    uintptr_t symbols = 0;
+    size_t symbolSize = sizeof(Elf64_Sym);
+
+    for (size_t offset = 0; offset + sizeof(Elf64_Dyn) <= dynamic.fileSize; offset += sizeof(Elf64_Dyn))
+    {
+        const auto entry = Read<Elf64_Dyn>(m_data + dynamic.fileOffset + offset);
+        if (entry.d_tag == DT_NULL)
+            break;
+
+        switch (entry.d_tag)
+        {
+        case DT_RELA:
+            relocations = entry.d_un.d_ptr;
+            break;
+
+        case DT_RELASZ:
+            relocationsSize = entry.d_un.d_val;
+            break;
+
+        case DT_RELAENT:
+            relocationSize = entry.d_un.d_val;
+            break;
+
+        case DT_JMPREL:
+            pltRelocations = entry.d_un.d_ptr;
+            break;
+
+        case DT_PLTRELSZ:
+            pltRelocationsSize = entry.d_un.d_val;
+            break;
+
+        case DT_PLTREL:
+            pltRelocationType = entry.d_un.d_val;
+            break;
+
+        case DT_SYMTAB:
+            symbols = entry.d_un.d_ptr;
+            break;
+
+        case DT_SYMENT:
+            symbolSize = entry.d_un.d_val;
+            break;
+
+        case DT_RELSZ:
+            // x86_64 and aarch64 only use relocations with addends
+            if (entry.d_un.d_val)
+                return mtl::unexpected(ErrorCode::Unsupported);
+            break;
+
+        case DT_NEEDED:
+        case DT_TEXTREL:
+            return mtl::unexpected(ErrorCode::Unsupported);
+        }
+    }
+
+    if (relocationSize != sizeof(Elf64_Rela) || symbolSize != sizeof(Elf64_Sym) || pltRelocationType != DT_RELA)
+        return mtl::unexpected(ErrorCode::Unsupported);
+
+    if (auto result = ParseRelocations(relocations, relocationsSize, symbols); !result)
+        return result;
+
+    if (auto result = ParseRelocations(pltRelocations, pltRelocationsSize, symbols); !result)
+        return result;
+
+    std::sort(m_relocations.begin(), m_relocations.end(),
+              [](const Relocation& a, const Relocation& b) { return a.address < b.address; });
+
+    // Relocations must target data: text relocations would make code pages private to each process
+    for (const auto& relocation : m_relocations)
+    {
+        const auto segment = FindSegment(relocation.address);
+        if (!segment || relocation.address + sizeof(uint64_t) > segment->address + segment->memorySize)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        if (segment->IsExecutable())
+            return mtl::unexpected(ErrorCode::Unsupported);
+    }
+
+    return {};
+}
+
+mtl::expected<void, ErrorCode> ElfImage::ParseRelocations(uintptr_t address, size_t size, uintptr_t symbols)
+{
+    if (size == 0)
+        return {};
+
+    const auto relocations = GetFileContent(address, size);
+    if (!relocations || size % sizeof(Elf64_Rela))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    for (size_t offset = 0; offset != size; offset += sizeof(Elf64_Rela))
+    {
+        const auto rela = Read<Elf64_Rela>(relocations + offset);
+        const auto type = ELF64_R_TYPE(rela.r_info);
+
+        if (type == kRelocationNone)
+            continue;
+
+        if (type == kRelocationRelative)
+        {
+            m_relocations.push_back(Relocation{rela.r_offset, (uint64_t)rela.r_addend, true});
+            continue;
+        }
+
+        if (type != kRelocationAbsolute && type != kRelocationGlobalData && type != kRelocationJumpSlot)
+            return mtl::unexpected(ErrorCode::Unsupported);
+
+        const auto symbolData = GetFileContent(symbols + ELF64_R_SYM(rela.r_info) * sizeof(Elf64_Sym), sizeof(Elf64_Sym));
+        if (!symbols || !symbolData)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        // Undefined symbols would need a dynamic linker
+        const auto symbol = Read<Elf64_Sym>(symbolData);
+        if (symbol.st_shndx == SHN_UNDEF)
+            return mtl::unexpected(ErrorCode::Unsupported);
+
+        m_relocations.push_back(Relocation{rela.r_offset, symbol.st_value + rela.r_addend, symbol.st_shndx != SHN_ABS});
+    }
+
+    return {};
+}
+
+const ElfImage::Segment* ElfImage::FindSegment(uintptr_t address) const
+{
+    const auto it = std::lower_bound(m_segments.begin(), m_segments.end(), address, [](const Segment& segment, uintptr_t value) {
+        return segment.address + segment.memorySize <= value;
+    });
+
+    if (it == m_segments.end() || address < it->address)
+        return nullptr;
+
+    return it;
+}
+
+const char* ElfImage::GetFileContent(uintptr_t address, size_t size) const
+{
+    const auto segment = FindSegment(address);
+    if (!segment)
+        return nullptr;
+
+    const auto offset = address - segment->address;
+    if (offset > segment->fileSize || size > segment->fileSize - offset)
+        return nullptr;
+
+    return m_data + segment->fileOffset + offset;
+}
+
+bool ElfImage::HasRelocations(uintptr_t pageAddress) const
+{
+    // A relocation can start in the previous page and spill into this one
+    const auto start = pageAddress - std::min<uintptr_t>(pageAddress, sizeof(uint64_t) - 1);
+    const auto it = std::lower_bound(m_relocations.begin(), m_relocations.end(), start,
+                                     [](const Relocation& relocation, uintptr_t value) { return relocation.address < value; });
+
+    return it != m_relocations.end() && it->address < pageAddress + mtl::kMemoryPageSize;
+}
+
+bool ElfImage::HasFileContent(uintptr_t pageAddress) const
+{
+    for (const auto& segment : m_segments)
+    {
+        if (segment.address < pageAddress + mtl::kMemoryPageSize && segment.address + segment.fileSize > pageAddress)
+            return true;
+    }
+
+    return false;
+}
+
+void ElfImage::ReadPage(uintptr_t pageAddress, void* page) const
+{
+    memset(page, 0, mtl::kMemoryPageSize);
+
+    for (const auto& segment : m_segments)
+    {
+        const auto begin = std::max(segment.address, pageAddress);
+        const auto end = std::min(segment.address + segment.fileSize, pageAddress + mtl::kMemoryPageSize);
+        if (begin < end)
+            memcpy(static_cast<char*>(page) + (begin - pageAddress), m_data + segment.fileOffset + (begin - segment.address),
+                   end - begin);
+    }
+}
+
+void ElfImage::RelocatePage(uintptr_t pageAddress, uintptr_t loadBias, void* page) const
+{
+    const auto start = pageAddress - std::min<uintptr_t>(pageAddress, sizeof(uint64_t) - 1);
+    auto it = std::lower_bound(m_relocations.begin(), m_relocations.end(), start,
+                               [](const Relocation& relocation, uintptr_t value) { return relocation.address < value; });
+
+    for (; it != m_relocations.end() && it->address < pageAddress + mtl::kMemoryPageSize; ++it)
+    {
+        const uint64_t value = it->relative ? it->value + loadBias : it->value;
+
+        // Relocations are not necessarily aligned, only write the bytes that are in this page
+        uint8_t bytes[sizeof(uint64_t)];
+        memcpy(bytes, &value, sizeof(value));
+
+        for (size_t i = 0; i != sizeof(bytes); ++i)
+        {
+            const auto address = it->address + i;
+            if (address >= pageAddress && address < pageAddress + mtl::kMemoryPageSize)
+                static_cast<uint8_t*>(page)[address - pageAddress] = bytes[i];
+        }
+    }
+}
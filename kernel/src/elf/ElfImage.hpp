@@ -0,0 +1,114 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <metal/expected.hpp>
+#include <metal/unique_ptr.hpp>
+#include <metal/vector.hpp>
+
+// Read-only view of an ELF executable for the current architecture, either a regular executable (ET_EXEC) or a position
+// independent one (ET_DYN).
+//
+// Nothing is copied: segment contents are read straight from the file, which must stay mapped for as long as this object
+// lives. Addresses are link-time addresses, position independent executables need to add their load bias to them.
+//
+// Dynamic relocations are validated and resolved when the image is created. Only self-contained executables are supported:
+// there is no dynamic linker, so anything that needs one (PT_INTERP, DT_NEEDED, undefined symbols) is rejected. So are text
+// relocations, which would prevent sharing code pages between processes.
+class ElfImage
+{
+public:
+    struct Segment
+    {
+        uintptr_t address; // Link-time virtual address
+        size_t memorySize; // Size in memory, anything past 'fileSize' is zero-initialized
+        size_t fileOffset; // Offset of the content in the file
+        size_t fileSize;   // Size of the content in the file
+        uint32_t flags;    // PF_R, PF_W and PF_X
+
+        bool IsWritable() const;
+        bool IsExecutable() const;
+    };
+
+    // A resolved relocation: the 64 bits at 'address' are set to 'value', plus the load bias if 'relative' is set
+    struct Relocation
+    {
+        uintptr_t address;
+        uint64_t value;
+        bool relative;
+    };
+
+    // Parse and validate the executable at 'data'
+    static mtl::expected<mtl::unique_ptr<ElfImage>, ErrorCode> Create(const void* data, size_t size);
+
+    bool IsPositionIndependent() const { return m_positionIndependent; }
+    uintptr_t GetEntryPoint() const { return m_entryPoint; }
+
+    // Page aligned range covered by all the segments
+    uintptr_t GetStart() const { return m_start; }
+    uintptr_t GetEnd() const { return m_end; }
+
+    // Loadable segments, sorted by address. Segments never share a page.
+    const mtl::vector<Segment>& GetSegments() const { return m_segments; }
+    const Segment* FindSegment(uintptr_t address) const;
+
+    // Relocations, sorted by address
+    const mtl::vector<Relocation>& GetRelocations() const { return m_relocations; }
+
+    // Does the page at 'pageAddress' need relocations?
+    bool HasRelocations(uintptr_t pageAddress) const;
+
+    // Does the page at 'pageAddress' hold anything from the file? If not, it is all zeroes.
+    bool HasFileContent(uintptr_t pageAddress) const;
+
+    // Copy the content of the page at 'pageAddress' to 'page': file content, and zeroes everywhere else
+    void ReadPage(uintptr_t pageAddress, void* page) const;
+
+    // Apply the relocations that touch the page at 'pageAddress' to 'page', for an image loaded at 'loadBias'
+    void RelocatePage(uintptr_t pageAddress, uintptr_t loadBias, void* page) const;
+
+private:
+    ElfImage() = default;
+
+    mtl::expected<void, ErrorCode> ParseDynamic(const Segment& dynamic);
+    mtl::expected<void, ErrorCode> ParseRelocations(uintptr_t address, size_t size, uintptr_t symbols);
+
+    // Get a pointer to the file content at 'address', or nullptr if [address, address + size) isn't in the file
+    const char* GetFileContent(uintptr_t address, size_t size) const;
+
+    const char* m_data{};
+    size_t m_size{};
+    bool m_positionIndependent{};
+    uintptr_t m_entryPoint{};
+    uintptr_t m_start{};
+    uintptr_t m_end{};
+    mtl::vector<Segment> m_segments;
+    mtl::vector<Relocation> m_relocations;
+};
@@ -0,0 +1,198 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ElfLoader.hpp"
+#include "arch.hpp"
+#include "memory.hpp"
+#include <metal/helpers.hpp>
+#include <metal/log.hpp>
+
+// Executables that were opened, they are never released (neither is the initrd)
+static mtl::vector<mtl::shared_ptr<ElfExecutable>> g_executables;
+static Spinlock g_executablesLock;
+
+// Find an executable that was already opened, g_executablesLock must be held
+static mtl::shared_ptr<ElfExecutable> FindExecutable(const InitrdFile& file)
+{
+    for (const auto& executable : g_executables)
+    {
+        if (executable->GetFile().data == file.data)
+            return executable;
+    }
+
+    return {};
+}
+
+ElfExecutable::ElfExecutable(const InitrdFile& file, mtl::unique_ptr<ElfImage> image)
+    : m_file(file), m_image(std::move(image))
+{
+    m_pages.resize((m_image->GetEnd() - m_image->GetStart()) >> mtl::kMemoryPageShift);
+}
+
+mtl::expected<mtl::shared_ptr<ElfExecutable>, ErrorCode> ElfExecutable::Open(mtl::string_view path)
+{
+    const auto file = InitrdOpen(path);
+    if (!file)
+        return mtl::unexpected(file.error());
+
+    g_executablesLock.Lock();
+    auto executable = FindExecutable(*file);
+    g_executablesLock.Unlock();
+
+    if (executable)
+        return executable;
+
+    // Parse the image without holding the lock
+    auto image = ElfImage::Create(file->data, file->size);
+    if (!image)
+        return mtl::unexpected(image.error());
+
+    mtl::shared_ptr<ElfExecutable> newExecutable(new ElfExecutable(*file, std::move(*image)));
+
+    // Someone else might have opened the same file in the meantime
+    g_executablesLock.Lock();
+    executable = FindExecutable(*file);
+    if (!executable)
+    {
+        executable = newExecutable;
+        g_executables.push_back(executable);
+    }
+    g_executablesLock.Unlock();
+
+    return executable;
+}
+
+mtl::expected<ElfPage, ErrorCode> ElfExecutable::GetPage(uintptr_t pageAddress, uintptr_t loadBias)
+{
+    if (!mtl::IsAligned(pageAddress, mtl::kMemoryPageSize) || pageAddress < m_image->GetStart() ||
+        pageAddress >= m_image->GetEnd())
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    // The content of relocated pages depends on where the image is loaded
+    if (m_image->HasRelocations(pageAddress))
+    {
+        const auto frame = ReadPage(pageAddress, loadBias, true);
+        if (!frame)
+            return mtl::unexpected(frame.error());
+
+        return ElfPage{.frame = *frame, .shared = false, .read = true};
+    }
+
+    // Nothing to read (bss)
+    if (!m_image->HasFileContent(pageAddress))
+    {
+        const auto zeroPage = MemoryGetZeroPage();
+        if (!zeroPage)
+            return mtl::unexpected(zeroPage.error());
+
+        return ElfPage{.frame = *zeroPage, .shared = true, .read = false};
+    }
+
+    const auto index = (pageAddress - m_image->GetStart()) >> mtl::kMemoryPageShift;
+
+    m_pagesLock.Lock();
+    const auto page = m_pages[index];
+    m_pagesLock.Unlock();
+
+    if (page)
+        return ElfPage{.frame = page, .shared = true, .read = false};
+
+    // Read the page without holding the lock
+    const auto frame = ReadPage(pageAddress, loadBias, false);
+    if (!frame)
+        return mtl::unexpected(frame.error());
+
+    // Someone else might have read the same page in the meantime, keep theirs as it might be mapped already
+    m_pagesLock.Lock();
+    const auto existing = m_pages[index];
+    if (!existing)
+        m_pages[index] = *frame;
+    m_pagesLock.Unlock();
+
+    if (existing)
+    {
+        FreeFrames(*frame, 1);
+        return ElfPage{.frame = existing, .shared = true, .read = true};
+    }
+
+    return ElfPage{.frame = *frame, .shared = true, .read = true};
+}
+
+mtl::expected<PhysicalAddress, ErrorCode> ElfExecutable::ReadPage(uintptr_t pageAddress, uintptr_t loadBias,
+                                                                  bool relocate) const
+{
+    const auto frame = AllocFrames(1);
+    if (!frame)
+        return mtl::unexpected(frame.error());
+
+    const auto page = ArchMapSystemMemory(*frame, 1, mtl::PageFlags::KernelData_RW);
+    if (!page)
+    {
+        FreeFrames(*frame, 1);
+        return mtl::unexpected(page.error());
+    }
+
+    m_image->ReadPage(pageAddress, *page);
+
+    if (relocate)
+        m_image->RelocatePage(pageAddress, loadBias, *page);
+
+    return *frame;
+}
+
+mtl::expected<ElfProgram, ErrorCode> ElfLoad(mtl::string_view path, uintptr_t loadAddress)
+{
+    auto executable = ElfExecutable::Open(path);
+    if (!executable)
+    {
+        MTL_LOG(Error) << "[KRNL] Unable to load executable " << path << ": " << executable.error();
+        return mtl::unexpected(executable.error());
+    }
+
+    const auto& image = (*executable)->GetImage();
+
+    uintptr_t loadBias = 0;
+    if (image.IsPositionIndependent())
+    {
+        if (!mtl::IsAligned(loadAddress, mtl::kMemoryPageSize))
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        loadBias = loadAddress - image.GetStart();
+    }
+
+    ElfProgram program{
+        .executable = std::move(*executable), .loadBias = loadBias, .entryPoint = image.GetEntryPoint() + loadBias, .regions = {}};
+
+    for (const auto& segment : image.GetSegments())
+    {
+        program.regions.push_back(
+            ElfRegion{.start = mtl::AlignDown(segment.address, mtl::kMemoryPageSize) + loadBias,
+                      .end = mtl::AlignUp(segment.address + segment.memorySize, mtl::kMemoryPageSize) + loadBias,
+                      .flags = segment.flags});
+    }
+
+    return program;
+}
@@ -0,0 +1,97 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include "Spinlock.hpp"
+#include "elf/ElfImage.hpp"
+#include "initrd.hpp"
+#include <metal/arch.hpp>
+#include <metal/expected.hpp>
+#include <metal/shared_ptr.hpp>
+#include <metal/string_view.hpp>
+#include <metal/unique_ptr.hpp>
+#include <metal/vector.hpp>
+
+// A frame holding the content of an executable's page
+struct ElfPage
+{
+    PhysicalAddress frame;
+    bool shared; // Shared with other processes (or the zero page): map it read-only and copy it on write
+    bool read;   // The content had to be read from the file
+};
+
+// An executable from the initrd. There is a single instance per file, shared by all the processes running it.
+//
+// Nothing is read until a process touches it. Pages that are the same for every process (code, read-only data and the
+// initial content of data pages) are read once and then mapped in every process. Pages past the end of the file content
+// (bss) are the zero page. Only pages with relocations are private, as their content depends on where the image is loaded.
+class ElfExecutable
+{
+public:
+    // Open an executable, or get the instance that is already opened
+    static mtl::expected<mtl::shared_ptr<ElfExecutable>, ErrorCode> Open(mtl::string_view path);
+
+    const InitrdFile& GetFile() const { return m_file; }
+    const ElfImage& GetImage() const { return *m_image; }
+
+    // Get a frame for the page at 'pageAddress' (link-time address) of a process that loaded the image at 'loadBias'
+    mtl::expected<ElfPage, ErrorCode> GetPage(uintptr_t pageAddress, uintptr_t loadBias);
+
+private:
+    ElfExecutable(const InitrdFile& file, mtl::unique_ptr<ElfImage> image);
+
+    // Allocate a frame and read the page at 'pageAddress' into it
+    mtl::expected<PhysicalAddress, ErrorCode> ReadPage(uintptr_t pageAddress, uintptr_t loadBias, bool relocate) const;
+
+    InitrdFile m_file;
+    mtl::unique_ptr<ElfImage> m_image;
+    mtl::vector<PhysicalAddress> m_pages; // Shared pages indexed from the start of the image, 0 until they are read
+    Spinlock m_pagesLock;                 // Protects m_pages, it isn't held while pages are read
+};
+
+// A range of pages where an executable is mapped in a process
+struct ElfRegion
+{
+    uintptr_t start; // Page aligned
+    uintptr_t end;   // Page aligned
+    uint32_t flags;  // Segment flags: PF_R, PF_W and PF_X
+};
+
+// An executable loaded in a process. Regions are not backed by anything: page faults get their content from the
+// executable, with 'address - loadBias' being the link-time address of the page.
+struct ElfProgram
+{
+    mtl::shared_ptr<ElfExecutable> executable;
+    uintptr_t loadBias;
+    uintptr_t entryPoint;
+    mtl::vector<ElfRegion> regions;
+};
+
+// Load an executable from the initrd. Position independent executables are loaded at 'loadAddress', others where they
+// were linked.
+mtl::expected<ElfProgram, ErrorCode> ElfLoad(mtl::string_view path, uintptr_t loadAddress);
@@ -0,0 +1,165 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CpioArchive.hpp"
+#include <algorithm>
+#include <cstring>
+#include <metal/helpers.hpp>
+
+// "newc" header, all fields are 8 hexadecimal digits. The header is followed by the file name (including its terminating null
+// character) and then by the file data, both padded to 4 bytes.
+struct CpioHeader
+{
+    char magic[6]; // "070701", or "070702" when there is a checksum
+    char inode[8];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char linkCount[8];
+    char modificationTime[8];
+    char fileSize[8];
+    char deviceMajor[8];
+    char deviceMinor[8];
+    char rdeviceMajor[8];
+    char rdeviceMinor[8];
+    char nameSize[8];
+    char checksum[8];
+};
+
+static_assert(sizeof(CpioHeader) == 110);
+
+static mtl::expected<uint32_t, ErrorCode> ParseHex(const char (&field)[8])
+{
+    uint32_t value = 0;
+    for (const char c : field)
+    {
+        if (c >= '0' && c <= '9')
+            value = (value << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            value = (value << 4) | (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            value = (value << 4) | (c - 'A' + 10);
+        else
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+    }
+    return value;
+}
+
+// Strip leading "/" and "./" so that "./bin/init", "/bin/init" and "bin/init" are the same file
+static mtl::string_view NormalizePath(mtl::string_view path)
+{
+    const char* begin = path.begin();
+    const char* end = path.end();
+
+    for (;;)
+    {
+        if (begin != end && *begin == '/')
+            ++begin;
+        else if (end - begin >= 2 && begin[0] == '.' && begin[1] == '/')
+            begin += 2;
+        else
+            break;
+    }
+
+    // The root directory itself
+    if (end - begin == 1 && *begin == '.')
+        begin = end;
+
+    return mtl::string_view(begin, end - begin);
+}
+
+static int ComparePaths(mtl::string_view a, mtl::string_view b)
+{
+    const auto length = std::min(a.size(), b.size());
+    if (length > 0)
+    {
+        if (const auto result = memcmp(a.data(), b.data(), length))
+            return result;
+    }
+
+    return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+mtl::expected<mtl::unique_ptr<CpioArchive>, ErrorCode> CpioArchive::Create(const void* data, size_t size)
+{
+    const auto archive = static_cast<const char*>(data);
+
+    mtl::unique_ptr<CpioArchive> result(new CpioArchive());
+
+    size_t offset = 0;
+    for (;;)
+    {
+        if (offset > size || size - offset < sizeof(CpioHeader))
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        const auto& header = *reinterpret_cast<const CpioHeader*>(archive + offset);
+        if (memcmp(header.magic, "070701", 6) && memcmp(header.magic, "070702", 6))
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        const auto mode = ParseHex(header.mode);
+        const auto fileSize = ParseHex(header.fileSize);
+        const auto nameSize = ParseHex(header.nameSize);
+        if (!mode || !fileSize || !nameSize)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        // The name size includes the terminating null character
+        const auto nameOffset = offset + sizeof(CpioHeader);
+        if (*nameSize == 0 || *nameSize > size - nameOffset)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        const auto dataOffset = mtl::AlignUp(nameOffset + *nameSize, 4);
+        if (dataOffset > size || *fileSize > size - dataOffset)
+            return mtl::unexpected(ErrorCode::InvalidArguments);
+
+        const mtl::string_view name(archive + nameOffset, *nameSize - 1);
+        if (name == mtl::string_view("TRAILER!!!"))
+            break;
+
+        const auto path = NormalizePath(name);
+        if (path.size() > 0)
+            result->m_files.push_back(File{path, archive + dataOffset, *fileSize, *mode});
+
+        offset = mtl::AlignUp(dataOffset + *fileSize, 4);
+    }
+
+    std::sort(result->m_files.begin(), result->m_files.end(),
+              [](const File& a, const File& b) { return ComparePaths(a.path, b.path) < 0; });
+
+    return result;
+}
+
+const CpioArchive::File* CpioArchive::Find(mtl::string_view path) const
+{
+    path = NormalizePath(path);
+
+    const auto it = std::lower_bound(m_files.begin(), m_files.end(), path,
+                                     [](const File& file, mtl::string_view path) { return ComparePaths(file.path, path) < 0; });
+
+    if (it == m_files.end() || !(it->path == path))
+        return nullptr;
+
+    return it;
+}
@@ -0,0 +1,72 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <metal/expected.hpp>
+#include <metal/string_view.hpp>
+#include <metal/unique_ptr.hpp>
+#include <metal/vector.hpp>
+
+// Read-only view of a cpio archive in the "newc" format (what "cpio -H newc" and Linux initramfs use).
+//
+// Nothing is copied: file names and contents point straight into the archive, which must stay mapped for as long as this
+// object lives. Files are indexed by path in sorted order, lookups are O(log n).
+class CpioArchive
+{
+public:
+    static constexpr uint32_t kModeTypeMask = 0170000;
+    static constexpr uint32_t kModeDirectory = 0040000;
+    static constexpr uint32_t kModeRegular = 0100000;
+
+    struct File
+    {
+        mtl::string_view path; // Relative to the root, without a leading "/" or "./"
+        const void* data;
+        size_t size;
+        uint32_t mode; // Type and permissions
+
+        bool IsDirectory() const { return (mode & kModeTypeMask) == kModeDirectory; }
+        bool IsRegular() const { return (mode & kModeTypeMask) == kModeRegular; }
+    };
+
+    // Parse and index the archive at 'data'
+    static mtl::expected<mtl::unique_ptr<CpioArchive>, ErrorCode> Create(const void* data, size_t size);
+
+    // Find a file by path (with or without a leading "/")
+    const File* Find(mtl::string_view path) const;
+
+    // All files, sorted by path
+    const mtl::vector<File>& GetFiles() const { return m_files; }
+
+private:
+    CpioArchive() = default;
+
+    mtl::vector<File> m_files;
+};
@@ -0,0 +1,91 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "initrd.hpp"
+#include "arch.hpp"
+#include "fs/CpioArchive.hpp"
+#include <metal/helpers.hpp>
+#include <metal/log.hpp>
+
+static mtl::unique_ptr<CpioArchive> g_initrd;
+static const char* g_initrdAddress{};
+static PhysicalAddress g_initrdPhysicalAddress{};
+
+void InitrdInitialize(const BootInfo& bootInfo)
+{
+    const BootModule* module = nullptr;
+    for (uint32_t i = 0; i != bootInfo.moduleCount; ++i)
+    {
+        if (mtl::string_view(bootInfo.modules[i].name) == mtl::string_view("initrd"))
+            module = &bootInfo.modules[i];
+    }
+
+    if (!module)
+    {
+        MTL_LOG(Info) << "[KRNL] No initrd";
+        return;
+    }
+
+    // Map the module where it is, the archive is indexed in place
+    const auto pageOffset = module->address & (mtl::kMemoryPageSize - 1);
+    const auto pageCount = mtl::AlignUp(pageOffset + module->size, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift;
+    const auto pages = ArchMapSystemMemory(module->address - pageOffset, pageCount, mtl::PageFlags::KernelData_RO);
+    if (!pages)
+    {
+        MTL_LOG(Error) << "[KRNL] Unable to map initrd: " << pages.error();
+        return;
+    }
+
+    const auto address = static_cast<const char*>(*pages) + pageOffset;
+    auto archive = CpioArchive::Create(address, module->size);
+    if (!archive)
+    {
+        MTL_LOG(Error) << "[KRNL] Invalid initrd: " << archive.error();
+        return;
+    }
+
+    g_initrd = std::move(*archive);
+    g_initrdAddress = address;
+    g_initrdPhysicalAddress = module->address;
+
+    MTL_LOG(Info) << "[KRNL] Initrd: " << g_initrd->GetFiles().size() << " files, " << module->size << " bytes";
+}
+
+mtl::expected<InitrdFile, ErrorCode> InitrdOpen(mtl::string_view path)
+{
+    if (!g_initrd)
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    const auto file = g_initrd->Find(path);
+    if (!file)
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    if (!file->IsRegular())
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto offset = static_cast<const char*>(file->data) - g_initrdAddress;
+    return InitrdFile{file->data, file->size, g_initrdPhysicalAddress + offset};
+}
@@ -0,0 +1,48 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include <cstddef>
+#include <metal/arch.hpp>
+#include <metal/expected.hpp>
+#include <metal/string_view.hpp>
+#include <rainbow/boot.hpp>
+
+// A file in the initrd. Nothing is copied: 'data' points into the initrd's pages, which are never released.
+struct InitrdFile
+{
+    const void* data;                // Kernel mapping of the file's content
+    size_t size;                     // Size in bytes
+    PhysicalAddress physicalAddress; // To map the content elsewhere (e.g. executables), only 4 bytes aligned
+};
+
+// Index the initrd ("initrd" boot module, a cpio archive in the "newc" format) if the bootloader loaded one
+void InitrdInitialize(const BootInfo& bootInfo);
+
+// Look up a regular file in the initrd
+mtl::expected<InitrdFile, ErrorCode> InitrdOpen(mtl::string_view path);
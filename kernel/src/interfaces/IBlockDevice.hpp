@@ -0,0 +1,81 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include <cstdint>
+#include <metal/arch.hpp>
+#include <metal/expected.hpp>
+
+// Asynchronous block I/O request. The memory is owned by the caller until the completion callback is invoked.
+struct BlockRequest
+{
+    enum class Operation
+    {
+        Read,
+        Write,
+        Flush, // Make previous writes durable
+    };
+
+    // Physically contiguous piece of the request's data
+    struct Segment
+    {
+        mtl::PhysicalAddress address;
+        uint32_t length;
+    };
+
+    using Callback = void(BlockRequest* request);
+
+    Operation operation;
+    uint64_t sector;         // First sector, in units of 512 bytes
+    const Segment* segments; // Data buffers, transferred without copies
+    int segmentCount;
+    Callback* callback;      // Called on completion, possibly from interrupt context
+    void* context;           // For use by the callback
+    ErrorCode status;        // Result of the request, valid when the callback is invoked
+
+    // Driver private
+    BlockRequest* next;
+};
+
+struct IBlockDevice
+{
+    virtual ~IBlockDevice() = default;
+
+    // Size of the device in units of 512 bytes
+    virtual uint64_t GetSectorCount() const = 0;
+
+    // Queue a request. Requests are not guaranteed to reach the device before Kick() is called, which gives the driver
+    // a chance to merge adjacent requests and to notify the device once per batch.
+    virtual mtl::expected<void, ErrorCode> Submit(BlockRequest* request) = 0;
+
+    // Send queued requests to the device
+    virtual void Kick() = 0;
+
+    // Process completed requests. This is only needed when the device is not interrupt driven.
+    virtual void Poll() = 0;
+};
@@ -0,0 +1,130 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "ErrorCode.hpp"
+#include <cstdint>
+#include <metal/arch.hpp>
+#include <metal/expected.hpp>
+
+// Checksum and segmentation work delegated to the device
+struct NetworkOffload
+{
+    enum class Segmentation : uint8_t
+    {
+        None,
+        TcpIpv4,
+        TcpIpv6,
+    };
+
+    bool partialChecksum;      // Device computes the checksum from checksumStart to the end of the packet
+    Segmentation segmentation; // Device splits the packet in segments of 'segmentSize' bytes of payload
+    uint16_t headerLength;     // Length of the Ethernet + IP + TCP headers when segmenting
+    uint16_t segmentSize;
+    uint16_t checksumStart;
+    uint16_t checksumOffset;   // Where to store the checksum, relative to checksumStart
+};
+
+// Packet to transmit. The memory is owned by the caller until the completion callback is invoked.
+struct NetworkTransmitRequest
+{
+    // Packets made of more segments must be linearized by the caller
+    static constexpr int kMaxSegments = 15;
+
+    // Physically contiguous piece of the packet
+    struct Segment
+    {
+        mtl::PhysicalAddress address;
+        uint32_t length;
+    };
+
+    using Callback = void(NetworkTransmitRequest* request);
+
+    const Segment* segments; // Packet data starting with the Ethernet header, transferred without copies
+    int segmentCount;
+    NetworkOffload offload;
+    Callback* callback;      // Called once the device is done with the data
+    void* context;           // For use by the callback
+    ErrorCode status;        // Result of the request, valid when the callback is invoked
+
+    // Driver private
+    NetworkTransmitRequest* next;
+};
+
+// Received packet. The data lives in the driver's buffers and must be handed back with INetworkDevice::Release().
+struct NetworkPacket
+{
+    static constexpr int kMaxFragments = 4;
+
+    struct Fragment
+    {
+        const void* data;
+        uint32_t length;
+    };
+
+    Fragment fragments[kMaxFragments]; // Packet data starting with the Ethernet header
+    int fragmentCount;
+    bool checksumValid;                // The device validated the checksum
+
+    // Driver private
+    uint16_t queue;
+    uint16_t buffers[kMaxFragments];
+};
+
+/*
+    Raw packet interface. Consumers (network stack, user space rings) get the driver's receive buffers directly and
+    give them back when done, which lets the driver recycle them without copying any data.
+*/
+
+struct INetworkDevice
+{
+    using ReceiveCallback = void(INetworkDevice* device, void* context);
+
+    virtual ~INetworkDevice() = default;
+
+    virtual void GetMacAddress(uint8_t address[6]) const = 0;
+    virtual int GetMtu() const = 0;
+
+    // Queue a packet. Packets are not guaranteed to reach the device before Kick() is called, which lets the driver
+    // notify the device once per batch. Returns OutOfMemory if the transmit queue is full.
+    virtual mtl::expected<void, ErrorCode> Transmit(NetworkTransmitRequest* request) = 0;
+
+    // Send queued packets to the device
+    virtual void Kick() = 0;
+
+    // Fetch up to 'maxCount' received packets, returns the number of packets fetched
+    virtual int Receive(NetworkPacket* packets, int maxCount) = 0;
+
+    // Give the packet's buffers back to the driver
+    virtual void Release(const NetworkPacket& packet) = 0;
+
+    // Called when packets are received, possibly from interrupt context. This is not called when polling.
+    virtual void SetReceiveCallback(ReceiveCallback* callback, void* context) = 0;
+
+    // Process transmit completions. Receive() doesn't need this.
+    virtual void Poll() = 0;
+};
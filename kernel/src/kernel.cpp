@@ -26,12 +26,15 @@
 
 #include "Interrupt.hpp"
 #include "Scheduler.hpp"
+#include "Spinlock.hpp"
 #include "Task.hpp"
 #include "acpi/Acpi.hpp"
 #include "arch.hpp"
 #include "display.hpp"
+#include "initrd.hpp"
 #include "memory.hpp"
 #include "pci.hpp"
+#include "timing.hpp"
 #include "uefi.hpp"
 #include <chrono>
 #include <metal/log.hpp>
@@ -73,6 +76,9 @@ static void Task1Entry(Task* task, const void* /*args*/)
     for (;;)
     {
         // MTL_LOG(Info) << "Task 1";
+
+        // Nothing else to do, zero frames so that page faults and heap growth don't have to
+        MemoryRefillZeroedFrames();
         SchedulerYield();
     }
 }
@@ -112,6 +118,8 @@ void TestInterrupts()
 
 [[noreturn]] void KernelMain(const BootInfo& bootInfo)
 {
+    TimingInitialize(bootInfo.timing);
+
     ArchInitialize();
 
     MTL_LOG(Info) << "[KRNL] Rainbow OS kernel starting";
@@ -123,6 +131,8 @@ void TestInterrupts()
     // Once UEFI is initialized, it is safe to release boot services code and data.
     MemoryInitialize();
 
+    InitrdInitialize(bootInfo);
+
     bool bHasAcpi = false;
     if (auto rsdp = UefiFindAcpiRsdp())
     {
@@ -159,6 +169,9 @@ void TestInterrupts()
     PciInitialize();
     DisplayInitialize();
 
+    TimingLogBootPhases();
+    SpinlockLogStats();
+
     // TODO: at this point we can reclaim AcpiReclaimable memory (?)
 
     SchedulerInitialize(new Task(Task1Entry, nullptr));
@@ -25,7 +25,10 @@
 */
 
 #include "memory.hpp"
+#include "AddressSpace.hpp"
+#include "Spinlock.hpp"
 #include "arch.hpp"
+#include <cstdlib>
 #include <metal/arch.hpp>
 #include <metal/helpers.hpp>
 #include <metal/log.hpp>
@@ -33,7 +36,22 @@
 
 static_assert(mtl::kMemoryPageSize == efi::kPageSize);
 
+// The heap starts at the end of the kernel image and grows up to the end of the address space
+extern "C" char __heap_start[];
+static constexpr uintptr_t kHeapLimit = 0xFFFFFFFFFFFFF000ull;
+
+// Pool of frames zeroed ahead of time. It is a fixed size array as frames are taken while growing the heap.
+static constexpr int kZeroedFramePoolSize = 64;
+static constexpr int kZeroedFramesPerRefill = 8; // Bounds the time spent in MemoryRefillZeroedFrames()
+
+// Room kept in the memory map for FreeFrames(), which can need two more descriptors and can't grow the vector
+static constexpr int kSpareMemoryDescriptors = 64;
+
 mtl::vector<efi::MemoryDescriptor> g_systemMemoryMap;
+static PhysicalAddress g_zeroPage{};
+static PhysicalAddress g_zeroedFrames[kZeroedFramePoolSize];
+static int g_zeroedFrameCount{0};
+static Spinlock g_zeroedFramesLock;
 
 static void Log(const mtl::vector<efi::MemoryDescriptor>& memoryMap)
 {
@@ -93,6 +111,29 @@ void MemoryEarlyInit(mtl::vector<efi::MemoryDescriptor> memoryMap)
 {
     g_systemMemoryMap = std::move(memoryMap);
     Tidy(g_systemMemoryMap);
+
+    // Reserve the heap's address space now: growing the heap happens with the malloc lock held and can't allocate
+    if (!g_kernelAddressSpace.AddRegion(VmRegion{.start = (uintptr_t)__heap_start,
+                                                 .end = kHeapLimit,
+                                                 .protection = VmRead | VmWrite,
+                                                 .type = VmRegionType::Committed}))
+    {
+        MTL_LOG(Fatal) << "[KRNL] Failed to reserve the heap";
+        std::abort();
+    }
+}
+
+// Allocate the zero page once, before anyone can fault on anonymous memory
+static void InitializeZeroPage()
+{
+    const auto frame = AllocZeroedFrame();
+    if (!frame)
+    {
+        MTL_LOG(Fatal) << "[KRNL] Failed to allocate the zero page: " << frame.error();
+        std::abort();
+    }
+
+    g_zeroPage = *frame;
 }
 
 void MemoryInitialize()
@@ -101,6 +142,14 @@ void MemoryInitialize()
 
     Tidy(g_systemMemoryMap);
     Log(g_systemMemoryMap);
+
+    g_systemMemoryMap.reserve(g_systemMemoryMap.size() + kSpareMemoryDescriptors);
+
+    InitializeZeroPage();
+
+    // Task 1 refills the pool when it has nothing else to do, but that is only once the scheduler runs. Start full.
+    for (int i = 0; i < kZeroedFramePoolSize; i += kZeroedFramesPerRefill)
+        MemoryRefillZeroedFrames();
 }
 
 const efi::MemoryDescriptor* MemoryFindSystemDescriptor(PhysicalAddress address)
@@ -178,13 +227,96 @@ mtl::expected<PhysicalAddress, ErrorCode> AllocFrames(int pageCount)
     return address;
 }
 
+// Return [address, address + pageCount) to conventional memory. The range is inside the KernelData descriptor at 'index'
+// and there is room for two more descriptors.
+static void ReleaseFrames(size_t index, PhysicalAddress address, uint64_t pageCount)
+{
+    const auto descriptor = g_systemMemoryMap[index];
+    const auto end = address + pageCount * mtl::kMemoryPageSize;
+    const auto descriptorEnd = descriptor.physicalStart + descriptor.numberOfPages * mtl::kMemoryPageSize;
+
+    // What is left on either side stays allocated
+    if (address > descriptor.physicalStart)
+    {
+        auto head = descriptor;
+        head.numberOfPages = (address - descriptor.physicalStart) >> mtl::kMemoryPageShift;
+        g_systemMemoryMap.push_back(head);
+    }
+
+    if (end < descriptorEnd)
+    {
+        auto tail = descriptor;
+        tail.physicalStart = end;
+        tail.numberOfPages = (descriptorEnd - end) >> mtl::kMemoryPageShift;
+        g_systemMemoryMap.push_back(tail);
+    }
+
+    auto& freed = g_systemMemoryMap[index];
+    freed.type = efi::MemoryType::Conventional;
+    freed.physicalStart = address;
+    freed.numberOfPages = pageCount;
+
+    // Coalesce with the free memory on either side. The descriptors that get merged are emptied and removed below.
+    for (auto& other : g_systemMemoryMap)
+    {
+        if (&other == &freed || other.type != efi::MemoryType::Conventional || other.attributes != freed.attributes)
+            continue;
+
+        if (other.physicalStart + other.numberOfPages * mtl::kMemoryPageSize == freed.physicalStart)
+        {
+            freed.physicalStart = other.physicalStart;
+            freed.numberOfPages += other.numberOfPages;
+            other.numberOfPages = 0;
+        }
+        else if (freed.physicalStart + freed.numberOfPages * mtl::kMemoryPageSize == other.physicalStart)
+        {
+            freed.numberOfPages += other.numberOfPages;
+            other.numberOfPages = 0;
+        }
+    }
+
+    // AllocFrames() leaves empty descriptors behind too
+    size_t count = 0;
+    for (const auto& descriptor : g_systemMemoryMap)
+    {
+        if (descriptor.numberOfPages)
+            g_systemMemoryMap[count++] = descriptor;
+    }
+
+    g_systemMemoryMap.resize(count);
+}
+
 mtl::expected<void, ErrorCode> FreeFrames(PhysicalAddress frames, int pageCount)
 {
-    if (pageCount <= 0)
+    if (pageCount <= 0 || !mtl::IsAligned(frames, mtl::kMemoryPageSize))
         return mtl::unexpected(ErrorCode::InvalidArguments);
 
-    // TODO
-    (void)frames;
+    // The frames can span several allocations, each one is released from its own descriptor
+    auto remaining = (uint64_t)pageCount;
+    while (remaining)
+    {
+        const auto descriptor =
+            std::find_if(g_systemMemoryMap.begin(), g_systemMemoryMap.end(), [frames](const efi::MemoryDescriptor& descriptor) {
+                return descriptor.type == efi::MemoryType::KernelData && frames >= descriptor.physicalStart &&
+                       frames - descriptor.physicalStart < descriptor.numberOfPages * mtl::kMemoryPageSize;
+            });
+
+        if (descriptor == g_systemMemoryMap.end())
+            return mtl::unexpected(ErrorCode::NotFound);
+
+        // Growing the vector would allocate. The frames stay allocated until AllocFrames() grows it.
+        if (g_systemMemoryMap.capacity() - g_systemMemoryMap.size() < 2)
+            return mtl::unexpected(ErrorCode::OutOfMemory);
+
+        const auto available =
+            descriptor->numberOfPages - ((frames - descriptor->physicalStart) >> mtl::kMemoryPageShift);
+        const auto count = std::min(remaining, available);
+
+        ReleaseFrames(descriptor - g_systemMemoryMap.begin(), frames, count);
+
+        frames += count * mtl::kMemoryPageSize;
+        remaining -= count;
+    }
 
     return {};
 }
@@ -194,7 +326,52 @@ mtl::expected<void*, ErrorCode> AllocPages(int pageCount)
     if (pageCount <= 0)
         return mtl::unexpected(ErrorCode::InvalidArguments);
 
+    const auto address = g_kernelAddressSpace.AllocateRegion(pageCount * mtl::kMemoryPageSize,
+                                                             VmRegion{.start = 0,
+                                                                      .end = 0,
+                                                                      .protection = VmRead | VmWrite,
+                                                                      .type = VmRegionType::Committed});
+    if (!address)
+        return mtl::unexpected(address.error());
+
     // TODO: current implementation relies on finding continuous frames, which is not ideal
+    auto frames = AllocFrames(pageCount);
+    if (!frames)
+    {
+        g_kernelAddressSpace.RemoveRegion(*address);
+        return mtl::unexpected(frames.error());
+    }
+
+    if (auto result = MapPages(frames.value(), (void*)*address, pageCount, mtl::PageFlags::KernelData_RW); !result)
+    {
+        FreeFrames(frames.value(), pageCount);
+        g_kernelAddressSpace.RemoveRegion(*address);
+        return mtl::unexpected(result.error());
+    }
+
+    return (void*)*address;
+}
+
+mtl::expected<void, ErrorCode> FreePages(void* pages, int pageCount)
+{
+    if (!pages || pageCount <= 0 || !mtl::IsAligned(pages, mtl::kMemoryPageSize))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto region = g_kernelAddressSpace.FindRegion((uintptr_t)pages);
+    if (!region || region->start != (uintptr_t)pages || region->end - region->start != (uintptr_t)pageCount * mtl::kMemoryPageSize)
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    if (auto result = UnmapPages(pages, pageCount); !result)
+        return result;
+
+    return g_kernelAddressSpace.RemoveRegion((uintptr_t)pages);
+}
+
+mtl::expected<DmaMemory, ErrorCode> AllocDmaMemory(int pageCount)
+{
+    if (pageCount <= 0)
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
     auto frames = AllocFrames(pageCount);
     if (!frames)
         return mtl::unexpected(frames.error());
@@ -206,46 +383,175 @@ mtl::expected<void*, ErrorCode> AllocPages(int pageCount)
         return mtl::unexpected(address.error());
     }
 
-    return address.value();
+    memset(address.value(), 0, pageCount * mtl::kMemoryPageSize);
+
+    return DmaMemory{.physicalAddress = frames.value(), .address = address.value()};
 }
 
-mtl::expected<void, ErrorCode> FreePages(void* pages, int pageCount)
+mtl::expected<void, ErrorCode> FreeDmaMemory(const DmaMemory& memory, int pageCount)
 {
-    if (!pages || pageCount <= 0)
+    if (!memory.address || pageCount <= 0)
         return mtl::unexpected(ErrorCode::InvalidArguments);
 
-    // TODO
-    return {};
+    // The memory comes from the system memory mapping, so there is no region to remove. Unmapping releases the frames.
+    return UnmapPages(memory.address, pageCount);
+}
+
+mtl::expected<PhysicalAddress, ErrorCode> MemoryGetZeroPage()
+{
+    // Set once by MemoryInitialize()
+    if (!g_zeroPage)
+        return mtl::unexpected(ErrorCode::NotFound);
+
+    return g_zeroPage;
+}
+
+// Validate that [address, address + size) is inside a committed region, or outside of any region. Returns whether it is
+// inside a region.
+static mtl::expected<bool, ErrorCode> FindCommittedRegion(void* address, int size)
+{
+    if (size <= 0 || !mtl::IsAligned(address, mtl::kMemoryPageSize))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    const auto start = (uintptr_t)address;
+    const auto end = start + mtl::AlignUp(size, mtl::kMemoryPageSize);
+
+    const auto region = g_kernelAddressSpace.FindRegion(start);
+    if (region && (region->type != VmRegionType::Committed || region->end < end))
+        return mtl::unexpected(ErrorCode::InvalidArguments);
+
+    return region.has_value();
+}
+
+mtl::expected<PhysicalAddress, ErrorCode> AllocZeroedFrame()
+{
+    if (auto frame = TakeZeroedFrame())
+        return frame;
+
+    auto frame = AllocFrames(1);
+    if (!frame)
+        return mtl::unexpected(frame.error());
+
+    auto address = ArchMapSystemMemory(frame.value(), 1, mtl::PageFlags::KernelData_RW);
+    if (!address)
+    {
+        FreeFrames(frame.value(), 1);
+        return mtl::unexpected(address.error());
+    }
+
+    memset(address.value(), 0, mtl::kMemoryPageSize);
+
+    return frame;
+}
+
+mtl::expected<PhysicalAddress, ErrorCode> TakeZeroedFrame()
+{
+    mtl::expected<PhysicalAddress, ErrorCode> frame = mtl::unexpected(ErrorCode::NotFound);
+
+    g_zeroedFramesLock.Lock();
+    if (g_zeroedFrameCount > 0)
+        frame = g_zeroedFrames[--g_zeroedFrameCount];
+    g_zeroedFramesLock.Unlock();
+
+    return frame;
+}
+
+static bool IsZeroedFramePoolFull()
+{
+    g_zeroedFramesLock.Lock();
+    const bool full = g_zeroedFrameCount == kZeroedFramePoolSize;
+    g_zeroedFramesLock.Unlock();
+
+    return full;
+}
+
+bool MemoryRefillZeroedFrames()
+{
+    for (int i = 0; i != kZeroedFramesPerRefill; ++i)
+    {
+        if (IsZeroedFramePoolFull())
+            return true;
+
+        auto frame = AllocFrames(1);
+        if (!frame)
+            return false;
+
+        auto address = ArchMapSystemMemory(frame.value(), 1, mtl::PageFlags::KernelData_RW);
+        if (!address)
+        {
+            FreeFrames(frame.value(), 1);
+            return false;
+        }
+
+        // Whoever takes the frame will likely not touch all of it soon, don't evict useful data from the cache
+        mtl::ClearMemoryNonTemporal(address.value(), mtl::kMemoryPageSize);
+
+        g_zeroedFramesLock.Lock();
+        const bool added = g_zeroedFrameCount < kZeroedFramePoolSize;
+        if (added)
+            g_zeroedFrames[g_zeroedFrameCount++] = frame.value();
+        g_zeroedFramesLock.Unlock();
+
+        if (!added)
+        {
+            FreeFrames(frame.value(), 1);
+            return true;
+        }
+    }
+
+    return IsZeroedFramePoolFull();
 }
 
 mtl::expected<void, ErrorCode> VirtualAlloc(void* address, int size)
 {
-    // TODO: need some validation that [address, address + size] is not already mapped
+    // Memory is committed in address space reserved beforehand. Nothing is allocated besides frames, which matters
+    // as this is how the heap grows.
+    const auto region = FindCommittedRegion(address, size);
+    if (!region)
+        return mtl::unexpected(region.error());
+    if (!*region)
+        return mtl::unexpected(ErrorCode::NotFound);
+
     size = mtl::AlignUp(size, mtl::kMemoryPageSize);
 
     const auto pageCount = size >> mtl::kMemoryPageShift;
 
-    // TODO: support for non-contiguous frames
-    const auto frames = AllocFrames(pageCount);
-    if (!frames)
-        return mtl::unexpected(frames.error());
+    for (int page = 0; page != pageCount; ++page)
+    {
+        if (GetPageMapping((char*)address + page * mtl::kMemoryPageSize))
+            return mtl::unexpected(ErrorCode::Conflict);
+    }
 
-    auto result = MapPages(frames.value(), address, pageCount, mtl::PageFlags::KernelData_RW);
-    if (!result)
-        return mtl::unexpected(result.error());
+    for (int page = 0; page != pageCount; ++page)
+    {
+        // Frames don't need to be contiguous
+        const auto frame = AllocZeroedFrame();
+        if (!frame)
+        {
+            UnmapPages(address, page);
+            return mtl::unexpected(frame.error());
+        }
 
-    memset(address, 0, size);
+        if (auto result = MapPages(*frame, (char*)address + page * mtl::kMemoryPageSize, 1, mtl::PageFlags::KernelData_RW);
+            !result)
+        {
+            FreeFrames(*frame, 1);
+            UnmapPages(address, page);
+            return result;
+        }
+    }
 
     return {};
 }
 
 mtl::expected<void, ErrorCode> VirtualFree(void* address, int size)
 {
-    // TODO
-    (void)address;
-    (void)size;
+    // Decommit memory, the region (if any) stays reserved. Memory outside of regions (i.e. the boot stack) is unmapped.
+    const auto region = FindCommittedRegion(address, size);
+    if (!region)
+        return mtl::unexpected(region.error());
 
-    return {};
+    return UnmapPages(address, mtl::AlignUp(size, mtl::kMemoryPageSize) >> mtl::kMemoryPageShift);
 }
 
 mtl::PageFlags MemoryGetPageFlags(const efi::MemoryDescriptor& descriptor)
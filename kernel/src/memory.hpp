@@ -46,7 +46,8 @@ const efi::MemoryDescriptor* MemoryFindSystemDescriptor(PhysicalAddress address)
 // Allocate contiguous physical memory
 mtl::expected<PhysicalAddress, ErrorCode> AllocFrames(int count);
 
-// Free physical memory
+// Free physical memory allocated with AllocFrames(). This doesn't allocate memory, it is called with the page tables
+// locked.
 mtl::expected<void, ErrorCode> FreeFrames(PhysicalAddress frames, int count);
 
 // Allocate virtual memory pages
@@ -55,6 +56,34 @@ mtl::expected<void*, ErrorCode> AllocPages(int pageCount);
 // Free virtual memory pages
 mtl::expected<void, ErrorCode> FreePages(void* pages, int pageCount);
 
+// Memory shared with devices
+struct DmaMemory
+{
+    PhysicalAddress physicalAddress;
+    void* address;
+};
+
+// Allocate physically contiguous memory suitable for DMA transfers
+// Memory will be zero-initialized
+mtl::expected<DmaMemory, ErrorCode> AllocDmaMemory(int pageCount);
+
+// Free memory allocated with AllocDmaMemory()
+mtl::expected<void, ErrorCode> FreeDmaMemory(const DmaMemory& memory, int pageCount);
+
+// Get the zero page: a frame filled with zeroes shared by everyone who needs one. It must never be written to.
+mtl::expected<PhysicalAddress, ErrorCode> MemoryGetZeroPage();
+
+// Allocate a frame filled with zeroes, taken from the pool of pre-zeroed frames when possible
+mtl::expected<PhysicalAddress, ErrorCode> AllocZeroedFrame();
+
+// Take a frame from the pool of pre-zeroed frames, NotFound if the pool is empty. Unlike AllocZeroedFrame(), this
+// never maps memory.
+mtl::expected<PhysicalAddress, ErrorCode> TakeZeroedFrame();
+
+// Zero frames ahead of time to refill the pool, this is meant to be called when there is nothing else to do.
+// Returns true if the pool is full.
+bool MemoryRefillZeroedFrames();
+
 // Commit memory at the specified address
 // Memory will be zero-initialized
 mtl::expected<void, ErrorCode> VirtualAlloc(void* address, int size);
@@ -66,8 +95,27 @@ mtl::expected<void, ErrorCode> VirtualFree(void* address, int size);
 mtl::expected<void, ErrorCode> MapPages(efi::PhysicalAddress physicalAddress, const void* virtualAddress, int pageCount,
                                         mtl::PageFlags pageFlags);
 
+// Unmap pages and free the frames they own, pages mapped with PageFlags::Shared keep theirs. Page tables left empty
+// are freed as well.
 mtl::expected<void, ErrorCode> UnmapPages(const void* virtualAddress, int pageCount);
 
+// Page mapping, as found in the page tables
+struct PageMapping
+{
+    PhysicalAddress physicalAddress;
+    bool writable;
+};
+
+// Get the mapping of the page at 'virtualAddress', NotFound if nothing is mapped there
+mtl::expected<PageMapping, ErrorCode> GetPageMapping(const void* virtualAddress);
+
+// Replace the mapping of a page that is already mapped
+mtl::expected<void, ErrorCode> RemapPage(efi::PhysicalAddress physicalAddress, const void* virtualAddress,
+                                         mtl::PageFlags pageFlags);
+
+// Whether the page tables are locked. With a single CPU, a page fault while they are can't be resolved.
+bool ArePageTablesLocked();
+
 // Helper to figure out page mapping flags
 // Returns 0 if the descriptor doesn't have cacheability flags
 mtl::PageFlags MemoryGetPageFlags(const efi::MemoryDescriptor& descriptor);
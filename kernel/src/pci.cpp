@@ -30,6 +30,7 @@
 #include "devices/DeviceManager.hpp"
 #include "devices/PciDevice.hpp"
 #include "memory.hpp"
+#include "timing.hpp"
 #include <algorithm>
 #include <cassert>
 #include <metal/helpers.hpp>
@@ -54,6 +55,8 @@ static const AcpiMcfg::Config* PciFindConfig(int segment, int bus)
 
 static void PciEnumerateDevices()
 {
+    ScopedBootPhase phase("PciEnumerateDevices");
+
     if (!g_mcfg) [[unlikely]]
         return;
 
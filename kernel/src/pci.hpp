@@ -63,6 +63,27 @@ struct PciConfigSpaceType0 : PciConfigSpace
 
 static_assert(sizeof(PciConfigSpaceType0) == 0x40);
 
+enum PciCommand : uint16_t
+{
+    PciCommand_IoSpace = 1 << 0,
+    PciCommand_MemorySpace = 1 << 1,
+    PciCommand_BusMaster = 1 << 2,
+    PciCommand_InterruptDisable = 1 << 10,
+};
+
+enum PciStatus : uint16_t
+{
+    PciStatus_CapabilitiesList = 1 << 4,
+};
+
+enum class PciCapabilityId : uint8_t
+{
+    Msi = 0x05,
+    VendorSpecific = 0x09,
+    PciExpress = 0x10,
+    MsiX = 0x11,
+};
+
 // TODO: return error codes where appropriate
 
 void PciInitialize();
@@ -25,6 +25,7 @@
 */
 
 #include "memory.hpp"
+#include <cstdlib>
 #include <metal/graphics/GraphicsConsole.hpp>
 #include <metal/graphics/SimpleDisplay.hpp>
 #include <metal/graphics/Surface.hpp>
@@ -55,10 +56,10 @@ static void Crt0CallGlobalConstructors()
 
 static void Crt0InitEarlyGraphicsConsole(const Framebuffer& framebuffer)
 {
-    auto frontbuffer = mtl::make_shared<mtl::Surface>(framebuffer.width, framebuffer.height, framebuffer.pitch, framebuffer.format,
-                                                      (void*)framebuffer.pixels);
+    auto frontbuffer = mtl::make_intrusive<mtl::Surface>(framebuffer.width, framebuffer.height, framebuffer.pitch,
+                                                         framebuffer.format, (void*)framebuffer.pixels);
 
-    auto backbuffer = mtl::make_shared<mtl::Surface>(framebuffer.width, framebuffer.height, mtl::PixelFormat::X8R8G8B8);
+    auto backbuffer = mtl::make_intrusive<mtl::Surface>(framebuffer.width, framebuffer.height, mtl::PixelFormat::X8R8G8B8);
     memset(backbuffer->pixels, 0, backbuffer->height * backbuffer->pitch);
 
     auto display = mtl::make_shared<mtl::SimpleDisplay>(std::move(frontbuffer), std::move(backbuffer));
@@ -78,6 +79,14 @@ extern "C" void _kernel_start(const BootInfo& bootInfo)
     if (bootInfo.framebuffer.pixels)
         Crt0InitEarlyGraphicsConsole(bootInfo.framebuffer);
 
+    // The fields used so far haven't moved since the first version, the rest of the layout depends on the version
+    if (bootInfo.version != kRainbowBootVersion)
+    {
+        MTL_LOG(Fatal) << "[KRNL] Bootloader version " << bootInfo.version << " is not supported, expected version "
+                       << kRainbowBootVersion << ". Update the bootloader.";
+        std::abort();
+    }
+
     // Copy boot info into kernel space as we won't keep the original one memory mapped for long.
     g_bootInfo = bootInfo;
 
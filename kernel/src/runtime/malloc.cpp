@@ -59,12 +59,13 @@
 // This means that the locks must not try to access globals / things that
 // are not yet initialized (so a RecursiveSpinlock would not work).
 #define MLOCK_T Spinlock
-#define INITIAL_LOCK(mutex) (void)0
+#define INITIAL_LOCK(mutex) ((mutex)->EnableStats(g_mallocLockStats), 0)
 #define DESTROY_LOCK(mutex) (void)0
 #define ACQUIRE_LOCK(mutex) ((mutex)->Lock(), 0)
 #define RELEASE_LOCK(mutex) (mutex)->Unlock()
 #define TRY_LOCK(mutex) (mutex)->TryLock()
 
+static constinit SpinlockStats g_mallocLockStats{"malloc"};
 static MLOCK_T malloc_global_mutex;
 
 #define MORECORE dlmalloc_sbrk
@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "timing.hpp"
+#include <algorithm>
+#include <metal/arch.hpp>
+#include <metal/log.hpp>
+
+static BootTiming g_bootTiming;
+
+void TimingInitialize(const BootTiming& bootTiming)
+{
+    g_bootTiming = bootTiming;
+
+#if defined(__aarch64__)
+    if (!g_bootTiming.frequency)
+        g_bootTiming.frequency = mtl::Read_CNTFRQ_EL0();
+#endif
+}
+
+uint64_t TimingReadTimestamp()
+{
+#if defined(__aarch64__)
+    return mtl::Read_CNTVCT_EL0();
+#else
+    return mtl::x86_rdtsc();
+#endif
+}
+
+void TimingRecordBootPhase(const char* name, uint64_t start, uint64_t end)
+{
+    g_bootTiming.AddPhase(name, start, end);
+}
+
+static uint64_t TicksToMicroseconds(uint64_t ticks)
+{
+    // Split the conversion to avoid overflowing on large tick counts
+    const auto frequency = g_bootTiming.frequency;
+    return frequency ? ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency : 0;
+}
+
+void TimingLogBootPhases()
+{
+    const auto phaseCount = g_bootTiming.phaseCount;
+    if (!phaseCount)
+        return;
+
+    const BootPhase* phases[BootTiming::kMaxPhases];
+    uint64_t total = 0;
+    for (uint32_t i = 0; i != phaseCount; ++i)
+    {
+        phases[i] = &g_bootTiming.phases[i];
+        total = std::max(total, phases[i]->end);
+    }
+
+    std::sort(phases, phases + phaseCount,
+              [](const BootPhase* a, const BootPhase* b) { return a->end - a->start > b->end - b->start; });
+
+    const auto totalUs = TicksToMicroseconds(total);
+    MTL_LOG(Info) << "[KRNL] Boot phases (" << totalUs / 1000 << " ms since reset):";
+    for (uint32_t i = 0; i != phaseCount; ++i)
+    {
+        const auto us = TicksToMicroseconds(phases[i]->end - phases[i]->start);
+        const auto permille = totalUs ? us * 1000 / totalUs : 0;
+        MTL_LOG(Info).Format("[KRNL]     {:>6}.{:03} ms  {:>3}.{}%  {}", us / 1000, us % 1000, permille / 10, permille % 10,
+                             phases[i]->name);
+    }
+
+    // One line per phase in recording order: BOOTPHASE,<name>,<start us>,<end us>
+    for (uint32_t i = 0; i != phaseCount; ++i)
+    {
+        const auto& phase = g_bootTiming.phases[i];
+        MTL_LOG(Info).Format("BOOTPHASE,{},{},{}", phase.name, TicksToMicroseconds(phase.start), TicksToMicroseconds(phase.end));
+    }
+}
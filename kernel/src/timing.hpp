@@ -0,0 +1,57 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <rainbow/boot.hpp>
+
+// Take over the boot phases recorded by the bootloader
+void TimingInitialize(const BootTiming& bootTiming);
+
+// Read the CPU's timestamp counter, this is the same counter the bootloader used
+uint64_t TimingReadTimestamp();
+
+// Record a named boot phase
+void TimingRecordBootPhase(const char* name, uint64_t start, uint64_t end);
+
+// Log boot phases sorted by duration, followed by a machine-readable copy for tooling that parses the serial output
+void TimingLogBootPhases();
+
+// Record the boot phase covering the lifetime of this object
+class ScopedBootPhase
+{
+public:
+    explicit ScopedBootPhase(const char* name) : m_name(name), m_start(TimingReadTimestamp()) {}
+    ~ScopedBootPhase() { TimingRecordBootPhase(m_name, m_start, TimingReadTimestamp()); }
+
+    ScopedBootPhase(const ScopedBootPhase&) = delete;
+    ScopedBootPhase& operator=(const ScopedBootPhase&) = delete;
+
+private:
+    const char* const m_name;
+    const uint64_t m_start;
+};
@@ -27,6 +27,7 @@
 #include "uefi.hpp"
 #include "arch.hpp"
 #include "memory.hpp"
+#include "timing.hpp"
 #include <metal/log.hpp>
 #include <rainbow/acpi.hpp>
 
@@ -36,7 +37,9 @@ static const efi::SystemTable* g_efiSystemTable{};
 
 static void UefiSetVirtualMemoryMap(const efi::SystemTable& systemTable)
 {
-    mtl::vector<efi::MemoryDescriptor> firmwareMemory;
+    ScopedBootPhase phase("UefiSetVirtualMemoryMap");
+
+    mtl::small_vector<efi::MemoryDescriptor, 16> firmwareMemory;
     for (const auto& descriptor : g_systemMemoryMap)
     {
         // We also map ACPI memory here as it is convenient
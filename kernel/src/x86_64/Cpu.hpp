@@ -55,6 +55,18 @@ inline void CpuSetTask(Task* task)
     CPU_SET_DATA(task, task);
 }
 
+// Number of CPUs running the kernel and index of the current one, in [0, CpuGetCount()). Only the boot CPU runs the
+// kernel until SMP is brought up.
+inline int CpuGetCount()
+{
+    return 1;
+}
+
+inline int CpuGetIndex()
+{
+    return 0;
+}
+
 // Get/set the local apic. Every APIC is at the same physical address.
 Apic* CpuGetApic();
 void CpuSetApic(mtl::unique_ptr<Apic> apic);
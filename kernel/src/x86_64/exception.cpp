@@ -24,6 +24,7 @@
     OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "AddressSpace.hpp"
 #include "Cpu.hpp"
 #include "Task.hpp"
 #include "interrupt.hpp"
@@ -102,6 +103,11 @@ UNHANDLED_EXCEPTION(19, Simd)
 extern "C" void ExceptionPageFault(InterruptContext* context)
 {
     const auto address = (void*)mtl::Read_CR2();
+
+    // The error code has the same bits as PageFaultFlags
+    if (HandlePageFault(address, context->error))
+        return;
+
     LogException("PageFault", context);
     MTL_LOG(Fatal) << "Unhandled CPU exception: 0e (PageFault), address " << address;
     std::abort();
@@ -0,0 +1,180 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fs/CpioArchive.hpp"
+#include <cstdio>
+#include <string>
+#include <unittest.hpp>
+
+// Build a "newc" archive the way "cpio -o -H newc" does
+class CpioWriter
+{
+public:
+    void Add(const std::string& name, const std::string& data, uint32_t mode = CpioArchive::kModeRegular | 0644)
+    {
+        char header[111];
+        snprintf(header, sizeof(header), "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X", m_inode++, mode, 0, 0, 1,
+                 0, (unsigned)data.size(), 0, 0, 0, 0, (unsigned)name.size() + 1, 0);
+
+        m_archive.append(header, 110);
+        m_archive.append(name.c_str(), name.size() + 1);
+        Pad();
+        m_archive.append(data);
+        Pad();
+    }
+
+    std::string Finish()
+    {
+        Add("TRAILER!!!", "", 0);
+        return m_archive;
+    }
+
+private:
+    void Pad()
+    {
+        while (m_archive.size() % 4)
+            m_archive.push_back('\0');
+    }
+
+    std::string m_archive;
+    uint32_t m_inode{1};
+};
+
+TEST_CASE("CpioArchive - Lookup", "[cpio]")
+{
+    CpioWriter writer;
+    writer.Add(".", "", CpioArchive::kModeDirectory | 0755);
+    writer.Add("./sbin", "", CpioArchive::kModeDirectory | 0755);
+    writer.Add("./sbin/init", "init program");
+    writer.Add("./etc", "", CpioArchive::kModeDirectory | 0755);
+    writer.Add("./etc/motd", "Hello");
+    writer.Add("./etc/empty", "");
+    const auto data = writer.Finish();
+
+    auto archive = CpioArchive::Create(data.data(), data.size());
+    REQUIRE(archive);
+
+    SECTION("Files are found")
+    {
+        const auto file = (*archive)->Find("etc/motd");
+        REQUIRE(file);
+        REQUIRE(file->IsRegular());
+        REQUIRE(file->size == 5);
+        REQUIRE(std::string((const char*)file->data, file->size) == "Hello");
+    }
+
+    SECTION("Contents are not copied")
+    {
+        const auto file = (*archive)->Find("sbin/init");
+        REQUIRE(file);
+        REQUIRE((const char*)file->data >= data.data());
+        REQUIRE((const char*)file->data + file->size <= data.data() + data.size());
+    }
+
+    SECTION("Leading separators are ignored")
+    {
+        REQUIRE((*archive)->Find("/sbin/init") == (*archive)->Find("sbin/init"));
+        REQUIRE((*archive)->Find("./sbin/init") == (*archive)->Find("sbin/init"));
+    }
+
+    SECTION("Directories")
+    {
+        const auto file = (*archive)->Find("etc");
+        REQUIRE(file);
+        REQUIRE(file->IsDirectory());
+    }
+
+    SECTION("Empty files")
+    {
+        const auto file = (*archive)->Find("etc/empty");
+        REQUIRE(file);
+        REQUIRE(file->size == 0);
+    }
+
+    SECTION("Missing files")
+    {
+        REQUIRE(!(*archive)->Find("etc/passwd"));
+        REQUIRE(!(*archive)->Find("et"));
+        REQUIRE(!(*archive)->Find("etc/motd/"));
+    }
+
+    SECTION("Index is sorted and skips the root")
+    {
+        const auto& files = (*archive)->GetFiles();
+        REQUIRE(files.size() == 5);
+        for (size_t i = 1; i != files.size(); ++i)
+        {
+            const std::string a(files[i - 1].path.data(), files[i - 1].path.size());
+            const std::string b(files[i].path.data(), files[i].path.size());
+            REQUIRE(a < b);
+        }
+    }
+}
+
+TEST_CASE("CpioArchive - Invalid archives", "[cpio]")
+{
+    CpioWriter writer;
+    writer.Add("file", "0123456789");
+    const auto data = writer.Finish();
+
+    SECTION("Valid")
+    {
+        REQUIRE(CpioArchive::Create(data.data(), data.size()));
+    }
+
+    SECTION("Bad magic")
+    {
+        auto bad = data;
+        bad[5] = '7';
+        REQUIRE(!CpioArchive::Create(bad.data(), bad.size()));
+    }
+
+    SECTION("Bad hexadecimal digits")
+    {
+        auto bad = data;
+        bad[6 + 8 + 3] = 'x';
+        REQUIRE(!CpioArchive::Create(bad.data(), bad.size()));
+    }
+
+    SECTION("Truncated")
+    {
+        REQUIRE(!CpioArchive::Create(data.data(), 120));
+        REQUIRE(!CpioArchive::Create(data.data(), 50));
+    }
+
+    SECTION("Missing trailer")
+    {
+        const auto partial = data.substr(0, 128);
+        REQUIRE(!CpioArchive::Create(partial.data(), partial.size()));
+    }
+
+    SECTION("File size past the end")
+    {
+        auto bad = data;
+        memcpy(&bad[6 + 6 * 8], "0000FFFF", 8);
+        REQUIRE(!CpioArchive::Create(bad.data(), bad.size()));
+    }
+}
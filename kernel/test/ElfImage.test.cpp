@@ -0,0 +1,399 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "elf/ElfImage.hpp"
+#include <cstring>
+#include <elf.h>
+#include <string>
+#include <unittest.hpp>
+#include <vector>
+
+// Build an ELF executable for the current architecture, the way a linker lays it out: headers first, then the content of
+// each segment at a file offset that matches its virtual address within a page
+class ElfWriter
+{
+public:
+    explicit ElfWriter(uint16_t type = ET_EXEC, uint16_t machine = EM_X86_64) : m_type(type), m_machine(machine) {}
+
+    void AddSegment(uint32_t type, uint32_t flags, uint64_t address, const std::string& content, uint64_t memorySize)
+    {
+        const auto offset = (m_content.size() + 4095) / 4096 * 4096 + address % 4096;
+        m_content.resize(offset, '\0');
+        m_content.append(content);
+        m_headers.push_back(Elf64_Phdr{type, flags, offset, address, address, content.size(), memorySize, 4096});
+    }
+
+    // Add a header for something that is part of a segment that was already added
+    void AddHeader(uint32_t type, uint64_t address, uint64_t size)
+    {
+        for (const auto& phdr : m_headers)
+        {
+            if (phdr.p_type == PT_LOAD && address >= phdr.p_vaddr && address + size <= phdr.p_vaddr + phdr.p_filesz)
+            {
+                const auto offset = phdr.p_offset + address - phdr.p_vaddr;
+                m_headers.push_back(Elf64_Phdr{type, phdr.p_flags, offset, address, address, size, size, 8});
+                return;
+            }
+        }
+    }
+
+    std::string Finish(uint64_t entryPoint)
+    {
+        Elf64_Ehdr ehdr{};
+        ehdr.e_ident[EI_MAG0] = ELFMAG0;
+        ehdr.e_ident[EI_MAG1] = ELFMAG1;
+        ehdr.e_ident[EI_MAG2] = ELFMAG2;
+        ehdr.e_ident[EI_MAG3] = ELFMAG3;
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_type = m_type;
+        ehdr.e_machine = m_machine;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_entry = entryPoint;
+        ehdr.e_phoff = sizeof(Elf64_Ehdr);
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_phnum = m_headers.size();
+
+        std::string file(reinterpret_cast<const char*>(&ehdr), sizeof(ehdr));
+        file.append(reinterpret_cast<const char*>(m_headers.data()), m_headers.size() * sizeof(Elf64_Phdr));
+        REQUIRE(file.size() <= 4096);
+
+        file.append(m_content, file.size());
+        return file;
+    }
+
+private:
+    uint16_t m_type;
+    uint16_t m_machine;
+    std::vector<Elf64_Phdr> m_headers;
+    std::string m_content{std::string(4096, '\0')}; // Reserved for the headers, replaced by Finish()
+};
+
+// Dynamic section, relocations and symbols, to be added as a read-only segment at 'address'
+class DynamicWriter
+{
+public:
+    explicit DynamicWriter(uint64_t address) : m_address(address) {}
+
+    void AddRelocation(uint64_t address, uint32_t type, uint32_t symbol, int64_t addend)
+    {
+        m_relocations.push_back(Elf64_Rela{address, (uint64_t)symbol << 32 | type, addend});
+    }
+
+    void AddSymbol(uint64_t value, uint16_t section)
+    {
+        Elf64_Sym symbol{};
+        symbol.st_value = value;
+        symbol.st_shndx = section;
+        m_symbols.push_back(symbol);
+    }
+
+    std::string Finish(std::vector<Elf64_Dyn> extra = {})
+    {
+        const auto dynamicSize = (6 + extra.size()) * sizeof(Elf64_Dyn);
+        const auto relocationsSize = m_relocations.size() * sizeof(Elf64_Rela);
+
+        std::vector<Elf64_Dyn> dynamic = std::move(extra);
+        dynamic.push_back(Elf64_Dyn{DT_RELA, {m_address + dynamicSize}});
+        dynamic.push_back(Elf64_Dyn{DT_RELASZ, {relocationsSize}});
+        dynamic.push_back(Elf64_Dyn{DT_RELAENT, {sizeof(Elf64_Rela)}});
+        dynamic.push_back(Elf64_Dyn{DT_SYMTAB, {m_address + dynamicSize + relocationsSize}});
+        dynamic.push_back(Elf64_Dyn{DT_SYMENT, {sizeof(Elf64_Sym)}});
+        dynamic.push_back(Elf64_Dyn{DT_NULL, {0}});
+
+        std::string content(reinterpret_cast<const char*>(dynamic.data()), dynamicSize);
+        content.append(reinterpret_cast<const char*>(m_relocations.data()), relocationsSize);
+        content.append(reinterpret_cast<const char*>(m_symbols.data()), m_symbols.size() * sizeof(Elf64_Sym));
+        m_dynamicSize = dynamicSize;
+        return content;
+    }
+
+    uint64_t GetDynamicSize() const { return m_dynamicSize; }
+
+private:
+    uint64_t m_address;
+    std::vector<Elf64_Rela> m_relocations;
+    std::vector<Elf64_Sym> m_symbols{Elf64_Sym{}}; // Symbol 0 is always the undefined symbol
+    uint64_t m_dynamicSize{};
+};
+
+static uint64_t Read64(const std::vector<uint8_t>& page, size_t offset)
+{
+    uint64_t value;
+    memcpy(&value, page.data() + offset, sizeof(value));
+    return value;
+}
+
+TEST_CASE("ElfImage - Executable", "[elf]")
+{
+    ElfWriter writer;
+    writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x400000, std::string(0x1800, '\x90'), 0x1800);
+    writer.AddSegment(PT_LOAD, PF_R | PF_W, 0x402010, std::string(0x100, '\xAA'), 0x3000);
+    const auto file = writer.Finish(0x400010);
+
+    auto image = ElfImage::Create(file.data(), file.size());
+    REQUIRE(image);
+
+    const auto& elf = **image;
+    REQUIRE(!elf.IsPositionIndependent());
+    REQUIRE(elf.GetEntryPoint() == 0x400010);
+    REQUIRE(elf.GetStart() == 0x400000);
+    REQUIRE(elf.GetEnd() == 0x406000);
+    REQUIRE(elf.GetSegments().size() == 2);
+    REQUIRE(elf.GetRelocations().empty());
+
+    SECTION("Segments")
+    {
+        const auto text = elf.FindSegment(0x4017ff);
+        REQUIRE(text);
+        REQUIRE(text->IsExecutable());
+        REQUIRE(!text->IsWritable());
+
+        const auto data = elf.FindSegment(0x405000);
+        REQUIRE(data);
+        REQUIRE(data->IsWritable());
+        REQUIRE(!data->IsExecutable());
+
+        REQUIRE(elf.FindSegment(0x3fffff) == nullptr);
+        REQUIRE(elf.FindSegment(0x401800) == nullptr);
+        REQUIRE(elf.FindSegment(0x402000) == nullptr);
+        REQUIRE(elf.FindSegment(0x405010) == nullptr);
+    }
+
+    SECTION("File content")
+    {
+        REQUIRE(elf.HasFileContent(0x400000));
+        REQUIRE(elf.HasFileContent(0x401000));
+        REQUIRE(elf.HasFileContent(0x402000));
+        REQUIRE(!elf.HasFileContent(0x403000));
+        REQUIRE(!elf.HasFileContent(0x404000));
+        REQUIRE(!elf.HasRelocations(0x402000));
+    }
+
+    SECTION("Pages are read from the file and zero-filled")
+    {
+        std::vector<uint8_t> page(4096, 0xFF);
+
+        elf.ReadPage(0x401000, page.data());
+        REQUIRE(page[0] == 0x90);
+        REQUIRE(page[0x7ff] == 0x90);
+        REQUIRE(page[0x800] == 0);
+        REQUIRE(page[0xfff] == 0);
+
+        elf.ReadPage(0x402000, page.data());
+        REQUIRE(page[0x0f] == 0);
+        REQUIRE(page[0x10] == 0xAA);
+        REQUIRE(page[0x10f] == 0xAA);
+        REQUIRE(page[0x110] == 0);
+
+        elf.ReadPage(0x404000, page.data());
+        REQUIRE(std::all_of(page.begin(), page.end(), [](uint8_t byte) { return byte == 0; }));
+    }
+}
+
+TEST_CASE("ElfImage - Position independent executable", "[elf]")
+{
+    DynamicWriter dynamic(0x1000);
+    dynamic.AddSymbol(0x50, 1);         // Symbol 1, defined in the image
+    dynamic.AddSymbol(0x1234, SHN_ABS); // Symbol 2, absolute
+    dynamic.AddRelocation(0x2008, R_X86_64_RELATIVE, 0, 0x40);
+    dynamic.AddRelocation(0x2010, R_X86_64_64, 1, 4);
+    dynamic.AddRelocation(0x2018, R_X86_64_GLOB_DAT, 2, 0);
+    dynamic.AddRelocation(0x2ffc, R_X86_64_RELATIVE, 0, 0x1122334455667788);
+    dynamic.AddRelocation(0x2020, R_X86_64_NONE, 0, 0);
+    const auto content = dynamic.Finish();
+
+    ElfWriter writer(ET_DYN);
+    writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x0000, std::string(0x100, '\x90'), 0x100);
+    writer.AddSegment(PT_LOAD, PF_R, 0x1000, content, content.size());
+    writer.AddSegment(PT_LOAD, PF_R | PF_W, 0x2000, std::string(0x1000, '\xAA'), 0x3000);
+    writer.AddHeader(PT_DYNAMIC, 0x1000, dynamic.GetDynamicSize());
+    const auto file = writer.Finish(0x10);
+
+    auto image = ElfImage::Create(file.data(), file.size());
+    REQUIRE(image);
+
+    const auto& elf = **image;
+    REQUIRE(elf.IsPositionIndependent());
+    REQUIRE(elf.GetStart() == 0);
+    REQUIRE(elf.GetEnd() == 0x5000);
+
+    SECTION("Relocations are resolved and sorted")
+    {
+        const auto& relocations = elf.GetRelocations();
+        REQUIRE(relocations.size() == 4);
+
+        REQUIRE(relocations[0].address == 0x2008);
+        REQUIRE(relocations[0].value == 0x40);
+        REQUIRE(relocations[0].relative);
+
+        REQUIRE(relocations[1].address == 0x2010);
+        REQUIRE(relocations[1].value == 0x54);
+        REQUIRE(relocations[1].relative);
+
+        REQUIRE(relocations[2].address == 0x2018);
+        REQUIRE(relocations[2].value == 0x1234);
+        REQUIRE(!relocations[2].relative);
+
+        REQUIRE(relocations[3].address == 0x2ffc);
+    }
+
+    SECTION("Pages with relocations")
+    {
+        REQUIRE(!elf.HasRelocations(0x0000));
+        REQUIRE(!elf.HasRelocations(0x1000));
+        REQUIRE(elf.HasRelocations(0x2000));
+        REQUIRE(elf.HasRelocations(0x3000)); // The last relocation spills into this page
+        REQUIRE(!elf.HasFileContent(0x3000));
+        REQUIRE(!elf.HasRelocations(0x4000));
+    }
+
+    SECTION("Relocations are applied for the load bias")
+    {
+        const uint64_t loadBias = 0x10000000;
+        std::vector<uint8_t> page(4096);
+        std::vector<uint8_t> next(4096);
+
+        elf.ReadPage(0x2000, page.data());
+        elf.RelocatePage(0x2000, loadBias, page.data());
+        REQUIRE(Read64(page, 0x000) == 0xAAAAAAAAAAAAAAAA);
+        REQUIRE(Read64(page, 0x008) == loadBias + 0x40);
+        REQUIRE(Read64(page, 0x010) == loadBias + 0x54);
+        REQUIRE(Read64(page, 0x018) == 0x1234);
+        REQUIRE(Read64(page, 0x020) == 0xAAAAAAAAAAAAAAAA);
+
+        elf.ReadPage(0x3000, next.data());
+        elf.RelocatePage(0x3000, loadBias, next.data());
+        REQUIRE(next[4] == 0);
+
+        uint8_t bytes[8];
+        memcpy(bytes, page.data() + 0xffc, 4);
+        memcpy(bytes + 4, next.data(), 4);
+
+        uint64_t value;
+        memcpy(&value, bytes, sizeof(value));
+        REQUIRE(value == loadBias + 0x1122334455667788);
+    }
+}
+
+TEST_CASE("ElfImage - Invalid files", "[elf]")
+{
+    SECTION("Truncated")
+    {
+        ElfWriter writer;
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x400000, std::string(0x100, '\x90'), 0x100);
+        const auto file = writer.Finish(0x400000);
+
+        REQUIRE(ElfImage::Create(file.data(), sizeof(Elf64_Ehdr) - 1).error() == ErrorCode::InvalidArguments);
+        REQUIRE(ElfImage::Create(file.data(), file.size() - 1).error() == ErrorCode::InvalidArguments);
+    }
+
+    SECTION("Not an ELF file")
+    {
+        std::string file(8192, 'x');
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::InvalidArguments);
+    }
+
+    SECTION("Wrong architecture")
+    {
+        ElfWriter writer(ET_EXEC, EM_AARCH64);
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x400000, std::string(0x100, '\x90'), 0x100);
+        const auto file = writer.Finish(0x400000);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::Unsupported);
+    }
+
+    SECTION("Needs a dynamic linker")
+    {
+        ElfWriter writer;
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x400000, std::string(0x100, '\x90'), 0x100);
+        writer.AddHeader(PT_INTERP, 0x400000, 0x10);
+        const auto file = writer.Finish(0x400000);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::Unsupported);
+    }
+
+    SECTION("Entry point is not in code")
+    {
+        ElfWriter writer;
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x400000, std::string(0x100, '\x90'), 0x100);
+        writer.AddSegment(PT_LOAD, PF_R | PF_W, 0x401000, std::string(0x100, '\xAA'), 0x100);
+        const auto file = writer.Finish(0x401000);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::InvalidArguments);
+    }
+
+    SECTION("Segments sharing a page")
+    {
+        ElfWriter writer;
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x400000, std::string(0x100, '\x90'), 0x100);
+        writer.AddSegment(PT_LOAD, PF_R | PF_W, 0x400800, std::string(0x100, '\xAA'), 0x100);
+        const auto file = writer.Finish(0x400000);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::Unsupported);
+    }
+
+    SECTION("Text relocations")
+    {
+        DynamicWriter dynamic(0x1000);
+        dynamic.AddRelocation(0x0008, R_X86_64_RELATIVE, 0, 0x40);
+        const auto content = dynamic.Finish();
+
+        ElfWriter writer(ET_DYN);
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x0000, std::string(0x100, '\x90'), 0x100);
+        writer.AddSegment(PT_LOAD, PF_R, 0x1000, content, content.size());
+        writer.AddHeader(PT_DYNAMIC, 0x1000, dynamic.GetDynamicSize());
+        const auto file = writer.Finish(0x10);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::Unsupported);
+    }
+
+    SECTION("Undefined symbols")
+    {
+        DynamicWriter dynamic(0x1000);
+        dynamic.AddSymbol(0, SHN_UNDEF);
+        dynamic.AddRelocation(0x2000, R_X86_64_GLOB_DAT, 1, 0);
+        const auto content = dynamic.Finish();
+
+        ElfWriter writer(ET_DYN);
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x0000, std::string(0x100, '\x90'), 0x100);
+        writer.AddSegment(PT_LOAD, PF_R, 0x1000, content, content.size());
+        writer.AddSegment(PT_LOAD, PF_R | PF_W, 0x2000, std::string(0x100, '\xAA'), 0x100);
+        writer.AddHeader(PT_DYNAMIC, 0x1000, dynamic.GetDynamicSize());
+        const auto file = writer.Finish(0x10);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::Unsupported);
+    }
+
+    SECTION("Shared libraries are not supported")
+    {
+        DynamicWriter dynamic(0x1000);
+        const auto content = dynamic.Finish({Elf64_Dyn{DT_NEEDED, {1}}});
+
+        ElfWriter writer(ET_DYN);
+        writer.AddSegment(PT_LOAD, PF_R | PF_X, 0x0000, std::string(0x100, '\x90'), 0x100);
+        writer.AddSegment(PT_LOAD, PF_R, 0x1000, content, content.size());
+        writer.AddHeader(PT_DYNAMIC, 0x1000, dynamic.GetDynamicSize());
+        const auto file = writer.Finish(0x10);
+        REQUIRE(ElfImage::Create(file.data(), file.size()).error() == ErrorCode::Unsupported);
+    }
+}
@@ -0,0 +1,135 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "devices/nvme/NvmeDataPointer.hpp"
+#include <unittest.hpp>
+
+static constexpr mtl::PhysicalAddress kListAddress = 0x100000;
+
+TEST_CASE("NVMe - PRP", "[nvme]")
+{
+    uint64_t list[kNvmeMaxPrpEntries];
+    NvmeDataPointer data{};
+
+    SECTION("Single page")
+    {
+        const BlockRequest::Segment segments[] = {{0x5000, 4096}};
+        REQUIRE(NvmeBuildPrp(segments, 1, list, kListAddress, data));
+        REQUIRE(data.prp1 == 0x5000);
+        REQUIRE(data.prp2 == 0);
+    }
+
+    SECTION("Unaligned start within a page")
+    {
+        const BlockRequest::Segment segments[] = {{0x5200, 512}};
+        REQUIRE(NvmeBuildPrp(segments, 1, list, kListAddress, data));
+        REQUIRE(data.prp1 == 0x5200);
+        REQUIRE(data.prp2 == 0);
+    }
+
+    SECTION("Two pages use PRP2 directly")
+    {
+        const BlockRequest::Segment segments[] = {{0x5800, 4096}};
+        REQUIRE(NvmeBuildPrp(segments, 1, list, kListAddress, data));
+        REQUIRE(data.prp1 == 0x5800);
+        REQUIRE(data.prp2 == 0x6000);
+    }
+
+    SECTION("More pages use a list")
+    {
+        const BlockRequest::Segment segments[] = {{0x5000, 8192}, {0x20000, 4096}, {0x30000, 1024}};
+        REQUIRE(NvmeBuildPrp(segments, 3, list, kListAddress, data));
+        REQUIRE(data.prp1 == 0x5000);
+        REQUIRE(data.prp2 == kListAddress);
+        REQUIRE(list[0] == 0x6000);
+        REQUIRE(list[1] == 0x20000);
+        REQUIRE(list[2] == 0x30000);
+    }
+
+    SECTION("Largest transfer")
+    {
+        const BlockRequest::Segment segments[] = {{0x100000, kNvmeMaxPrpEntries * kNvmePageSize}};
+        REQUIRE(NvmeBuildPrp(segments, 1, list, kListAddress, data));
+        REQUIRE(data.prp1 == 0x100000);
+        REQUIRE(data.prp2 == kListAddress);
+        REQUIRE(list[kNvmeMaxPrpEntries - 2] == 0x100000 + (kNvmeMaxPrpEntries - 1) * kNvmePageSize);
+    }
+
+    SECTION("Gaps can't be described")
+    {
+        const BlockRequest::Segment unalignedEnd[] = {{0x5000, 1024}, {0x20000, 4096}};
+        REQUIRE(!NvmeBuildPrp(unalignedEnd, 2, list, kListAddress, data));
+
+        const BlockRequest::Segment unalignedStart[] = {{0x5000, 4096}, {0x20200, 512}};
+        REQUIRE(!NvmeBuildPrp(unalignedStart, 2, list, kListAddress, data));
+
+        const BlockRequest::Segment unalignedAddress[] = {{0x5002, 512}};
+        REQUIRE(!NvmeBuildPrp(unalignedAddress, 1, list, kListAddress, data));
+    }
+
+    SECTION("List overflow")
+    {
+        const BlockRequest::Segment segments[] = {{0x100800, (kNvmeMaxPrpEntries + 1) * kNvmePageSize}};
+        REQUIRE(!NvmeBuildPrp(segments, 1, list, kListAddress, data));
+    }
+}
+
+TEST_CASE("NVMe - SGL", "[nvme]")
+{
+    NvmeSglDescriptor list[kNvmeMaxSglDescriptors];
+    NvmeDataPointer data{};
+
+    SECTION("Single segment is inlined")
+    {
+        const BlockRequest::Segment segments[] = {{0x5200, 1024}};
+        REQUIRE(NvmeBuildSgl(segments, 1, list, kListAddress, data));
+        REQUIRE(data.sgl.address == 0x5200);
+        REQUIRE(data.sgl.length == 1024);
+        REQUIRE(data.sgl.type == NvmeSgl_DataBlock);
+    }
+
+    SECTION("Unaligned segments use a list")
+    {
+        const BlockRequest::Segment segments[] = {{0x5200, 1024}, {0x20200, 512}};
+        REQUIRE(NvmeBuildSgl(segments, 2, list, kListAddress, data));
+        REQUIRE(data.sgl.address == kListAddress);
+        REQUIRE(data.sgl.length == 2 * sizeof(NvmeSglDescriptor));
+        REQUIRE(data.sgl.type == NvmeSgl_LastSegment);
+        REQUIRE(list[0].address == 0x5200);
+        REQUIRE(list[0].length == 1024);
+        REQUIRE(list[1].address == 0x20200);
+        REQUIRE(list[1].length == 512);
+        REQUIRE(list[1].type == NvmeSgl_DataBlock);
+    }
+
+    SECTION("Invalid segments")
+    {
+        const BlockRequest::Segment unalignedAddress[] = {{0x5201, 512}};
+        REQUIRE(!NvmeBuildSgl(unalignedAddress, 1, list, kListAddress, data));
+        REQUIRE(!NvmeBuildSgl(unalignedAddress, 0, list, kListAddress, data));
+        REQUIRE(!NvmeBuildSgl(unalignedAddress, kNvmeMaxSglDescriptors + 1, list, kListAddress, data));
+    }
+}
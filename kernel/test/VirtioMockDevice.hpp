@@ -0,0 +1,307 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "devices/virtio/Virtqueue.hpp"
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+/*
+    Device side of a virtqueue, used to test drivers without hardware.
+
+    The mock parses the rings straight from the queue's memory following the virtio specification, independently of
+    the driver implementation. Physical addresses are host pointers.
+*/
+
+class VirtioMockDevice
+{
+public:
+    struct Buffer
+    {
+        void* data;
+        uint32_t length;
+    };
+
+    struct Request
+    {
+        uint16_t id;             // Head descriptor (split) or buffer id (packed)
+        int descriptorCount;     // Number of descriptors used in the ring
+        bool indirect;           // Is the request using an indirect table?
+        std::vector<Buffer> readable;
+        std::vector<Buffer> writable;
+    };
+
+    VirtioMockDevice(uint64_t features)
+        : m_packed(features & VirtioFeature_RingPacked), m_eventIndex(features & VirtioFeature_EventIndex)
+    {
+    }
+
+    // Locate the rings the same way a transport would program them in a device
+    void Attach(const Virtqueue& queue)
+    {
+        m_size = queue.GetSize();
+        m_descriptors = reinterpret_cast<void*>(queue.GetDescriptorAddress());
+        m_driver = reinterpret_cast<void*>(queue.GetDriverAddress());
+        m_device = reinterpret_cast<void*>(queue.GetDeviceAddress());
+    }
+
+    // Notification register to give to the queue
+    volatile uint16_t* GetNotifyAddress() { return &m_notify; }
+
+    // Returns whether the driver notified the device since the last call
+    bool TakeNotification()
+    {
+        const bool notified = m_notify != 0xFFFF;
+        m_notify = 0xFFFF;
+        return notified;
+    }
+
+    // Number of interrupts the device would have sent so far
+    int GetInterruptCount() const { return m_interruptCount; }
+
+    // Ask the driver not to notify (without event index)
+    void SetNotificationsEnabled(bool enabled)
+    {
+        if (m_packed)
+            PackedDeviceEvent()->flags = enabled ? VirtqPackedEvent::Enable : VirtqPackedEvent::Disable;
+        else
+            Used()->flags = enabled ? 0 : VirtqUsed::NoNotify;
+    }
+
+    // Ask the driver to notify once the request at 'index' is made available (with event index)
+    void SetNotificationEvent(uint16_t index, bool wrap = true)
+    {
+        if (m_packed)
+        {
+            PackedDeviceEvent()->offsetWrap = index | (wrap << 15);
+            PackedDeviceEvent()->flags = VirtqPackedEvent::Descriptor;
+        }
+        else
+        {
+            *reinterpret_cast<uint16_t*>(UsedRing() + m_size) = index;
+        }
+    }
+
+    // Fetch all the requests made available by the driver
+    std::vector<Request> Fetch()
+    {
+        std::vector<Request> requests;
+
+        if (m_packed)
+        {
+            while (true)
+            {
+                auto descriptors = static_cast<VirtqPackedDescriptor*>(m_descriptors);
+                const auto flags = std::atomic_ref(descriptors[m_availablePosition].flags).load(std::memory_order_acquire);
+                const bool available = flags & VirtqPackedDescriptor::Available;
+                const bool used = flags & VirtqPackedDescriptor::Used;
+                if (available != m_availableWrap || used == m_availableWrap)
+                    break;
+
+                Request request{};
+                for (;;)
+                {
+                    const auto& descriptor = descriptors[m_availablePosition];
+                    request.id = descriptor.id;
+                    ++request.descriptorCount;
+
+                    if (descriptor.flags & VirtqPackedDescriptor::Indirect)
+                    {
+                        request.indirect = true;
+                        const auto table = reinterpret_cast<VirtqPackedDescriptor*>(descriptor.address);
+                        for (size_t i = 0; i != descriptor.length / sizeof(VirtqPackedDescriptor); ++i)
+                            AddBuffer(request, table[i].address, table[i].length, table[i].flags & VirtqPackedDescriptor::Write);
+                    }
+                    else
+                    {
+                        AddBuffer(request, descriptor.address, descriptor.length, descriptor.flags & VirtqPackedDescriptor::Write);
+                    }
+
+                    const bool next = descriptor.flags & VirtqPackedDescriptor::Next;
+                    if (++m_availablePosition == m_size)
+                    {
+                        m_availablePosition = 0;
+                        m_availableWrap = !m_availableWrap;
+                    }
+
+                    if (!next)
+                        break;
+                }
+
+                requests.push_back(std::move(request));
+            }
+        }
+        else
+        {
+            const auto availableIndex = std::atomic_ref(Available()->index).load(std::memory_order_acquire);
+            while (m_lastAvailable != availableIndex)
+            {
+                const auto head = AvailableRing()[m_lastAvailable++ % m_size];
+
+                Request request{};
+                request.id = head;
+
+                auto descriptors = static_cast<VirtqDescriptor*>(m_descriptors);
+                for (auto index = head;; index = descriptors[index].next)
+                {
+                    const auto& descriptor = descriptors[index];
+                    ++request.descriptorCount;
+
+                    if (descriptor.flags & VirtqDescriptor::Indirect)
+                    {
+                        request.indirect = true;
+                        const auto table = reinterpret_cast<VirtqDescriptor*>(descriptor.address);
+                        for (int i = 0;; i = table[i].next)
+                        {
+                            AddBuffer(request, table[i].address, table[i].length, table[i].flags & VirtqDescriptor::Write);
+                            if (!(table[i].flags & VirtqDescriptor::Next))
+                                break;
+                        }
+                    }
+                    else
+                    {
+                        AddBuffer(request, descriptor.address, descriptor.length, descriptor.flags & VirtqDescriptor::Write);
+                    }
+
+                    if (!(descriptor.flags & VirtqDescriptor::Next))
+                        break;
+                }
+
+                requests.push_back(std::move(request));
+            }
+
+            // Keep asking for notifications on new requests
+            if (m_eventIndex)
+                SetNotificationEvent(m_lastAvailable);
+        }
+
+        return requests;
+    }
+
+    // Complete a request, reporting 'length' bytes written
+    void Complete(const Request& request, uint32_t length)
+    {
+        if (m_packed)
+        {
+            auto& descriptor = static_cast<VirtqPackedDescriptor*>(m_descriptors)[m_usedPosition];
+            descriptor.id = request.id;
+            descriptor.length = length;
+
+            const uint16_t flags = m_usedWrap ? (VirtqPackedDescriptor::Available | VirtqPackedDescriptor::Used) : 0;
+            std::atomic_ref(descriptor.flags).store(flags, std::memory_order_release);
+
+            m_usedPosition += request.descriptorCount;
+            if (m_usedPosition >= m_size)
+            {
+                m_usedPosition -= m_size;
+                m_usedWrap = !m_usedWrap;
+            }
+
+            const auto event = static_cast<VirtqPackedEvent*>(m_driver);
+            if (event->flags == VirtqPackedEvent::Descriptor)
+            {
+                uint16_t eventIndex = event->offsetWrap & 0x7FFF;
+                if ((event->offsetWrap >> 15) != m_usedWrap)
+                    eventIndex -= m_size;
+
+                if (VirtqNeedEvent(eventIndex, m_usedPosition, m_usedPosition - request.descriptorCount))
+                    ++m_interruptCount;
+            }
+            else if (event->flags == VirtqPackedEvent::Enable)
+            {
+                ++m_interruptCount;
+            }
+        }
+        else
+        {
+            auto& element = UsedRing()[m_usedIndex % m_size];
+            element.id = request.id;
+            element.length = length;
+
+            const uint16_t oldIndex = m_usedIndex++;
+            std::atomic_ref(Used()->index).store(m_usedIndex, std::memory_order_release);
+
+            if (m_eventIndex)
+            {
+                const auto usedEvent = AvailableRing()[m_size];
+                if (VirtqNeedEvent(usedEvent, m_usedIndex, oldIndex))
+                    ++m_interruptCount;
+            }
+            else if (!(Available()->flags & VirtqAvailable::NoInterrupt))
+            {
+                ++m_interruptCount;
+            }
+        }
+    }
+
+    // Complete a request, filling its writable buffers with 'value'
+    void Complete(const Request& request, uint8_t value)
+    {
+        uint32_t length = 0;
+        for (const auto& buffer : request.writable)
+        {
+            memset(buffer.data, value, buffer.length);
+            length += buffer.length;
+        }
+
+        Complete(request, length);
+    }
+
+private:
+    static void AddBuffer(Request& request, uint64_t address, uint32_t length, bool writable)
+    {
+        auto& buffers = writable ? request.writable : request.readable;
+        buffers.push_back(Buffer{reinterpret_cast<void*>(address), length});
+    }
+
+    VirtqAvailable* Available() const { return static_cast<VirtqAvailable*>(m_driver); }
+    uint16_t* AvailableRing() const { return reinterpret_cast<uint16_t*>(Available() + 1); }
+    VirtqUsed* Used() const { return static_cast<VirtqUsed*>(m_device); }
+    VirtqUsedElement* UsedRing() const { return reinterpret_cast<VirtqUsedElement*>(Used() + 1); }
+    VirtqPackedEvent* PackedDeviceEvent() const { return static_cast<VirtqPackedEvent*>(m_device); }
+
+    const bool m_packed;
+    const bool m_eventIndex;
+    int m_size{};
+    void* m_descriptors{};
+    void* m_driver{};
+    void* m_device{};
+
+    volatile uint16_t m_notify{0xFFFF};
+    int m_interruptCount{0};
+
+    // Split ring state
+    uint16_t m_lastAvailable{0};
+    uint16_t m_usedIndex{0};
+
+    // Packed ring state
+    uint16_t m_availablePosition{0};
+    bool m_availableWrap{true};
+    uint16_t m_usedPosition{0};
+    bool m_usedWrap{true};
+};
@@ -0,0 +1,338 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "VirtioMockDevice.hpp"
+#include <cstdlib>
+#include <metal/helpers.hpp>
+#include <unittest.hpp>
+
+struct VirtqueueFixture
+{
+    VirtqueueFixture(uint64_t features, int size = 8) : features(features), device(features)
+    {
+        const auto memorySize = mtl::AlignUp(Virtqueue::GetMemorySize(size, features), Virtqueue::kMemoryAlignment);
+        memory = std::aligned_alloc(Virtqueue::kMemoryAlignment, memorySize);
+
+        auto result = Virtqueue::Create(0, size, features, memory, reinterpret_cast<uintptr_t>(memory), device.GetNotifyAddress());
+        REQUIRE(result);
+        queue = std::move(*result);
+
+        device.Attach(*queue);
+    }
+
+    ~VirtqueueFixture()
+    {
+        queue.reset();
+        std::free(memory);
+    }
+
+    // Add a request with one readable and one writable buffer
+    void AddRequest(int index)
+    {
+        const VirtqBuffer buffers[] = {{reinterpret_cast<uintptr_t>(&requests[index]), sizeof(requests[index])},
+                                       {reinterpret_cast<uintptr_t>(&responses[index]), sizeof(responses[index])}};
+        REQUIRE(queue->AddBuffers(buffers, 1, 1, &requests[index]));
+    }
+
+    const uint64_t features;
+    VirtioMockDevice device;
+    void* memory;
+    mtl::unique_ptr<Virtqueue> queue;
+    uint32_t requests[64]{};
+    uint32_t responses[64]{};
+};
+
+static constexpr uint64_t kSplit = 0;
+static constexpr uint64_t kSplitEventIndex = VirtioFeature_EventIndex;
+static constexpr uint64_t kSplitIndirect = VirtioFeature_IndirectDescriptors;
+static constexpr uint64_t kPacked = VirtioFeature_RingPacked;
+static constexpr uint64_t kPackedEventIndex = VirtioFeature_RingPacked | VirtioFeature_EventIndex;
+static constexpr uint64_t kPackedIndirect = VirtioFeature_RingPacked | VirtioFeature_IndirectDescriptors;
+
+TEST_CASE("Virtqueue - Requests", "[virtqueue]")
+{
+    const auto features = GENERATE(kSplit, kSplitEventIndex, kSplitIndirect, kPacked, kPackedEventIndex, kPackedIndirect);
+    VirtqueueFixture fixture(features);
+    auto& queue = *fixture.queue;
+    auto& device = fixture.device;
+
+    SECTION("Completions return tokens and lengths")
+    {
+        for (int i = 0; i != 3; ++i)
+        {
+            fixture.requests[i] = 100 + i;
+            fixture.AddRequest(i);
+        }
+
+        queue.Kick();
+        REQUIRE(device.TakeNotification());
+
+        auto requests = device.Fetch();
+        REQUIRE(requests.size() == 3);
+
+        for (int i = 0; i != 3; ++i)
+        {
+            REQUIRE(requests[i].readable.size() == 1);
+            REQUIRE(requests[i].writable.size() == 1);
+            REQUIRE(*static_cast<uint32_t*>(requests[i].readable[0].data) == 100u + i);
+            device.Complete(requests[i], (uint8_t)(0x10 + i));
+        }
+
+        for (int i = 0; i != 3; ++i)
+        {
+            uint32_t length = 0;
+            REQUIRE(queue.GetUsed(&length) == &fixture.requests[i]);
+            REQUIRE(length == sizeof(uint32_t));
+            REQUIRE(fixture.responses[i] == 0x01010101u * (0x10 + i));
+        }
+
+        REQUIRE(queue.GetUsed() == nullptr);
+        REQUIRE(!queue.IsBusy());
+        REQUIRE(queue.GetFreeCount() == queue.GetSize());
+    }
+
+    SECTION("Out of order completions")
+    {
+        fixture.AddRequest(0);
+        fixture.AddRequest(1);
+        queue.Kick();
+
+        auto requests = device.Fetch();
+        REQUIRE(requests.size() == 2);
+
+        device.Complete(requests[1], (uint32_t)0);
+        device.Complete(requests[0], (uint32_t)0);
+
+        REQUIRE(queue.GetUsed() == &fixture.requests[1]);
+        REQUIRE(queue.GetUsed() == &fixture.requests[0]);
+        REQUIRE(queue.GetFreeCount() == queue.GetSize());
+    }
+
+    SECTION("Ring wraps around")
+    {
+        // Requests of 3 descriptors don't divide the ring size evenly, chains end up crossing the end of the ring
+        uint32_t data[3]{};
+        const VirtqBuffer buffers[] = {{reinterpret_cast<uintptr_t>(&data[0]), 4},
+                                       {reinterpret_cast<uintptr_t>(&data[1]), 4},
+                                       {reinterpret_cast<uintptr_t>(&data[2]), 4}};
+
+        for (int i = 0; i != 5 * queue.GetSize(); ++i)
+        {
+            REQUIRE(queue.AddBuffers(buffers, 2, 1, &fixture.requests[i % 64]));
+            queue.Kick();
+
+            auto requests = device.Fetch();
+            REQUIRE(requests.size() == 1);
+            REQUIRE(requests[0].readable.size() == 2);
+            REQUIRE(requests[0].writable.size() == 1);
+            device.Complete(requests[0], (uint8_t)i);
+
+            uint32_t length = 0;
+            REQUIRE(queue.GetUsed(&length) == &fixture.requests[i % 64]);
+            REQUIRE(length == 4);
+            REQUIRE(data[2] == 0x01010101u * (uint8_t)i);
+            REQUIRE(queue.GetFreeCount() == queue.GetSize());
+        }
+    }
+
+    SECTION("Full queue")
+    {
+        int count = 0;
+        while (queue.GetFreeCount() >= 2)
+            fixture.AddRequest(count++);
+
+        const VirtqBuffer buffers[] = {{0, 4}, {0, 4}, {0, 4}};
+        const bool indirect = features & VirtioFeature_IndirectDescriptors;
+        REQUIRE(queue.AddBuffers(buffers, 1, 2, &fixture.requests[count]).has_value() == (indirect && queue.GetFreeCount() > 0));
+
+        queue.Kick();
+        for (const auto& request : device.Fetch())
+            device.Complete(request, (uint32_t)0);
+
+        while (queue.GetUsed())
+            continue;
+
+        REQUIRE(queue.GetFreeCount() == queue.GetSize());
+    }
+
+    SECTION("Invalid arguments")
+    {
+        const VirtqBuffer buffers[] = {{0, 4}};
+        REQUIRE(queue.AddBuffers(nullptr, 1, 0, &fixture.requests[0]).error() == ErrorCode::InvalidArguments);
+        REQUIRE(queue.AddBuffers(buffers, 0, 0, &fixture.requests[0]).error() == ErrorCode::InvalidArguments);
+        REQUIRE(queue.AddBuffers(buffers, 1, 0, nullptr).error() == ErrorCode::InvalidArguments);
+    }
+}
+
+TEST_CASE("Virtqueue - Batching", "[virtqueue]")
+{
+    const auto features = GENERATE(kSplit, kSplitEventIndex, kPacked, kPackedEventIndex);
+    VirtqueueFixture fixture(features);
+    auto& queue = *fixture.queue;
+    auto& device = fixture.device;
+
+    for (int i = 0; i != 4; ++i)
+        fixture.AddRequest(i);
+
+    // Nothing happens until the queue is kicked, then the device is notified once
+    REQUIRE(!device.TakeNotification());
+    queue.Kick();
+    REQUIRE(device.TakeNotification());
+    queue.Kick();
+    REQUIRE(!device.TakeNotification());
+
+    REQUIRE(device.Fetch().size() == 4);
+}
+
+TEST_CASE("Virtqueue - Notification suppression", "[virtqueue]")
+{
+    SECTION("Without event index")
+    {
+        const auto features = GENERATE(kSplit, kPacked);
+        VirtqueueFixture fixture(features);
+
+        fixture.device.SetNotificationsEnabled(false);
+        fixture.AddRequest(0);
+        fixture.queue->Kick();
+        REQUIRE(!fixture.device.TakeNotification());
+
+        fixture.device.SetNotificationsEnabled(true);
+        fixture.AddRequest(1);
+        fixture.queue->Kick();
+        REQUIRE(fixture.device.TakeNotification());
+        REQUIRE(fixture.device.Fetch().size() == 2);
+    }
+
+    SECTION("With event index")
+    {
+        const auto features = GENERATE(kSplitEventIndex, kPackedEventIndex);
+        VirtqueueFixture fixture(features, 16);
+
+        // Device wants to be notified when the third request is made available. For packed rings, the event is a
+        // descriptor position and each request takes two descriptors.
+        fixture.device.SetNotificationEvent((features & VirtioFeature_RingPacked) ? 4 : 2);
+
+        fixture.AddRequest(0);
+        fixture.queue->Kick();
+        REQUIRE(!fixture.device.TakeNotification());
+
+        fixture.AddRequest(1);
+        fixture.queue->Kick();
+        REQUIRE(!fixture.device.TakeNotification());
+
+        fixture.AddRequest(2);
+        fixture.AddRequest(3);
+        fixture.queue->Kick();
+        REQUIRE(fixture.device.TakeNotification());
+
+        // Event is in the past
+        fixture.AddRequest(4);
+        fixture.queue->Kick();
+        REQUIRE(!fixture.device.TakeNotification());
+
+        REQUIRE(fixture.device.Fetch().size() == 5);
+    }
+}
+
+TEST_CASE("Virtqueue - Indirect descriptors", "[virtqueue]")
+{
+    const auto features = GENERATE(kSplit, kSplitIndirect, kPacked, kPackedIndirect);
+    const bool indirect = features & VirtioFeature_IndirectDescriptors;
+    VirtqueueFixture fixture(features);
+    auto& queue = *fixture.queue;
+
+    uint8_t data[4]{};
+    const VirtqBuffer buffers[] = {{reinterpret_cast<uintptr_t>(&data[0]), 1},
+                                   {reinterpret_cast<uintptr_t>(&data[1]), 1},
+                                   {reinterpret_cast<uintptr_t>(&data[2]), 1},
+                                   {reinterpret_cast<uintptr_t>(&data[3]), 1}};
+
+    REQUIRE(queue.AddBuffers(buffers, 1, 3, &fixture.requests[0]));
+    REQUIRE(queue.GetFreeCount() == queue.GetSize() - (indirect ? 1 : 4));
+
+    // Single buffer requests are never indirect
+    REQUIRE(queue.AddBuffers(buffers, 1, 0, &fixture.requests[1]));
+    REQUIRE(queue.GetFreeCount() == queue.GetSize() - (indirect ? 2 : 5));
+
+    queue.Kick();
+    auto requests = fixture.device.Fetch();
+    REQUIRE(requests.size() == 2);
+    REQUIRE(requests[0].indirect == indirect);
+    REQUIRE(requests[0].readable.size() == 1);
+    REQUIRE(requests[0].writable.size() == 3);
+    REQUIRE(!requests[1].indirect);
+
+    fixture.device.Complete(requests[0], (uint8_t)0xAB);
+    fixture.device.Complete(requests[1], (uint32_t)0);
+
+    uint32_t length = 0;
+    REQUIRE(queue.GetUsed(&length) == &fixture.requests[0]);
+    REQUIRE(length == 3);
+    REQUIRE(data[0] == 0);
+    REQUIRE(data[1] == 0xAB);
+    REQUIRE(data[3] == 0xAB);
+    REQUIRE(queue.GetUsed() == &fixture.requests[1]);
+    REQUIRE(queue.GetFreeCount() == queue.GetSize());
+}
+
+TEST_CASE("Virtqueue - Interrupt suppression", "[virtqueue]")
+{
+    const auto features = GENERATE(kSplit, kSplitEventIndex, kPacked, kPackedEventIndex);
+    VirtqueueFixture fixture(features);
+    auto& queue = *fixture.queue;
+    auto& device = fixture.device;
+
+    // Polling mode
+    queue.DisableInterrupts();
+    const auto interruptCount = device.GetInterruptCount();
+
+    fixture.AddRequest(0);
+    queue.Kick();
+    device.Complete(device.Fetch()[0], (uint32_t)0);
+
+    // One spurious interrupt is allowed when using event indices
+    REQUIRE(device.GetInterruptCount() - interruptCount <= ((features & VirtioFeature_EventIndex) ? 1 : 0));
+
+    // A completion is pending, the caller must poll it
+    REQUIRE(!queue.EnableInterrupts());
+    REQUIRE(queue.GetUsed() == &fixture.requests[0]);
+
+    // Interrupt mode
+    REQUIRE(queue.EnableInterrupts());
+    const auto before = device.GetInterruptCount();
+
+    fixture.AddRequest(1);
+    fixture.AddRequest(2);
+    queue.Kick();
+    auto requests = device.Fetch();
+    device.Complete(requests[0], (uint32_t)0);
+    REQUIRE(device.GetInterruptCount() == before + 1);
+
+    REQUIRE(queue.GetUsed() == &fixture.requests[1]);
+    device.Complete(requests[1], (uint32_t)0);
+    REQUIRE(device.GetInterruptCount() == before + 2);
+    REQUIRE(queue.GetUsed() == &fixture.requests[2]);
+}
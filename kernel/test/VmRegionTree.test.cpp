@@ -0,0 +1,228 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "VmRegionTree.hpp"
+#include <map>
+#include <unittest.hpp>
+
+static constexpr uintptr_t kPage = mtl::kMemoryPageSize;
+static constexpr uintptr_t kStart = 0x100000;
+static constexpr uintptr_t kEnd = kStart + 64 * kPage;
+
+static mtl::unique_ptr<VmRegionTree::Node> UserRegion(uintptr_t start = 0, uintptr_t end = 0)
+{
+    return mtl::make_unique<VmRegionTree::Node>(
+        VmRegion{.start = start, .end = end, .protection = VmRead | VmWrite | VmUser, .type = VmRegionType::Anonymous});
+}
+
+TEST_CASE("VmRegionTree - Add and find", "[vm]")
+{
+    VmRegionTree tree(kStart, kEnd);
+
+    REQUIRE(tree.Add(UserRegion(kStart + 4 * kPage, kStart + 8 * kPage)));
+    REQUIRE(tree.Add(UserRegion(kStart + 8 * kPage, kStart + 9 * kPage)));
+
+    REQUIRE(tree.Find(kStart + 3 * kPage) == nullptr);
+    REQUIRE(tree.Find(kStart + 4 * kPage)->start == kStart + 4 * kPage);
+    REQUIRE(tree.Find(kStart + 8 * kPage - 1)->start == kStart + 4 * kPage);
+    REQUIRE(tree.Find(kStart + 8 * kPage)->start == kStart + 8 * kPage);
+    REQUIRE(tree.Find(kStart + 9 * kPage) == nullptr);
+
+    SECTION("Overlaps are rejected")
+    {
+        REQUIRE(tree.Add(UserRegion(kStart + 3 * kPage, kStart + 5 * kPage)).error() == ErrorCode::Conflict);
+        REQUIRE(tree.Add(UserRegion(kStart + 5 * kPage, kStart + 6 * kPage)).error() == ErrorCode::Conflict);
+        REQUIRE(tree.Add(UserRegion(kStart + 7 * kPage, kStart + 10 * kPage)).error() == ErrorCode::Conflict);
+        REQUIRE(tree.Add(UserRegion(kStart, kStart + 16 * kPage)).error() == ErrorCode::Conflict);
+
+        // The caller keeps the node when it isn't added
+        auto node = UserRegion(kStart + 4 * kPage, kStart + 5 * kPage);
+        REQUIRE(!tree.Add(std::move(node)));
+        REQUIRE(node);
+
+        REQUIRE(tree.Add(UserRegion(kStart + 3 * kPage, kStart + 4 * kPage)));
+    }
+
+    SECTION("Invalid regions are rejected")
+    {
+        REQUIRE(tree.Add(UserRegion(kStart, kStart)).error() == ErrorCode::InvalidArguments);
+        REQUIRE(tree.Add(UserRegion(kStart + 1, kStart + kPage)).error() == ErrorCode::InvalidArguments);
+        REQUIRE(tree.Add(UserRegion(kStart, kStart + kPage + 1)).error() == ErrorCode::InvalidArguments);
+
+        auto kernel = UserRegion(kStart, kStart + kPage);
+        kernel->region.protection = VmRead;
+        REQUIRE(tree.Add(std::move(kernel)).error() == ErrorCode::InvalidArguments);
+
+        auto code = UserRegion(kStart, kStart + kPage);
+        code->region.protection |= VmExecute;
+        REQUIRE(tree.Add(std::move(code)).error() == ErrorCode::Unsupported);
+    }
+
+    SECTION("Remove")
+    {
+        REQUIRE(tree.Remove(kStart + 5 * kPage).error() == ErrorCode::NotFound);
+        REQUIRE(tree.Remove(kStart + 4 * kPage).value()->region.end == kStart + 8 * kPage);
+        REQUIRE(tree.Find(kStart + 4 * kPage) == nullptr);
+        REQUIRE(tree.Find(kStart + 8 * kPage)->start == kStart + 8 * kPage);
+        REQUIRE(tree.Remove(kStart + 4 * kPage).error() == ErrorCode::NotFound);
+    }
+}
+
+TEST_CASE("VmRegionTree - Allocate", "[vm]")
+{
+    VmRegionTree tree(kStart, kEnd);
+
+    SECTION("Empty tree")
+    {
+        REQUIRE(tree.Allocate(kPage, UserRegion()).value() == kStart);
+        REQUIRE(tree.Allocate(2 * kPage, UserRegion()).value() == kStart + kPage);
+        REQUIRE(tree.Find(kStart + 2 * kPage)->end == kStart + 3 * kPage);
+    }
+
+    SECTION("Size must be page aligned")
+    {
+        REQUIRE(tree.Allocate(0, UserRegion()).error() == ErrorCode::InvalidArguments);
+        REQUIRE(tree.Allocate(kPage + 1, UserRegion()).error() == ErrorCode::InvalidArguments);
+    }
+
+    SECTION("First fit")
+    {
+        REQUIRE(tree.Add(UserRegion(kStart + 2 * kPage, kStart + 4 * kPage)));
+        REQUIRE(tree.Add(UserRegion(kStart + 5 * kPage, kStart + 8 * kPage)));
+        REQUIRE(tree.Add(UserRegion(kStart + 11 * kPage, kStart + 12 * kPage)));
+
+        REQUIRE(tree.FindFreeRange(3 * kPage).value() == kStart + 8 * kPage);
+        REQUIRE(tree.FindFreeRange(4 * kPage).value() == kStart + 12 * kPage);
+        REQUIRE(tree.Allocate(2 * kPage, UserRegion()).value() == kStart);
+        REQUIRE(tree.Allocate(2 * kPage, UserRegion()).value() == kStart + 8 * kPage);
+        REQUIRE(tree.Allocate(kPage, UserRegion()).value() == kStart + 4 * kPage);
+        REQUIRE(tree.Allocate(kPage, UserRegion()).value() == kStart + 10 * kPage);
+        REQUIRE(tree.Allocate(kPage, UserRegion()).value() == kStart + 12 * kPage);
+    }
+
+    SECTION("Gap at the start of the range")
+    {
+        REQUIRE(tree.Add(UserRegion(kStart + 4 * kPage, kEnd)));
+
+        REQUIRE(tree.FindFreeRange(4 * kPage).value() == kStart);
+        REQUIRE(tree.FindFreeRange(5 * kPage).error() == ErrorCode::OutOfMemory);
+    }
+
+    SECTION("Gap at the end of the range")
+    {
+        REQUIRE(tree.Add(UserRegion(kStart, kEnd - 4 * kPage)));
+
+        REQUIRE(tree.FindFreeRange(4 * kPage).value() == kEnd - 4 * kPage);
+        REQUIRE(tree.FindFreeRange(5 * kPage).error() == ErrorCode::OutOfMemory);
+    }
+
+    SECTION("Regions outside the range are ignored")
+    {
+        REQUIRE(tree.Add(UserRegion(kStart - 4 * kPage, kStart + kPage)));
+        REQUIRE(tree.Add(UserRegion(kEnd - kPage, kEnd + 4 * kPage)));
+
+        REQUIRE(tree.FindFreeRange(62 * kPage).value() == kStart + kPage);
+        REQUIRE(tree.FindFreeRange(63 * kPage).error() == ErrorCode::OutOfMemory);
+    }
+
+    SECTION("Full")
+    {
+        REQUIRE(tree.Allocate(64 * kPage, UserRegion()).value() == kStart);
+        REQUIRE(tree.Allocate(kPage, UserRegion()).error() == ErrorCode::OutOfMemory);
+    }
+}
+
+// Insert and remove regions at random, checking FindFreeRange() against a brute force search. This exercises
+// rebalancing, which is where the subtree bookkeeping can go stale.
+TEST_CASE("VmRegionTree - Augmentation", "[vm]")
+{
+    constexpr int kPageCount = 64;
+
+    VmRegionTree tree(kStart, kEnd);
+    std::map<uintptr_t, uintptr_t> regions; // start -> end
+    bool used[kPageCount] = {};
+
+    uint32_t seed = 12345;
+    const auto random = [&seed](uint32_t count) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % count;
+    };
+
+    const auto expected = [&used](int size) -> int {
+        for (int page = 0; page + size <= kPageCount; ++page)
+        {
+            int length = 0;
+            while (length < size && !used[page + length])
+                ++length;
+            if (length == size)
+                return page;
+        }
+        return -1;
+    };
+
+    for (int i = 0; i != 2000; ++i)
+    {
+        if (regions.empty() || random(3) != 0)
+        {
+            const int size = random(4) + 1;
+            const int page = expected(size);
+
+            const auto address = tree.Allocate(size * kPage, UserRegion());
+            if (page < 0)
+            {
+                REQUIRE(address.error() == ErrorCode::OutOfMemory);
+            }
+            else
+            {
+                REQUIRE(address.value() == kStart + page * kPage);
+                regions[*address] = *address + size * kPage;
+                for (int j = 0; j != size; ++j)
+                    used[page + j] = true;
+            }
+        }
+        else
+        {
+            auto it = regions.begin();
+            std::advance(it, random(regions.size()));
+
+            REQUIRE(tree.Remove(it->first));
+            for (auto address = it->first; address != it->second; address += kPage)
+                used[(address - kStart) / kPage] = false;
+            regions.erase(it);
+        }
+
+        for (int size = 1; size <= 8; ++size)
+        {
+            const int page = expected(size);
+            const auto address = tree.FindFreeRange(size * kPage);
+            if (page < 0)
+                REQUIRE(address.error() == ErrorCode::OutOfMemory);
+            else
+                REQUIRE(address.value() == kStart + page * kPage);
+        }
+    }
+}
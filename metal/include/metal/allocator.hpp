@@ -0,0 +1,83 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <malloc.h>
+
+namespace mtl
+{
+    template <typename T>
+    struct allocation_result
+    {
+        T* ptr;
+        std::size_t count;
+    };
+
+    // Default allocator for containers, backed by malloc(). Containers use allocate_at_least() to make use of the
+    // slack in heap blocks and reallocate() to grow trivially relocatable elements in place.
+    template <typename T>
+    class allocator
+    {
+    public:
+        using value_type = T;
+
+        constexpr allocator() noexcept = default;
+
+        template <typename U>
+        constexpr allocator(const allocator<U>&) noexcept
+        {
+        }
+
+        T* allocate(std::size_t count)
+        {
+            const auto memory = static_cast<T*>(::malloc(count * sizeof(T)));
+            assert(memory); // TODO: we can't handle this very well in the kernel...
+            return memory;
+        }
+
+        allocation_result<T> allocate_at_least(std::size_t count)
+        {
+            const auto memory = allocate(count);
+            return {memory, ::malloc_usable_size(memory) / sizeof(T)};
+        }
+
+        // Only valid for trivially relocatable types
+        T* reallocate(T* memory, std::size_t /*oldCount*/, std::size_t newCount)
+        {
+            const auto newMemory = static_cast<T*>(::realloc(static_cast<void*>(memory), newCount * sizeof(T)));
+            assert(newMemory); // TODO: we can't handle this very well in the kernel...
+            return newMemory;
+        }
+
+        void deallocate(T* memory, std::size_t /*count*/) noexcept { ::free(memory); }
+
+        friend constexpr bool operator==(const allocator&, const allocator&) noexcept { return true; }
+    };
+} // namespace mtl
@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <metal/helpers.hpp>
 
@@ -180,4 +181,27 @@ namespace mtl
     {
         asm volatile("yield" ::: "memory");
     }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Memory
+    ///////////////////////////////////////////////////////////////////////////
+
+    // Clear memory with non-temporal stores, which hint that the memory shouldn't be cached. Use this for memory that
+    // isn't going to be accessed soon. 'memory' must be 16 bytes aligned and 'size' a multiple of 64.
+    static inline void ClearMemoryNonTemporal(void* memory, size_t size)
+    {
+        for (auto p = static_cast<char*>(memory), end = p + size; p != end; p += 64)
+        {
+            asm volatile("stnp xzr, xzr, [%0]\n"
+                         "stnp xzr, xzr, [%0, #16]\n"
+                         "stnp xzr, xzr, [%0, #32]\n"
+                         "stnp xzr, xzr, [%0, #48]\n"
+                         :
+                         : "r"(p)
+                         : "memory");
+        }
+
+        // Make the stores visible before the memory is handed out
+        asm volatile("dmb ishst" ::: "memory");
+    }
 } // namespace mtl
@@ -67,6 +67,9 @@ namespace mtl
     static constexpr auto kMemoryHugePageShift = 30;
     static constexpr auto kMemoryHugePageSize = 1024 * 1024 * 1024;
 
+    // Cache lines are 64 bytes on the cores we care about (some Apple cores use 128)
+    static constexpr auto kCacheLineSize = 64;
+
     enum PageFlags : uint64_t
     {
         Valid = 1 << 0,          // Descriptor is valid
@@ -102,6 +105,7 @@ namespace mtl
         UXN = 1ull << 54,              // Unprivileged eXecute Never
 
         // bits 55-58 are reserved for software use
+        Shared = 1ull << 55, // The frame isn't owned by the mapping, unmapping the page doesn't free it
 
         // https://medium.com/@om.nara/arm64-normal-memory-attributes-6086012fa0e3
         PXNTable = 1ull << 59,    // Privileged eXecute Never
@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace mtl
@@ -380,4 +381,41 @@ namespace mtl
         __builtin_ia32_pause();
     }
 
+    static inline uint64_t x86_rdtsc()
+    {
+        return __builtin_ia32_rdtsc();
+    }
+
+    static inline void x86_cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+    {
+        asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Memory
+    ///////////////////////////////////////////////////////////////////////////
+
+    // Clear memory with non-temporal stores, which don't pull the memory into the cache. Use this for memory that isn't
+    // going to be accessed soon. 'memory' must be 8 bytes aligned and 'size' a multiple of 64.
+    static inline void ClearMemoryNonTemporal(void* memory, size_t size)
+    {
+        for (auto p = static_cast<char*>(memory), end = p + size; p != end; p += 64)
+        {
+            asm volatile("movnti %1, 0(%0)\n"
+                         "movnti %1, 8(%0)\n"
+                         "movnti %1, 16(%0)\n"
+                         "movnti %1, 24(%0)\n"
+                         "movnti %1, 32(%0)\n"
+                         "movnti %1, 40(%0)\n"
+                         "movnti %1, 48(%0)\n"
+                         "movnti %1, 56(%0)\n"
+                         :
+                         : "r"(p), "r"(0ull)
+                         : "memory");
+        }
+
+        // Non-temporal stores are weakly ordered
+        asm volatile("sfence" ::: "memory");
+    }
+
 } // namespace mtl
@@ -62,6 +62,9 @@ namespace mtl
     static constexpr auto kMemoryHugePageShift = 30;
     static constexpr auto kMemoryHugePageSize = 1024 * 1024 * 1024;
 
+    // Cache lines are 64 bytes
+    static constexpr auto kCacheLineSize = 64;
+
     enum PageFlags : uint64_t
     {
         // Page mapping flags (12 bits)
@@ -91,6 +94,12 @@ namespace mtl
         Reserved1 = 0x400, // Usable by OS
         Reserved2 = 0x800, // Usable by OS
 
+        // Software flags
+        Shared = Reserved0, // The frame isn't owned by the mapping, unmapping the page doesn't free it
+
+        // PAT bit for large pages, where bit 7 is used for Size. It overlaps the address mask, but large pages are aligned.
+        LargePAT = 0x1000,
+
         // Bits 12..51 are the address mask
         AddressMask = 0x000FFFFFFFFFF000ull,
 
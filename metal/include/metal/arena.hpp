@@ -0,0 +1,154 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <metal/allocator.hpp>
+
+namespace mtl
+{
+    // Monotonic allocator: allocations are pointer bumps in large chunks obtained from malloc(). Individual allocations
+    // are not freed, instead memory is released in one shot by rewinding to a checkpoint or destroying the arena.
+    //
+    // Checkpoints nest like a stack: everything allocated after mark() is released by rewind(). Use arena::scope to
+    // bound the lifetime of temporary allocations to a block of code.
+    class arena
+    {
+        struct chunk
+        {
+            chunk* previous;
+            char* end;
+        };
+
+    public:
+        static constexpr std::size_t kDefaultChunkSize = 64 * 1024;
+
+        struct checkpoint
+        {
+            chunk* _chunk;
+            char* _current;
+        };
+
+        // Release everything allocated from 'arena' during the lifetime of the scope
+        class scope
+        {
+        public:
+            explicit scope(arena& arena) noexcept : _arena(arena), _checkpoint(arena.mark()) {}
+            ~scope() { _arena.rewind(_checkpoint); }
+
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+
+        private:
+            arena& _arena;
+            const checkpoint _checkpoint;
+        };
+
+        constexpr explicit arena(std::size_t chunkSize = kDefaultChunkSize) noexcept : _chunkSize(chunkSize) {}
+        ~arena() { release(); }
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        // Alignment must be a power of 2
+        void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+        {
+            const auto padding = -reinterpret_cast<uintptr_t>(_current) & (alignment - 1);
+            if (_chunk && padding + size <= std::size_t(_end - _current)) [[likely]]
+            {
+                const auto memory = _current + padding;
+                _current = memory + size;
+                return memory;
+            }
+
+            return allocate_chunk(size, alignment);
+        }
+
+        // Memory is only reclaimed if 'memory' is the last allocation
+        void deallocate(void* memory, std::size_t size) noexcept
+        {
+            if (static_cast<char*>(memory) + size == _current)
+                _current = static_cast<char*>(memory);
+        }
+
+        // Grow or shrink an allocation. The last allocation is resized in place when there is room for it, others are
+        // copied to a new allocation.
+        void* reallocate(void* memory, std::size_t oldSize, std::size_t newSize,
+                         std::size_t alignment = alignof(std::max_align_t));
+
+        checkpoint mark() const noexcept { return {_chunk, _current}; }
+
+        // Release everything allocated since 'checkpoint' was taken
+        void rewind(const checkpoint& checkpoint) noexcept;
+
+        // Release all memory
+        void release() noexcept { rewind({nullptr, nullptr}); }
+
+    private:
+        void* allocate_chunk(std::size_t size, std::size_t alignment);
+
+        chunk* _chunk{nullptr};   // Current chunk
+        char* _current{nullptr};  // Next free byte in the current chunk
+        char* _end{nullptr};      // End of the current chunk
+        std::size_t _chunkSize;
+    };
+
+    // Container allocator drawing memory from an arena
+    template <typename T>
+    class arena_allocator
+    {
+    public:
+        using value_type = T;
+
+        arena_allocator(mtl::arena& arena) noexcept : _arena(&arena) {}
+
+        template <typename U>
+        arena_allocator(const arena_allocator<U>& other) noexcept : _arena(other._arena)
+        {
+        }
+
+        T* allocate(std::size_t count) { return static_cast<T*>(_arena->allocate(count * sizeof(T), alignof(T))); }
+
+        allocation_result<T> allocate_at_least(std::size_t count) { return {allocate(count), count}; }
+
+        T* reallocate(T* memory, std::size_t oldCount, std::size_t newCount)
+        {
+            return static_cast<T*>(_arena->reallocate(memory, oldCount * sizeof(T), newCount * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T* memory, std::size_t count) noexcept { _arena->deallocate(memory, count * sizeof(T)); }
+
+        friend bool operator==(const arena_allocator& a, const arena_allocator& b) noexcept { return a._arena == b._arena; }
+
+    private:
+        template <typename U>
+        friend class arena_allocator;
+
+        mtl::arena* _arena;
+    };
+} // namespace mtl
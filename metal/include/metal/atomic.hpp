@@ -47,6 +47,11 @@ namespace mtl
     inline constexpr memory_order memory_order_acq_rel = memory_order::acq_rel;
     inline constexpr memory_order memory_order_seq_cst = memory_order::seq_cst;
 
+    inline void atomic_thread_fence(memory_order order) noexcept
+    {
+        __atomic_thread_fence(static_cast<int>(order));
+    }
+
     template <typename T>
         requires(std::is_trivially_copyable_v<T> && std::is_copy_constructible_v<T> && std::is_copy_assignable_v<T>)
     struct atomic
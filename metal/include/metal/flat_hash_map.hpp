@@ -0,0 +1,120 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <initializer_list>
+#include <metal/flat_hash_table.hpp>
+
+namespace mtl
+{
+    namespace details
+    {
+        template <typename K, typename V>
+        struct flat_hash_map_policy
+        {
+            using key_type = K;
+            using value_type = std::pair<const K, V>;
+
+            static const key_type& key(const value_type& value) { return value.first; }
+        };
+    } // namespace details
+
+    // Hash map storing its elements inline in an open addressing table (see flat_hash_table.hpp).
+    // Pointers and iterators to elements are invalidated when the table grows.
+    template <typename K, typename V, typename Hash = mtl::hash<K>, typename Eq = mtl::equal_to<K>>
+    class flat_hash_map : public details::flat_hash_table<details::flat_hash_map_policy<K, V>, Hash, Eq>
+    {
+        using base = details::flat_hash_table<details::flat_hash_map_policy<K, V>, Hash, Eq>;
+
+        template <typename T>
+        using key_arg = typename base::template key_arg<T>;
+
+    public:
+        using mapped_type = V;
+        using typename base::iterator;
+        using typename base::value_type;
+
+        flat_hash_map() = default;
+
+        flat_hash_map(std::initializer_list<value_type> init)
+        {
+            this->reserve(init.size());
+            for (const auto& value : init)
+                insert(value);
+        }
+
+        std::pair<iterator, bool> insert(const value_type& value) { return try_emplace(value.first, value.second); }
+        std::pair<iterator, bool> insert(value_type&& value)
+        {
+            return try_emplace(value.first, std::move(value.second));
+        }
+
+        // Inserts a value constructed from 'args' if 'key' is not in the map. Nothing is constructed otherwise.
+        template <typename KeyArg, typename... Args>
+        std::pair<iterator, bool> try_emplace(KeyArg&& key, Args&&... args)
+        {
+            // Lookups with anything but K require a transparent hash function
+            const key_arg<std::remove_cvref_t<KeyArg>>& lookupKey = key;
+
+            const auto result = this->find_or_prepare_insert(lookupKey);
+            if (result.second)
+                std::construct_at(this->slot(result.first), std::forward<KeyArg>(key), V(std::forward<Args>(args)...));
+            return {this->iterator_at(result.first), result.second};
+        }
+
+        template <typename KeyArg, typename Value>
+        std::pair<iterator, bool> insert_or_assign(KeyArg&& key, Value&& value)
+        {
+            auto result = try_emplace(std::forward<KeyArg>(key), std::forward<Value>(value));
+            if (!result.second)
+                result.first->second = std::forward<Value>(value);
+            return result;
+        }
+
+        template <typename KeyArg>
+        V& operator[](KeyArg&& key)
+        {
+            return try_emplace(std::forward<KeyArg>(key)).first->second;
+        }
+
+        template <typename KeyArg = K>
+        V& at(const key_arg<KeyArg>& key)
+        {
+            const auto it = this->find(key);
+            assert(it != this->end());
+            return it->second;
+        }
+
+        template <typename KeyArg = K>
+        const V& at(const key_arg<KeyArg>& key) const
+        {
+            const auto it = this->find(key);
+            assert(it != this->end());
+            return it->second;
+        }
+    };
+} // namespace mtl
@@ -0,0 +1,85 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <initializer_list>
+#include <metal/flat_hash_table.hpp>
+
+namespace mtl
+{
+    namespace details
+    {
+        template <typename K>
+        struct flat_hash_set_policy
+        {
+            using key_type = K;
+            using value_type = K;
+
+            static const key_type& key(const value_type& value) { return value; }
+        };
+    } // namespace details
+
+    // Hash set storing its elements inline in an open addressing table (see flat_hash_table.hpp).
+    // Pointers and iterators to elements are invalidated when the table grows.
+    template <typename K, typename Hash = mtl::hash<K>, typename Eq = mtl::equal_to<K>>
+    class flat_hash_set : public details::flat_hash_table<details::flat_hash_set_policy<K>, Hash, Eq>
+    {
+        using base = details::flat_hash_table<details::flat_hash_set_policy<K>, Hash, Eq>;
+
+        template <typename T>
+        using key_arg = typename base::template key_arg<T>;
+
+    public:
+        using typename base::iterator;
+        using typename base::value_type;
+
+        flat_hash_set() = default;
+
+        flat_hash_set(std::initializer_list<K> init)
+        {
+            this->reserve(init.size());
+            for (const auto& value : init)
+                insert(value);
+        }
+
+        std::pair<iterator, bool> insert(const K& value) { return emplace(value); }
+        std::pair<iterator, bool> insert(K&& value) { return emplace(std::move(value)); }
+
+        // Inserts 'key' if it isn't in the set. Heterogeneous keys are converted to K only when inserted.
+        template <typename KeyArg>
+        std::pair<iterator, bool> emplace(KeyArg&& key)
+        {
+            // Lookups with anything but K require a transparent hash function
+            const key_arg<std::remove_cvref_t<KeyArg>>& lookupKey = key;
+
+            const auto result = this->find_or_prepare_insert(lookupKey);
+            if (result.second)
+                std::construct_at(this->slot(result.first), std::forward<KeyArg>(key));
+            return {this->iterator_at(result.first), result.second};
+        }
+    };
+} // namespace mtl
@@ -0,0 +1,653 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <metal/hash.hpp>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+    Open addressing hash table in the style of Abseil's SwissTable, shared by flat_hash_map and flat_hash_set.
+
+    Each slot has a control byte. The control bytes are stored contiguously, separately from the slots, so that
+    a whole group of them can be matched against part of the hash at once:
+
+        empty       10000000
+        deleted     11111110
+        sentinel    11111111    (marks the end of the table for iterators)
+        full        0hhhhhhh    (low 7 bits of the hash, "H2")
+
+    The rest of the hash ("H1") selects the group where probing starts. Groups are probed quadratically until
+    a group containing an empty slot is found. The first (group width - 1) control bytes are mirrored after the
+    sentinel so that a group can be loaded from any position without wrapping.
+
+    Groups are matched with SSE2 or NEON when available. Kernel builds don't use SIMD registers and fall back to
+    matching 8 control bytes at a time in a 64 bits integer.
+
+    The capacity is always a power of 2 minus 1. At most 7/8 of the slots are used. Lookups never allocate.
+*/
+
+namespace mtl
+{
+    namespace details
+    {
+        using ctrl_t = int8_t;
+
+        inline constexpr ctrl_t kCtrlEmpty = -128;
+        inline constexpr ctrl_t kCtrlDeleted = -2;
+        inline constexpr ctrl_t kCtrlSentinel = -1;
+
+        constexpr bool is_full(ctrl_t ctrl) { return ctrl >= 0; }
+
+        // Set of matching positions within a group. Each position takes (1 << Shift) bits of the mask.
+        template <typename T, int Width, int Shift>
+        class group_mask
+        {
+        public:
+            explicit constexpr group_mask(T mask) : _mask(mask) {}
+
+            explicit constexpr operator bool() const { return _mask != 0; }
+
+            constexpr int lowest() const { return __builtin_ctzll(_mask) >> Shift; }
+
+            // Number of positions without a match at the start and at the end of the group
+            constexpr int leading_zeros() const
+            {
+                return (__builtin_clzll(_mask) - (64 - (Width << Shift))) >> Shift;
+            }
+            constexpr int trailing_zeros() const { return __builtin_ctzll(_mask) >> Shift; }
+
+            // Iteration over matching positions
+            constexpr group_mask begin() const { return *this; }
+            constexpr group_mask end() const { return group_mask(0); }
+            constexpr int operator*() const { return lowest(); }
+            constexpr group_mask& operator++()
+            {
+                _mask &= _mask - 1;
+                return *this;
+            }
+            constexpr bool operator!=(const group_mask& other) const { return _mask != other._mask; }
+
+        private:
+            T _mask;
+        };
+
+        // Portable implementation matching 8 control bytes at a time
+        class group_portable
+        {
+        public:
+            static constexpr size_t kWidth = 8;
+            using mask = group_mask<uint64_t, kWidth, 3>;
+
+            explicit group_portable(const ctrl_t* ctrl) { memcpy(&_ctrl, ctrl, sizeof(_ctrl)); }
+
+            // This can return false positives, but only on full slots following a true match. Callers compare keys
+            // anyways.
+            mask match(uint8_t h2) const
+            {
+                const auto x = _ctrl ^ (kLsbs * h2);
+                return mask((x - kLsbs) & ~x & kMsbs);
+            }
+
+            mask match_empty() const { return mask((_ctrl & ~(_ctrl << 6)) & kMsbs); }
+
+            mask match_empty_or_deleted() const { return mask((_ctrl & ~(_ctrl << 7)) & kMsbs); }
+
+        private:
+            static constexpr uint64_t kLsbs = 0x0101010101010101ull;
+            static constexpr uint64_t kMsbs = 0x8080808080808080ull;
+
+            uint64_t _ctrl;
+        };
+
+#if defined(__SSE2__)
+        class group_sse2
+        {
+        public:
+            static constexpr size_t kWidth = 16;
+            using mask = group_mask<uint32_t, kWidth, 0>;
+
+            explicit group_sse2(const ctrl_t* ctrl) : _ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+
+            mask match(uint8_t h2) const
+            {
+                return mask(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), _ctrl)));
+            }
+
+            mask match_empty() const { return mask(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(kCtrlEmpty), _ctrl))); }
+
+            mask match_empty_or_deleted() const
+            {
+                return mask(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(kCtrlSentinel), _ctrl)));
+            }
+
+        private:
+            __m128i _ctrl;
+        };
+
+        using group = group_sse2;
+#elif defined(__ARM_NEON)
+        class group_neon
+        {
+        public:
+            static constexpr size_t kWidth = 8;
+            using mask = group_mask<uint64_t, kWidth, 3>;
+
+            explicit group_neon(const ctrl_t* ctrl) : _ctrl(vld1_s8(ctrl)) {}
+
+            mask match(uint8_t h2) const { return to_mask(vceq_s8(vdup_n_s8(h2), _ctrl)); }
+
+            mask match_empty() const { return to_mask(vceq_s8(vdup_n_s8(kCtrlEmpty), _ctrl)); }
+
+            mask match_empty_or_deleted() const { return to_mask(vcgt_s8(vdup_n_s8(kCtrlSentinel), _ctrl)); }
+
+        private:
+            static mask to_mask(uint8x8_t match)
+            {
+                return mask(vget_lane_u64(vreinterpret_u64_u8(match), 0) & 0x8080808080808080ull);
+            }
+
+            int8x8_t _ctrl;
+        };
+
+        using group = group_neon;
+#else
+        using group = group_portable;
+#endif
+
+        // Quadratic probing over groups. Because the capacity is a power of 2 minus 1, this visits every group.
+        template <size_t Width>
+        class probe_sequence
+        {
+        public:
+            probe_sequence(size_t hash, size_t mask) : _mask(mask), _offset(hash & mask), _index(0) {}
+
+            size_t offset() const { return _offset; }
+            size_t offset(size_t i) const { return (_offset + i) & _mask; }
+
+            void next()
+            {
+                _index += Width;
+                _offset = (_offset + _index) & _mask;
+            }
+
+        private:
+            size_t _mask;
+            size_t _offset;
+            size_t _index;
+        };
+
+        constexpr size_t h1(size_t hash) { return hash >> 7; }
+        constexpr uint8_t h2(size_t hash) { return hash & 0x7F; }
+
+        // Number of elements that can be inserted in a table of the given capacity before it must grow
+        constexpr size_t capacity_to_growth(size_t capacity) { return capacity - (capacity / 8 ? capacity / 8 : 1); }
+
+        // Capacity required to hold the given number of elements
+        constexpr size_t growth_to_capacity(size_t growth, size_t width)
+        {
+            size_t capacity = width - 1;
+            while (capacity_to_growth(capacity) < growth)
+                capacity = capacity * 2 + 1;
+            return capacity;
+        }
+
+        template <typename Hash, typename Eq, typename = void>
+        struct is_transparent_lookup : std::false_type
+        {
+        };
+
+        template <typename Hash, typename Eq>
+        struct is_transparent_lookup<Hash, Eq, std::void_t<typename Hash::is_transparent, typename Eq::is_transparent>>
+            : std::true_type
+        {
+        };
+
+        // This has to be an alias template that resolves to K itself, otherwise K could not be deduced in lookups
+        template <bool Transparent>
+        struct key_arg_selector
+        {
+            template <typename K, typename Key>
+            using type = Key;
+        };
+
+        template <>
+        struct key_arg_selector<true>
+        {
+            template <typename K, typename Key>
+            using type = K;
+        };
+
+        // Policy describes the slot type:
+        //  - Policy::key_type
+        //  - Policy::value_type
+        //  - static const key_type& Policy::key(const value_type&)
+        // Group is only overridden by tests, to exercise the portable implementation on SIMD capable hosts.
+        template <typename Policy, typename Hash, typename Eq, typename Group = group>
+        class flat_hash_table
+        {
+        public:
+            using key_type = typename Policy::key_type;
+            using value_type = typename Policy::value_type;
+            using size_type = size_t;
+            using hasher = Hash;
+            using key_equal = Eq;
+            using reference = value_type&;
+            using const_reference = const value_type&;
+
+            static_assert(alignof(value_type) <= 16, "over-aligned types are not supported");
+
+        protected:
+            // Lookups can use any type if both Hash and Eq are transparent, otherwise they require key_type
+            template <typename K>
+            using key_arg = typename key_arg_selector<is_transparent_lookup<Hash, Eq>::value>::template type<K, key_type>;
+
+        public:
+            template <bool Const>
+            class basic_iterator
+            {
+            public:
+                using value_type = flat_hash_table::value_type;
+                using reference = std::conditional_t<Const, const value_type&, value_type&>;
+                using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+                using difference_type = ptrdiff_t;
+
+                basic_iterator() = default;
+
+                // Allow conversion from iterator to const_iterator
+                template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+                basic_iterator(const basic_iterator<OtherConst>& other) : _ctrl(other._ctrl), _slot(other._slot)
+                {
+                }
+
+                reference operator*() const { return *_slot; }
+                pointer operator->() const { return _slot; }
+
+                basic_iterator& operator++()
+                {
+                    ++_ctrl;
+                    ++_slot;
+                    skip_empty_or_deleted();
+                    return *this;
+                }
+
+                basic_iterator operator++(int)
+                {
+                    auto result = *this;
+                    ++*this;
+                    return result;
+                }
+
+                friend bool operator==(const basic_iterator& a, const basic_iterator& b) { return a._ctrl == b._ctrl; }
+                friend bool operator!=(const basic_iterator& a, const basic_iterator& b) { return a._ctrl != b._ctrl; }
+
+            private:
+                friend class flat_hash_table;
+                template <bool>
+                friend class basic_iterator;
+
+                basic_iterator(const ctrl_t* ctrl, value_type* slot) : _ctrl(ctrl), _slot(slot) {}
+
+                void skip_empty_or_deleted()
+                {
+                    // The sentinel stops the iteration
+                    while (*_ctrl < kCtrlSentinel)
+                    {
+                        ++_ctrl;
+                        ++_slot;
+                    }
+                }
+
+                const ctrl_t* _ctrl{nullptr};
+                value_type* _slot{nullptr};
+            };
+
+            using iterator = basic_iterator<false>;
+            using const_iterator = basic_iterator<true>;
+
+            flat_hash_table() = default;
+            flat_hash_table(const flat_hash_table&) = delete; // not implemented (yet)
+            flat_hash_table(flat_hash_table&& other) noexcept { swap(other); }
+
+            ~flat_hash_table() { destroy(); }
+
+            flat_hash_table& operator=(const flat_hash_table&) = delete; // not implemented (yet)
+
+            flat_hash_table& operator=(flat_hash_table&& other) noexcept
+            {
+                destroy();
+                swap(other);
+                return *this;
+            }
+
+            iterator begin() noexcept
+            {
+                if (!_capacity)
+                    return end();
+
+                iterator it(_ctrl, _slots);
+                it.skip_empty_or_deleted();
+                return it;
+            }
+
+            iterator end() noexcept { return iterator(_ctrl + _capacity, nullptr); }
+
+            const_iterator begin() const noexcept { return const_cast<flat_hash_table*>(this)->begin(); }
+            const_iterator end() const noexcept { return const_cast<flat_hash_table*>(this)->end(); }
+
+            [[nodiscard]] bool empty() const noexcept { return _size == 0; }
+            size_type size() const noexcept { return _size; }
+            size_type capacity() const noexcept { return _capacity; }
+
+            void clear() noexcept
+            {
+                if (!_capacity)
+                    return;
+
+                for (size_t i = 0; i != _capacity; ++i)
+                {
+                    if (is_full(_ctrl[i]))
+                        std::destroy_at(_slots + i);
+                }
+
+                memset(_ctrl, kCtrlEmpty, _capacity + Group::kWidth);
+                _ctrl[_capacity] = kCtrlSentinel;
+                _size = 0;
+                _growthLeft = capacity_to_growth(_capacity);
+            }
+
+            // Make room for at least 'count' elements without growing
+            void reserve(size_type count)
+            {
+                if (count > _size + _growthLeft)
+                    resize(growth_to_capacity(count, Group::kWidth));
+            }
+
+            template <typename K = key_type>
+            iterator find(const key_arg<K>& key)
+            {
+                const auto index = find_index(key);
+                return index == _capacity ? end() : iterator(_ctrl + index, _slots + index);
+            }
+
+            template <typename K = key_type>
+            const_iterator find(const key_arg<K>& key) const
+            {
+                return const_cast<flat_hash_table*>(this)->find(key);
+            }
+
+            template <typename K = key_type>
+            bool contains(const key_arg<K>& key) const
+            {
+                return find_index(key) != _capacity;
+            }
+
+            template <typename K = key_type>
+            size_type count(const key_arg<K>& key) const
+            {
+                return contains(key) ? 1 : 0;
+            }
+
+            template <typename K = key_type>
+            size_type erase(const key_arg<K>& key)
+            {
+                const auto index = find_index(key);
+                if (index == _capacity)
+                    return 0;
+
+                erase_at(index);
+                return 1;
+            }
+
+            void erase(const_iterator it)
+            {
+                assert(it != end());
+                erase_at(it._ctrl - _ctrl);
+            }
+
+            void swap(flat_hash_table& other) noexcept
+            {
+                std::swap(_ctrl, other._ctrl);
+                std::swap(_slots, other._slots);
+                std::swap(_capacity, other._capacity);
+                std::swap(_size, other._size);
+                std::swap(_growthLeft, other._growthLeft);
+                std::swap(_hash, other._hash);
+                std::swap(_eq, other._eq);
+            }
+
+        protected:
+            // Hashes a key
+            template <typename K>
+            size_t hash_key(const K& key) const
+            {
+                return _hash(key);
+            }
+
+            // Returns the index of the slot holding 'key', or _capacity if there is none
+            template <typename K>
+            size_t find_index(const K& key) const
+            {
+                if (!_capacity)
+                    return _capacity;
+
+                const auto hash = hash_key(key);
+                probe_sequence<Group::kWidth> sequence(h1(hash), _capacity);
+                for (;;)
+                {
+                    const Group g(_ctrl + sequence.offset());
+                    for (const auto i : g.match(h2(hash)))
+                    {
+                        const auto index = sequence.offset(i);
+                        if (_eq(Policy::key(_slots[index]), key)) [[likely]]
+                            return index;
+                    }
+
+                    if (g.match_empty()) [[likely]]
+                        return _capacity;
+
+                    sequence.next();
+                }
+            }
+
+            // Looks up 'key'. If it isn't found, reserves a slot for it. Returns the slot index and whether or not the
+            // slot needs to be constructed by the caller (which must happen before any other operation on the table).
+            template <typename K>
+            std::pair<size_t, bool> find_or_prepare_insert(const K& key)
+            {
+                const auto hash = hash_key(key);
+                if (_capacity)
+                {
+                    probe_sequence<Group::kWidth> sequence(h1(hash), _capacity);
+                    for (;;)
+                    {
+                        const Group g(_ctrl + sequence.offset());
+                        for (const auto i : g.match(h2(hash)))
+                        {
+                            const auto index = sequence.offset(i);
+                            if (_eq(Policy::key(_slots[index]), key)) [[likely]]
+                                return {index, false};
+                        }
+
+                        if (g.match_empty()) [[likely]]
+                            break;
+
+                        sequence.next();
+                    }
+                }
+
+                return {prepare_insert(hash), true};
+            }
+
+            value_type* slot(size_t index) { return _slots + index; }
+            iterator iterator_at(size_t index) { return iterator(_ctrl + index, _slots + index); }
+
+        private:
+            size_t find_first_non_full(size_t hash) const
+            {
+                probe_sequence<Group::kWidth> sequence(h1(hash), _capacity);
+                for (;;)
+                {
+                    const Group g(_ctrl + sequence.offset());
+                    if (const auto mask = g.match_empty_or_deleted())
+                        return sequence.offset(mask.lowest());
+
+                    sequence.next();
+                }
+            }
+
+            size_t prepare_insert(size_t hash)
+            {
+                auto index = _capacity ? find_first_non_full(hash) : 0;
+
+                // Reusing a deleted slot doesn't consume growth
+                if (!_capacity || (_growthLeft == 0 && _ctrl[index] != kCtrlDeleted)) [[unlikely]]
+                {
+                    grow();
+                    index = find_first_non_full(hash);
+                }
+
+                _growthLeft -= (_ctrl[index] == kCtrlEmpty);
+                set_ctrl(index, h2(hash));
+                ++_size;
+                return index;
+            }
+
+            void erase_at(size_t index)
+            {
+                std::destroy_at(_slots + index);
+                --_size;
+
+                // If there is no group containing this slot that was ever full, no probe sequence ever went past it
+                // and we can mark it empty. Otherwise we need a tombstone to keep probe sequences going.
+                const auto indexBefore = (index - Group::kWidth) & _capacity;
+                const auto emptyAfter = Group(_ctrl + index).match_empty();
+                const auto emptyBefore = Group(_ctrl + indexBefore).match_empty();
+                const bool wasNeverFull = emptyBefore && emptyAfter &&
+                                          size_t(emptyAfter.trailing_zeros() + emptyBefore.leading_zeros()) < Group::kWidth;
+
+                if (wasNeverFull)
+                {
+                    set_ctrl(index, kCtrlEmpty);
+                    ++_growthLeft;
+                }
+                else
+                {
+                    set_ctrl(index, kCtrlDeleted);
+                }
+            }
+
+            void set_ctrl(size_t index, ctrl_t ctrl)
+            {
+                constexpr size_t kClonedBytes = Group::kWidth - 1;
+                _ctrl[index] = ctrl;
+                _ctrl[((index - kClonedBytes) & _capacity) + (kClonedBytes & _capacity)] = ctrl;
+            }
+
+            void grow()
+            {
+                // If a lot of the used slots are tombstones, rehashing in a table of the same size is enough
+                if (_capacity > Group::kWidth && _size * 32 <= _capacity * 25)
+                    resize(_capacity);
+                else
+                    resize(_capacity ? _capacity * 2 + 1 : Group::kWidth - 1);
+            }
+
+            static size_t slots_offset(size_t capacity)
+            {
+                const auto ctrlSize = capacity + Group::kWidth;
+                return (ctrlSize + alignof(value_type) - 1) & ~(alignof(value_type) - 1);
+            }
+
+            void resize(size_t newCapacity)
+            {
+                const auto oldCtrl = _ctrl;
+                const auto oldSlots = _slots;
+                const auto oldCapacity = _capacity;
+
+                const auto offset = slots_offset(newCapacity);
+                const auto memory = (char*)::malloc(offset + newCapacity * sizeof(value_type));
+                assert(memory); // TODO: we can't handle this very well in the kernel...
+
+                _ctrl = reinterpret_cast<ctrl_t*>(memory);
+                _slots = reinterpret_cast<value_type*>(memory + offset);
+                _capacity = newCapacity;
+                memset(_ctrl, kCtrlEmpty, newCapacity + Group::kWidth);
+                _ctrl[newCapacity] = kCtrlSentinel;
+                _growthLeft = capacity_to_growth(newCapacity) - _size;
+
+                for (size_t i = 0; i != oldCapacity; ++i)
+                {
+                    if (!is_full(oldCtrl[i]))
+                        continue;
+
+                    const auto hash = hash_key(Policy::key(oldSlots[i]));
+                    const auto index = find_first_non_full(hash);
+                    set_ctrl(index, h2(hash));
+                    std::construct_at(_slots + index, std::move(oldSlots[i]));
+                    std::destroy_at(oldSlots + i);
+                }
+
+                ::free(oldCtrl);
+            }
+
+            void destroy()
+            {
+                if (!_capacity)
+                    return;
+
+                clear();
+                ::free(_ctrl);
+                _ctrl = nullptr;
+                _slots = nullptr;
+                _capacity = 0;
+                _growthLeft = 0;
+            }
+
+            ctrl_t* _ctrl{nullptr};
+            value_type* _slots{nullptr};
+            size_t _capacity{0};   // Number of slots, 0 or a power of 2 minus 1
+            size_t _size{0};       // Number of elements
+            size_t _growthLeft{0}; // Number of elements that can be inserted before growing
+            [[no_unique_address]] Hash _hash;
+            [[no_unique_address]] Eq _eq;
+        };
+    } // namespace details
+} // namespace mtl
@@ -0,0 +1,559 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <metal/string.hpp>
+#include <metal/string_view.hpp>
+#include <type_traits>
+
+namespace mtl
+{
+    struct to_chars_result
+    {
+        char* ptr; // One past the last character written, or 'last' on failure
+        bool ok;   // False if the buffer was too small
+    };
+
+    namespace details
+    {
+        inline constexpr char kDigitPairs[] = "00010203040506070809"
+                                              "10111213141516171819"
+                                              "20212223242526272829"
+                                              "30313233343536373839"
+                                              "40414243444546474849"
+                                              "50515253545556575859"
+                                              "60616263646566676869"
+                                              "70717273747576777879"
+                                              "80818283848586878889"
+                                              "90919293949596979899";
+
+        inline constexpr char kHexDigits[] = "0123456789abcdef";
+        inline constexpr char kUpperHexDigits[] = "0123456789ABCDEF";
+
+        // Enough for a sign and 20 decimal digits, or a "0x" prefix and 16 hex digits
+        inline constexpr int kMaxIntegerLength = 24;
+
+        constexpr int count_digits(uint64_t value) noexcept
+        {
+            int count = 1;
+            for (;;)
+            {
+                if (value < 10)
+                    return count;
+                if (value < 100)
+                    return count + 1;
+                if (value < 1000)
+                    return count + 2;
+                if (value < 10000)
+                    return count + 3;
+                value /= 10000;
+                count += 4;
+            }
+        }
+
+        constexpr int count_hex_digits(uint64_t value) noexcept
+        {
+            return (64 - std::countl_zero(value | 1) + 3) / 4;
+        }
+
+        // Write the decimal digits of 'value' so that they end at 'last', two at a time. Returns the first digit.
+        constexpr char* write_decimal(char* last, uint64_t value) noexcept
+        {
+            while (value >= 100)
+            {
+                const auto pair = (value % 100) * 2;
+                value /= 100;
+                *--last = kDigitPairs[pair + 1];
+                *--last = kDigitPairs[pair];
+            }
+
+            if (value >= 10)
+            {
+                *--last = kDigitPairs[value * 2 + 1];
+                *--last = kDigitPairs[value * 2];
+            }
+            else
+            {
+                *--last = '0' + value;
+            }
+
+            return last;
+        }
+
+        // Write the 'count' lowest nibbles of 'value' so that they end at 'last'. Returns the first digit.
+        constexpr char* write_hex(char* last, uint64_t value, int count, const char* digits = kHexDigits) noexcept
+        {
+            for (; count > 0; --count)
+            {
+                *--last = digits[value & 15];
+                value >>= 4;
+            }
+
+            return last;
+        }
+
+        // Magnitude of 'value' as an unsigned 64 bits integer, this works for the most negative values too
+        template <typename T>
+        constexpr uint64_t magnitude(T value) noexcept
+        {
+            if constexpr (std::is_signed_v<T>)
+                return value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+            else
+                return value;
+        }
+    } // namespace details
+
+    // Convert an integer to text in base 10 or 16. The output is not null terminated.
+    template <typename T>
+        requires(std::is_integral_v<T> && !std::is_same_v<T, bool>)
+    constexpr to_chars_result to_chars(char* first, char* last, T value, int base = 10) noexcept
+    {
+        assert(base == 10 || base == 16);
+
+        const bool negative = std::is_signed_v<T> && value < 0;
+        const auto magnitude = details::magnitude(value);
+        const auto count = base == 10 ? details::count_digits(magnitude) : details::count_hex_digits(magnitude);
+        if (last - first < count + negative)
+            return {last, false};
+
+        if (negative)
+            *first++ = '-';
+
+        if (base == 10)
+            details::write_decimal(first + count, magnitude);
+        else
+            details::write_hex(first + count, magnitude, count);
+
+        return {first + count, true};
+    }
+
+    namespace details
+    {
+        enum class format_arg_type
+        {
+            None,
+            Bool,
+            Char,
+            Int,
+            UInt,
+            String,
+            Pointer
+        };
+
+        // Parsed replacement field: {[:[<|>][#][0][width][type]]}
+        struct format_spec
+        {
+            char align{0};         // '<' or '>', 0 to use the default for the argument type
+            bool alternate{false}; // '#': prefix hexadecimal numbers with "0x"
+            bool zero{false};      // '0': pad numbers with zeroes after the sign and prefix
+            int width{0};          // Minimum field width
+            char type{0};          // 'd', 'x', 'X', 'c', 's', 'p' or 0 for the default
+        };
+
+        // Parse the replacement field starting right after '{'. Returns the position after the closing '}', or
+        // nullptr if the field is malformed.
+        constexpr const char* parse_format_spec(const char* p, const char* end, format_spec& spec) noexcept
+        {
+            if (p != end && *p == ':')
+            {
+                ++p;
+
+                if (p != end && (*p == '<' || *p == '>'))
+                    spec.align = *p++;
+
+                if (p != end && *p == '#')
+                {
+                    spec.alternate = true;
+                    ++p;
+                }
+
+                if (p != end && *p == '0')
+                {
+                    spec.zero = true;
+                    ++p;
+                }
+
+                for (; p != end && *p >= '0' && *p <= '9'; ++p)
+                {
+                    spec.width = spec.width * 10 + (*p - '0');
+                    if (spec.width > 255)
+                        return nullptr;
+                }
+
+                if (p != end && *p != '}')
+                    spec.type = *p++;
+            }
+
+            return p != end && *p == '}' ? p + 1 : nullptr;
+        }
+
+        constexpr bool is_valid_format_type(format_arg_type arg, char type) noexcept
+        {
+            switch (arg)
+            {
+            case format_arg_type::Bool:
+                return type == 0 || type == 's';
+            case format_arg_type::Char:
+                return type == 0 || type == 'c';
+            case format_arg_type::Int:
+            case format_arg_type::UInt:
+                return type == 0 || type == 'd' || type == 'x' || type == 'X';
+            case format_arg_type::String:
+                return type == 0 || type == 's';
+            case format_arg_type::Pointer:
+                return type == 0 || type == 'p';
+            default:
+                return false;
+            }
+        }
+
+        template <typename T>
+        consteval format_arg_type get_format_arg_type()
+        {
+            using U = std::remove_cvref_t<T>;
+            using Ref = const std::remove_reference_t<T>&;
+
+            if constexpr (std::is_same_v<U, bool>)
+                return format_arg_type::Bool;
+            else if constexpr (std::is_same_v<U, char> || std::is_same_v<U, char8_t>)
+                return format_arg_type::Char;
+            else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+                return format_arg_type::Int;
+            else if constexpr (std::is_integral_v<U> && std::is_unsigned_v<U> && !std::is_same_v<U, char16_t> &&
+                               !std::is_same_v<U, char32_t> && !std::is_same_v<U, wchar_t>)
+                return format_arg_type::UInt;
+            else if constexpr (std::is_convertible_v<Ref, mtl::string_view> || std::is_convertible_v<Ref, mtl::u8string_view>)
+                return format_arg_type::String;
+            else if constexpr (std::is_pointer_v<U> || std::is_same_v<U, std::nullptr_t>)
+                return format_arg_type::Pointer;
+            else
+                return format_arg_type::None;
+        }
+
+        // Not constexpr: calling it while checking a format string at compile time makes the check fail, and the
+        // compiler's diagnostic will show 'message'.
+        inline void format_string_error(const char* message)
+        {
+            (void)message;
+        }
+
+        consteval void check_format_string(mtl::string_view format, const format_arg_type* args, std::size_t count)
+        {
+            std::size_t index = 0;
+            for (auto p = format.begin(), end = format.end(); p != end;)
+            {
+                const auto c = *p++;
+                if (c == '{')
+                {
+                    if (p != end && *p == '{')
+                    {
+                        ++p;
+                        continue;
+                    }
+
+                    format_spec spec;
+                    p = parse_format_spec(p, end, spec);
+                    if (!p)
+                        return format_string_error("invalid replacement field");
+                    if (index == count)
+                        return format_string_error("not enough arguments for the format string");
+                    if (!is_valid_format_type(args[index], spec.type))
+                        return format_string_error("invalid format type for argument");
+                    ++index;
+                }
+                else if (c == '}')
+                {
+                    if (p == end || *p != '}')
+                        return format_string_error("unmatched '}' in format string");
+                    ++p;
+                }
+            }
+
+            if (index != count)
+                format_string_error("too many arguments for the format string");
+        }
+
+        // Type-erased argument, so that the formatting engine is only instantiated once per output iterator type
+        struct format_arg
+        {
+            format_arg_type type;
+            union
+            {
+                bool b;
+                char c;
+                int64_t i;
+                uint64_t u;
+                const void* p;
+                struct
+                {
+                    const char* data;
+                    std::size_t size;
+                } s;
+            };
+        };
+
+        template <typename T>
+        format_arg make_format_arg(const T& value) noexcept
+        {
+            constexpr auto type = get_format_arg_type<const T&>();
+            format_arg arg{type, {}};
+
+            if constexpr (type == format_arg_type::Bool)
+                arg.b = value;
+            else if constexpr (type == format_arg_type::Char)
+                arg.c = static_cast<char>(value);
+            else if constexpr (type == format_arg_type::Int)
+                arg.i = value;
+            else if constexpr (type == format_arg_type::UInt)
+                arg.u = value;
+            else if constexpr (type == format_arg_type::String)
+            {
+                if constexpr (std::is_convertible_v<const T&, mtl::string_view>)
+                {
+                    const mtl::string_view text = value;
+                    arg.s = {text.data(), text.size()};
+                }
+                else
+                {
+                    const mtl::u8string_view text = value;
+                    arg.s = {reinterpret_cast<const char*>(text.data()), text.size()};
+                }
+            }
+            else if constexpr (type == format_arg_type::Pointer)
+                arg.p = value;
+            else
+                static_assert(type != format_arg_type::None, "mtl::format: unsupported argument type");
+
+            return arg;
+        }
+
+        template <typename OutputIt>
+        OutputIt format_fill(OutputIt out, char c, int count)
+        {
+            for (; count > 0; --count)
+                *out++ = c;
+            return out;
+        }
+
+        // Write [first, last) padded to the spec's width. The first 'prefixLength' characters (sign and "0x") go before
+        // any zero padding.
+        template <typename OutputIt>
+        OutputIt format_padded(OutputIt out, const char* first, const char* last, const format_spec& spec, bool isNumber,
+                               int prefixLength = 0)
+        {
+            const auto padding = spec.width - static_cast<int>(last - first);
+            if (padding <= 0)
+                return std::copy(first, last, out);
+
+            const auto align = spec.align ? spec.align : (isNumber ? '>' : '<');
+            if (spec.zero && isNumber && !spec.align)
+            {
+                out = std::copy(first, first + prefixLength, out);
+                out = format_fill(out, '0', padding);
+                return std::copy(first + prefixLength, last, out);
+            }
+
+            if (align == '>')
+                out = format_fill(out, ' ', padding);
+            out = std::copy(first, last, out);
+            if (align == '<')
+                out = format_fill(out, ' ', padding);
+
+            return out;
+        }
+
+        template <typename OutputIt>
+        OutputIt format_integer(OutputIt out, uint64_t magnitude, bool negative, const format_spec& spec)
+        {
+            char buffer[kMaxIntegerLength];
+            auto last = buffer + kMaxIntegerLength;
+            char* first;
+
+            if (spec.type == 'x' || spec.type == 'X' || spec.type == 'p')
+            {
+                const auto digits = spec.type == 'X' ? kUpperHexDigits : kHexDigits;
+                first = write_hex(last, magnitude, count_hex_digits(magnitude), digits);
+                if (spec.alternate || spec.type == 'p')
+                {
+                    *--first = spec.type == 'X' ? 'X' : 'x';
+                    *--first = '0';
+                }
+            }
+            else
+            {
+                first = write_decimal(last, magnitude);
+            }
+
+            if (negative)
+                *--first = '-';
+
+            const auto digitCount = spec.type == 'x' || spec.type == 'X' || spec.type == 'p' ? count_hex_digits(magnitude)
+                                                                                              : count_digits(magnitude);
+            return format_padded(out, first, last, spec, true, static_cast<int>(last - first) - digitCount);
+        }
+
+        template <typename OutputIt>
+        OutputIt format_value(OutputIt out, const format_arg& arg, format_spec spec)
+        {
+            switch (arg.type)
+            {
+            case format_arg_type::Bool:
+            {
+                const auto text = arg.b ? mtl::string_view("true", 4) : mtl::string_view("false", 5);
+                return format_padded(out, text.begin(), text.end(), spec, false);
+            }
+
+            case format_arg_type::Char:
+                return format_padded(out, &arg.c, &arg.c + 1, spec, false);
+
+            case format_arg_type::Int:
+                return format_integer(out, magnitude(arg.i), arg.i < 0, spec);
+
+            case format_arg_type::UInt:
+                return format_integer(out, arg.u, false, spec);
+
+            case format_arg_type::String:
+                return format_padded(out, arg.s.data, arg.s.data + arg.s.size, spec, false);
+
+            case format_arg_type::Pointer:
+                spec.type = 'p';
+                return format_integer(out, reinterpret_cast<uintptr_t>(arg.p), false, spec);
+
+            default:
+                return out;
+            }
+        }
+
+        template <typename OutputIt>
+        OutputIt vformat_to(OutputIt out, mtl::string_view format, const format_arg* args)
+        {
+            // The format string was validated at compile time
+            for (auto p = format.begin(), end = format.end(); p != end;)
+            {
+                // Copy literal text up to the next brace in one go
+                auto q = p;
+                while (q != end && *q != '{' && *q != '}')
+                    ++q;
+                out = std::copy(p, q, out);
+                if (q == end)
+                    break;
+
+                p = q + 1;
+                if (*q == '}' || *p == '{')
+                {
+                    // Escaped "}}" or "{{"
+                    *out++ = *p++;
+                    continue;
+                }
+
+                format_spec spec;
+                p = parse_format_spec(p, end, spec);
+                out = format_value(out, *args++, spec);
+            }
+
+            return out;
+        }
+
+        // Output iterator that only counts characters
+        struct counting_iterator
+        {
+            using iterator_category = std::output_iterator_tag;
+            using value_type = void;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = void;
+
+            counting_iterator& operator*() { return *this; }
+            counting_iterator& operator++() { return *this; }
+            counting_iterator& operator++(int) { return *this; }
+
+            counting_iterator& operator=(char)
+            {
+                ++count;
+                return *this;
+            }
+
+            std::size_t count{0};
+        };
+    } // namespace details
+
+    // Format string checked at compile time against the argument types
+    template <typename... Args>
+    class basic_format_string
+    {
+    public:
+        template <typename S>
+            requires(std::is_convertible_v<const S&, mtl::string_view>)
+        consteval basic_format_string(const S& format) : _format(format)
+        {
+            const details::format_arg_type args[] = {details::get_format_arg_type<Args>()..., details::format_arg_type::None};
+            details::check_format_string(_format, args, sizeof...(Args));
+        }
+
+        constexpr mtl::string_view get() const noexcept { return _format; }
+
+    private:
+        mtl::string_view _format;
+    };
+
+    template <typename... Args>
+    using format_string = basic_format_string<std::type_identity_t<Args>...>;
+
+    // Format 'args' to 'out' according to 'format'. This is a subset of std::format: arguments are consumed in order
+    // and replacement fields are "{[:[<|>][#][0][width][type]]}". Supported arguments are integers, bool, char,
+    // narrow and UTF-8 strings and pointers. Characters are written one at a time, nothing is ever truncated.
+    template <typename OutputIt, typename... Args>
+    OutputIt format_to(OutputIt out, format_string<Args...> format, Args&&... args)
+    {
+        const details::format_arg formatArgs[] = {details::make_format_arg(args)..., {}};
+        return details::vformat_to(std::move(out), format.get(), formatArgs);
+    }
+
+    template <typename... Args>
+    std::size_t formatted_size(format_string<Args...> format, Args&&... args)
+    {
+        const details::format_arg formatArgs[] = {details::make_format_arg(args)..., {}};
+        return details::vformat_to(details::counting_iterator{}, format.get(), formatArgs).count;
+    }
+
+    // The result is allocated once, at its final size
+    template <typename... Args>
+    mtl::u8string format(format_string<Args...> format, Args&&... args)
+    {
+        const details::format_arg formatArgs[] = {details::make_format_arg(args)..., {}};
+
+        mtl::u8string result;
+        result.reserve(details::vformat_to(details::counting_iterator{}, format.get(), formatArgs).count);
+        details::vformat_to(std::back_inserter(result), format.get(), formatArgs);
+        return result;
+    }
+} // namespace mtl
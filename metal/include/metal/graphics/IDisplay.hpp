@@ -55,11 +55,12 @@ namespace mtl
 
         // Get access to the frontbuffer, if it is accessible.
         // This can return nullptr, the pixel format could be anything / unusuable.
-        virtual mtl::shared_ptr<Surface> GetFrontbuffer() = 0;
+        virtual Surface* GetFrontbuffer() = 0;
 
         // Get access to the backbuffer
         // The pixel format is always going to be PixelFormat::X8R8G8B8.
-        virtual mtl::shared_ptr<Surface> GetBackbuffer() = 0;
+        // This is called for every character drawn on a console: take an intrusive_ptr to keep the surface around.
+        virtual Surface& GetBackbuffer() = 0;
 
         // Blit pixels from the backbuffer to the framebuffer
         virtual void Blit(int x, int y, int width, int height) = 0;
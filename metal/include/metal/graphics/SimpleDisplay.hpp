@@ -38,8 +38,8 @@ namespace mtl
     class SimpleDisplay : public IDisplay
     {
     public:
-        SimpleDisplay(mtl::shared_ptr<Surface> framebuffer) : SimpleDisplay(framebuffer, framebuffer) {}
-        SimpleDisplay(mtl::shared_ptr<Surface> frontbuffer, mtl::shared_ptr<Surface> backbuffer);
+        SimpleDisplay(mtl::intrusive_ptr<Surface> framebuffer) : SimpleDisplay(framebuffer, framebuffer) {}
+        SimpleDisplay(mtl::intrusive_ptr<Surface> frontbuffer, mtl::intrusive_ptr<Surface> backbuffer);
 
         // Initialize the backbuffer from the frontbuffer. The intended use is to enable double buffering at kernel startup time.
         void InitializeBackbuffer();
@@ -49,13 +49,13 @@ namespace mtl
         void GetCurrentMode(GraphicsMode* mode) const override;
         bool GetMode(int index, GraphicsMode* mode) const override;
         bool SetMode(int index) override;
-        mtl::shared_ptr<Surface> GetFrontbuffer() override;
-        mtl::shared_ptr<Surface> GetBackbuffer() override;
+        Surface* GetFrontbuffer() override;
+        Surface& GetBackbuffer() override;
         void Blit(int x, int y, int width, int height) override;
         // bool GetEdid(Edid* edid) const override;
 
     protected:
-        mtl::shared_ptr<Surface> m_frontbuffer;
-        mtl::shared_ptr<Surface> m_backbuffer;
+        mtl::intrusive_ptr<Surface> m_frontbuffer;
+        mtl::intrusive_ptr<Surface> m_backbuffer;
     };
 } // namespace mtl
\ No newline at end of file
@@ -27,10 +27,12 @@
 #pragma once
 
 #include "PixelFormat.hpp"
+#include <metal/intrusive_ptr.hpp>
 
 namespace mtl
 {
-    class Surface
+    // Surfaces are reference counted so that displays and consoles can share them
+    class Surface : public mtl::ref_counted<Surface>
     {
     public:
         // Create a surface and allocate memory for pixels. This memory will be freed on destruction.
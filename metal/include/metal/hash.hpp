@@ -0,0 +1,169 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <metal/string.hpp>
+#include <metal/string_view.hpp>
+#include <type_traits>
+
+namespace mtl
+{
+    namespace details
+    {
+        // Multiplies a and b as 128 bits integers and folds the result back to 64 bits
+        constexpr uint64_t hash_mix(uint64_t a, uint64_t b)
+        {
+            const auto result = static_cast<unsigned __int128>(a) * b;
+            return static_cast<uint64_t>(result) ^ static_cast<uint64_t>(result >> 64);
+        }
+
+        inline constexpr uint64_t kHashSeed0 = 0xa0761d6478bd642full;
+        inline constexpr uint64_t kHashSeed1 = 0xe7037ed1a0b428dbull;
+        inline constexpr uint64_t kHashSeed2 = 0x8ebc6af09c88c6e3ull;
+
+        inline uint64_t hash_read64(const uint8_t* p)
+        {
+            uint64_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        inline uint64_t hash_read32(const uint8_t* p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+    } // namespace details
+
+    // Hashes a block of memory 16 bytes at a time. This is a simplified wyhash: not cryptographic, but fast and with good
+    // enough distribution for hash tables.
+    inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0)
+    {
+        using namespace details;
+
+        auto p = static_cast<const uint8_t*>(data);
+        seed ^= hash_mix(seed ^ kHashSeed0, kHashSeed1);
+
+        uint64_t a;
+        uint64_t b;
+        if (size <= 16)
+        {
+            if (size >= 4)
+            {
+                a = (hash_read32(p) << 32) | hash_read32(p + ((size >> 3) << 2));
+                b = (hash_read32(p + size - 4) << 32) | hash_read32(p + size - 4 - ((size >> 3) << 2));
+            }
+            else if (size > 0)
+            {
+                a = (uint64_t{p[0]} << 16) | (uint64_t{p[size >> 1]} << 8) | p[size - 1];
+                b = 0;
+            }
+            else
+            {
+                a = b = 0;
+            }
+        }
+        else
+        {
+            auto remaining = size;
+            while (remaining > 16)
+            {
+                seed = hash_mix(hash_read64(p) ^ kHashSeed1, hash_read64(p + 8) ^ seed);
+                p += 16;
+                remaining -= 16;
+            }
+
+            // Last 16 bytes, possibly overlapping the previous block
+            a = hash_read64(p + remaining - 16);
+            b = hash_read64(p + remaining - 8);
+        }
+
+        return hash_mix(kHashSeed1 ^ size, hash_mix(a ^ kHashSeed1, b ^ seed));
+    }
+
+    inline constexpr uint64_t hash_integer(uint64_t value)
+    {
+        return details::hash_mix(value ^ details::kHashSeed0, details::kHashSeed2);
+    }
+
+    // Default hash function for the hash containers. Specializations can declare 'is_transparent' to allow lookups
+    // with types other than the key type (i.e. looking up a string_view in a set of strings).
+    template <typename T, typename Enable = void>
+    struct hash;
+
+    template <typename T>
+    struct hash<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>>
+    {
+        constexpr size_t operator()(T value) const noexcept { return hash_integer(static_cast<uint64_t>(value)); }
+    };
+
+    template <typename T>
+    struct hash<T*>
+    {
+        size_t operator()(const T* value) const noexcept { return hash_integer(reinterpret_cast<uintptr_t>(value)); }
+    };
+
+    template <typename T>
+    struct hash<basic_string_view<T>>
+    {
+        using is_transparent = void;
+
+        size_t operator()(basic_string_view<T> value) const noexcept
+        {
+            return hash_bytes(value.data(), value.length() * sizeof(T));
+        }
+    };
+
+    template <typename T, typename Allocator>
+    struct hash<basic_string<T, Allocator>> : hash<basic_string_view<T>>
+    {
+    };
+
+    // Default equality function for the hash containers
+    template <typename T>
+    struct equal_to
+    {
+        constexpr bool operator()(const T& a, const T& b) const { return a == b; }
+    };
+
+    template <typename T>
+    struct equal_to<basic_string_view<T>>
+    {
+        using is_transparent = void;
+
+        constexpr bool operator()(basic_string_view<T> a, basic_string_view<T> b) const { return a == b; }
+    };
+
+    template <typename T, typename Allocator>
+    struct equal_to<basic_string<T, Allocator>> : equal_to<basic_string_view<T>>
+    {
+    };
+} // namespace mtl
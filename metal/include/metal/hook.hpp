@@ -24,4 +24,25 @@
     OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <unittest.hpp>
+#pragma once
+
+#include <cstddef>
+
+namespace mtl::details
+{
+    // Offset of the member hook 'Member' within T
+    template <typename T, typename Hook, Hook T::*Member>
+    std::size_t hook_offset() noexcept
+    {
+        alignas(T) static char storage[sizeof(T)];
+        auto object = reinterpret_cast<T*>(storage);
+        return reinterpret_cast<char*>(&(object->*Member)) - storage;
+    }
+
+    // Returns the object containing 'hook', or null if 'hook' is null
+    template <typename T, typename Hook, Hook T::*Member>
+    T* hook_to_value(Hook* hook) noexcept
+    {
+        return hook ? reinterpret_cast<T*>(reinterpret_cast<char*>(hook) - hook_offset<T, Hook, Member>()) : nullptr;
+    }
+} // namespace mtl::details
@@ -0,0 +1,221 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <metal/hook.hpp>
+#include <type_traits>
+
+namespace mtl
+{
+    // Hook to embed in objects stored in an intrusive_list. An object can be in as many lists as it has hooks.
+    struct list_hook
+    {
+        list_hook* prev{nullptr};
+        list_hook* next{nullptr};
+
+        // Whether or not the object is currently in a list
+        bool is_linked() const noexcept { return next != nullptr; }
+    };
+
+    // Intrusive doubly linked list. The list doesn't own its elements, it only links them through their hook: insertion
+    // and removal never allocate and are O(1).
+    template <typename T, list_hook T::*Hook>
+    class intrusive_list
+    {
+    public:
+        using value_type = T;
+        using reference = T&;
+        using const_reference = const T&;
+        using size_type = std::size_t;
+
+        template <typename U>
+        class iterator_base
+        {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = U*;
+            using reference = U&;
+
+            constexpr iterator_base() = default;
+            constexpr explicit iterator_base(list_hook* node) : _node(node) {}
+
+            // Allow conversion from iterator to const_iterator
+            template <typename V, typename = std::enable_if_t<std::is_const_v<U> && !std::is_const_v<V>>>
+            constexpr iterator_base(const iterator_base<V>& other) : _node(other._node)
+            {
+            }
+
+            reference operator*() const { return *to_value(_node); }
+            pointer operator->() const { return to_value(_node); }
+
+            iterator_base& operator++()
+            {
+                _node = _node->next;
+                return *this;
+            }
+
+            iterator_base operator++(int)
+            {
+                auto result = *this;
+                ++*this;
+                return result;
+            }
+
+            iterator_base& operator--()
+            {
+                _node = _node->prev;
+                return *this;
+            }
+
+            iterator_base operator--(int)
+            {
+                auto result = *this;
+                --*this;
+                return result;
+            }
+
+            friend bool operator==(const iterator_base& a, const iterator_base& b) { return a._node == b._node; }
+
+        private:
+            friend class intrusive_list;
+            template <typename>
+            friend class iterator_base;
+
+            list_hook* _node{nullptr};
+        };
+
+        using iterator = iterator_base<T>;
+        using const_iterator = iterator_base<const T>;
+
+        // The list is circular around _head, so that there are no special cases at either end
+        constexpr intrusive_list() noexcept : _head{&_head, &_head} {}
+
+        // Moving or copying would leave elements pointing to the wrong head
+        intrusive_list(const intrusive_list&) = delete;
+        intrusive_list& operator=(const intrusive_list&) = delete;
+
+        ~intrusive_list() { clear(); }
+
+        [[nodiscard]] bool empty() const noexcept { return _head.next == &_head; }
+        size_type size() const noexcept { return _size; }
+
+        iterator begin() noexcept { return iterator(_head.next); }
+        const_iterator begin() const noexcept { return const_iterator(_head.next); }
+        iterator end() noexcept { return iterator(&_head); }
+        const_iterator end() const noexcept { return const_iterator(const_cast<list_hook*>(&_head)); }
+
+        reference front() { return *to_value(_head.next); }
+        const_reference front() const { return *to_value(_head.next); }
+        reference back() { return *to_value(_head.prev); }
+        const_reference back() const { return *to_value(_head.prev); }
+
+        void push_front(T& value) { link(&(value.*Hook), _head.next); }
+        void push_back(T& value) { link(&(value.*Hook), &_head); }
+
+        void pop_front() { unlink(_head.next); }
+        void pop_back() { unlink(_head.prev); }
+
+        // Insert 'value' before 'position'
+        iterator insert(const_iterator position, T& value)
+        {
+            link(&(value.*Hook), position._node);
+            return iterator(&(value.*Hook));
+        }
+
+        // Remove 'value' from the list, returns an iterator to the next element
+        iterator erase(T& value)
+        {
+            const auto next = (value.*Hook).next;
+            unlink(&(value.*Hook));
+            return iterator(next);
+        }
+
+        iterator erase(const_iterator position) { return erase(*to_value(position._node)); }
+
+        // Unlink all elements
+        void clear() noexcept
+        {
+            for (auto node = _head.next; node != &_head;)
+            {
+                const auto next = node->next;
+                node->prev = node->next = nullptr;
+                node = next;
+            }
+
+            _head.prev = _head.next = &_head;
+            _size = 0;
+        }
+
+        // Move all elements of 'other' at the end of this list
+        void splice_back(intrusive_list& other) noexcept
+        {
+            if (other.empty())
+                return;
+
+            other._head.next->prev = _head.prev;
+            _head.prev->next = other._head.next;
+            other._head.prev->next = &_head;
+            _head.prev = other._head.prev;
+            _size += other._size;
+
+            other._head.prev = other._head.next = &other._head;
+            other._size = 0;
+        }
+
+    private:
+        static T* to_value(list_hook* hook) noexcept { return details::hook_to_value<T, list_hook, Hook>(hook); }
+        static const T* to_value(const list_hook* hook) noexcept { return to_value(const_cast<list_hook*>(hook)); }
+
+        // Insert 'node' before 'position'
+        void link(list_hook* node, list_hook* position)
+        {
+            assert(!node->is_linked());
+            node->prev = position->prev;
+            node->next = position;
+            position->prev->next = node;
+            position->prev = node;
+            ++_size;
+        }
+
+        void unlink(list_hook* node)
+        {
+            assert(node->is_linked() && node != &_head);
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->prev = node->next = nullptr;
+            --_size;
+        }
+
+        list_hook _head;
+        size_type _size{0};
+    };
+} // namespace mtl
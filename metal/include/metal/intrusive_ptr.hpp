@@ -0,0 +1,207 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <metal/atomic.hpp>
+#include <metal/type_traits.hpp>
+#include <type_traits>
+#include <utility>
+
+namespace mtl
+{
+    namespace details
+    {
+        // Reference count for objects shared between processors
+        class atomic_ref_count
+        {
+        public:
+            void increment() noexcept { _count.fetch_add(1, mtl::memory_order_relaxed); }
+
+            // Returns true when the last reference is gone
+            bool decrement() noexcept { return _count.fetch_sub(1, mtl::memory_order_acq_rel) == 1; }
+
+            int get() const noexcept { return _count.load(mtl::memory_order_relaxed); }
+
+        private:
+            mtl::atomic<int> _count{0};
+        };
+
+        // Reference count for objects that never leave the processor that created them
+        class local_ref_count
+        {
+        public:
+            void increment() noexcept { ++_count; }
+            bool decrement() noexcept { return --_count == 0; }
+            int get() const noexcept { return _count; }
+
+        private:
+            int _count{0};
+        };
+    } // namespace details
+
+    // Base class embedding a reference count in T, for use with intrusive_ptr. There is no separate control block and
+    // no weak references: the object is deleted as soon as the last intrusive_ptr goes away.
+    //
+    // T doesn't need a virtual destructor, the object is deleted as a T.
+    template <typename T, typename Count = details::atomic_ref_count>
+    class ref_counted
+    {
+    public:
+        int use_count() const noexcept { return _count.get(); }
+
+    protected:
+        constexpr ref_counted() noexcept = default;
+        ~ref_counted() = default;
+
+        // Copies are new objects and start with their own count
+        ref_counted(const ref_counted&) noexcept {}
+        ref_counted& operator=(const ref_counted&) noexcept { return *this; }
+
+    private:
+        friend void intrusive_ptr_add_ref(const ref_counted* p) noexcept { p->_count.increment(); }
+
+        friend void intrusive_ptr_release(const ref_counted* p) noexcept
+        {
+            if (p->_count.decrement())
+                delete static_cast<const T*>(p);
+        }
+
+        mutable Count _count;
+    };
+
+    // Non-atomic reference count for objects that are only ever referenced from one processor (per-CPU data,
+    // objects private to a task that can't migrate, etc). Sharing such an object between processors is a bug.
+    template <typename T>
+    using local_ref_counted = ref_counted<T, details::local_ref_count>;
+
+    // Smart pointer to an object that carries its own reference count. The count is manipulated through the
+    // intrusive_ptr_add_ref() and intrusive_ptr_release() functions found by ADL, ref_counted provides them.
+    //
+    // Because the count lives in the object, an intrusive_ptr can be rebuilt from a raw pointer at any time. This lets
+    // interfaces hand out plain pointers and references and only take a reference when ownership is actually needed.
+    template <typename T>
+    class intrusive_ptr
+    {
+    public:
+        using element_type = T;
+
+        constexpr intrusive_ptr() noexcept = default;
+        constexpr intrusive_ptr(std::nullptr_t) noexcept {}
+
+        explicit intrusive_ptr(T* p, bool addRef = true) noexcept : _p(p)
+        {
+            if (_p && addRef)
+                intrusive_ptr_add_ref(_p);
+        }
+
+        intrusive_ptr(const intrusive_ptr& rhs) noexcept : intrusive_ptr(rhs._p) {}
+
+        template <typename U>
+            requires(std::is_convertible_v<U*, T*>)
+        intrusive_ptr(const intrusive_ptr<U>& rhs) noexcept : intrusive_ptr(rhs.get())
+        {
+        }
+
+        intrusive_ptr(intrusive_ptr&& rhs) noexcept : _p(rhs._p) { rhs._p = nullptr; }
+
+        template <typename U>
+            requires(std::is_convertible_v<U*, T*>)
+        intrusive_ptr(intrusive_ptr<U>&& rhs) noexcept : _p(rhs.detach())
+        {
+        }
+
+        ~intrusive_ptr()
+        {
+            if (_p)
+                intrusive_ptr_release(_p);
+        }
+
+        intrusive_ptr& operator=(const intrusive_ptr& rhs) noexcept
+        {
+            intrusive_ptr(rhs).swap(*this);
+            return *this;
+        }
+
+        intrusive_ptr& operator=(intrusive_ptr&& rhs) noexcept
+        {
+            intrusive_ptr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        void reset() noexcept { intrusive_ptr().swap(*this); }
+        void reset(T* p) noexcept { intrusive_ptr(p).swap(*this); }
+
+        // Give up ownership without releasing the reference
+        T* detach() noexcept
+        {
+            const auto p = _p;
+            _p = nullptr;
+            return p;
+        }
+
+        void swap(intrusive_ptr& rhs) noexcept { std::swap(_p, rhs._p); }
+
+        T* get() const noexcept { return _p; }
+        T* operator->() const noexcept { return _p; }
+        T& operator*() const noexcept { return *_p; }
+
+        explicit operator bool() const noexcept { return _p != nullptr; }
+
+    private:
+        T* _p{nullptr};
+    };
+
+    template <typename T, typename... Args>
+    intrusive_ptr<T> make_intrusive(Args&&... args)
+    {
+        return intrusive_ptr<T>(new T(std::forward<Args>(args)...));
+    }
+
+    template <typename T, typename U>
+    bool operator==(const intrusive_ptr<T>& lhs, const intrusive_ptr<U>& rhs) noexcept
+    {
+        return lhs.get() == rhs.get();
+    }
+
+    template <typename T>
+    bool operator==(const intrusive_ptr<T>& lhs, std::nullptr_t) noexcept
+    {
+        return !lhs;
+    }
+
+    template <typename T>
+    void swap(intrusive_ptr<T>& lhs, intrusive_ptr<T>& rhs) noexcept
+    {
+        lhs.swap(rhs);
+    }
+
+    template <class T>
+    struct is_trivially_relocatable<intrusive_ptr<T>> : std::true_type
+    {
+    };
+} // namespace mtl
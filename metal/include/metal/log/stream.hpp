@@ -27,9 +27,11 @@
 #pragma once
 
 #include <cstdint>
+#include <iterator>
+#include <metal/format.hpp>
 #include <metal/log/core.hpp>
-#include <metal/static_vector.hpp>
 #include <metal/string_view.hpp>
+#include <metal/vector.hpp>
 #include <type_traits>
 #include <utility>
 
@@ -119,9 +121,18 @@ namespace mtl
             WriteHex<uintptr_t>(reinterpret_cast<uintptr_t>(value));
         }
 
+        // Format directly into the stream, see mtl::format_to()
+        template <typename... Args>
+        void Format(mtl::format_string<Args...> format, Args&&... args)
+        {
+            mtl::format_to(std::back_inserter(m_buffer), format, std::forward<Args>(args)...);
+        }
+
     private:
+        void Append(const char* first, const char* last);
+
         LogRecord& m_record;
-        mtl::static_vector<char8_t, 200> m_buffer;
+        mtl::small_vector<char8_t, 200> m_buffer; // Most messages fit, longer ones spill to the heap
     };
 
     inline LogStream& operator<<(LogStream& stream, mtl::string_view text)
@@ -0,0 +1,94 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <metal/expected.hpp>
+
+namespace mtl
+{
+    enum class Lz4Error
+    {
+        InvalidData,
+        Unsupported,
+        OutputTooSmall,
+    };
+
+    // Streaming decoder for the LZ4 frame format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md).
+    //
+    // The content is decompressed into a single, caller provided buffer. This is what lets linked blocks reference
+    // data from previous blocks without the decoder having to keep a copy of the window. Input can be fed in chunks
+    // of any size: incomplete blocks are left to the caller to present again with the data that follows.
+    //
+    // Only frames that record their content size are supported. Checksums are not verified.
+    class Lz4FrameDecoder
+    {
+    public:
+        static constexpr uint32_t kMagic = 0x184D2204;
+        static constexpr size_t kMaxHeaderSize = 19;
+
+        struct FrameInfo
+        {
+            uint64_t contentSize; // Size of the decompressed content
+            size_t maxBlockSize;  // Maximum size of a block's data
+            size_t headerSize;    // Size of the frame header, the first block follows
+            bool blockChecksum;
+            bool contentChecksum;
+        };
+
+        // Parse the frame header at the start of 'data'
+        static expected<FrameInfo, Lz4Error> ParseHeader(const void* data, size_t size);
+
+        // Returns whether or not 'data' starts with the LZ4 frame magic number
+        static bool IsFrame(const void* data, size_t size);
+
+        Lz4FrameDecoder(const FrameInfo& info, void* output, size_t outputSize);
+
+        // Decode the complete blocks at the start of 'input', which follows the frame header or the last byte consumed.
+        // Returns the number of bytes consumed. Progress is guaranteed once GetMaxChunkSize() bytes are presented.
+        expected<size_t, Lz4Error> Decode(const void* input, size_t size);
+
+        // Largest amount of input needed to decode the next block
+        size_t GetMaxChunkSize() const { return m_info.maxBlockSize + 8; }
+
+        // Number of bytes written to the output buffer so far
+        size_t GetOutputSize() const { return m_outputSize; }
+
+        // Returns whether or not the end of the frame was reached
+        bool IsFinished() const { return m_finished; }
+
+    private:
+        expected<void, Lz4Error> DecodeBlock(const uint8_t* input, size_t size);
+
+        const FrameInfo m_info;
+        uint8_t* const m_output;
+        const size_t m_outputCapacity;
+        size_t m_outputSize{0};
+        bool m_finished{false};
+    };
+} // namespace mtl
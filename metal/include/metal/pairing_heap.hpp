@@ -0,0 +1,200 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <metal/hook.hpp>
+#include <utility>
+
+namespace mtl
+{
+    // Hook to embed in objects stored in a pairing_heap
+    struct heap_hook
+    {
+        heap_hook* child{nullptr}; // Leftmost child
+        heap_hook* next{nullptr};  // Next sibling
+        heap_hook* prev{nullptr};  // Previous sibling, or parent for the leftmost child
+    };
+
+    // Intrusive pairing heap. The heap doesn't own its elements, it only links them through their hook.
+    //
+    // top() returns the element that compares before all others (the minimum for std::less). push() and top() are O(1),
+    // pop(), erase() and update() are O(log n) amortized. None of them allocate. Arbitrary elements can be removed,
+    // which makes this a good fit for timer and wait queues where waits get cancelled.
+    template <typename T, heap_hook T::*Hook, typename Compare>
+    class pairing_heap
+    {
+    public:
+        using value_type = T;
+        using reference = T&;
+        using const_reference = const T&;
+        using size_type = std::size_t;
+
+        constexpr pairing_heap() = default;
+
+        pairing_heap(const pairing_heap&) = delete;
+        pairing_heap& operator=(const pairing_heap&) = delete;
+
+        [[nodiscard]] bool empty() const noexcept { return _root == nullptr; }
+        size_type size() const noexcept { return _size; }
+
+        reference top() { return *to_value(_root); }
+        const_reference top() const { return *to_value(_root); }
+
+        void push(T& value)
+        {
+            auto node = &(value.*Hook);
+            *node = {};
+            _root = _root ? meld(_root, node) : node;
+            ++_size;
+        }
+
+        void pop()
+        {
+            assert(_root);
+            const auto root = _root;
+            _root = merge_pairs(root->child);
+            if (_root)
+                _root->prev = nullptr;
+            *root = {};
+            --_size;
+        }
+
+        void erase(T& value)
+        {
+            auto node = &(value.*Hook);
+            if (node == _root)
+                return pop();
+
+            detach(node);
+
+            if (auto children = merge_pairs(node->child))
+                _root = meld(_root, children);
+
+            *node = {};
+            --_size;
+        }
+
+        // Call when the key of 'value' moved towards the top (i.e. a deadline got earlier)
+        void decrease(T& value)
+        {
+            auto node = &(value.*Hook);
+            if (node == _root)
+                return;
+
+            detach(node);
+            node->next = node->prev = nullptr;
+            _root = meld(_root, node);
+        }
+
+        // Call when the key of 'value' changed in any direction
+        void update(T& value)
+        {
+            erase(value);
+            push(value);
+        }
+
+        // Remove all elements from the heap without touching them. Their hooks are left dangling.
+        void clear() noexcept
+        {
+            _root = nullptr;
+            _size = 0;
+        }
+
+    private:
+        static T* to_value(heap_hook* hook) noexcept { return details::hook_to_value<T, heap_hook, Hook>(hook); }
+
+        static bool before(heap_hook* a, heap_hook* b) { return Compare{}(*to_value(a), *to_value(b)); }
+
+        // Merge two heap-ordered trees, returns the new root. 'a' and 'b' must not have siblings.
+        static heap_hook* meld(heap_hook* a, heap_hook* b)
+        {
+            if (before(b, a))
+                std::swap(a, b);
+
+            // b becomes the leftmost child of a
+            b->prev = a;
+            b->next = a->child;
+            if (a->child)
+                a->child->prev = b;
+            a->child = b;
+            return a;
+        }
+
+        // Standard two-pass merge of a list of siblings: meld them in pairs from left to right, then meld the pairs
+        // from right to left. Iterative to keep stack usage constant.
+        static heap_hook* merge_pairs(heap_hook* first)
+        {
+            // First pass: pairs are chained in reverse order through 'prev'
+            heap_hook* pairs = nullptr;
+            while (first)
+            {
+                auto a = first;
+                auto b = a->next;
+                first = b ? b->next : nullptr;
+
+                a->next = a->prev = nullptr;
+                if (b)
+                {
+                    b->next = b->prev = nullptr;
+                    a = meld(a, b);
+                }
+
+                a->prev = pairs;
+                pairs = a;
+            }
+
+            // Second pass: meld from the last pair to the first
+            heap_hook* result = nullptr;
+            while (pairs)
+            {
+                const auto pair = pairs;
+                pairs = pairs->prev;
+                pair->prev = nullptr;
+                result = result ? meld(result, pair) : pair;
+            }
+
+            return result;
+        }
+
+        // Remove the subtree rooted at 'node' from its parent. 'node' must not be the root.
+        static void detach(heap_hook* node)
+        {
+            if (node->prev->child == node)
+                node->prev->child = node->next;
+            else
+                node->prev->next = node->next;
+
+            if (node->next)
+                node->next->prev = node->prev;
+        }
+
+        heap_hook* _root{nullptr};
+        size_type _size{0};
+    };
+} // namespace mtl
@@ -0,0 +1,244 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <metal/hook.hpp>
+
+namespace mtl
+{
+    // Hook to embed in objects stored in an rbtree. An object can be in as many trees as it has hooks.
+    struct rbtree_hook
+    {
+        rbtree_hook* parent{nullptr};
+        rbtree_hook* left{nullptr};
+        rbtree_hook* right{nullptr};
+        bool red{false};
+    };
+
+    // Default augmentation: nothing to maintain
+    struct rbtree_no_augment
+    {
+        template <typename T>
+        constexpr void operator()(T&, const T*, const T*) const
+        {
+        }
+    };
+
+    namespace details
+    {
+        // Type-erased red-black tree algorithms. The augment callback is invoked on a node whenever one of its
+        // subtrees changes, children before parents. This lets trees maintain per-subtree data (maximums, sizes,
+        // gaps) that can be used to prune searches.
+        class rbtree_base
+        {
+        public:
+            using augment_callback = void (*)(rbtree_hook* node);
+
+            rbtree_base(const rbtree_base&) = delete;
+            rbtree_base& operator=(const rbtree_base&) = delete;
+
+            [[nodiscard]] bool empty() const noexcept { return _root == nullptr; }
+            std::size_t size() const noexcept { return _size; }
+
+        protected:
+            explicit constexpr rbtree_base(augment_callback augment) : _augment(augment) {}
+
+            // Insert 'node' as the 'left' or 'right' child of 'parent' ('parent' is null for an empty tree)
+            void link(rbtree_hook* node, rbtree_hook* parent, bool left);
+            void unlink(rbtree_hook* node);
+
+            static rbtree_hook* first(rbtree_hook* node);
+            static rbtree_hook* last(rbtree_hook* node);
+            static rbtree_hook* next(rbtree_hook* node);
+            static rbtree_hook* prev(rbtree_hook* node);
+
+            rbtree_hook* _root{nullptr};
+            std::size_t _size{0};
+
+        private:
+            void augment_path(rbtree_hook* node);
+            void replace_child(rbtree_hook* parent, rbtree_hook* oldChild, rbtree_hook* newChild);
+            void rotate_left(rbtree_hook* node);
+            void rotate_right(rbtree_hook* node);
+            void insert_fixup(rbtree_hook* node);
+            void erase_fixup(rbtree_hook* node, rbtree_hook* parent);
+
+            augment_callback _augment;
+        };
+    } // namespace details
+
+    // Intrusive red-black tree. The tree doesn't own its elements, it only links them through their hook.
+    //
+    // Compare is a strict weak ordering of T. Elements comparing equal are kept in insertion order.
+    //
+    // Augment is called as Augment{}(T& node, const T* left, const T* right) and must recompute the node's
+    // augmented data from its own value and its children's augmented data.
+    template <typename T, rbtree_hook T::*Hook, typename Compare, typename Augment = rbtree_no_augment>
+    class rbtree : public details::rbtree_base
+    {
+    public:
+        using value_type = T;
+        using reference = T&;
+        using const_reference = const T&;
+        using size_type = std::size_t;
+
+        template <typename U>
+        class iterator_base
+        {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = U*;
+            using reference = U&;
+
+            constexpr iterator_base() = default;
+            constexpr iterator_base(rbtree_hook* node, const rbtree* tree) : _node(node), _tree(tree) {}
+
+            reference operator*() const { return *to_value(_node); }
+            pointer operator->() const { return to_value(_node); }
+
+            iterator_base& operator++()
+            {
+                _node = rbtree::next(_node);
+                return *this;
+            }
+
+            iterator_base operator++(int)
+            {
+                auto result = *this;
+                ++*this;
+                return result;
+            }
+
+            iterator_base& operator--()
+            {
+                _node = _node ? rbtree::prev(_node) : rbtree::last(_tree->_root);
+                return *this;
+            }
+
+            iterator_base operator--(int)
+            {
+                auto result = *this;
+                --*this;
+                return result;
+            }
+
+            friend bool operator==(const iterator_base& a, const iterator_base& b) { return a._node == b._node; }
+
+        private:
+            rbtree_hook* _node{nullptr};
+            const rbtree* _tree{nullptr};
+        };
+
+        using iterator = iterator_base<T>;
+        using const_iterator = iterator_base<const T>;
+
+        constexpr rbtree() : rbtree_base(&augment) {}
+
+        iterator begin() noexcept { return {first(_root), this}; }
+        const_iterator begin() const noexcept { return {first(_root), this}; }
+        iterator end() noexcept { return {nullptr, this}; }
+        const_iterator end() const noexcept { return {nullptr, this}; }
+
+        // Remove all elements from the tree without touching them. Their hooks are left dangling.
+        void clear() noexcept
+        {
+            _root = nullptr;
+            _size = 0;
+        }
+
+        iterator insert(T& value)
+        {
+            const Compare compare;
+            rbtree_hook* parent = nullptr;
+            bool left = false;
+
+            for (auto node = _root; node;)
+            {
+                parent = node;
+                left = compare(value, *to_value(node));
+                node = left ? node->left : node->right;
+            }
+
+            auto hook = &(value.*Hook);
+            link(hook, parent, left);
+            return {hook, this};
+        }
+
+        void erase(T& value) { unlink(&(value.*Hook)); }
+
+        // Call when the key or augmented inputs of 'value' changed in a way that preserves ordering
+        void update(T& value)
+        {
+            for (auto node = &(value.*Hook); node; node = node->parent)
+                augment(node);
+        }
+
+        // Structural accessors, used to write custom searches (for example pruning with augmented data)
+        T* root() const noexcept { return to_value(_root); }
+        static T* parent(const T& value) noexcept { return to_value((value.*Hook).parent); }
+        static T* left(const T& value) noexcept { return to_value((value.*Hook).left); }
+        static T* right(const T& value) noexcept { return to_value((value.*Hook).right); }
+        static T* next(const T& value) noexcept { return to_value(next(const_cast<rbtree_hook*>(&(value.*Hook)))); }
+        static T* prev(const T& value) noexcept { return to_value(prev(const_cast<rbtree_hook*>(&(value.*Hook)))); }
+
+        // First element for which 'before(element)' is false, where 'before' is true for a prefix of the tree
+        template <typename Predicate>
+        T* partition_point(Predicate before) const
+        {
+            T* result = nullptr;
+            for (auto node = root(); node;)
+            {
+                if (before(*node))
+                {
+                    node = right(*node);
+                }
+                else
+                {
+                    result = node;
+                    node = left(*node);
+                }
+            }
+            return result;
+        }
+
+    private:
+        using rbtree_base::next;
+        using rbtree_base::prev;
+
+        static T* to_value(rbtree_hook* hook) noexcept { return details::hook_to_value<T, rbtree_hook, Hook>(hook); }
+
+        static void augment(rbtree_hook* hook)
+        {
+            auto& value = *to_value(hook);
+            Augment{}(value, to_value(hook->left), to_value(hook->right));
+        }
+    };
+} // namespace mtl
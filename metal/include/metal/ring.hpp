@@ -0,0 +1,284 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <metal/arch.hpp>
+#include <metal/atomic.hpp>
+#include <new>
+#include <utility>
+
+namespace mtl
+{
+    namespace details
+    {
+        // Uninitialized storage for one element
+        template <typename T>
+        struct ring_slot
+        {
+            T* get() noexcept { return reinterpret_cast<T*>(_storage); }
+
+            alignas(T) unsigned char _storage[sizeof(T)];
+        };
+
+        // Index owned by one side of a ring, on its own cache line so that producers and consumers don't fight over it
+        struct alignas(kCacheLineSize) ring_index
+        {
+            mtl::atomic<std::size_t> value{0};
+        };
+
+        // Bounded ring where each slot carries a sequence number (Dmitry Vyukov's design). The sequence tells whether
+        // the slot is ready to be written (sequence == position) or read (sequence == position + 1) for the lap at
+        // 'position'. Producers claim positions with a CAS on the tail. SingleConsumer skips the CAS on the head.
+        template <typename T, std::size_t Capacity, bool SingleConsumer>
+        class sequenced_ring
+        {
+            static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+        public:
+            using value_type = T;
+            using size_type = std::size_t;
+
+            sequenced_ring() noexcept
+            {
+                for (size_type i = 0; i != Capacity; ++i)
+                    _cells[i].sequence.store(i, mtl::memory_order_relaxed);
+            }
+
+            ~sequenced_ring()
+            {
+                // Destroy whatever is left
+                for (auto position = _head.value.load(mtl::memory_order_relaxed);
+                     _cells[position & kMask].sequence.load(mtl::memory_order_relaxed) == position + 1; ++position)
+                {
+                    std::destroy_at(_cells[position & kMask].slot.get());
+                }
+            }
+
+            sequenced_ring(const sequenced_ring&) = delete;
+            sequenced_ring& operator=(const sequenced_ring&) = delete;
+
+            static constexpr size_type capacity() noexcept { return Capacity; }
+
+            // Returns false if the ring is full. 'value' is left untouched in that case.
+            template <typename U>
+            bool try_push(U&& value)
+            {
+                auto position = _tail.value.load(mtl::memory_order_relaxed);
+                for (;;)
+                {
+                    auto& cell = _cells[position & kMask];
+                    const auto sequence = cell.sequence.load(mtl::memory_order_acquire);
+                    const auto difference = static_cast<intptr_t>(sequence - position);
+
+                    if (difference == 0)
+                    {
+                        // The slot is free for this lap, try to claim it
+                        if (_tail.value.compare_exchange_weak(position, position + 1, mtl::memory_order_relaxed))
+                        {
+                            std::construct_at(cell.slot.get(), std::forward<U>(value));
+                            cell.sequence.store(position + 1, mtl::memory_order_release);
+                            return true;
+                        }
+                    }
+                    else if (difference < 0)
+                    {
+                        // The consumer hasn't freed the slot from the previous lap yet: we are full
+                        return false;
+                    }
+                    else
+                    {
+                        // Another producer claimed the slot
+                        position = _tail.value.load(mtl::memory_order_relaxed);
+                    }
+                }
+            }
+
+            // Returns false if the ring is empty
+            bool try_pop(T& value)
+            {
+                auto position = _head.value.load(mtl::memory_order_relaxed);
+                for (;;)
+                {
+                    auto& cell = _cells[position & kMask];
+                    const auto sequence = cell.sequence.load(mtl::memory_order_acquire);
+                    const auto difference = static_cast<intptr_t>(sequence - (position + 1));
+
+                    if (difference == 0)
+                    {
+                        if constexpr (SingleConsumer)
+                        {
+                            _head.value.store(position + 1, mtl::memory_order_relaxed);
+                        }
+                        else if (!_head.value.compare_exchange_weak(position, position + 1, mtl::memory_order_relaxed))
+                        {
+                            continue;
+                        }
+
+                        value = std::move(*cell.slot.get());
+                        std::destroy_at(cell.slot.get());
+
+                        // Make the slot available to producers for the next lap
+                        cell.sequence.store(position + Capacity, mtl::memory_order_release);
+                        return true;
+                    }
+                    else if (difference < 0)
+                    {
+                        // Nothing published at this position yet
+                        return false;
+                    }
+                    else
+                    {
+                        // Another consumer took the element
+                        position = _head.value.load(mtl::memory_order_relaxed);
+                    }
+                }
+            }
+
+            // Only a snapshot when other threads are using the ring
+            size_type size() const noexcept
+            {
+                const auto head = _head.value.load(mtl::memory_order_relaxed);
+                const auto tail = _tail.value.load(mtl::memory_order_relaxed);
+                return tail > head ? tail - head : 0;
+            }
+
+            [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+        private:
+            static constexpr size_type kMask = Capacity - 1;
+
+            struct cell
+            {
+                mtl::atomic<std::size_t> sequence;
+                ring_slot<T> slot;
+            };
+
+            ring_index _head; // Next position to read
+            ring_index _tail; // Next position to write
+            alignas(kCacheLineSize) cell _cells[Capacity];
+        };
+    } // namespace details
+
+    // Bounded single-producer single-consumer ring (Lamport). Each side keeps a cached copy of the other side's index
+    // and only reads the shared one when the cache says the ring is full (or empty). In the common case a push or a pop
+    // touches no cache line written by the other side except for the element itself.
+    template <typename T, std::size_t Capacity>
+    class spsc_ring
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+    public:
+        using value_type = T;
+        using size_type = std::size_t;
+
+        spsc_ring() noexcept = default;
+
+        ~spsc_ring()
+        {
+            const auto tail = _tail.load(mtl::memory_order_relaxed);
+            for (auto position = _head.load(mtl::memory_order_relaxed); position != tail; ++position)
+                std::destroy_at(_slots[position & kMask].get());
+        }
+
+        spsc_ring(const spsc_ring&) = delete;
+        spsc_ring& operator=(const spsc_ring&) = delete;
+
+        static constexpr size_type capacity() noexcept { return Capacity; }
+
+        // Producer side. Returns false if the ring is full, 'value' is left untouched in that case.
+        template <typename U>
+        bool try_push(U&& value)
+        {
+            const auto tail = _tail.load(mtl::memory_order_relaxed);
+            if (tail - _cachedHead == Capacity)
+            {
+                _cachedHead = _head.load(mtl::memory_order_acquire);
+                if (tail - _cachedHead == Capacity)
+                    return false;
+            }
+
+            std::construct_at(_slots[tail & kMask].get(), std::forward<U>(value));
+            _tail.store(tail + 1, mtl::memory_order_release);
+            return true;
+        }
+
+        // Consumer side. Returns false if the ring is empty.
+        bool try_pop(T& value)
+        {
+            const auto head = _head.load(mtl::memory_order_relaxed);
+            if (head == _cachedTail)
+            {
+                _cachedTail = _tail.load(mtl::memory_order_acquire);
+                if (head == _cachedTail)
+                    return false;
+            }
+
+            const auto slot = _slots[head & kMask].get();
+            value = std::move(*slot);
+            std::destroy_at(slot);
+            _head.store(head + 1, mtl::memory_order_release);
+            return true;
+        }
+
+        // Only a snapshot when the other side is using the ring
+        size_type size() const noexcept
+        {
+            return _tail.load(mtl::memory_order_acquire) - _head.load(mtl::memory_order_acquire);
+        }
+
+        [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+    private:
+        static constexpr size_type kMask = Capacity - 1;
+
+        // Consumer cache line
+        alignas(kCacheLineSize) mtl::atomic<std::size_t> _head{0};
+        std::size_t _cachedTail{0};
+
+        // Producer cache line
+        alignas(kCacheLineSize) mtl::atomic<std::size_t> _tail{0};
+        std::size_t _cachedHead{0};
+
+        alignas(kCacheLineSize) details::ring_slot<T> _slots[Capacity];
+    };
+
+    // Bounded multiple-producer single-consumer ring. Use it to hand work from interrupt handlers or other processors
+    // to a single task. try_push() never blocks, which makes it safe to call from interrupt handlers.
+    template <typename T, std::size_t Capacity>
+    class mpsc_ring : public details::sequenced_ring<T, Capacity, true>
+    {
+    };
+
+    // Bounded multiple-producer multiple-consumer ring (Vyukov)
+    template <typename T, std::size_t Capacity>
+    class mpmc_ring : public details::sequenced_ring<T, Capacity, false>
+    {
+    };
+} // namespace mtl
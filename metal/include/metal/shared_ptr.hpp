@@ -30,6 +30,7 @@
 #include <cassert>
 #include <concepts>
 #include <metal/atomic.hpp>
+#include <metal/type_traits.hpp>
 #include <type_traits>
 #include <utility>
 
@@ -488,4 +489,8 @@ namespace mtl
         mutable mtl::weak_ptr<T> _weak_this{};
     };
 
+    template <class T>
+    struct is_trivially_relocatable<shared_ptr<T>> : std::true_type
+    {
+    };
 } // namespace mtl
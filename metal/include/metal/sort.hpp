@@ -0,0 +1,640 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Sorting algorithms that don't allocate and use a bounded amount of stack space (O(log n)), making them safe to use
+// on small kernel stacks. These are exposed as std::sort(), std::stable_sort(), std::partial_sort() and
+// std::nth_element() by <algorithm>.
+
+namespace mtl
+{
+    namespace details
+    {
+        // Ranges smaller than this are insertion sorted
+        inline constexpr ptrdiff_t kInsertionSortThreshold = 24;
+
+        // Ranges bigger than this use Tukey's ninther to select a pivot
+        inline constexpr ptrdiff_t kNintherThreshold = 128;
+
+        // partial_insertion_sort() gives up after moving this many elements
+        inline constexpr ptrdiff_t kPartialInsertionSortLimit = 8;
+
+        template <class RandomIt>
+        using sort_value_t = std::remove_cvref_t<decltype(*std::declval<RandomIt>())>;
+
+        struct less
+        {
+            template <class T, class U>
+            constexpr bool operator()(const T& a, const U& b) const
+            {
+                return a < b;
+            }
+        };
+
+        constexpr int log2(ptrdiff_t n)
+        {
+            int log = 0;
+            while (n >>= 1)
+                ++log;
+            return log;
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void insertion_sort(RandomIt first, RandomIt last, Compare& compare)
+        {
+            if (first == last)
+                return;
+
+            for (auto it = first + 1; it != last; ++it)
+            {
+                auto hole = it;
+                if (compare(*hole, *(hole - 1)))
+                {
+                    auto value = std::move(*hole);
+                    do
+                    {
+                        *hole = std::move(*(hole - 1));
+                        --hole;
+                    } while (hole != first && compare(value, *(hole - 1)));
+                    *hole = std::move(value);
+                }
+            }
+        }
+
+        // Same as insertion_sort(), but assumes that *(first - 1) is not greater than any element of [first, last)
+        template <class RandomIt, class Compare>
+        constexpr void unguarded_insertion_sort(RandomIt first, RandomIt last, Compare& compare)
+        {
+            if (first == last)
+                return;
+
+            for (auto it = first + 1; it != last; ++it)
+            {
+                auto hole = it;
+                if (compare(*hole, *(hole - 1)))
+                {
+                    auto value = std::move(*hole);
+                    do
+                    {
+                        *hole = std::move(*(hole - 1));
+                        --hole;
+                    } while (compare(value, *(hole - 1)));
+                    *hole = std::move(value);
+                }
+            }
+        }
+
+        // Attempts to insertion sort [first, last). Returns false if it gave up because too many elements were out of
+        // place, in which case the range is left partially sorted.
+        template <class RandomIt, class Compare>
+        constexpr bool partial_insertion_sort(RandomIt first, RandomIt last, Compare& compare)
+        {
+            if (first == last)
+                return true;
+
+            ptrdiff_t moves = 0;
+            for (auto it = first + 1; it != last; ++it)
+            {
+                auto hole = it;
+                if (compare(*hole, *(hole - 1)))
+                {
+                    auto value = std::move(*hole);
+                    do
+                    {
+                        *hole = std::move(*(hole - 1));
+                        --hole;
+                    } while (hole != first && compare(value, *(hole - 1)));
+                    *hole = std::move(value);
+
+                    moves += it - hole;
+                    if (moves > kPartialInsertionSortLimit)
+                        return false;
+                }
+            }
+
+            return true;
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void sort2(RandomIt a, RandomIt b, Compare& compare)
+        {
+            if (compare(*b, *a))
+                std::swap(*a, *b);
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void sort3(RandomIt a, RandomIt b, RandomIt c, Compare& compare)
+        {
+            details::sort2(a, b, compare);
+            details::sort2(b, c, compare);
+            details::sort2(a, b, compare);
+        }
+
+        // Moves an approximation of the median of [first, last) to *first. This also guarantees that an element that is
+        // not less than the pivot follows it, which partition_right() relies on.
+        template <class RandomIt, class Compare>
+        constexpr void select_pivot(RandomIt first, RandomIt last, Compare& compare)
+        {
+            const auto size = last - first;
+            const auto half = size / 2;
+            if (size > kNintherThreshold)
+            {
+                details::sort3(first, first + half, last - 1, compare);
+                details::sort3(first + 1, first + (half - 1), last - 2, compare);
+                details::sort3(first + 2, first + (half + 1), last - 3, compare);
+                details::sort3(first + (half - 1), first + half, first + (half + 1), compare);
+                std::swap(*first, *(first + half));
+            }
+            else
+            {
+                details::sort3(first + half, first, last - 1, compare);
+            }
+        }
+
+        // Partitions [first, last) around the pivot *first. Elements equal to the pivot end up on the right. Returns
+        // the pivot's final position. 'alreadyPartitioned' is set if no elements had to be swapped.
+        template <class RandomIt, class Compare>
+        constexpr RandomIt partition_right(RandomIt first, RandomIt last, Compare& compare, bool& alreadyPartitioned)
+        {
+            auto pivot = std::move(*first);
+            auto left = first;
+            auto right = last;
+
+            // select_pivot() guarantees that there is an element not less than the pivot
+            while (compare(*++left, pivot))
+                ;
+
+            // If the first element was already out of place, there is no guard on the left
+            if (left - 1 == first)
+            {
+                while (left < right && !compare(*--right, pivot))
+                    ;
+            }
+            else
+            {
+                while (!compare(*--right, pivot))
+                    ;
+            }
+
+            alreadyPartitioned = left >= right;
+
+            while (left < right)
+            {
+                std::swap(*left, *right);
+                while (compare(*++left, pivot))
+                    ;
+                while (!compare(*--right, pivot))
+                    ;
+            }
+
+            const auto position = left - 1;
+            *first = std::move(*position);
+            *position = std::move(pivot);
+            return position;
+        }
+
+        // Partitions [first, last) around the pivot *first. Elements equal to the pivot end up on the left. This is used
+        // when the pivot is equal to *(first - 1): all the elements equal to the pivot are then already in place.
+        template <class RandomIt, class Compare>
+        constexpr RandomIt partition_left(RandomIt first, RandomIt last, Compare& compare)
+        {
+            auto pivot = std::move(*first);
+            auto left = first;
+            auto right = last;
+
+            while (compare(pivot, *--right))
+                ;
+
+            if (right + 1 == last)
+            {
+                while (left < right && !compare(pivot, *++left))
+                    ;
+            }
+            else
+            {
+                while (!compare(pivot, *++left))
+                    ;
+            }
+
+            while (left < right)
+            {
+                std::swap(*left, *right);
+                while (compare(pivot, *--right))
+                    ;
+                while (!compare(pivot, *++left))
+                    ;
+            }
+
+            *first = std::move(*right);
+            *right = std::move(pivot);
+            return right;
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void sift_down(RandomIt first, ptrdiff_t size, ptrdiff_t hole, sort_value_t<RandomIt> value, Compare& compare)
+        {
+            for (;;)
+            {
+                auto child = 2 * hole + 1;
+                if (child >= size)
+                    break;
+
+                if (child + 1 < size && compare(*(first + child), *(first + (child + 1))))
+                    ++child;
+
+                if (!compare(value, *(first + child)))
+                    break;
+
+                *(first + hole) = std::move(*(first + child));
+                hole = child;
+            }
+
+            *(first + hole) = std::move(value);
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void make_heap(RandomIt first, RandomIt last, Compare& compare)
+        {
+            const auto size = last - first;
+            for (auto parent = size / 2; parent-- > 0;)
+                details::sift_down(first, size, parent, std::move(*(first + parent)), compare);
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void sort_heap(RandomIt first, RandomIt last, Compare& compare)
+        {
+            for (auto size = last - first; size > 1; --size)
+            {
+                auto value = std::move(*(first + (size - 1)));
+                *(first + (size - 1)) = std::move(*first);
+                details::sift_down(first, size - 1, 0, std::move(value), compare);
+            }
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void partial_sort(RandomIt first, RandomIt middle, RandomIt last, Compare& compare)
+        {
+            if (first == middle)
+                return;
+
+            details::make_heap(first, middle, compare);
+
+            const auto size = middle - first;
+            for (auto it = middle; it != last; ++it)
+            {
+                if (compare(*it, *first))
+                {
+                    auto value = std::move(*it);
+                    *it = std::move(*first);
+                    details::sift_down(first, size, 0, std::move(value), compare);
+                }
+            }
+
+            details::sort_heap(first, middle, compare);
+        }
+
+        // Pattern-defeating quicksort (Orson Peters, 2021). This is an introsort that detects sorted runs and many
+        // equal elements in linear time, and shuffles elements around after a bad partition instead of degrading to
+        // quadratic time. Heap sort is used as a last resort after too many bad partitions. We always recurse into the
+        // smaller partition and loop on the bigger one, bounding the stack depth to log2(n).
+        template <class RandomIt, class Compare>
+        constexpr void pdqsort(RandomIt first, RandomIt last, Compare& compare, int badAllowed, bool leftmost)
+        {
+            for (;;)
+            {
+                const auto size = last - first;
+                if (size < kInsertionSortThreshold)
+                {
+                    if (leftmost)
+                        details::insertion_sort(first, last, compare);
+                    else
+                        details::unguarded_insertion_sort(first, last, compare);
+                    return;
+                }
+
+                details::select_pivot(first, last, compare);
+
+                // If the pivot is equal to the element before this range, no element of this range is less than the
+                // pivot. Put all the equal elements on the left, they are in their final position.
+                if (!leftmost && !compare(*(first - 1), *first))
+                {
+                    first = details::partition_left(first, last, compare) + 1;
+                    continue;
+                }
+
+                bool alreadyPartitioned;
+                const auto pivot = details::partition_right(first, last, compare, alreadyPartitioned);
+
+                const auto leftSize = pivot - first;
+                const auto rightSize = last - (pivot + 1);
+
+                if (leftSize < size / 8 || rightSize < size / 8)
+                {
+                    if (--badAllowed == 0)
+                    {
+                        details::make_heap(first, last, compare);
+                        details::sort_heap(first, last, compare);
+                        return;
+                    }
+
+                    // Break patterns that could be causing bad pivots
+                    if (leftSize >= kInsertionSortThreshold)
+                    {
+                        std::swap(*first, *(first + leftSize / 4));
+                        std::swap(*(pivot - 1), *(pivot - leftSize / 4));
+                        if (leftSize > kNintherThreshold)
+                        {
+                            std::swap(*(first + 1), *(first + (leftSize / 4 + 1)));
+                            std::swap(*(first + 2), *(first + (leftSize / 4 + 2)));
+                            std::swap(*(pivot - 2), *(pivot - (leftSize / 4 + 1)));
+                            std::swap(*(pivot - 3), *(pivot - (leftSize / 4 + 2)));
+                        }
+                    }
+
+                    if (rightSize >= kInsertionSortThreshold)
+                    {
+                        std::swap(*(pivot + 1), *(pivot + (1 + rightSize / 4)));
+                        std::swap(*(last - 1), *(last - rightSize / 4));
+                        if (rightSize > kNintherThreshold)
+                        {
+                            std::swap(*(pivot + 2), *(pivot + (2 + rightSize / 4)));
+                            std::swap(*(pivot + 3), *(pivot + (3 + rightSize / 4)));
+                            std::swap(*(last - 2), *(last - (1 + rightSize / 4)));
+                            std::swap(*(last - 3), *(last - (2 + rightSize / 4)));
+                        }
+                    }
+                }
+                else if (alreadyPartitioned && details::partial_insertion_sort(first, pivot, compare) &&
+                         details::partial_insertion_sort(pivot + 1, last, compare))
+                {
+                    // The input was (almost) sorted
+                    return;
+                }
+
+                if (leftSize < rightSize)
+                {
+                    details::pdqsort(first, pivot, compare, badAllowed, leftmost);
+                    first = pivot + 1;
+                    leftmost = false;
+                }
+                else
+                {
+                    details::pdqsort(pivot + 1, last, compare, badAllowed, false);
+                    last = pivot;
+                }
+            }
+        }
+
+        // Quickselect with a heap select fallback if it doesn't converge fast enough
+        template <class RandomIt, class Compare>
+        constexpr void nth_element(RandomIt first, RandomIt nth, RandomIt last, Compare& compare)
+        {
+            if (nth == last)
+                return;
+
+            auto badAllowed = 2 * log2(last - first);
+            bool leftmost = true;
+
+            while (last - first >= kInsertionSortThreshold)
+            {
+                if (badAllowed-- == 0)
+                {
+                    details::partial_sort(first, nth + 1, last, compare);
+                    return;
+                }
+
+                details::select_pivot(first, last, compare);
+
+                // See pdqsort(): all the elements equal to the pivot end up in their final position
+                if (!leftmost && !compare(*(first - 1), *first))
+                {
+                    const auto pivot = details::partition_left(first, last, compare);
+                    if (nth <= pivot)
+                        return;
+
+                    first = pivot + 1;
+                    continue;
+                }
+
+                bool alreadyPartitioned;
+                const auto pivot = details::partition_right(first, last, compare, alreadyPartitioned);
+                if (pivot == nth)
+                    return;
+
+                if (nth < pivot)
+                {
+                    last = pivot;
+                }
+                else
+                {
+                    first = pivot + 1;
+                    leftmost = false;
+                }
+            }
+
+            details::insertion_sort(first, last, compare);
+        }
+
+        template <class RandomIt, class T, class Compare>
+        constexpr RandomIt lower_bound(RandomIt first, RandomIt last, const T& value, Compare& compare)
+        {
+            auto count = last - first;
+            while (count > 0)
+            {
+                const auto step = count / 2;
+                if (compare(*(first + step), value))
+                {
+                    first += step + 1;
+                    count -= step + 1;
+                }
+                else
+                {
+                    count = step;
+                }
+            }
+            return first;
+        }
+
+        template <class RandomIt, class T, class Compare>
+        constexpr RandomIt upper_bound(RandomIt first, RandomIt last, const T& value, Compare& compare)
+        {
+            auto count = last - first;
+            while (count > 0)
+            {
+                const auto step = count / 2;
+                if (!compare(value, *(first + step)))
+                {
+                    first += step + 1;
+                    count -= step + 1;
+                }
+                else
+                {
+                    count = step;
+                }
+            }
+            return first;
+        }
+
+        template <class RandomIt>
+        constexpr void reverse(RandomIt first, RandomIt last)
+        {
+            while (first < last)
+                std::swap(*first++, *--last);
+        }
+
+        template <class RandomIt>
+        constexpr RandomIt rotate(RandomIt first, RandomIt middle, RandomIt last)
+        {
+            details::reverse(first, middle);
+            details::reverse(middle, last);
+            details::reverse(first, last);
+            return first + (last - middle);
+        }
+
+        // Merges the sorted ranges [first, middle) and [middle, last) in place by rotating blocks. This is
+        // O(n log n), but doesn't require a buffer.
+        template <class RandomIt, class Compare>
+        constexpr void merge_in_place(RandomIt first, RandomIt middle, RandomIt last, Compare& compare)
+        {
+            for (;;)
+            {
+                const auto size1 = middle - first;
+                const auto size2 = last - middle;
+                if (size1 == 0 || size2 == 0)
+                    return;
+
+                if (size1 + size2 == 2)
+                {
+                    if (compare(*middle, *first))
+                        std::swap(*first, *middle);
+                    return;
+                }
+
+                RandomIt cut1;
+                RandomIt cut2;
+                if (size1 > size2)
+                {
+                    cut1 = first + size1 / 2;
+                    cut2 = details::lower_bound(middle, last, *cut1, compare);
+                }
+                else
+                {
+                    cut2 = middle + size2 / 2;
+                    cut1 = details::upper_bound(first, middle, *cut2, compare);
+                }
+
+                const auto newMiddle = details::rotate(cut1, middle, cut2);
+
+                // Recurse into the smaller half to bound stack usage
+                if ((newMiddle - first) < (last - newMiddle))
+                {
+                    details::merge_in_place(first, cut1, newMiddle, compare);
+                    first = newMiddle;
+                    middle = cut2;
+                }
+                else
+                {
+                    details::merge_in_place(newMiddle, cut2, last, compare);
+                    last = newMiddle;
+                    middle = cut1;
+                }
+            }
+        }
+
+        template <class RandomIt, class Compare>
+        constexpr void stable_sort(RandomIt first, RandomIt last, Compare& compare)
+        {
+            if (last - first < kInsertionSortThreshold)
+            {
+                details::insertion_sort(first, last, compare);
+                return;
+            }
+
+            const auto middle = first + (last - first) / 2;
+            details::stable_sort(first, middle, compare);
+            details::stable_sort(middle, last, compare);
+
+            if (compare(*middle, *(middle - 1)))
+                details::merge_in_place(first, middle, last, compare);
+        }
+    } // namespace details
+
+    // Not stable. O(n log n) worst case, O(n) for sorted inputs and inputs with few distinct values.
+    template <class RandomIt, class Compare>
+    constexpr void sort(RandomIt first, RandomIt last, Compare compare)
+    {
+        if (last - first > 1)
+            details::pdqsort(first, last, compare, details::log2(last - first), true);
+    }
+
+    template <class RandomIt>
+    constexpr void sort(RandomIt first, RandomIt last)
+    {
+        mtl::sort(first, last, details::less{});
+    }
+
+    // O(n log² n). This merges in place rather than allocating a buffer.
+    template <class RandomIt, class Compare>
+    constexpr void stable_sort(RandomIt first, RandomIt last, Compare compare)
+    {
+        details::stable_sort(first, last, compare);
+    }
+
+    template <class RandomIt>
+    constexpr void stable_sort(RandomIt first, RandomIt last)
+    {
+        mtl::stable_sort(first, last, details::less{});
+    }
+
+    template <class RandomIt, class Compare>
+    constexpr void partial_sort(RandomIt first, RandomIt middle, RandomIt last, Compare compare)
+    {
+        details::partial_sort(first, middle, last, compare);
+    }
+
+    template <class RandomIt>
+    constexpr void partial_sort(RandomIt first, RandomIt middle, RandomIt last)
+    {
+        mtl::partial_sort(first, middle, last, details::less{});
+    }
+
+    template <class RandomIt, class Compare>
+    constexpr void nth_element(RandomIt first, RandomIt nth, RandomIt last, Compare compare)
+    {
+        details::nth_element(first, nth, last, compare);
+    }
+
+    template <class RandomIt>
+    constexpr void nth_element(RandomIt first, RandomIt nth, RandomIt last)
+    {
+        mtl::nth_element(first, nth, last, details::less{});
+    }
+} // namespace mtl
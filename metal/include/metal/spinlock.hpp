@@ -0,0 +1,174 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <metal/arch.hpp>
+#include <metal/atomic.hpp>
+
+namespace mtl
+{
+    namespace details
+    {
+        // Default way to wait between two looks at a lock
+        struct cpu_pause
+        {
+            void operator()() const noexcept { mtl::CpuPause(); }
+        };
+    } // namespace details
+
+    // These locks only implement the waiting algorithms. They know nothing about interrupts or preemption: that is
+    // the job of the kernel wrappers. lock() returns the number of times the caller had to wait, 0 meaning the lock
+    // was not contended.
+
+    // Ticket lock: waiters take a ticket and are served in FIFO order. All waiters poll the same cache line, which is
+    // fine for a handful of CPUs.
+    class ticket_lock
+    {
+    public:
+        constexpr ticket_lock() noexcept = default;
+
+        ticket_lock(const ticket_lock&) = delete;
+        ticket_lock& operator=(const ticket_lock&) = delete;
+
+        template <typename Pause = details::cpu_pause>
+        uint32_t lock(Pause pause = {}) noexcept
+        {
+            const auto ticket = _next.fetch_add(1, mtl::memory_order_relaxed);
+
+            uint32_t spins = 0;
+            while (_owner.load(mtl::memory_order_acquire) != ticket)
+            {
+                pause();
+                ++spins;
+            }
+
+            return spins;
+        }
+
+        bool try_lock() noexcept
+        {
+            // The lock is free when the next ticket is the one being served
+            auto owner = _owner.load(mtl::memory_order_acquire);
+            return _next.compare_exchange_strong(owner, owner + 1, mtl::memory_order_acquire, mtl::memory_order_relaxed);
+        }
+
+        void unlock() noexcept
+        {
+            // Only the owner writes '_owner'
+            _owner.store(_owner.load(mtl::memory_order_relaxed) + 1, mtl::memory_order_release);
+        }
+
+        bool is_locked() const noexcept
+        {
+            return _next.load(mtl::memory_order_relaxed) != _owner.load(mtl::memory_order_relaxed);
+        }
+
+        // Whether or not someone is waiting for the lock
+        bool is_contended() const noexcept
+        {
+            return _next.load(mtl::memory_order_relaxed) - _owner.load(mtl::memory_order_relaxed) > 1;
+        }
+
+    private:
+        mtl::atomic<uint32_t> _next{0};  // Next ticket to hand out
+        mtl::atomic<uint32_t> _owner{0}; // Ticket being served
+    };
+
+    // MCS queue lock: waiters form a linked list of nodes and each one spins on its own node, so handing the lock
+    // over only touches the cache lines of the two CPUs involved. The node must stay alive and untouched until
+    // unlock() returns, it is usually on the caller's stack.
+    class mcs_lock
+    {
+    public:
+        struct node
+        {
+            mtl::atomic<node*> next{nullptr};
+            mtl::atomic<bool> locked{false};
+        };
+
+        constexpr mcs_lock() noexcept = default;
+
+        mcs_lock(const mcs_lock&) = delete;
+        mcs_lock& operator=(const mcs_lock&) = delete;
+
+        template <typename Pause = details::cpu_pause>
+        uint32_t lock(node& self, Pause pause = {}) noexcept
+        {
+            self.next.store(nullptr, mtl::memory_order_relaxed);
+            self.locked.store(true, mtl::memory_order_relaxed);
+
+            const auto previous = _tail.exchange(&self, mtl::memory_order_acq_rel);
+            if (!previous)
+                return 0;
+
+            previous->next.store(&self, mtl::memory_order_release);
+
+            uint32_t spins = 0;
+            while (self.locked.load(mtl::memory_order_acquire))
+            {
+                pause();
+                ++spins;
+            }
+
+            return spins;
+        }
+
+        bool try_lock(node& self) noexcept
+        {
+            self.next.store(nullptr, mtl::memory_order_relaxed);
+            self.locked.store(true, mtl::memory_order_relaxed);
+
+            node* expected = nullptr;
+            return _tail.compare_exchange_strong(expected, &self, mtl::memory_order_acquire, mtl::memory_order_relaxed);
+        }
+
+        template <typename Pause = details::cpu_pause>
+        void unlock(node& self, Pause pause = {}) noexcept
+        {
+            auto next = self.next.load(mtl::memory_order_acquire);
+            if (!next)
+            {
+                // No known successor: try to mark the lock as free
+                auto expected = &self;
+                if (_tail.compare_exchange_strong(expected, nullptr, mtl::memory_order_release, mtl::memory_order_relaxed))
+                    return;
+
+                // Someone is between exchanging the tail and linking itself to us
+                while (!(next = self.next.load(mtl::memory_order_acquire)))
+                    pause();
+            }
+
+            next->locked.store(false, mtl::memory_order_release);
+        }
+
+        bool is_locked() const noexcept { return _tail.load(mtl::memory_order_relaxed) != nullptr; }
+
+    private:
+        mtl::atomic<node*> _tail{nullptr};
+    };
+} // namespace mtl
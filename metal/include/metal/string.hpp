@@ -27,7 +27,8 @@
 #pragma once
 
 #include <algorithm>
-#include <malloc.h>
+#include <cassert>
+#include <metal/allocator.hpp>
 #include <metal/helpers.hpp>
 #include <metal/string_view.hpp>
 
@@ -55,10 +56,11 @@ namespace mtl
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #endif
 
-    template <typename T>
+    template <typename T, typename Allocator = mtl::allocator<T>>
     class basic_string
     {
     public:
+        using allocator_type = Allocator;
         using iterator = T*;
         using const_iterator = const T*;
         using reference = T&;
@@ -98,21 +100,30 @@ namespace mtl
 
     public:
         // Construction
-        constexpr basic_string() { _init<T>(nullptr, 0); }
+        constexpr basic_string() : basic_string(Allocator()) {}
+
+        constexpr explicit basic_string(const Allocator& allocator) : _allocator(allocator) { _init<T>(nullptr, 0); }
 
-        constexpr basic_string(const T* string) { _init(string, _strlen(string)); }
+        constexpr basic_string(const T* string, const Allocator& allocator = Allocator()) : _allocator(allocator)
+        {
+            _init(string, _strlen(string));
+        }
 
-        constexpr basic_string(const T* string, size_type length) { _init(string, length); }
+        constexpr basic_string(const T* string, size_type length, const Allocator& allocator = Allocator())
+            : _allocator(allocator)
+        {
+            _init(string, length);
+        }
 
         template <typename U>
-        constexpr basic_string(const U* first, const U* last)
+        constexpr basic_string(const U* first, const U* last, const Allocator& allocator = Allocator()) : _allocator(allocator)
         {
             _init(first, last - first);
         }
 
-        constexpr basic_string(const basic_string& other) { _init(other.data(), other.length()); }
+        constexpr basic_string(const basic_string& other) : _allocator(other._allocator) { _init(other.data(), other.length()); }
 
-        constexpr basic_string(basic_string&& other) noexcept { _move(std::move(other)); }
+        constexpr basic_string(basic_string&& other) noexcept : _allocator(other._allocator) { _move(std::move(other)); }
 
         // Destruction
         constexpr ~basic_string() { _destroy(); }
@@ -133,6 +144,52 @@ namespace mtl
             return *this;
         }
 
+        // Modifiers
+        constexpr void reserve(size_type newCapacity)
+        {
+            if (newCapacity <= capacity())
+                return;
+
+            const auto length = this->length();
+            const auto memory = _allocator.allocate_at_least(newCapacity + 1);
+            // Not std::copy(): GCC can't tell which union member is active here and reports bogus overflows
+            const auto source = data();
+            for (size_type i = 0; i != length; ++i)
+                memory.ptr[i] = source[i];
+            memory.ptr[length] = 0;
+            _destroy();
+
+            _large.data = memory.ptr;
+            _large.length = length;
+            _large.capacity = (memory.count - 1) | kLargeFlag;
+        }
+
+        constexpr basic_string& append(const T* s, size_type count)
+        {
+            const auto length = this->length();
+            if (length + count > capacity())
+                reserve(std::max(length + count, capacity() * 2));
+
+            const auto data = _data();
+            std::copy(s, s + count, data + length);
+            _setLength(data, length + count);
+            return *this;
+        }
+
+        constexpr void push_back(T c) { append(&c, 1); }
+
+        // Resize the string to at most 'count' characters without initializing them. 'op(data, count)' writes the
+        // characters and returns the final length.
+        template <typename Operation>
+        constexpr void resize_and_overwrite(size_type count, Operation op)
+        {
+            reserve(count);
+            const auto data = _data();
+            const size_type length = op(data, count);
+            assert(length <= count);
+            _setLength(data, length);
+        }
+
         // Accessors
         constexpr size_type capacity() const noexcept { return _isLarge() ? _large.capacity & kCapacityMask : kMaxSmallLength; }
         constexpr size_type length() const { return _isSmall() ? kMaxSmallLength - _small.length : _large.length; }
@@ -145,6 +202,8 @@ namespace mtl
         constexpr const_iterator end() const noexcept { return data() + size(); }
         constexpr const_iterator cend() const noexcept { return data() + size(); }
 
+        constexpr allocator_type get_allocator() const noexcept { return _allocator; }
+
         // Conversion
         constexpr const T* data() const noexcept { return _isSmall() ? _small.data : _large.data; }
         constexpr const T* c_str() const noexcept { return data(); }
@@ -169,9 +228,10 @@ namespace mtl
             }
             else
             {
-                _large.data = static_cast<T*>(::malloc(sizeof(T) * (length + 1)));
+                const auto memory = _allocator.allocate_at_least(length + 1);
+                _large.data = memory.ptr;
                 _large.length = length;
-                _large.capacity = (::malloc_usable_size(_large.data) / sizeof(T) - 1) | kLargeFlag;
+                _large.capacity = (memory.count - 1) | kLargeFlag;
                 std::copy(string, string + length, _large.data);
                 _large.data[length] = 0;
             }
@@ -183,6 +243,11 @@ namespace mtl
             {
                 _small = other._small;
             }
+            else if (!(_allocator == other._allocator))
+            {
+                // Memory can't be stolen from a different allocator
+                _init(other._large.data, other._large.length);
+            }
             else
             {
                 _large = other._large;
@@ -190,10 +255,22 @@ namespace mtl
             }
         }
 
+        constexpr T* _data() noexcept { return _isSmall() ? _small.data : _large.data; }
+
+        // When the string is small and full, the null terminator is the length field itself
+        constexpr void _setLength(T* data, size_type length)
+        {
+            data[length] = 0;
+            if (_isSmall())
+                _small.length = kMaxSmallLength - length;
+            else
+                _large.length = length;
+        }
+
         constexpr void _destroy()
         {
             if (_isLarge())
-                ::free(_large.data);
+                _allocator.deallocate(_large.data, capacity() + 1);
         }
 
         union
@@ -202,20 +279,22 @@ namespace mtl
             _LargeString _large; // String data on the heap
         };
 
+        [[no_unique_address]] Allocator _allocator;
+
         constexpr bool _isSmall() const { return !_isLarge(); }
         constexpr bool _isLarge() const { return _large.capacity & kLargeFlag; }
     };
 
-    template <typename T>
-    constexpr bool operator==(const mtl::basic_string<T>& lhs, const mtl::basic_string<T>& rhs) noexcept
+    template <typename T, typename A1, typename A2>
+    constexpr bool operator==(const mtl::basic_string<T, A1>& lhs, const mtl::basic_string<T, A2>& rhs) noexcept
     {
         if (lhs.size() != rhs.size())
             return false;
         return 0 == _strncmp(lhs.data(), rhs.data(), lhs.size());
     }
 
-    template <typename T>
-    constexpr bool operator==(const mtl::basic_string<T>& lhs, const T* rhs) noexcept
+    template <typename T, typename Allocator>
+    constexpr bool operator==(const mtl::basic_string<T, Allocator>& lhs, const T* rhs) noexcept
     {
         if (lhs.size() != _strlen(rhs))
             return false;
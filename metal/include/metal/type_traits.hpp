@@ -43,4 +43,19 @@ namespace mtl
     struct is_specialization<V<Args...>, V> : std::true_type
     {
     };
+
+    ///////////////////////////////////////////////////////////////////////////
+    // is_trivially_relocatable
+    ///////////////////////////////////////////////////////////////////////////
+
+    // A type is trivially relocatable if moving it to a new address and destroying the original is the same as copying
+    // its bytes. Containers use this to grow with realloc(). Specialize for types that own resources but don't point
+    // to themselves (smart pointers, etc).
+    template <class T>
+    struct is_trivially_relocatable : std::is_trivially_copyable<T>
+    {
+    };
+
+    template <class T>
+    inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
 } // namespace mtl
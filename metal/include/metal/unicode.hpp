@@ -44,7 +44,9 @@ namespace mtl
     // U+100000 - U+10FFFF	Private use area
 
     // Convert a utf-8 sequence into a unicode code point.
-    // Returns < 0 on error.
+    // Returns < 0 on error: invalid or truncated sequences, missing continuation bytes,
+    // overlong encodings, surrogate halves (U+D800 to U+DFFF) and code points above
+    // U+10FFFF.
     //
     // The "src" pointer will be updated on both success and error to point to the
     // start of the next utf-8 sequence (or the end).
@@ -53,11 +55,6 @@ namespace mtl
     // use a simple loop to walk a utf-8 string and convert it to code points.
     //
     // This function is secure in that it will not access memory at "end" or pass it.
-    //
-    // Note: if surrogate halves are found in the utf-8 stream, they will be returned
-    // as-is. This is not expected and if it happens it means the utf-8 stream is
-    // ill-formed. But not treating this as an error seems more robust, The caller can
-    // decide whether or not to merge surrogate pairs into valid code points.
     int Utf8ToCodePoint(const char8_t*& src, const char8_t* end);
 
     // Convert a codepoint to a surrogate pair (UTF-16)
@@ -94,6 +91,8 @@ namespace mtl
         Ucs2,
     };
 
+    // Invalid sequences are replaced with U+FFFD. ASCII runs are copied several characters
+    // at a time and the result is allocated once, at its final size.
     mtl::u8string ToU8String(mtl::u16string_view string);
     mtl::u16string ToU16String(mtl::u8string_view string, U16StringFormat = Utf16);
 
@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <metal/type_traits.hpp>
 #include <type_traits>
 #include <utility>
 
@@ -127,4 +128,9 @@ namespace mtl
     {
         return mtl::unique_ptr<T>(new T(std::forward<Args>(args)...));
     }
+
+    template <class T>
+    struct is_trivially_relocatable<unique_ptr<T>> : std::true_type
+    {
+    };
 } // namespace mtl
@@ -27,186 +27,354 @@
 #pragma once
 
 #include <cassert>
-#include <cstdlib>
+#include <cstring>
 #include <initializer_list>
 #include <iterator>
 #include <memory>
+#include <metal/allocator.hpp>
+#include <metal/type_traits.hpp>
 #include <new>
 
 namespace mtl
 {
-    template <typename T>
-    class vector
+    namespace details
     {
-    public:
-        using iterator = T*;
-        using const_iterator = const T*;
-        using reference = T&;
-        using const_reference = const T&;
-        using size_type = std::size_t;
-        using value_type = T;
-
-        constexpr vector() : _first(0), _last(0), _max(0) {}
-        constexpr vector(const vector& other) = delete; // not implemented (yet)
-        vector(vector&& other) noexcept : vector() { swap(other); }
-
-        template <class InputIt>
-        constexpr vector(InputIt first, InputIt last) : vector()
+        // Inline storage for small_vector, empty for vector
+        template <typename T, std::size_t N>
+        struct vector_storage
         {
-            reserve(std::distance(first, last));
-            for (auto it = first; it != last; ++it)
-                emplace_back(*it);
-        }
+            alignas(T) unsigned char _buffer[N * sizeof(T)];
+        };
 
-        constexpr vector(std::initializer_list<T> init) : vector()
+        template <typename T>
+        struct vector_storage<T, 0>
         {
-            reserve(init.size());
-            for (const auto& value : init)
-                emplace_back(value);
-        }
+        };
 
-        constexpr ~vector() { clear(); }
+        // Implementation shared by vector and small_vector. The first N elements are stored inline, the vector only
+        // allocates memory once it grows past that.
+        template <typename T, std::size_t N, typename Allocator>
+        class vector_base
+        {
+        public:
+            using iterator = T*;
+            using const_iterator = const T*;
+            using reference = T&;
+            using const_reference = const T&;
+            using size_type = std::size_t;
+            using value_type = T;
+            using allocator_type = Allocator;
+
+            constexpr vector_base() : vector_base(Allocator()) {}
+
+            constexpr explicit vector_base(const Allocator& allocator)
+                : _first(inline_data()), _last(_first), _max(_first + N), _allocator(allocator)
+            {
+            }
 
-        constexpr vector& operator=(const vector& other) = delete; // not implemented (yet)
+            constexpr vector_base(const vector_base& other) : vector_base(other._allocator)
+            {
+                assign(other._first, other._last);
+            }
 
-        constexpr vector& operator=(vector&& other)
-        {
-            clear();
-            swap(other);
-            return *this;
-        }
+            vector_base(vector_base&& other) noexcept : vector_base(other._allocator) { take(other); }
+
+            template <class InputIt>
+            constexpr vector_base(InputIt first, InputIt last, const Allocator& allocator = Allocator()) : vector_base(allocator)
+            {
+                reserve(std::distance(first, last));
+                for (auto it = first; it != last; ++it)
+                    emplace_back(*it);
+            }
+
+            constexpr vector_base(std::initializer_list<T> init, const Allocator& allocator = Allocator()) : vector_base(allocator)
+            {
+                assign(init.begin(), init.end());
+            }
 
-        constexpr reference operator[](size_type pos) { return _first[pos]; }
-        constexpr const_reference operator[](size_type pos) const { return _first[pos]; }
+            constexpr ~vector_base() { clear(); }
 
-        constexpr reference front() { return *_first; }
-        constexpr const_reference front() const { return *_first; }
-        constexpr reference back() { return *(_last - 1); }
-        constexpr const_reference back() const { return *(_last - 1); }
+            constexpr vector_base& operator=(const vector_base& other)
+            {
+                if (this != &other)
+                {
+                    destroy(_first, _last);
+                    _last = _first;
+                    assign(other._first, other._last);
+                }
+                return *this;
+            }
 
-        constexpr T* data() noexcept { return _first; }
-        constexpr const T* data() const noexcept { return _first; }
+            constexpr vector_base& operator=(vector_base&& other)
+            {
+                if (this != &other)
+                {
+                    clear();
+                    take(other);
+                }
+                return *this;
+            }
 
-        constexpr iterator begin() noexcept { return _first; }
-        constexpr const_iterator begin() const noexcept { return _first; }
-        constexpr iterator end() noexcept { return _last; }
-        constexpr const_iterator end() const noexcept { return _last; }
+            constexpr reference operator[](size_type pos) { return _first[pos]; }
+            constexpr const_reference operator[](size_type pos) const { return _first[pos]; }
 
-        [[nodiscard]] constexpr bool empty() const noexcept { return _first == _last; }
+            constexpr reference front() { return *_first; }
+            constexpr const_reference front() const { return *_first; }
+            constexpr reference back() { return *(_last - 1); }
+            constexpr const_reference back() const { return *(_last - 1); }
 
-        constexpr size_type size() const noexcept { return _last - _first; }
+            constexpr T* data() noexcept { return _first; }
+            constexpr const T* data() const noexcept { return _first; }
 
-        constexpr void reserve(size_type newCapacity)
-        {
-            if (newCapacity > capacity())
+            constexpr iterator begin() noexcept { return _first; }
+            constexpr const_iterator begin() const noexcept { return _first; }
+            constexpr iterator end() noexcept { return _last; }
+            constexpr const_iterator end() const noexcept { return _last; }
+
+            [[nodiscard]] constexpr bool empty() const noexcept { return _first == _last; }
+
+            constexpr size_type size() const noexcept { return _last - _first; }
+
+            constexpr void reserve(size_type newCapacity)
             {
-                const auto oldSize = size();
+                if (newCapacity > capacity())
+                    reallocate(newCapacity);
+            }
+
+            constexpr size_type capacity() const noexcept { return _max - _first; }
 
-                // Allocate new memory
-                T* newMemory = (T*)::malloc(newCapacity * sizeof(T));
-                assert(newMemory); // TODO: we can't handle this very well in the kernel...
+            constexpr allocator_type get_allocator() const noexcept { return _allocator; }
 
-                // Move objects from old location ot the new one
-                std::uninitialized_move(_first, _last, newMemory);
+            // Release unused capacity. Elements move back to the inline storage if they fit.
+            constexpr void shrink_to_fit()
+            {
+                if (is_inline() || size() == capacity())
+                    return;
 
-                // Destroy objects from old location
-                for (auto p = _first; p != _last; ++p)
+                if (size() <= N)
                 {
-                    p->T::~T();
+                    const auto oldSize = size();
+                    const auto inlineMemory = inline_data();
+                    relocate(_first, _last, inlineMemory);
+                    _allocator.deallocate(_first, capacity());
+
+                    _first = inlineMemory;
+                    _last = inlineMemory + oldSize;
+                    _max = inlineMemory + N;
                 }
+                else
+                {
+                    reallocate(size());
+                }
+            }
 
-                // Free old memory
-                ::free(_first);
+            // Destroy all elements and release memory
+            constexpr void clear() noexcept
+            {
+                destroy(_first, _last);
+                deallocate();
 
-                _first = newMemory;
-                _last = newMemory + oldSize;
-                _max = newMemory + newCapacity;
+                _first = _last = inline_data();
+                _max = _first + N;
             }
-        }
 
-        constexpr size_type capacity() const noexcept { return _max - _first; }
+            constexpr void push_back(const T& value) { emplace_back(value); }
 
-        constexpr void clear() noexcept
-        {
-            for (auto p = _first; p != _last; ++p)
+            constexpr void push_back(T&& value) { emplace_back(std::move(value)); }
+
+            template <class... Args>
+            constexpr reference emplace_back(Args&&... args)
             {
-                p->T::~T();
+                const auto oldSize = size();
+
+                // Is the vector full?
+                if (oldSize == capacity())
+                {
+                    // Yes: allocate more memory
+                    reallocate(oldSize ? oldSize * 2 : 16);
+                }
+
+                std::construct_at(_last, std::forward<Args>(args)...);
+                return *_last++;
             }
 
-            ::free(_first);
-            _first = _last = _max = nullptr;
-        }
+            constexpr void pop_back()
+            {
+                (_last - 1)->~T();
+                --_last;
+            }
 
-        constexpr void push_back(const T& value) { emplace_back(value); }
+            constexpr void resize(size_type newSize)
+            {
+                const auto oldSize = size();
+
+                if (newSize > oldSize)
+                {
+                    // Make sure there is enough room
+                    reserve(newSize);
 
-        constexpr void push_back(T&& value) { emplace_back(std::move(value)); }
+                    // Build new objects
+                    for (auto i = oldSize; i != newSize; ++i)
+                    {
+                        new (_first + i) T();
+                    }
 
-        template <class... Args>
-        constexpr reference emplace_back(Args&&... args)
-        {
-            const auto oldSize = size();
+                    _last = _first + newSize;
+                }
+                else
+                {
+                    // Destroy objects over the new size
+                    destroy(_first + newSize, _last);
+                    _last = _first + newSize;
+                }
+            }
 
-            // Is the vector full?
-            if (oldSize == capacity())
+            constexpr void swap(vector_base& other)
             {
-                // Yes: allocate more memory
-                reserve(oldSize ? oldSize * 2 : 16);
+                if (!is_inline() && !other.is_inline() && _allocator == other._allocator)
+                {
+                    std::swap(_first, other._first);
+                    std::swap(_last, other._last);
+                    std::swap(_max, other._max);
+                }
+                else
+                {
+                    // Inline elements have to be moved
+                    vector_base temp(std::move(other));
+                    other = std::move(*this);
+                    *this = std::move(temp);
+                }
             }
 
-            std::construct_at(_last, std::forward<Args>(args)...);
-            return *_last++;
-        }
+        private:
+            constexpr T* inline_data() const noexcept
+            {
+                if constexpr (N > 0)
+                    return reinterpret_cast<T*>(const_cast<unsigned char*>(_storage._buffer));
+                else
+                    return nullptr;
+            }
 
-        constexpr void pop_back()
-        {
-            (_last - 1)->~T();
-            --_last;
-        }
+            // Are the elements stored in the inline storage?
+            constexpr bool is_inline() const noexcept
+            {
+                return N > 0 && _first == inline_data();
+            }
 
-        constexpr void resize(size_type newSize)
-        {
-            const auto oldSize = size();
+            static constexpr void destroy(T* first, T* last) noexcept
+            {
+                for (auto p = first; p != last; ++p)
+                {
+                    p->T::~T();
+                }
+            }
+
+            // Move objects to uninitialized memory at 'destination' and destroy the originals
+            static void relocate(T* first, T* last, T* destination)
+            {
+                if constexpr (mtl::is_trivially_relocatable_v<T>)
+                {
+                    if (first != last)
+                        memcpy(static_cast<void*>(destination), static_cast<const void*>(first), (last - first) * sizeof(T));
+                }
+                else
+                {
+                    std::uninitialized_move(first, last, destination);
+                    destroy(first, last);
+                }
+            }
+
+            // Release the heap block, if any
+            constexpr void deallocate() noexcept
+            {
+                if (!is_inline() && _first)
+                    _allocator.deallocate(_first, capacity());
+            }
 
-            if (newSize > oldSize)
+            // Move the elements to a new heap block of 'newCapacity' elements
+            constexpr void reallocate(size_type newCapacity)
             {
-                // Make sure there is enough room
-                reserve(newSize);
+                const auto oldSize = size();
+                T* newMemory;
 
-                // Build new objects
-                for (auto i = oldSize; i != newSize; ++i)
+                if (mtl::is_trivially_relocatable_v<T> && !is_inline())
                 {
-                    new (_first + i) T();
+                    // The allocator can often grow the block in place and otherwise copies the bytes for us
+                    newMemory = _allocator.reallocate(_first, capacity(), newCapacity);
+                }
+                else
+                {
+                    newMemory = _allocator.allocate(newCapacity);
+                    relocate(_first, _last, newMemory);
+                    deallocate();
                 }
 
-                _last = _first + newSize;
+                _first = newMemory;
+                _last = newMemory + oldSize;
+                _max = newMemory + newCapacity;
+            }
+
+            // Copy [first, last) at the end of the vector
+            constexpr void assign(const T* first, const T* last)
+            {
+                reserve(last - first);
+                _last = std::uninitialized_copy(first, last, _last);
             }
-            else
+
+            // Take the content of 'other', this vector must be empty and not own any memory
+            void take(vector_base& other) noexcept
             {
-                // Destroy objects over the new size
-                for (auto i = newSize; i != oldSize; ++i)
+                if (other.is_inline() || !(_allocator == other._allocator))
                 {
-                    (_first + i)->~T();
+                    // Elements can't be stolen, they have to be moved one by one
+                    reserve(other.size());
+                    relocate(other._first, other._last, _first);
+                    _last = _first + other.size();
+                    other._last = other._first;
                 }
+                else if (other._first)
+                {
+                    _first = other._first;
+                    _last = other._last;
+                    _max = other._max;
 
-                _last = _first + newSize;
+                    other._first = other._last = other.inline_data();
+                    other._max = other._first + N;
+                }
             }
-        }
 
-        constexpr void swap(vector& other)
-        {
-            std::swap(_first, other._first);
-            std::swap(_last, other._last);
-            std::swap(_max, other._max);
-        }
-
-    private:
-        T* _first; // begin()
-        T* _last;  // end()
-        T* _max;   // capacity()
+            [[no_unique_address]] vector_storage<T, N> _storage; // Declared first as _first points into it
+            T* _first;                                          // begin()
+            T* _last;                                           // end()
+            T* _max;                                            // capacity()
+            [[no_unique_address]] Allocator _allocator;
+        };
+    } // namespace details
+
+    template <typename T, typename Allocator = mtl::allocator<T>>
+    class vector : public details::vector_base<T, 0, Allocator>
+    {
+    public:
+        using details::vector_base<T, 0, Allocator>::vector_base;
     };
 
-    template <class T>
-    void swap(vector<T>& x, vector<T>& y) noexcept
+    // A vector that stores up to N elements inline before allocating memory. Use it for short lived or typically small
+    // collections to avoid heap traffic.
+    template <typename T, std::size_t N, typename Allocator = mtl::allocator<T>>
+    class small_vector : public details::vector_base<T, N, Allocator>
+    {
+    public:
+        using details::vector_base<T, N, Allocator>::vector_base;
+    };
+
+    template <class T, class Allocator>
+    void swap(vector<T, Allocator>& x, vector<T, Allocator>& y) noexcept
+    {
+        x.swap(y);
+    }
+
+    template <class T, std::size_t N, class Allocator>
+    void swap(small_vector<T, N, Allocator>& x, small_vector<T, N, Allocator>& y) noexcept
     {
         x.swap(y);
     }
@@ -0,0 +1,83 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <metal/arena.hpp>
+
+namespace mtl
+{
+    void* arena::allocate_chunk(std::size_t size, std::size_t alignment)
+    {
+        // Large allocations get a chunk of their own
+        const auto chunkSize = std::max(_chunkSize, sizeof(chunk) + size + alignment);
+
+        const auto newChunk = static_cast<chunk*>(::malloc(chunkSize));
+        assert(newChunk); // TODO: we can't handle this very well in the kernel...
+
+        newChunk->previous = _chunk;
+        newChunk->end = reinterpret_cast<char*>(newChunk) + chunkSize;
+
+        _chunk = newChunk;
+        _current = reinterpret_cast<char*>(newChunk + 1);
+        _end = newChunk->end;
+
+        return allocate(size, alignment);
+    }
+
+    void* arena::reallocate(void* memory, std::size_t oldSize, std::size_t newSize, std::size_t alignment)
+    {
+        if (!memory)
+            return allocate(newSize, alignment);
+
+        const auto p = static_cast<char*>(memory);
+        if (p + oldSize == _current && newSize <= std::size_t(_end - p))
+        {
+            _current = p + newSize;
+            return memory;
+        }
+
+        const auto newMemory = allocate(newSize, alignment);
+        memcpy(newMemory, memory, std::min(oldSize, newSize));
+        return newMemory;
+    }
+
+    void arena::rewind(const checkpoint& checkpoint) noexcept
+    {
+        while (_chunk != checkpoint._chunk)
+        {
+            assert(_chunk);
+            const auto previous = _chunk->previous;
+            ::free(_chunk);
+            _chunk = previous;
+        }
+
+        _current = checkpoint._current;
+        _end = _chunk ? _chunk->end : nullptr;
+    }
+} // namespace mtl
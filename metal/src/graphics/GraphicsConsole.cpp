@@ -70,11 +70,11 @@ namespace mtl
 {
     GraphicsConsole::GraphicsConsole(mtl::shared_ptr<IDisplay> display) : m_display(std::move(display))
     {
-        const auto backbuffer = m_display->GetBackbuffer();
-        m_width = backbuffer->width / 8;
-        m_height = backbuffer->height / 16;
-        m_dirtyLeft = backbuffer->width;
-        m_dirtyTop = backbuffer->height;
+        const auto& backbuffer = m_display->GetBackbuffer();
+        m_width = backbuffer.width / 8;
+        m_height = backbuffer.height / 16;
+        m_dirtyLeft = backbuffer.width;
+        m_dirtyTop = backbuffer.height;
         m_dirtyRight = 0;
         m_dirtyBottom = 0;
     }
@@ -92,21 +92,21 @@ namespace mtl
         m_display->Blit(m_dirtyLeft, m_dirtyTop, width, height);
 
         // Reset dirty rect to "nothing"
-        const auto backbuffer = m_display->GetBackbuffer();
-        m_dirtyLeft = backbuffer->width;
-        m_dirtyTop = backbuffer->height;
+        const auto& backbuffer = m_display->GetBackbuffer();
+        m_dirtyLeft = backbuffer.width;
+        m_dirtyTop = backbuffer.height;
         m_dirtyRight = 0;
         m_dirtyBottom = 0;
     }
 
     void GraphicsConsole::Clear()
     {
-        const auto backbuffer = m_display->GetBackbuffer();
+        const auto& backbuffer = m_display->GetBackbuffer();
 
-        for (int y = 0; y != backbuffer->height; ++y)
+        for (int y = 0; y != backbuffer.height; ++y)
         {
-            uint32_t* dest = (uint32_t*)(((uintptr_t)backbuffer->pixels) + y * backbuffer->pitch);
-            for (int i = 0; i != backbuffer->width; ++i)
+            uint32_t* dest = (uint32_t*)(((uintptr_t)backbuffer.pixels) + y * backbuffer.pitch);
+            for (int i = 0; i != backbuffer.width; ++i)
             {
                 *dest++ = m_backgroundColor;
             }
@@ -115,8 +115,8 @@ namespace mtl
         // Set dirty rect to the whole screen
         m_dirtyLeft = 0;
         m_dirtyTop = 0;
-        m_dirtyRight = backbuffer->width;
-        m_dirtyBottom = backbuffer->height;
+        m_dirtyRight = backbuffer.width;
+        m_dirtyBottom = backbuffer.height;
 
         Blit();
     }
@@ -133,7 +133,7 @@ namespace mtl
             const auto px = m_cursorX * 8;
             const auto py = m_cursorY * 16;
 
-            VgaDrawChar(c, *m_display->GetBackbuffer(), px, py, m_foregroundColor, m_backgroundColor);
+            VgaDrawChar(c, m_display->GetBackbuffer(), px, py, m_foregroundColor, m_backgroundColor);
 
             // Update dirty rect
             m_dirtyLeft = std::min(px, m_dirtyLeft);
@@ -188,28 +188,28 @@ namespace mtl
 
     void GraphicsConsole::Scroll() const
     {
-        const auto backbuffer = m_display->GetBackbuffer();
+        const auto& backbuffer = m_display->GetBackbuffer();
 
         // Scroll text
-        for (int y = 16; y != backbuffer->height; ++y)
+        for (int y = 16; y != backbuffer.height; ++y)
         {
-            void* dest = (void*)(((uintptr_t)backbuffer->pixels) + (y - 16) * backbuffer->pitch);
-            const void* src = (void*)(((uintptr_t)backbuffer->pixels) + y * backbuffer->pitch);
-            memcpy(dest, src, backbuffer->width * 4);
+            void* dest = (void*)(((uintptr_t)backbuffer.pixels) + (y - 16) * backbuffer.pitch);
+            const void* src = (void*)(((uintptr_t)backbuffer.pixels) + y * backbuffer.pitch);
+            memcpy(dest, src, backbuffer.width * 4);
         }
 
         // Erase last line
-        for (int y = backbuffer->height - 16; y != backbuffer->height; ++y)
+        for (int y = backbuffer.height - 16; y != backbuffer.height; ++y)
         {
-            uint32_t* dest = (uint32_t*)(((uintptr_t)backbuffer->pixels) + y * backbuffer->pitch);
+            uint32_t* dest = (uint32_t*)(((uintptr_t)backbuffer.pixels) + y * backbuffer.pitch);
 
             if (m_backgroundColor == 0)
             {
-                memset(dest, 0, backbuffer->width * 4);
+                memset(dest, 0, backbuffer.width * 4);
             }
             else
             {
-                for (int i = 0; i != backbuffer->width; ++i)
+                for (int i = 0; i != backbuffer.width; ++i)
                 {
                     *dest++ = m_backgroundColor;
                 }
@@ -219,8 +219,8 @@ namespace mtl
         // Set dirty rect to the whole screen
         m_dirtyLeft = 0;
         m_dirtyTop = 0;
-        m_dirtyRight = backbuffer->width;
-        m_dirtyBottom = backbuffer->height;
+        m_dirtyRight = backbuffer.width;
+        m_dirtyBottom = backbuffer.height;
     }
 
     void GraphicsConsole::SetCursorPosition(int x, int y)
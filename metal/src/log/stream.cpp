@@ -67,58 +67,38 @@ namespace mtl
         Write(string);
     }
 
-    namespace
+    void LogStream::Append(const char* first, const char* last)
     {
-        template <typename T>
-        void WriteImpl(LogStream& stream, T value, bool negative, const int base = 10, const int width = 0)
-        {
-            constexpr int kMaxDigits = 32; // Enough space for 20 digits (2^64)
-
-            if (negative && value)
-            {
-                stream.Write(u8'-');
-            }
-
-            char8_t digits[kMaxDigits];
-            int count = 0;
-
-            do
-            {
-                const auto digit = value % base;
-                digits[count++] = digit < 10 ? u8'0' + digit : u8'a' + digit - 10;
-                value /= base;
-            } while (value && count < kMaxDigits);
-
-            for (int leadingZeroes = width - count; leadingZeroes > 0; --leadingZeroes)
-            {
-                stream.Write(u8'0');
-            }
-
-            for (auto i = count; i > 0; --i)
-            {
-                stream.Write(digits[i - 1]);
-            }
-        }
-    } // namespace
+        for (; first != last; ++first)
+            m_buffer.push_back(*first);
+    }
 
     void LogStream::Write(uint32_t value, bool negative)
     {
-        WriteImpl(*this, value, negative);
+        Write(static_cast<uint64_t>(value), negative);
     }
 
     void LogStream::Write(uint64_t value, bool negative)
     {
-        WriteImpl(*this, value, negative);
+        char buffer[details::kMaxIntegerLength];
+        const auto last = buffer + details::kMaxIntegerLength;
+        auto first = details::write_decimal(last, value);
+        if (negative && value)
+            *--first = '-';
+
+        Append(first, last);
     }
 
     void LogStream::WriteHex(uint32_t value, std::size_t width)
     {
-        WriteImpl(*this, value, false, 16, width);
+        WriteHex(static_cast<uint64_t>(value), width);
     }
 
     void LogStream::WriteHex(uint64_t value, std::size_t width)
     {
-        WriteImpl(*this, value, false, 16, width);
+        char buffer[details::kMaxIntegerLength];
+        const auto last = buffer + details::kMaxIntegerLength;
+        const auto count = std::max(details::count_hex_digits(value), std::min(static_cast<int>(width), 16));
+        Append(details::write_hex(last, value, count), last);
     }
-
 } // namespace mtl
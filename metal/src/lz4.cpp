@@ -0,0 +1,229 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <metal/lz4.hpp>
+
+namespace mtl
+{
+    static inline uint32_t ReadLE32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static inline uint64_t ReadLE64(const uint8_t* p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    // Read the extra bytes of a literal or match length
+    static inline bool ReadLength(const uint8_t*& input, const uint8_t* end, size_t& length)
+    {
+        uint8_t byte;
+        do
+        {
+            if (input == end)
+                return false;
+            byte = *input++;
+            length += byte;
+        } while (byte == 255);
+
+        return true;
+    }
+
+    bool Lz4FrameDecoder::IsFrame(const void* data, size_t size)
+    {
+        return size >= 4 && ReadLE32(static_cast<const uint8_t*>(data)) == kMagic;
+    }
+
+    expected<Lz4FrameDecoder::FrameInfo, Lz4Error> Lz4FrameDecoder::ParseHeader(const void* data, size_t size)
+    {
+        const auto header = static_cast<const uint8_t*>(data);
+        if (!IsFrame(data, size) || size < 7)
+            return unexpected(Lz4Error::InvalidData);
+
+        const uint8_t flags = header[4];
+        const uint8_t blockDescriptor = header[5];
+
+        // Version 01, reserved bits cleared
+        if ((flags >> 6) != 1 || (flags & 0x02) || (blockDescriptor & 0x8F))
+            return unexpected(Lz4Error::InvalidData);
+
+        const bool hasContentSize = flags & 0x08;
+        const bool hasDictionaryId = flags & 0x01;
+        if (!hasContentSize || hasDictionaryId)
+            return unexpected(Lz4Error::Unsupported);
+
+        const int blockSizeId = (blockDescriptor >> 4) & 7;
+        if (blockSizeId < 4)
+            return unexpected(Lz4Error::InvalidData);
+
+        FrameInfo info;
+        info.headerSize = 4 + 2 + 8 + 1;
+        if (size < info.headerSize)
+            return unexpected(Lz4Error::InvalidData);
+
+        info.contentSize = ReadLE64(header + 6);
+        info.maxBlockSize = size_t(1) << (8 + 2 * blockSizeId); // 64 KB, 256 KB, 1 MB or 4 MB
+        info.blockChecksum = flags & 0x10;
+        info.contentChecksum = flags & 0x04;
+
+        return info;
+    }
+
+    Lz4FrameDecoder::Lz4FrameDecoder(const FrameInfo& info, void* output, size_t outputSize)
+        : m_info(info), m_output(static_cast<uint8_t*>(output)), m_outputCapacity(outputSize)
+    {
+    }
+
+    expected<size_t, Lz4Error> Lz4FrameDecoder::Decode(const void* input, size_t size)
+    {
+        const auto data = static_cast<const uint8_t*>(input);
+        size_t position = 0;
+
+        while (!m_finished && size - position >= 4)
+        {
+            uint32_t blockSize = ReadLE32(data + position);
+
+            // End mark, optionally followed by the content checksum
+            if (blockSize == 0)
+            {
+                const size_t endSize = 4 + (m_info.contentChecksum ? 4 : 0);
+                if (size - position < endSize)
+                    break;
+
+                if (m_outputSize != m_info.contentSize)
+                    return unexpected(Lz4Error::InvalidData);
+
+                position += endSize;
+                m_finished = true;
+                break;
+            }
+
+            const bool compressed = !(blockSize & 0x80000000u);
+            blockSize &= 0x7FFFFFFFu;
+            if (blockSize > m_info.maxBlockSize)
+                return unexpected(Lz4Error::InvalidData);
+
+            const size_t chunkSize = 4 + blockSize + (m_info.blockChecksum ? 4 : 0);
+            if (size - position < chunkSize)
+                break;
+
+            const auto block = data + position + 4;
+            if (compressed)
+            {
+                if (auto result = DecodeBlock(block, blockSize); !result)
+                    return unexpected(result.error());
+            }
+            else
+            {
+                if (blockSize > m_outputCapacity - m_outputSize)
+                    return unexpected(Lz4Error::OutputTooSmall);
+
+                memcpy(m_output + m_outputSize, block, blockSize);
+                m_outputSize += blockSize;
+            }
+
+            position += chunkSize;
+        }
+
+        return position;
+    }
+
+    // LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+    expected<void, Lz4Error> Lz4FrameDecoder::DecodeBlock(const uint8_t* input, size_t size)
+    {
+        const uint8_t* const inputEnd = input + size;
+        uint8_t* output = m_output + m_outputSize;
+        uint8_t* const outputEnd = m_output + m_outputCapacity;
+
+        for (;;)
+        {
+            if (input == inputEnd)
+                return unexpected(Lz4Error::InvalidData);
+
+            const uint8_t token = *input++;
+
+            // Literals
+            size_t literalLength = token >> 4;
+            if (literalLength == 15 && !ReadLength(input, inputEnd, literalLength))
+                return unexpected(Lz4Error::InvalidData);
+
+            if (literalLength > size_t(inputEnd - input))
+                return unexpected(Lz4Error::InvalidData);
+
+            if (literalLength > size_t(outputEnd - output))
+                return unexpected(Lz4Error::OutputTooSmall);
+
+            memcpy(output, input, literalLength);
+            output += literalLength;
+            input += literalLength;
+
+            // The last sequence of a block only has literals
+            if (input == inputEnd)
+                break;
+
+            // Match
+            if (inputEnd - input < 2)
+                return unexpected(Lz4Error::InvalidData);
+
+            const size_t offset = input[0] | (input[1] << 8);
+            input += 2;
+
+            if (offset == 0 || offset > size_t(output - m_output))
+                return unexpected(Lz4Error::InvalidData);
+
+            size_t matchLength = token & 15;
+            if (matchLength == 15 && !ReadLength(input, inputEnd, matchLength))
+                return unexpected(Lz4Error::InvalidData);
+            matchLength += 4;
+
+            if (matchLength > size_t(outputEnd - output))
+                return unexpected(Lz4Error::OutputTooSmall);
+
+            // Overlapping matches repeat the last 'offset' bytes and must be copied forward one byte at a time
+            const uint8_t* match = output - offset;
+            if (offset >= matchLength)
+            {
+                memcpy(output, match, matchLength);
+                output += matchLength;
+            }
+            else
+            {
+                for (size_t i = 0; i != matchLength; ++i)
+                    *output++ = *match++;
+            }
+        }
+
+        m_outputSize = output - m_output;
+
+        return {};
+    }
+} // namespace mtl
@@ -0,0 +1,334 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <metal/rbtree.hpp>
+
+namespace mtl::details
+{
+    void rbtree_base::link(rbtree_hook* node, rbtree_hook* parent, bool left)
+    {
+        node->parent = parent;
+        node->left = node->right = nullptr;
+        node->red = true;
+
+        if (!parent)
+            _root = node;
+        else if (left)
+            parent->left = node;
+        else
+            parent->right = node;
+
+        ++_size;
+
+        // Rotations preserve the set of nodes under the rotated pair, so ancestors only need to be updated once
+        augment_path(node);
+        insert_fixup(node);
+    }
+
+    void rbtree_base::unlink(rbtree_hook* node)
+    {
+        rbtree_hook* child;
+        rbtree_hook* parent;
+        bool removedRed;
+
+        if (!node->left || !node->right)
+        {
+            child = node->left ? node->left : node->right;
+            parent = node->parent;
+            removedRed = node->red;
+
+            if (child)
+                child->parent = parent;
+            replace_child(parent, node, child);
+        }
+        else
+        {
+            // Replace 'node' with its successor
+            auto successor = first(node->right);
+            child = successor->right;
+            removedRed = successor->red;
+
+            if (successor->parent == node)
+            {
+                parent = successor;
+            }
+            else
+            {
+                parent = successor->parent;
+                parent->left = child;
+                if (child)
+                    child->parent = parent;
+
+                successor->right = node->right;
+                node->right->parent = successor;
+            }
+
+            successor->left = node->left;
+            node->left->parent = successor;
+            successor->parent = node->parent;
+            successor->red = node->red;
+            replace_child(node->parent, node, successor);
+        }
+
+        --_size;
+
+        augment_path(parent);
+
+        if (!removedRed)
+            erase_fixup(child, parent);
+
+        node->parent = node->left = node->right = nullptr;
+    }
+
+    rbtree_hook* rbtree_base::first(rbtree_hook* node)
+    {
+        if (node)
+        {
+            while (node->left)
+                node = node->left;
+        }
+        return node;
+    }
+
+    rbtree_hook* rbtree_base::last(rbtree_hook* node)
+    {
+        if (node)
+        {
+            while (node->right)
+                node = node->right;
+        }
+        return node;
+    }
+
+    rbtree_hook* rbtree_base::next(rbtree_hook* node)
+    {
+        if (node->right)
+            return first(node->right);
+
+        while (node->parent && node == node->parent->right)
+            node = node->parent;
+
+        return node->parent;
+    }
+
+    rbtree_hook* rbtree_base::prev(rbtree_hook* node)
+    {
+        if (node->left)
+            return last(node->left);
+
+        while (node->parent && node == node->parent->left)
+            node = node->parent;
+
+        return node->parent;
+    }
+
+    void rbtree_base::augment_path(rbtree_hook* node)
+    {
+        for (; node; node = node->parent)
+            _augment(node);
+    }
+
+    void rbtree_base::replace_child(rbtree_hook* parent, rbtree_hook* oldChild, rbtree_hook* newChild)
+    {
+        if (!parent)
+            _root = newChild;
+        else if (parent->left == oldChild)
+            parent->left = newChild;
+        else
+            parent->right = newChild;
+    }
+
+    void rbtree_base::rotate_left(rbtree_hook* node)
+    {
+        auto pivot = node->right;
+
+        node->right = pivot->left;
+        if (pivot->left)
+            pivot->left->parent = node;
+
+        pivot->parent = node->parent;
+        replace_child(node->parent, node, pivot);
+
+        pivot->left = node;
+        node->parent = pivot;
+
+        _augment(node);
+        _augment(pivot);
+    }
+
+    void rbtree_base::rotate_right(rbtree_hook* node)
+    {
+        auto pivot = node->left;
+
+        node->left = pivot->right;
+        if (pivot->right)
+            pivot->right->parent = node;
+
+        pivot->parent = node->parent;
+        replace_child(node->parent, node, pivot);
+
+        pivot->right = node;
+        node->parent = pivot;
+
+        _augment(node);
+        _augment(pivot);
+    }
+
+    void rbtree_base::insert_fixup(rbtree_hook* node)
+    {
+        while (node->parent && node->parent->red)
+        {
+            auto parent = node->parent;
+            auto grandparent = parent->parent; // Exists because the root is black
+
+            if (parent == grandparent->left)
+            {
+                auto uncle = grandparent->right;
+                if (uncle && uncle->red)
+                {
+                    parent->red = uncle->red = false;
+                    grandparent->red = true;
+                    node = grandparent;
+                    continue;
+                }
+
+                if (node == parent->right)
+                {
+                    rotate_left(parent);
+                    node = parent;
+                    parent = node->parent;
+                }
+
+                parent->red = false;
+                grandparent->red = true;
+                rotate_right(grandparent);
+            }
+            else
+            {
+                auto uncle = grandparent->left;
+                if (uncle && uncle->red)
+                {
+                    parent->red = uncle->red = false;
+                    grandparent->red = true;
+                    node = grandparent;
+                    continue;
+                }
+
+                if (node == parent->left)
+                {
+                    rotate_right(parent);
+                    node = parent;
+                    parent = node->parent;
+                }
+
+                parent->red = false;
+                grandparent->red = true;
+                rotate_left(grandparent);
+            }
+        }
+
+        _root->red = false;
+    }
+
+    void rbtree_base::erase_fixup(rbtree_hook* node, rbtree_hook* parent)
+    {
+        // 'node' carries an extra black and can be null, hence 'parent' is tracked separately
+        while (node != _root && (!node || !node->red))
+        {
+            if (node == parent->left)
+            {
+                auto sibling = parent->right;
+                if (sibling->red)
+                {
+                    sibling->red = false;
+                    parent->red = true;
+                    rotate_left(parent);
+                    sibling = parent->right;
+                }
+
+                if ((!sibling->left || !sibling->left->red) && (!sibling->right || !sibling->right->red))
+                {
+                    sibling->red = true;
+                    node = parent;
+                    parent = node->parent;
+                }
+                else
+                {
+                    if (!sibling->right || !sibling->right->red)
+                    {
+                        sibling->left->red = false;
+                        sibling->red = true;
+                        rotate_right(sibling);
+                        sibling = parent->right;
+                    }
+
+                    sibling->red = parent->red;
+                    parent->red = false;
+                    sibling->right->red = false;
+                    rotate_left(parent);
+                    node = _root;
+                }
+            }
+            else
+            {
+                auto sibling = parent->left;
+                if (sibling->red)
+                {
+                    sibling->red = false;
+                    parent->red = true;
+                    rotate_right(parent);
+                    sibling = parent->left;
+                }
+
+                if ((!sibling->left || !sibling->left->red) && (!sibling->right || !sibling->right->red))
+                {
+                    sibling->red = true;
+                    node = parent;
+                    parent = node->parent;
+                }
+                else
+                {
+                    if (!sibling->left || !sibling->left->red)
+                    {
+                        sibling->right->red = false;
+                        sibling->red = true;
+                        rotate_left(sibling);
+                        sibling = parent->left;
+                    }
+
+                    sibling->red = parent->red;
+                    parent->red = false;
+                    sibling->left->red = false;
+                    rotate_right(parent);
+                    node = _root;
+                }
+            }
+        }
+
+        if (node)
+            node->red = false;
+    }
+} // namespace mtl::details
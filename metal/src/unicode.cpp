@@ -24,169 +24,245 @@
     OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <metal/unicode.hpp>
-#include <metal/vector.hpp>
 
 namespace mtl
 {
     int Utf8ToCodePoint(const char8_t*& src, const char8_t* end)
     {
-        int codePoint = -1;
+        if (src >= end)
+            return -1;
 
-        if (src < end)
+        const auto lead = src[0];
+        if (lead < 0x80)
         {
-            if (src[0] < 0x80)
-            {
-                codePoint = src[0];
-                src += 1;
-            }
-            else if ((src[0] & 0xe0) == 0xc0)
-            {
-                if (src + 2 <= end)
-                {
-                    codePoint = ((src[0] & 0x1f) << 6) | ((src[1] & 0x3f) << 0);
-                    src += 2;
-                }
-                else
-                {
-                    src = end;
-                }
-            }
-            else if ((src[0] & 0xf0) == 0xe0)
-            {
-                if (src + 3 <= end)
-                {
-                    codePoint = ((src[0] & 0x0f) << 12) | ((src[1] & 0x3f) << 6) | ((src[2] & 0x3f) << 0);
-                    src += 3;
-                }
-                else
-                {
-                    src = end;
-                }
-            }
-            else if ((src[0] & 0xf8) == 0xf0 && (src[0] <= 0xf4))
+            src += 1;
+            return lead;
+        }
+
+        int length;
+        int codePoint;
+        int minimum;
+        if ((lead & 0xe0) == 0xc0)
+        {
+            length = 2;
+            codePoint = lead & 0x1f;
+            minimum = 0x80;
+        }
+        else if ((lead & 0xf0) == 0xe0)
+        {
+            length = 3;
+            codePoint = lead & 0x0f;
+            minimum = 0x800;
+        }
+        else if ((lead & 0xf8) == 0xf0 && lead <= 0xf4)
+        {
+            length = 4;
+            codePoint = lead & 0x07;
+            minimum = 0x10000;
+        }
+        else
+        {
+            // Invalid
+            src += 1;
+            return -1;
+        }
+
+        for (int i = 1; i != length; ++i)
+        {
+            if (src + i == end)
             {
-                if (src + 4 <= end)
-                {
-                    codePoint = ((src[0] & 0x07) << 18) | ((src[1] & 0x3f) << 12) | ((src[2] & 0x3f) << 6) | ((src[3] & 0x3f) << 0);
-                    src += 4;
-                }
-                else
-                {
-                    src = end;
-                }
+                // Truncated sequence
+                src = end;
+                return -1;
             }
-            else
+
+            if ((src[i] & 0xc0) != 0x80)
             {
-                // Invalid
-                src += 1;
+                // Missing continuation byte, resume decoding at the unexpected byte
+                src += i;
+                return -1;
             }
+
+            codePoint = (codePoint << 6) | (src[i] & 0x3f);
         }
 
+        src += length;
+
+        // Overlong encodings, surrogates and code points past the end of Unicode
+        if (codePoint < minimum || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF)
+            return -1;
+
         return codePoint;
     }
 
-    mtl::u8string ToU8String(mtl::u16string_view string)
+    namespace
     {
-        mtl::vector<char8_t> buffer;
-        buffer.reserve(string.size());
-
-        for (auto text = string.begin(); text != string.end();)
+        // Length of the ASCII prefix of [text, end). Most strings we convert are ASCII, so we look at 8 bytes at a
+        // time. This uses plain 64 bits integer operations as the kernel and boot loader are built without SIMD.
+        template <typename T>
+        size_t AsciiLength(const T* text, const T* end)
         {
-            int codePoint = *text++;
+            constexpr auto kCharsPerWord = static_cast<ptrdiff_t>(sizeof(uint64_t) / sizeof(T));
+            constexpr uint64_t kNonAsciiMask = sizeof(T) == 1 ? 0x8080808080808080ull : 0xFF80FF80FF80FF80ull;
 
-            // Handle surrogate pairs
-            if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+            auto p = text;
+            for (; end - p >= kCharsPerWord; p += kCharsPerWord)
             {
-                if (text != string.end())
-                {
-                    const auto trail = *text;
-
-                    if (trail >= 0xDC00 && trail <= 0xDFFF)
-                    {
-                        codePoint = SurrogatesToCodePoint(codePoint, trail);
-                        ++text;
-                    }
-                    else
-                    {
-                        codePoint = 0xFFFD;
-                    }
-                }
-                else
-                {
-                    codePoint = 0xFFFD;
-                }
+                uint64_t word;
+                memcpy(&word, p, sizeof(word));
+                if (word & kNonAsciiMask)
+                    break;
             }
 
+            while (p != end && *p < 0x80)
+                ++p;
+
+            return p - text;
+        }
+
+        // Decode the next code point from UTF-16. Unpaired surrogates become U+FFFD.
+        int Utf16ToCodePoint(const char16_t*& text, const char16_t* end)
+        {
+            const int codePoint = *text++;
+
+            if (codePoint < 0xD800 || codePoint > 0xDFFF)
+                return codePoint;
+
+            if (codePoint <= 0xDBFF && text != end && *text >= 0xDC00 && *text <= 0xDFFF)
+                return SurrogatesToCodePoint(codePoint, *text++);
+
+            return 0xFFFD;
+        }
+
+        int Utf8Length(int codePoint)
+        {
+            return codePoint < 0x80 ? 1 : codePoint < 0x800 ? 2 : codePoint < 0x10000 ? 3 : 4;
+        }
+
+        char8_t* WriteUtf8(int codePoint, char8_t* out)
+        {
             if (codePoint < 0x80)
             {
-                buffer.push_back(codePoint);
+                *out++ = codePoint;
             }
             else if (codePoint < 0x800)
             {
-                buffer.push_back(0xC0 | (codePoint >> 6));
-                buffer.push_back(0x80 | (codePoint & 0x3F));
+                *out++ = 0xC0 | (codePoint >> 6);
+                *out++ = 0x80 | (codePoint & 0x3F);
             }
             else if (codePoint < 0x10000)
             {
-                buffer.push_back(0xE0 | (codePoint >> 12));
-                buffer.push_back(0x80 | ((codePoint >> 6) & 0x3F));
-                buffer.push_back(0x80 | (codePoint & 0x3F));
+                *out++ = 0xE0 | (codePoint >> 12);
+                *out++ = 0x80 | ((codePoint >> 6) & 0x3F);
+                *out++ = 0x80 | (codePoint & 0x3F);
             }
             else
             {
-                buffer.push_back(0xF0 | (codePoint >> 18));
-                buffer.push_back(0x80 | ((codePoint >> 12) & 0x3F));
-                buffer.push_back(0x80 | ((codePoint >> 6) & 0x3F));
-                buffer.push_back(0x80 | (codePoint & 0x3F));
+                *out++ = 0xF0 | (codePoint >> 18);
+                *out++ = 0x80 | ((codePoint >> 12) & 0x3F);
+                *out++ = 0x80 | ((codePoint >> 6) & 0x3F);
+                *out++ = 0x80 | (codePoint & 0x3F);
             }
+
+            return out;
         }
 
-        return mtl::u8string(buffer.data(), buffer.data() + buffer.size());
-    }
+        // Convert a code point returned by Utf8ToCodePoint() to UTF-16 or UCS-2, returns the number of code units
+        int WriteUtf16(int codePoint, U16StringFormat format, char16_t* out)
+        {
+            if (format == Ucs2)
+            {
+                out[0] = mtl::IsValidUcs2CodePoint(codePoint) ? codePoint : u'\uFFFD';
+                return 1;
+            }
 
-    mtl::u16string ToU16String(mtl::u8string_view string, U16StringFormat format)
-    {
-        mtl::vector<char16_t> buffer;
-        buffer.reserve(string.size());
+            assert(format == Utf16);
 
-        auto text = string.begin();
-        auto end = string.end();
-        while (text != end)
-        {
-            const auto codePoint = mtl::Utf8ToCodePoint(text, end);
+            if (codePoint < 0)
+            {
+                out[0] = u'\uFFFD';
+                return 1;
+            }
 
-            if (format == Utf16)
+            if (codePoint <= 0xFFFF)
             {
-                if (codePoint <= 0xFFFF)
-                {
-                    buffer.push_back(codePoint);
-                }
-                else
-                {
-                    char16_t lead, trail;
-                    CodePointToSurrogates(codePoint, lead, trail);
-                    buffer.push_back(lead);
-                    buffer.push_back(trail);
-                }
+                out[0] = codePoint;
+                return 1;
             }
-            else if (format == Ucs2)
+
+            CodePointToSurrogates(codePoint, out[0], out[1]);
+            return 2;
+        }
+    } // namespace
+
+    mtl::u8string ToU8String(mtl::u16string_view string)
+    {
+        // Measure the result first so that it is allocated once
+        size_t length = 0;
+        for (auto text = string.begin(), end = string.end(); text != end;)
+        {
+            const auto ascii = AsciiLength(text, end);
+            text += ascii;
+            length += ascii;
+
+            if (text != end)
+                length += Utf8Length(Utf16ToCodePoint(text, end));
+        }
+
+        mtl::u8string result;
+        result.resize_and_overwrite(length, [&string](char8_t* out, size_t count) {
+            for (auto text = string.begin(), end = string.end(); text != end;)
             {
-                if (mtl::IsValidUcs2CodePoint(codePoint))
-                {
-                    buffer.push_back(codePoint);
-                }
-                else
-                {
-                    buffer.push_back(u'\uFFFD');
-                }
+                const auto ascii = AsciiLength(text, end);
+                out = std::copy(text, text + ascii, out);
+                text += ascii;
+
+                if (text != end)
+                    out = WriteUtf8(Utf16ToCodePoint(text, end), out);
             }
-            else
+
+            return count;
+        });
+
+        return result;
+    }
+
+    mtl::u16string ToU16String(mtl::u8string_view string, U16StringFormat format)
+    {
+        // Measure the result first so that it is allocated once
+        size_t length = 0;
+        for (auto text = string.begin(), end = string.end(); text != end;)
+        {
+            const auto ascii = AsciiLength(text, end);
+            text += ascii;
+            length += ascii;
+
+            if (text != end)
             {
-                assert(!"Unknown format");
+                char16_t units[2];
+                length += WriteUtf16(mtl::Utf8ToCodePoint(text, end), format, units);
             }
         }
 
-        return mtl::u16string(buffer.data(), buffer.data() + buffer.size());
+        mtl::u16string result;
+        result.resize_and_overwrite(length, [&string, format](char16_t* out, size_t count) {
+            for (auto text = string.begin(), end = string.end(); text != end;)
+            {
+                const auto ascii = AsciiLength(text, end);
+                out = std::copy(text, text + ascii, out);
+                text += ascii;
+
+                if (text != end)
+                    out += WriteUtf16(mtl::Utf8ToCodePoint(text, end), format, out);
+            }
+
+            return count;
+        });
+
+        return result;
     }
 } // namespace mtl
@@ -273,3 +273,26 @@ TEST_CASE("operator<<", "[LogStream]")
         }
     }
 }
+
+TEST_CASE("Format", "[LogStream]")
+{
+    LogRecord record;
+    LogStream stream(record);
+
+    SECTION("Mixed with operator<<")
+    {
+        stream << "Mapped ";
+        stream.Format("{} pages at {:#x}", 16, 0x1000);
+        stream.Flush();
+        REQUIRE(record.message == u8"Mapped 16 pages at 0x1000");
+    }
+
+    SECTION("Long messages are not truncated")
+    {
+        for (int i = 0; i != 100; ++i)
+            stream.Format("{:04}", i);
+        stream.Flush();
+        REQUIRE(record.message.length() == 400);
+        REQUIRE(mtl::u8string_view(record.message.data() + 396, 4) == u8"0099"sv);
+    }
+}
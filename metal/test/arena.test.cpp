@@ -0,0 +1,201 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <metal/arena.hpp>
+#include <metal/string.hpp>
+#include <metal/vector.hpp>
+#include <unittest.hpp>
+
+TEST_CASE("Allocations are contiguous", "[arena]")
+{
+    mtl::arena arena;
+
+    const auto a = static_cast<char*>(arena.allocate(10, 1));
+    const auto b = static_cast<char*>(arena.allocate(10, 1));
+    REQUIRE(b == a + 10);
+
+    const auto c = arena.allocate(8, 16);
+    REQUIRE(reinterpret_cast<uintptr_t>(c) % 16 == 0);
+    REQUIRE(static_cast<char*>(c) >= b + 10);
+    REQUIRE(static_cast<char*>(c) < b + 10 + 16);
+}
+
+TEST_CASE("Large allocations", "[arena]")
+{
+    mtl::arena arena(1024);
+
+    const auto small = static_cast<char*>(arena.allocate(100));
+    memset(small, 1, 100);
+
+    const auto large = static_cast<char*>(arena.allocate(100000));
+    memset(large, 2, 100000);
+
+    for (int i = 0; i != 1000; ++i)
+        memset(arena.allocate(100), 3, 100);
+
+    REQUIRE(small[99] == 1);
+    REQUIRE(large[0] == 2);
+    REQUIRE(large[99999] == 2);
+}
+
+TEST_CASE("Checkpoints", "[arena]")
+{
+    mtl::arena arena(1024);
+
+    const auto first = arena.allocate(16);
+    const auto checkpoint = arena.mark();
+
+    const auto second = arena.allocate(16);
+    for (int i = 0; i != 100; ++i)
+        arena.allocate(100); // Spans multiple chunks
+
+    arena.rewind(checkpoint);
+    REQUIRE(arena.allocate(16) == second);
+
+    arena.release();
+    const auto again = arena.allocate(16);
+    REQUIRE(again != nullptr);
+    (void)first;
+}
+
+TEST_CASE("Nested scopes", "[arena]")
+{
+    mtl::arena arena;
+    const auto start = arena.allocate(1);
+
+    void* outer;
+    {
+        mtl::arena::scope scope(arena);
+        outer = arena.allocate(32);
+        {
+            mtl::arena::scope scope(arena);
+            arena.allocate(64);
+        }
+        REQUIRE(static_cast<char*>(arena.allocate(32)) == static_cast<char*>(outer) + 32);
+    }
+
+    REQUIRE(arena.allocate(32) == outer);
+    (void)start;
+}
+
+TEST_CASE("Reallocate the last allocation in place", "[arena]")
+{
+    mtl::arena arena;
+
+    const auto a = static_cast<char*>(arena.allocate(16));
+    memcpy(a, "0123456789abcdef", 16);
+
+    REQUIRE(arena.reallocate(a, 16, 64) == a);
+
+    const auto b = arena.allocate(16);
+    const auto c = static_cast<char*>(arena.reallocate(a, 64, 128));
+    REQUIRE(c != a);
+    REQUIRE(c > static_cast<char*>(b));
+    REQUIRE(memcmp(c, "0123456789abcdef", 16) == 0);
+
+    arena.deallocate(c, 128);
+    REQUIRE(arena.allocate(1) == c);
+}
+
+TEST_CASE("vector with an arena allocator", "[arena]")
+{
+    mtl::arena arena(256);
+    mtl::vector<int, mtl::arena_allocator<int>> vector(arena);
+
+    for (int i = 0; i != 1000; ++i)
+        vector.push_back(i);
+
+    for (int i = 0; i != 1000; ++i)
+        REQUIRE(vector[i] == i);
+
+    // Copies and moves keep the allocator
+    auto copy = vector;
+    REQUIRE(copy.get_allocator() == vector.get_allocator());
+    REQUIRE(copy.size() == 1000);
+    REQUIRE(copy[999] == 999);
+
+    auto moved = std::move(copy);
+    REQUIRE(moved.size() == 1000);
+    REQUIRE(copy.empty());
+
+    // Moving between allocators moves the elements
+    mtl::arena otherArena;
+    mtl::vector<int, mtl::arena_allocator<int>> other(otherArena);
+    other.push_back(42);
+    other = std::move(moved);
+    REQUIRE(other.size() == 1000);
+    REQUIRE(other[500] == 500);
+    REQUIRE(other.get_allocator() == mtl::arena_allocator<int>(otherArena));
+
+    swap(other, vector);
+    REQUIRE(other.size() == 1000);
+    REQUIRE(vector.size() == 1000);
+}
+
+TEST_CASE("small_vector with an arena allocator", "[arena]")
+{
+    mtl::arena arena;
+    const auto before = arena.mark();
+
+    {
+        mtl::small_vector<int, 4, mtl::arena_allocator<int>> vector(arena);
+        for (int i = 0; i != 4; ++i)
+            vector.push_back(i);
+
+        // Nothing allocated yet
+        const auto checkpoint = arena.mark();
+        REQUIRE(checkpoint._current == before._current);
+
+        vector.push_back(4);
+        REQUIRE(arena.mark()._current != before._current);
+    }
+}
+
+TEST_CASE("string with an arena allocator", "[arena]")
+{
+    using String = mtl::basic_string<char, mtl::arena_allocator<char>>;
+
+    mtl::arena arena;
+    const String small("small", arena);
+    const String large("a string that doesn't fit in the small string buffer", arena);
+
+    REQUIRE(small == "small");
+    REQUIRE(large == "a string that doesn't fit in the small string buffer");
+    REQUIRE(large == mtl::string("a string that doesn't fit in the small string buffer"));
+
+    String copy(large);
+    REQUIRE(copy == large);
+    REQUIRE(copy.data() != large.data());
+
+    String moved(std::move(copy));
+    REQUIRE(moved == large);
+
+    mtl::arena otherArena;
+    String other(otherArena);
+    other = std::move(moved);
+    REQUIRE(other == large);
+}
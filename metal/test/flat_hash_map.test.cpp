@@ -0,0 +1,376 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <metal/flat_hash_map.hpp>
+#include <metal/flat_hash_set.hpp>
+#include <random>
+#include <unittest.hpp>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace mtl::details;
+
+namespace
+{
+    template <typename Group>
+    void CheckGroup(const ctrl_t* ctrl)
+    {
+        const Group group(ctrl);
+
+        std::vector<int> empty;
+        for (const auto i : group.match_empty())
+            empty.push_back(i);
+
+        std::vector<int> emptyOrDeleted;
+        for (const auto i : group.match_empty_or_deleted())
+            emptyOrDeleted.push_back(i);
+
+        std::vector<int> expectedEmpty;
+        std::vector<int> expectedEmptyOrDeleted;
+        for (size_t i = 0; i != Group::kWidth; ++i)
+        {
+            if (ctrl[i] == kCtrlEmpty)
+                expectedEmpty.push_back(i);
+            if (ctrl[i] == kCtrlEmpty || ctrl[i] == kCtrlDeleted)
+                expectedEmptyOrDeleted.push_back(i);
+        }
+
+        REQUIRE(empty == expectedEmpty);
+        REQUIRE(emptyOrDeleted == expectedEmptyOrDeleted);
+
+        if (expectedEmpty.empty())
+            return;
+
+        const auto mask = group.match_empty();
+        REQUIRE(mask.trailing_zeros() == expectedEmpty.front());
+        REQUIRE(mask.leading_zeros() == int(Group::kWidth) - 1 - expectedEmpty.back());
+
+        for (uint8_t h2 = 0; h2 != 128; ++h2)
+        {
+            std::vector<bool> matched(Group::kWidth);
+            for (const auto i : group.match(h2))
+            {
+                matched[i] = true;
+                // False positives are allowed, but only on full slots
+                REQUIRE(is_full(ctrl[i]));
+            }
+
+            for (size_t i = 0; i != Group::kWidth; ++i)
+            {
+                if (ctrl[i] == h2)
+                    REQUIRE(matched[i]);
+            }
+        }
+    }
+
+    // Counts live instances to catch leaks and double destructions
+    struct Counted
+    {
+        static inline int s_count = 0;
+
+        explicit Counted(int v) : value(v) { ++s_count; }
+        Counted(const Counted& other) : value(other.value) { ++s_count; }
+        Counted(Counted&& other) : value(other.value) { ++s_count; }
+        ~Counted() { --s_count; }
+
+        int value;
+    };
+} // namespace
+
+TEST_CASE("Group matching", "[flat_hash_map]")
+{
+    std::mt19937 random(42);
+    const ctrl_t special[] = {kCtrlEmpty, kCtrlDeleted, kCtrlSentinel};
+
+    for (int iteration = 0; iteration != 10000; ++iteration)
+    {
+        ctrl_t ctrl[16];
+        for (auto& c : ctrl)
+            c = (random() % 3) ? ctrl_t(random() % 128) : special[random() % 3];
+
+        CheckGroup<group_portable>(ctrl);
+        CheckGroup<group>(ctrl);
+    }
+}
+
+TEST_CASE("flat_hash_map basics", "[flat_hash_map]")
+{
+    mtl::flat_hash_map<int, int> map;
+    REQUIRE(map.empty());
+    REQUIRE(map.find(1) == map.end());
+    REQUIRE(map.begin() == map.end());
+    REQUIRE(map.erase(1) == 0);
+
+    REQUIRE(map.insert({1, 10}).second);
+    REQUIRE(!map.insert({1, 20}).second);
+    REQUIRE(map.at(1) == 10);
+
+    REQUIRE(map.insert_or_assign(1, 30).second == false);
+    REQUIRE(map.at(1) == 30);
+
+    map[2] = 40;
+    REQUIRE(map.size() == 2);
+    REQUIRE(map.contains(2));
+    REQUIRE(map.count(3) == 0);
+
+    REQUIRE(map.erase(1) == 1);
+    REQUIRE(!map.contains(1));
+    REQUIRE(map.size() == 1);
+
+    map.erase(map.find(2));
+    REQUIRE(map.empty());
+}
+
+TEST_CASE("flat_hash_map against std::unordered_map", "[flat_hash_map]")
+{
+    std::mt19937 random(1234);
+
+    // Small key range to get a lot of collisions, erasures and tombstones
+    for (const int keyRange : {10, 1000, 100000})
+    {
+        INFO("keyRange " << keyRange);
+
+        mtl::flat_hash_map<int, int> map;
+        std::unordered_map<int, int> expected;
+
+        for (int i = 0; i != 200000; ++i)
+        {
+            const int key = random() % keyRange;
+            switch (random() % 4)
+            {
+            case 0:
+            case 1:
+                REQUIRE(map.try_emplace(key, i).second == expected.try_emplace(key, i).second);
+                break;
+
+            case 2:
+                REQUIRE(map.erase(key) == expected.erase(key));
+                break;
+
+            case 3: {
+                const auto it = map.find(key);
+                const auto it2 = expected.find(key);
+                REQUIRE((it == map.end()) == (it2 == expected.end()));
+                if (it != map.end())
+                    REQUIRE(it->second == it2->second);
+                break;
+            }
+            }
+
+            REQUIRE(map.size() == expected.size());
+        }
+
+        // Iteration visits every element once
+        size_t count = 0;
+        for (const auto& [key, value] : map)
+        {
+            REQUIRE(expected.at(key) == value);
+            ++count;
+        }
+        REQUIRE(count == expected.size());
+    }
+}
+
+TEST_CASE("flat_hash_map destroys its elements", "[flat_hash_map]")
+{
+    {
+        mtl::flat_hash_map<int, Counted> map;
+        for (int i = 0; i != 1000; ++i)
+            map.try_emplace(i, i);
+
+        for (int i = 0; i != 1000; i += 2)
+            map.erase(i);
+
+        REQUIRE(Counted::s_count == 500);
+
+        mtl::flat_hash_map<int, Counted> other(std::move(map));
+        REQUIRE(other.size() == 500);
+        REQUIRE(map.empty());
+
+        other.clear();
+        REQUIRE(Counted::s_count == 0);
+
+        for (int i = 0; i != 100; ++i)
+            other.try_emplace(i, i);
+    }
+
+    REQUIRE(Counted::s_count == 0);
+}
+
+TEST_CASE("flat_hash_map heterogeneous lookup", "[flat_hash_map]")
+{
+    mtl::flat_hash_map<mtl::string, int> map;
+    map.try_emplace(mtl::string("RSDP"), 1);
+    map.try_emplace("XSDT", 2);
+    map.try_emplace("a string that is too long for the small string optimization", 3);
+
+    REQUIRE(map.at("RSDP") == 1);
+    REQUIRE(map.find(mtl::string_view("XSDT"))->second == 2);
+    REQUIRE(map.contains("a string that is too long for the small string optimization"));
+    REQUIRE(!map.contains("FACP"));
+    REQUIRE(map.erase("RSDP") == 1);
+    REQUIRE(map.size() == 2);
+}
+
+TEST_CASE("flat_hash_map reserve", "[flat_hash_map]")
+{
+    mtl::flat_hash_map<int, int> map;
+    map.reserve(1000);
+    const auto capacity = map.capacity();
+    REQUIRE(capacity >= 1000);
+
+    for (int i = 0; i != 1000; ++i)
+        map[i] = i;
+
+    REQUIRE(map.capacity() == capacity);
+}
+
+TEST_CASE("flat_hash_map doesn't grow on churn", "[flat_hash_map]")
+{
+    mtl::flat_hash_map<int, int> map;
+    for (int i = 0; i != 80; ++i)
+        map[i] = i;
+
+    const auto capacity = map.capacity();
+
+    // Tombstones are reclaimed by rehashing in place
+    for (int i = 80; i != 100000; ++i)
+    {
+        map.erase(i - 80);
+        map[i] = i;
+    }
+
+    REQUIRE(map.size() == 80);
+    REQUIRE(map.capacity() == capacity);
+}
+
+TEST_CASE("flat_hash_table with portable groups", "[flat_hash_map]")
+{
+    // This is the implementation used in the kernel, which doesn't use SIMD registers
+    struct PortableSet
+        : flat_hash_table<flat_hash_set_policy<int>, mtl::hash<int>, mtl::equal_to<int>, group_portable>
+    {
+        bool insert(int key)
+        {
+            const auto result = find_or_prepare_insert(key);
+            if (result.second)
+                std::construct_at(slot(result.first), key);
+            return result.second;
+        }
+    };
+
+    std::mt19937 random(5678);
+    PortableSet set;
+    std::unordered_set<int> expected;
+
+    for (int i = 0; i != 200000; ++i)
+    {
+        const int key = random() % 5000;
+        if (random() % 2)
+            REQUIRE(set.insert(key) == expected.insert(key).second);
+        else
+            REQUIRE(set.erase(key) == expected.erase(key));
+
+        REQUIRE(set.size() == expected.size());
+    }
+
+    for (const auto key : set)
+        REQUIRE(expected.count(key));
+
+    for (int key = 0; key != 5000; ++key)
+        REQUIRE(set.contains(key) == (expected.count(key) != 0));
+}
+
+TEST_CASE("flat_hash_set", "[flat_hash_map]")
+{
+    mtl::flat_hash_set<uint64_t> set{1, 2, 3};
+    REQUIRE(set.size() == 3);
+    REQUIRE(set.contains(2));
+    REQUIRE(!set.insert(2).second);
+    REQUIRE(set.insert(4).second);
+    REQUIRE(set.erase(1) == 1);
+    REQUIRE(!set.contains(1));
+
+    mtl::flat_hash_set<mtl::string> strings;
+    strings.emplace("DSDT");
+    REQUIRE(strings.contains(mtl::string_view("DSDT")));
+    REQUIRE(!strings.contains("SSDT"));
+}
+
+// Run with: metal_tests "[benchmark]"
+TEST_CASE("flat_hash_map benchmark", "[.][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+
+    const int count = 1000000;
+    std::mt19937_64 random(1);
+    std::vector<uint64_t> keys(count);
+    std::vector<uint64_t> misses(count);
+    for (auto& key : keys)
+        key = random();
+    for (auto& key : misses)
+        key = random();
+
+    const auto measure = [](auto&& function) {
+        const auto start = Clock::now();
+        function();
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    const auto run = [&](const char* name, auto& map) {
+        size_t found = 0;
+        const auto insert = measure([&] {
+            for (const auto key : keys)
+                map.try_emplace(key, key);
+        });
+        const auto hit = measure([&] {
+            for (const auto key : keys)
+                found += map.find(key) != map.end();
+        });
+        const auto miss = measure([&] {
+            for (const auto key : misses)
+                found += map.find(key) != map.end();
+        });
+        const auto erase = measure([&] {
+            for (const auto key : keys)
+                map.erase(key);
+        });
+
+        REQUIRE(found == keys.size());
+        printf("%-20s insert: %7.2f ms   find hit: %7.2f ms   find miss: %7.2f ms   erase: %7.2f ms\n", name, insert, hit,
+               miss, erase);
+    };
+
+    mtl::flat_hash_map<uint64_t, uint64_t> flatMap;
+    run("mtl::flat_hash_map", flatMap);
+
+    std::unordered_map<uint64_t, uint64_t> unorderedMap;
+    run("std::unordered_map", unorderedMap);
+}
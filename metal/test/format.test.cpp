@@ -0,0 +1,225 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <metal/format.hpp>
+#include <random>
+#include <string>
+#include <unittest.hpp>
+#include <vector>
+
+using namespace mtl::literals;
+
+namespace
+{
+    template <typename T>
+    std::string ToChars(T value, int base = 10)
+    {
+        char buffer[32];
+        const auto result = mtl::to_chars(buffer, buffer + sizeof(buffer), value, base);
+        REQUIRE(result.ok);
+        return std::string(buffer, result.ptr);
+    }
+
+    template <typename T>
+    std::string StdToChars(T value, int base = 10)
+    {
+        char buffer[32];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, base);
+        return std::string(buffer, result.ptr);
+    }
+
+    template <typename... Args>
+    std::string Format(mtl::format_string<Args...> format, Args&&... args)
+    {
+        std::string result;
+        mtl::format_to(std::back_inserter(result), format, std::forward<Args>(args)...);
+        return result;
+    }
+} // namespace
+
+TEST_CASE("to_chars", "[format]")
+{
+    SECTION("Limits")
+    {
+        REQUIRE(ToChars(0) == "0");
+        REQUIRE(ToChars(std::numeric_limits<int8_t>::min()) == "-128");
+        REQUIRE(ToChars(std::numeric_limits<int32_t>::min()) == "-2147483648");
+        REQUIRE(ToChars(std::numeric_limits<int64_t>::min()) == "-9223372036854775808");
+        REQUIRE(ToChars(std::numeric_limits<int64_t>::max()) == "9223372036854775807");
+        REQUIRE(ToChars(std::numeric_limits<uint64_t>::max()) == "18446744073709551615");
+        REQUIRE(ToChars(std::numeric_limits<uint64_t>::max(), 16) == "ffffffffffffffff");
+        REQUIRE(ToChars(-255, 16) == "-ff");
+    }
+
+    SECTION("Buffer too small")
+    {
+        char buffer[3];
+        auto result = mtl::to_chars(buffer, buffer + 3, 1234);
+        REQUIRE(!result.ok);
+        REQUIRE(result.ptr == buffer + 3);
+
+        result = mtl::to_chars(buffer, buffer + 3, -12);
+        REQUIRE(result.ok);
+        REQUIRE(std::string(buffer, result.ptr) == "-12");
+    }
+
+    SECTION("Powers of 10 and their neighbours")
+    {
+        for (uint64_t value = 1; value < std::numeric_limits<uint64_t>::max() / 10; value *= 10)
+        {
+            for (const auto v : {value - 1, value, value + 1})
+            {
+                REQUIRE(ToChars(v) == StdToChars(v));
+                REQUIRE(ToChars(v, 16) == StdToChars(v, 16));
+            }
+        }
+    }
+
+    SECTION("Random values against std::to_chars")
+    {
+        std::mt19937_64 random(1234);
+        for (int i = 0; i != 100000; ++i)
+        {
+            // Vary the number of significant bits
+            const auto value = random() >> (random() % 64);
+            REQUIRE(ToChars(value) == StdToChars(value));
+            REQUIRE(ToChars(value, 16) == StdToChars(value, 16));
+
+            const auto signedValue = static_cast<int64_t>(value) * (i & 1 ? -1 : 1);
+            REQUIRE(ToChars(signedValue) == StdToChars(signedValue));
+        }
+    }
+}
+
+TEST_CASE("format_to", "[format]")
+{
+    SECTION("Literal text")
+    {
+        REQUIRE(Format("") == "");
+        REQUIRE(Format("Hello") == "Hello");
+        REQUIRE(Format("{{}}") == "{}");
+        REQUIRE(Format("a{{b}}c") == "a{b}c");
+    }
+
+    SECTION("Integers")
+    {
+        REQUIRE(Format("{}", 123) == "123");
+        REQUIRE(Format("{}", -512) == "-512");
+        REQUIRE(Format("{}", 0xFFFFFFFFFFFFFFFFull) == "18446744073709551615");
+        REQUIRE(Format("{}", (short)-7) == "-7");
+        REQUIRE(Format("{:d}", 42u) == "42");
+        REQUIRE(Format("{:x}", 0xfa1337) == "fa1337");
+        REQUIRE(Format("{:X}", 0xfa1337) == "FA1337");
+        REQUIRE(Format("{:#x}", 255) == "0xff");
+        REQUIRE(Format("{:x}", -255) == "-ff");
+    }
+
+    SECTION("Width and alignment")
+    {
+        REQUIRE(Format("{:5}", 42) == "   42");
+        REQUIRE(Format("{:<5}", 42) == "42   ");
+        REQUIRE(Format("{:05}", -42) == "-0042");
+        REQUIRE(Format("{:016x}", 0xfa1337ull) == "0000000000fa1337");
+        REQUIRE(Format("{:#010x}", 0x1234) == "0x00001234");
+        REQUIRE(Format("{:>5}", "ab") == "   ab");
+        REQUIRE(Format("{:5}", "ab") == "ab   ");
+        REQUIRE(Format("{:2}", 12345) == "12345");
+        REQUIRE(Format("{:3}.{:03} ms", 5, 7) == "  5.007 ms");
+    }
+
+    SECTION("Other types")
+    {
+        REQUIRE(Format("{} {}", true, false) == "true false");
+        REQUIRE(Format("{}{:c}", 'a', u8'b') == "ab");
+        REQUIRE(Format("{}", "text") == "text");
+        REQUIRE(Format("{}", u8"utf8"sv) == "utf8");
+        REQUIRE(Format("{}", mtl::string("string")) == "string");
+        REQUIRE(Format("{}", (void*)0xf8001234abcd) == "0xf8001234abcd");
+        REQUIRE(Format("{}", nullptr) == "0x0");
+
+        const char name[24] = "phase";
+        REQUIRE(Format("[{}]", name) == "[phase]");
+    }
+
+    SECTION("Multiple arguments")
+    {
+        REQUIRE(Format("{} + {} = {}", 1, 2, 3) == "1 + 2 = 3");
+        REQUIRE(Format("{}:{:02x}:{:02x}.{:x}", 0, 3, 31, 7) == "0:03:1f.7");
+    }
+
+    SECTION("Long output is not truncated")
+    {
+        const std::string text(1000, 'x');
+        REQUIRE(Format("{}{}", text.c_str(), 1) == text + "1");
+    }
+}
+
+TEST_CASE("format", "[format]")
+{
+    const auto text = mtl::format("{} pages at {:#x}", 16, 0x1000);
+    REQUIRE(text == u8"16 pages at 0x1000");
+    REQUIRE(mtl::formatted_size("{} pages at {:#x}", 16, 0x1000) == text.length());
+
+    const auto large = mtl::format("{:100}", 1);
+    REQUIRE(large.length() == 100);
+    REQUIRE(large.capacity() < 200);
+}
+
+// Run with: metal_tests "[benchmark]"
+TEST_CASE("to_chars benchmark", "[.][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::mt19937_64 random(1);
+    std::vector<uint64_t> values(1000000);
+    for (auto& value : values)
+        value = random() >> (random() % 64);
+
+    const auto measure = [&](auto&& convert) {
+        char buffer[32];
+        size_t total = 0;
+        const auto start = Clock::now();
+        for (const auto value : values)
+            total += convert(buffer, buffer + sizeof(buffer), value) - buffer;
+        const auto end = Clock::now();
+        REQUIRE(total > 0);
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+
+    for (const int base : {10, 16})
+    {
+        const auto mtlTime =
+            measure([base](char* first, char* last, uint64_t value) { return mtl::to_chars(first, last, value, base).ptr; });
+        const auto stdTime =
+            measure([base](char* first, char* last, uint64_t value) { return std::to_chars(first, last, value, base).ptr; });
+
+        printf("to_chars base %2d: %8.2f ms (std: %8.2f ms)\n", base, mtlTime, stdTime);
+    }
+}
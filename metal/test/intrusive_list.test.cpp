@@ -0,0 +1,182 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <list>
+#include <metal/intrusive_list.hpp>
+#include <random>
+#include <unittest.hpp>
+#include <vector>
+
+namespace
+{
+    struct Node
+    {
+        int value;
+        mtl::list_hook hook{};
+        mtl::list_hook otherHook{};
+    };
+
+    using List = mtl::intrusive_list<Node, &Node::hook>;
+    using OtherList = mtl::intrusive_list<Node, &Node::otherHook>;
+
+    template <typename L>
+    std::vector<int> Values(const L& list)
+    {
+        std::vector<int> result;
+        for (const auto& node : list)
+            result.push_back(node.value);
+        return result;
+    }
+} // namespace
+
+TEST_CASE("Empty list", "[intrusive_list]")
+{
+    List list;
+    REQUIRE(list.empty());
+    REQUIRE(list.size() == 0);
+    REQUIRE(list.begin() == list.end());
+}
+
+TEST_CASE("Push and pop", "[intrusive_list]")
+{
+    Node a{1}, b{2}, c{3};
+    List list;
+
+    list.push_back(b);
+    list.push_back(c);
+    list.push_front(a);
+    REQUIRE(Values(list) == std::vector<int>{1, 2, 3});
+    REQUIRE(list.size() == 3);
+    REQUIRE(&list.front() == &a);
+    REQUIRE(&list.back() == &c);
+    REQUIRE(b.hook.is_linked());
+
+    list.pop_front();
+    REQUIRE(!a.hook.is_linked());
+    list.pop_back();
+    REQUIRE(Values(list) == std::vector<int>{2});
+
+    list.pop_back();
+    REQUIRE(list.empty());
+}
+
+TEST_CASE("Insert and erase", "[intrusive_list]")
+{
+    Node a{1}, b{2}, c{3};
+    List list;
+
+    list.push_back(a);
+    list.push_back(c);
+    list.insert(++list.begin(), b);
+    REQUIRE(Values(list) == std::vector<int>{1, 2, 3});
+
+    const auto it = list.erase(b);
+    REQUIRE(&*it == &c);
+    REQUIRE(Values(list) == std::vector<int>{1, 3});
+    REQUIRE(!b.hook.is_linked());
+
+    list.erase(list.begin());
+    REQUIRE(Values(list) == std::vector<int>{3});
+
+    // Reverse iteration from end()
+    REQUIRE(&*--list.end() == &c);
+
+    list.clear();
+    REQUIRE(list.empty());
+    REQUIRE(!c.hook.is_linked());
+}
+
+TEST_CASE("An object can be in multiple lists", "[intrusive_list]")
+{
+    Node a{1}, b{2};
+    List list;
+    OtherList other;
+
+    list.push_back(a);
+    list.push_back(b);
+    other.push_back(b);
+    other.push_back(a);
+
+    REQUIRE(Values(list) == std::vector<int>{1, 2});
+    REQUIRE(Values(other) == std::vector<int>{2, 1});
+
+    list.clear();
+    other.clear();
+}
+
+TEST_CASE("Splice", "[intrusive_list]")
+{
+    Node a{1}, b{2}, c{3};
+    List list;
+    List other;
+
+    list.push_back(a);
+    other.push_back(b);
+    other.push_back(c);
+
+    list.splice_back(other);
+    REQUIRE(Values(list) == std::vector<int>{1, 2, 3});
+    REQUIRE(list.size() == 3);
+    REQUIRE(other.empty());
+
+    list.clear();
+}
+
+TEST_CASE("Random operations against std::list", "[intrusive_list]")
+{
+    std::mt19937 random(42);
+    std::vector<Node> nodes(100);
+    for (int i = 0; i != 100; ++i)
+        nodes[i].value = i;
+
+    List list;
+    std::list<int> expected;
+
+    for (int i = 0; i != 10000; ++i)
+    {
+        auto& node = nodes[random() % nodes.size()];
+        if (node.hook.is_linked())
+        {
+            list.erase(node);
+            expected.remove(node.value);
+        }
+        else if (random() % 2)
+        {
+            list.push_front(node);
+            expected.push_front(node.value);
+        }
+        else
+        {
+            list.push_back(node);
+            expected.push_back(node.value);
+        }
+
+        REQUIRE(list.size() == expected.size());
+    }
+
+    REQUIRE(Values(list) == std::vector<int>(expected.begin(), expected.end()));
+    list.clear();
+}
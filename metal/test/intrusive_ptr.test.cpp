@@ -0,0 +1,175 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <metal/intrusive_ptr.hpp>
+#include <unittest.hpp>
+
+namespace
+{
+    int g_destroyed = 0;
+
+    struct Object : mtl::ref_counted<Object>
+    {
+        explicit Object(int value = 0) : value(value) {}
+        ~Object() { ++g_destroyed; }
+
+        int value;
+    };
+
+    struct Derived : Object
+    {
+        using Object::Object;
+    };
+
+    struct LocalObject : mtl::local_ref_counted<LocalObject>
+    {
+        ~LocalObject() { ++g_destroyed; }
+    };
+} // namespace
+
+TEST_CASE("intrusive_ptr - Constructor", "[intrusive_ptr]")
+{
+    g_destroyed = 0;
+
+    SECTION("Default")
+    {
+        mtl::intrusive_ptr<Object> x;
+        REQUIRE(!x);
+        REQUIRE(x == nullptr);
+    }
+
+    SECTION("with pointer")
+    {
+        {
+            mtl::intrusive_ptr<Object> x(new Object{123});
+            REQUIRE(x);
+            REQUIRE(x->value == 123);
+            REQUIRE(x->use_count() == 1);
+        }
+        REQUIRE(g_destroyed == 1);
+    }
+
+    SECTION("without adding a reference")
+    {
+        auto p = new Object;
+        mtl::intrusive_ptr<Object> x(p);
+        mtl::intrusive_ptr<Object> y(x.detach(), false);
+        REQUIRE(!x);
+        REQUIRE(y.get() == p);
+        REQUIRE(p->use_count() == 1);
+    }
+
+    SECTION("make_intrusive")
+    {
+        auto x = mtl::make_intrusive<Object>(7);
+        REQUIRE(x->value == 7);
+        REQUIRE(x->use_count() == 1);
+    }
+}
+
+TEST_CASE("intrusive_ptr - Copy and move", "[intrusive_ptr]")
+{
+    g_destroyed = 0;
+
+    {
+        auto x = mtl::make_intrusive<Object>();
+        auto y = x;
+        REQUIRE(x == y);
+        REQUIRE(x->use_count() == 2);
+
+        auto z = std::move(y);
+        REQUIRE(!y);
+        REQUIRE(z == x);
+        REQUIRE(x->use_count() == 2);
+
+        z = mtl::make_intrusive<Object>();
+        REQUIRE(x->use_count() == 1);
+        REQUIRE(z->use_count() == 1);
+
+        z = x;
+        REQUIRE(g_destroyed == 1);
+        REQUIRE(x->use_count() == 2);
+
+        x.reset();
+        REQUIRE(!x);
+        REQUIRE(z->use_count() == 1);
+    }
+
+    REQUIRE(g_destroyed == 2);
+}
+
+TEST_CASE("intrusive_ptr - Conversions", "[intrusive_ptr]")
+{
+    g_destroyed = 0;
+
+    {
+        auto derived = mtl::make_intrusive<Derived>(5);
+        mtl::intrusive_ptr<Object> base = derived;
+        REQUIRE(base == derived);
+        REQUIRE(base->use_count() == 2);
+
+        mtl::intrusive_ptr<Object> moved = std::move(derived);
+        REQUIRE(!derived);
+        REQUIRE(moved->value == 5);
+        REQUIRE(moved->use_count() == 2);
+    }
+
+    REQUIRE(g_destroyed == 1);
+}
+
+TEST_CASE("intrusive_ptr - Rebuild from raw pointer", "[intrusive_ptr]")
+{
+    g_destroyed = 0;
+
+    mtl::intrusive_ptr<Object> owner = mtl::make_intrusive<Object>();
+    Object& object = *owner;
+
+    mtl::intrusive_ptr<Object> other(&object);
+    REQUIRE(other == owner);
+    REQUIRE(object.use_count() == 2);
+
+    owner.reset();
+    REQUIRE(g_destroyed == 0);
+    REQUIRE(other->use_count() == 1);
+
+    other.reset();
+    REQUIRE(g_destroyed == 1);
+}
+
+TEST_CASE("intrusive_ptr - Local reference count", "[intrusive_ptr]")
+{
+    g_destroyed = 0;
+
+    {
+        auto x = mtl::make_intrusive<LocalObject>();
+        auto y = x;
+        REQUIRE(x->use_count() == 2);
+        y.reset();
+        REQUIRE(x->use_count() == 1);
+    }
+
+    REQUIRE(g_destroyed == 1);
+}
@@ -0,0 +1,344 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <metal/lz4.hpp>
+#include <unittest.hpp>
+#include <unordered_map>
+#include <vector>
+
+using namespace mtl;
+
+using Buffer = std::vector<uint8_t>;
+
+static uint32_t Read32(const Buffer& data, size_t position)
+{
+    uint32_t value;
+    memcpy(&value, &data[position], sizeof(value));
+    return value;
+}
+
+static void Write32(Buffer& buffer, uint32_t value)
+{
+    for (int i = 0; i != 4; ++i)
+        buffer.push_back(value >> (8 * i));
+}
+
+static void WriteLength(Buffer& buffer, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        buffer.push_back(255);
+    buffer.push_back(length);
+}
+
+static void WriteSequence(Buffer& buffer, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    const size_t matchCode = matchLength ? matchLength - 4 : 0;
+    buffer.push_back((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15));
+    if (literalLength >= 15)
+        WriteLength(buffer, literalLength - 15);
+    buffer.insert(buffer.end(), literals, literals + literalLength);
+
+    if (matchLength)
+    {
+        buffer.push_back(offset);
+        buffer.push_back(offset >> 8);
+        if (matchCode >= 15)
+            WriteLength(buffer, matchCode - 15);
+    }
+}
+
+// Greedy LZ4 block compressor, good enough to generate test data. Matches can reference data starting at
+// 'windowStart', which is before 'begin' for linked blocks.
+static Buffer CompressBlock(const Buffer& content, size_t begin, size_t end, size_t windowStart)
+{
+    Buffer block;
+    std::unordered_map<uint32_t, size_t> table;
+    for (size_t i = windowStart; i + 4 <= begin; ++i)
+        table[Read32(content, i)] = i;
+
+    // The last 5 bytes are always literals and the last match starts at least 12 bytes before the end
+    size_t anchor = begin;
+    size_t position = begin;
+    while (position + 12 < end)
+    {
+        const auto sequence = Read32(content, position);
+        const auto it = table.find(sequence);
+        const bool found = it != table.end() && position - it->second <= 65535;
+        const size_t match = found ? it->second : 0;
+        table[sequence] = position;
+
+        if (!found)
+        {
+            ++position;
+            continue;
+        }
+
+        size_t length = 4;
+        while (position + length < end - 5 && content[match + length] == content[position + length])
+            ++length;
+
+        WriteSequence(block, &content[anchor], position - anchor, position - match, length);
+        position += length;
+        anchor = position;
+    }
+
+    WriteSequence(block, content.data() + anchor, end - anchor, 0, 0);
+
+    return block;
+}
+
+struct FrameOptions
+{
+    int blockSizeId = 4; // 64 KB
+    bool linked = false;
+    bool checksums = false;
+};
+
+static Buffer CompressFrame(const Buffer& content, const FrameOptions& options = {})
+{
+    Buffer frame;
+    Write32(frame, Lz4FrameDecoder::kMagic);
+    frame.push_back(0x40 | (options.linked ? 0 : 0x20) | (options.checksums ? 0x14 : 0) | 0x08);
+    frame.push_back(options.blockSizeId << 4);
+    Write32(frame, content.size());
+    Write32(frame, uint64_t(content.size()) >> 32);
+    frame.push_back(0); // Header checksum, not verified
+
+    const size_t blockSize = size_t(1) << (8 + 2 * options.blockSizeId);
+    for (size_t begin = 0; begin < content.size(); begin += blockSize)
+    {
+        const size_t end = std::min(begin + blockSize, content.size());
+        const auto block = CompressBlock(content, begin, end, options.linked ? 0 : begin);
+
+        // Incompressible blocks are stored as-is
+        if (block.size() >= end - begin)
+        {
+            Write32(frame, (end - begin) | 0x80000000u);
+            frame.insert(frame.end(), content.begin() + begin, content.begin() + end);
+        }
+        else
+        {
+            Write32(frame, block.size());
+            frame.insert(frame.end(), block.begin(), block.end());
+        }
+
+        if (options.checksums)
+            Write32(frame, 0);
+    }
+
+    Write32(frame, 0);
+    if (options.checksums)
+        Write32(frame, 0);
+
+    return frame;
+}
+
+// Decompress the way the boot loader does it: read chunks, keep what wasn't consumed for the next round
+static expected<Buffer, Lz4Error> Decompress(const Buffer& frame, size_t chunkSize)
+{
+    auto info = Lz4FrameDecoder::ParseHeader(frame.data(), frame.size());
+    if (!info)
+        return unexpected(info.error());
+
+    Buffer output(info->contentSize);
+    Lz4FrameDecoder decoder(*info, output.data(), output.size());
+
+    Buffer pending;
+    size_t position = info->headerSize;
+    while (!decoder.IsFinished())
+    {
+        const size_t count = std::min(chunkSize, frame.size() - position);
+        pending.insert(pending.end(), frame.begin() + position, frame.begin() + position + count);
+        position += count;
+
+        auto consumed = decoder.Decode(pending.data(), pending.size());
+        if (!consumed)
+            return unexpected(consumed.error());
+
+        pending.erase(pending.begin(), pending.begin() + *consumed);
+
+        // Truncated frame
+        if (count == 0 && *consumed == 0)
+            return unexpected(Lz4Error::InvalidData);
+    }
+
+    REQUIRE(decoder.GetOutputSize() == output.size());
+
+    return output;
+}
+
+// Text-like data with plenty of repetitions, mixed with noise
+static Buffer MakeContent(size_t size)
+{
+    static const char* const kWords[] = {"rainbow ", "kernel ", "boot ", "loader ", "page ", "table ", "module "};
+
+    Buffer content;
+    uint32_t seed = 12345;
+    while (content.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 5 == 0)
+        {
+            for (int i = 0; i != 16; ++i)
+                content.push_back(seed >> (i % 24));
+        }
+        else
+        {
+            const char* word = kWords[(seed >> 16) % 7];
+            content.insert(content.end(), word, word + strlen(word));
+        }
+    }
+
+    content.resize(size);
+    return content;
+}
+
+TEST_CASE("Lz4FrameDecoder - Round trip", "[lz4]")
+{
+    FrameOptions options;
+    options.linked = GENERATE(false, true);
+    options.checksums = GENERATE(false, true);
+
+    const auto content = MakeContent(300 * 1024);
+    const auto frame = CompressFrame(content, options);
+    REQUIRE(frame.size() < content.size());
+
+    const size_t chunkSize = GENERATE(1, 7, 4096, 65536 + 8, 1024 * 1024);
+    auto output = Decompress(frame, chunkSize);
+    REQUIRE(output);
+    REQUIRE(*output == content);
+}
+
+TEST_CASE("Lz4FrameDecoder - Overlapping matches", "[lz4]")
+{
+    // Runs of a single byte, then of a 3 bytes pattern
+    Buffer content(1000, 'a');
+    for (int i = 0; i != 900; ++i)
+        content.push_back("xyz"[i % 3]);
+
+    auto output = Decompress(CompressFrame(content), 64);
+    REQUIRE(output);
+    REQUIRE(*output == content);
+}
+
+TEST_CASE("Lz4FrameDecoder - Incompressible data", "[lz4]")
+{
+    Buffer content;
+    uint32_t seed = 1;
+    for (int i = 0; i != 100000; ++i)
+    {
+        seed = seed * 1664525 + 1013904223;
+        content.push_back(seed >> 24);
+    }
+
+    auto output = Decompress(CompressFrame(content), 4096);
+    REQUIRE(output);
+    REQUIRE(*output == content);
+}
+
+TEST_CASE("Lz4FrameDecoder - Headers", "[lz4]")
+{
+    const auto frame = CompressFrame(MakeContent(1000));
+
+    SECTION("Valid header")
+    {
+        REQUIRE(Lz4FrameDecoder::IsFrame(frame.data(), frame.size()));
+        auto info = Lz4FrameDecoder::ParseHeader(frame.data(), frame.size());
+        REQUIRE(info);
+        REQUIRE(info->contentSize == 1000);
+        REQUIRE(info->maxBlockSize == 64 * 1024);
+        REQUIRE(info->headerSize == 15);
+    }
+
+    SECTION("Not a frame")
+    {
+        const char text[] = "\x7F" "ELF and some more";
+        REQUIRE(!Lz4FrameDecoder::IsFrame(text, sizeof(text)));
+        REQUIRE(Lz4FrameDecoder::ParseHeader(text, sizeof(text)).error() == Lz4Error::InvalidData);
+    }
+
+    SECTION("Truncated header")
+    {
+        REQUIRE(Lz4FrameDecoder::ParseHeader(frame.data(), 10).error() == Lz4Error::InvalidData);
+    }
+
+    SECTION("Bad version")
+    {
+        auto bad = frame;
+        bad[4] = (bad[4] & 0x3F) | 0x80;
+        REQUIRE(Lz4FrameDecoder::ParseHeader(bad.data(), bad.size()).error() == Lz4Error::InvalidData);
+    }
+
+    SECTION("Missing content size")
+    {
+        auto bad = frame;
+        bad[4] &= ~0x08;
+        REQUIRE(Lz4FrameDecoder::ParseHeader(bad.data(), bad.size()).error() == Lz4Error::Unsupported);
+    }
+}
+
+TEST_CASE("Lz4FrameDecoder - Corrupted data", "[lz4]")
+{
+    const auto content = MakeContent(5000);
+
+    SECTION("Content size mismatch")
+    {
+        auto bad = CompressFrame(content);
+        bad[6] -= 1;
+        REQUIRE(Decompress(bad, 4096).error() == Lz4Error::OutputTooSmall);
+
+        bad[6] += 2;
+        REQUIRE(Decompress(bad, 4096).error() == Lz4Error::InvalidData);
+    }
+
+    SECTION("Match before the start of the output")
+    {
+        Buffer block;
+        const uint8_t literals[] = {'a', 'b', 'c', 'd'};
+        WriteSequence(block, literals, 4, 5, 4);
+        WriteSequence(block, literals, 4, 0, 0);
+
+        Buffer bad;
+        Write32(bad, Lz4FrameDecoder::kMagic);
+        bad.insert(bad.end(), {0x68, 0x40});
+        Write32(bad, 12);
+        Write32(bad, 0);
+        bad.push_back(0);
+        Write32(bad, block.size());
+        bad.insert(bad.end(), block.begin(), block.end());
+        Write32(bad, 0);
+
+        REQUIRE(Decompress(bad, 4096).error() == Lz4Error::InvalidData);
+    }
+
+    SECTION("Truncated frame")
+    {
+        auto bad = CompressFrame(content);
+        bad.resize(bad.size() - 10);
+        REQUIRE(Decompress(bad, 4096).error() == Lz4Error::InvalidData);
+    }
+}
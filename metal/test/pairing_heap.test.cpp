@@ -0,0 +1,136 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <metal/pairing_heap.hpp>
+#include <random>
+#include <set>
+#include <unittest.hpp>
+#include <vector>
+
+namespace
+{
+    struct Timer
+    {
+        int deadline;
+        int id;
+        mtl::heap_hook hook{};
+        bool queued{false};
+    };
+
+    struct CompareTimer
+    {
+        bool operator()(const Timer& a, const Timer& b) const { return a.deadline < b.deadline; }
+    };
+
+    using Heap = mtl::pairing_heap<Timer, &Timer::hook, CompareTimer>;
+} // namespace
+
+TEST_CASE("Empty heap", "[pairing_heap]")
+{
+    Heap heap;
+    REQUIRE(heap.empty());
+    REQUIRE(heap.size() == 0);
+}
+
+TEST_CASE("Heap sort", "[pairing_heap]")
+{
+    std::mt19937 random(1234);
+    std::vector<Timer> timers(1000);
+    for (int i = 0; i != 1000; ++i)
+        timers[i] = {int(random() % 100), i};
+
+    Heap heap;
+    for (auto& timer : timers)
+        heap.push(timer);
+
+    REQUIRE(heap.size() == 1000);
+
+    int last = -1;
+    while (!heap.empty())
+    {
+        const auto& top = heap.top();
+        REQUIRE(top.deadline >= last);
+        last = top.deadline;
+        heap.pop();
+    }
+}
+
+TEST_CASE("Random operations against std::multiset", "[pairing_heap]")
+{
+    std::mt19937 random(5678);
+    std::vector<Timer> timers(200);
+    for (int i = 0; i != 200; ++i)
+        timers[i].id = i;
+
+    Heap heap;
+    std::multiset<std::pair<int, int>> expected; // (deadline, id)
+
+    for (int i = 0; i != 50000; ++i)
+    {
+        auto& timer = timers[random() % timers.size()];
+        const int operation = random() % 5;
+
+        if (!timer.queued)
+        {
+            timer.deadline = random() % 1000;
+            heap.push(timer);
+            expected.emplace(timer.deadline, timer.id);
+            timer.queued = true;
+        }
+        else if (operation == 0)
+        {
+            heap.erase(timer);
+            expected.erase({timer.deadline, timer.id});
+            timer.queued = false;
+        }
+        else if (operation == 1)
+        {
+            expected.erase({timer.deadline, timer.id});
+            timer.deadline -= random() % 100;
+            heap.decrease(timer);
+            expected.emplace(timer.deadline, timer.id);
+        }
+        else if (operation == 2)
+        {
+            expected.erase({timer.deadline, timer.id});
+            timer.deadline = random() % 1000;
+            heap.update(timer);
+            expected.emplace(timer.deadline, timer.id);
+        }
+        else if (!heap.empty())
+        {
+            auto& top = heap.top();
+            REQUIRE(top.deadline == expected.begin()->first);
+            heap.pop();
+            expected.erase({top.deadline, top.id});
+            top.queued = false;
+        }
+
+        REQUIRE(heap.size() == expected.size());
+        if (!heap.empty())
+            REQUIRE(heap.top().deadline == expected.begin()->first);
+    }
+}
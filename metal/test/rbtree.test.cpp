@@ -0,0 +1,201 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <metal/rbtree.hpp>
+#include <random>
+#include <unittest.hpp>
+#include <vector>
+
+namespace
+{
+    struct Node
+    {
+        int key;
+        mtl::rbtree_hook hook{};
+        int count{1}; // Number of nodes in this subtree
+        int maxKey{0};
+    };
+
+    struct CompareNode
+    {
+        bool operator()(const Node& a, const Node& b) const { return a.key < b.key; }
+    };
+
+    struct AugmentNode
+    {
+        void operator()(Node& node, const Node* left, const Node* right) const
+        {
+            node.count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+            node.maxKey = right ? right->maxKey : node.key;
+        }
+    };
+
+    using Tree = mtl::rbtree<Node, &Node::hook, CompareNode, AugmentNode>;
+
+    // Returns the black height of the subtree, checking the red-black and augmented invariants on the way
+    int Validate(const Node* node, const Node* parent)
+    {
+        if (!node)
+            return 1;
+
+        REQUIRE(Tree::parent(*node) == parent);
+
+        const auto left = Tree::left(*node);
+        const auto right = Tree::right(*node);
+
+        if (node->hook.red)
+        {
+            REQUIRE((!left || !left->hook.red));
+            REQUIRE((!right || !right->hook.red));
+        }
+
+        if (left)
+            REQUIRE(left->key <= node->key);
+        if (right)
+            REQUIRE(right->key >= node->key);
+
+        REQUIRE(node->count == 1 + (left ? left->count : 0) + (right ? right->count : 0));
+        REQUIRE(node->maxKey == (right ? right->maxKey : node->key));
+
+        const auto leftHeight = Validate(left, node);
+        const auto rightHeight = Validate(right, node);
+        REQUIRE(leftHeight == rightHeight);
+
+        return leftHeight + (node->hook.red ? 0 : 1);
+    }
+
+    void Validate(const Tree& tree)
+    {
+        if (tree.root())
+        {
+            REQUIRE(!tree.root()->hook.red);
+            REQUIRE(tree.root()->count == static_cast<int>(tree.size()));
+        }
+        Validate(tree.root(), nullptr);
+    }
+} // namespace
+
+TEST_CASE("rbtree - Empty", "[rbtree]")
+{
+    Tree tree;
+    REQUIRE(tree.empty());
+    REQUIRE(tree.size() == 0);
+    REQUIRE(tree.begin() == tree.end());
+    REQUIRE(tree.root() == nullptr);
+}
+
+TEST_CASE("rbtree - Insert and erase", "[rbtree]")
+{
+    std::vector<Node> nodes;
+    for (int i = 0; i < 1000; ++i)
+        nodes.push_back(Node{.key = i});
+
+    std::mt19937 random(1234);
+    std::shuffle(nodes.begin(), nodes.end(), random);
+
+    Tree tree;
+    for (auto& node : nodes)
+        tree.insert(node);
+
+    REQUIRE(tree.size() == nodes.size());
+    Validate(tree);
+
+    SECTION("Iteration is ordered")
+    {
+        int expected = 0;
+        for (const auto& node : tree)
+            REQUIRE(node.key == expected++);
+        REQUIRE(expected == 1000);
+
+        auto it = tree.end();
+        for (int i = 999; i >= 0; --i)
+            REQUIRE((--it)->key == i);
+        REQUIRE(it == tree.begin());
+    }
+
+    SECTION("Erase")
+    {
+        // Nodes are linked in the tree, shuffle pointers to them
+        std::vector<Node*> order;
+        for (auto& node : nodes)
+            order.push_back(&node);
+        std::shuffle(order.begin(), order.end(), random);
+
+        for (size_t i = 0; i != order.size(); ++i)
+        {
+            tree.erase(*order[i]);
+            if (i % 37 == 0)
+                Validate(tree);
+        }
+
+        REQUIRE(tree.empty());
+        REQUIRE(tree.begin() == tree.end());
+    }
+
+    SECTION("partition_point")
+    {
+        REQUIRE(tree.partition_point([](const Node& node) { return node.key < 500; })->key == 500);
+        REQUIRE(tree.partition_point([](const Node& node) { return node.key < 0; })->key == 0);
+        REQUIRE(tree.partition_point([](const Node& node) { return node.key < 1000; }) == nullptr);
+    }
+}
+
+TEST_CASE("rbtree - Duplicate keys", "[rbtree]")
+{
+    Node nodes[] = {{.key = 1}, {.key = 2}, {.key = 1}, {.key = 2}, {.key = 1}};
+
+    Tree tree;
+    for (auto& node : nodes)
+        tree.insert(node);
+
+    Validate(tree);
+
+    // Equal keys keep their insertion order
+    const Node* expected[] = {&nodes[0], &nodes[2], &nodes[4], &nodes[1], &nodes[3]};
+    int i = 0;
+    for (const auto& node : tree)
+        REQUIRE(&node == expected[i++]);
+
+    tree.erase(nodes[2]);
+    Validate(tree);
+    REQUIRE(Tree::next(nodes[0]) == &nodes[4]);
+    REQUIRE(Tree::prev(nodes[1]) == &nodes[4]);
+}
+
+TEST_CASE("rbtree - Update", "[rbtree]")
+{
+    Node nodes[] = {{.key = 10}, {.key = 20}, {.key = 30}};
+
+    Tree tree;
+    for (auto& node : nodes)
+        tree.insert(node);
+
+    nodes[2].key = 25;
+    tree.update(nodes[2]);
+    Validate(tree);
+    REQUIRE(tree.root()->maxKey == 25);
+}
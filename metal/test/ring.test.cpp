@@ -0,0 +1,262 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <metal/ring.hpp>
+#include <thread>
+#include <unittest.hpp>
+#include <vector>
+
+namespace
+{
+    struct Tracked
+    {
+        static inline int s_count = 0;
+
+        Tracked(int v = 0) : value(v) { ++s_count; }
+        Tracked(const Tracked& other) : value(other.value) { ++s_count; }
+        Tracked& operator=(const Tracked& other) = default;
+        ~Tracked() { --s_count; }
+
+        int value;
+    };
+
+    template <typename Ring>
+    void TestSingleThreaded()
+    {
+        Ring ring;
+        REQUIRE(ring.empty());
+
+        int value = -1;
+        REQUIRE(!ring.try_pop(value));
+
+        // Fill, checking wrap around on later rounds
+        for (int round = 0; round != 3; ++round)
+        {
+            for (int i = 0; i != (int)Ring::capacity(); ++i)
+                REQUIRE(ring.try_push(i));
+
+            REQUIRE(!ring.try_push(-1));
+            REQUIRE(ring.size() == Ring::capacity());
+
+            for (int i = 0; i != (int)Ring::capacity(); ++i)
+            {
+                REQUIRE(ring.try_pop(value));
+                REQUIRE(value == i);
+            }
+
+            REQUIRE(!ring.try_pop(value));
+            REQUIRE(ring.empty());
+
+            // Offset the indices for the next round
+            REQUIRE(ring.try_push(42));
+            REQUIRE(ring.try_pop(value));
+        }
+    }
+
+    template <typename Ring>
+    void TestLeftoversAreDestroyed()
+    {
+        {
+            Ring ring;
+            for (int i = 0; i != 5; ++i)
+                REQUIRE(ring.try_push(Tracked(i)));
+
+            Tracked value;
+            REQUIRE(ring.try_pop(value));
+            REQUIRE(value.value == 0);
+            REQUIRE(Tracked::s_count == 5);
+        }
+
+        REQUIRE(Tracked::s_count == 0);
+    }
+
+    // Each producer pushes (producer, sequence) pairs, consumers check that every element is seen exactly once and
+    // that elements from a given producer come out in order.
+    template <template <typename, std::size_t> class Ring>
+    void StressTest(int producerCount, int consumerCount, int countPerProducer)
+    {
+        const auto ring = std::make_unique<Ring<uint64_t, 1024>>();
+        std::vector<std::atomic<int>> seen(producerCount * countPerProducer);
+        std::atomic<int> consumed{0};
+        std::atomic<bool> orderError{false};
+
+        std::vector<std::thread> threads;
+        for (int p = 0; p != producerCount; ++p)
+        {
+            threads.emplace_back([&, p] {
+                for (int i = 0; i != countPerProducer; ++i)
+                {
+                    const auto value = (uint64_t(p) << 32) | i;
+                    while (!ring->try_push(value))
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        const int total = producerCount * countPerProducer;
+        for (int c = 0; c != consumerCount; ++c)
+        {
+            threads.emplace_back([&] {
+                std::vector<int> last(producerCount, -1);
+                uint64_t value;
+                while (consumed.load() != total)
+                {
+                    if (!ring->try_pop(value))
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    const int producer = value >> 32;
+                    const int sequence = value & 0xFFFFFFFF;
+                    if (sequence <= last[producer])
+                        orderError = true;
+                    last[producer] = sequence;
+
+                    seen[producer * countPerProducer + sequence]++;
+                    consumed++;
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        REQUIRE(!orderError);
+        REQUIRE(consumed == total);
+        for (const auto& count : seen)
+            REQUIRE(count == 1);
+        REQUIRE(ring->empty());
+    }
+} // namespace
+
+TEST_CASE("spsc_ring basics", "[ring]")
+{
+    TestSingleThreaded<mtl::spsc_ring<int, 8>>();
+    TestLeftoversAreDestroyed<mtl::spsc_ring<Tracked, 8>>();
+}
+
+TEST_CASE("mpsc_ring basics", "[ring]")
+{
+    TestSingleThreaded<mtl::mpsc_ring<int, 8>>();
+    TestLeftoversAreDestroyed<mtl::mpsc_ring<Tracked, 8>>();
+}
+
+TEST_CASE("mpmc_ring basics", "[ring]")
+{
+    TestSingleThreaded<mtl::mpmc_ring<int, 8>>();
+    TestLeftoversAreDestroyed<mtl::mpmc_ring<Tracked, 8>>();
+}
+
+TEST_CASE("Indices live on separate cache lines", "[ring]")
+{
+    mtl::spsc_ring<int, 8> spsc;
+    const auto base = reinterpret_cast<uintptr_t>(&spsc);
+    REQUIRE(base % mtl::kCacheLineSize == 0);
+    REQUIRE(sizeof(spsc) >= 3 * mtl::kCacheLineSize);
+
+    static_assert(alignof(mtl::mpmc_ring<int, 8>) == mtl::kCacheLineSize);
+}
+
+TEST_CASE("spsc_ring stress", "[ring]")
+{
+    StressTest<mtl::spsc_ring>(1, 1, 1000000);
+}
+
+TEST_CASE("mpsc_ring stress", "[ring]")
+{
+    StressTest<mtl::mpsc_ring>(4, 1, 250000);
+}
+
+TEST_CASE("mpmc_ring stress", "[ring]")
+{
+    StressTest<mtl::mpmc_ring>(4, 4, 250000);
+}
+
+// Run with: metal_tests "[benchmark]"
+TEST_CASE("ring benchmark", "[.][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+
+    const auto run = [](const char* name, auto& ring, int producerCount, int consumerCount) {
+        const int countPerProducer = 10000000 / producerCount;
+        const int total = countPerProducer * producerCount;
+        std::atomic<int> consumed{0};
+
+        const auto start = Clock::now();
+
+        std::vector<std::thread> threads;
+        for (int p = 0; p != producerCount; ++p)
+        {
+            threads.emplace_back([&] {
+                for (int i = 0; i != countPerProducer; ++i)
+                {
+                    while (!ring.try_push(i))
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        for (int c = 0; c != consumerCount; ++c)
+        {
+            threads.emplace_back([&] {
+                int value;
+                while (consumed.load(std::memory_order_relaxed) < total)
+                {
+                    if (ring.try_pop(value))
+                        consumed.fetch_add(1, std::memory_order_relaxed);
+                    else
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        printf("%-24s %dP/%dC: %6.1f M items/s\n", name, producerCount, consumerCount, total / seconds / 1e6);
+    };
+
+    {
+        const auto ring = std::make_unique<mtl::spsc_ring<int, 4096>>();
+        run("spsc_ring", *ring, 1, 1);
+    }
+    {
+        const auto ring = std::make_unique<mtl::mpsc_ring<int, 4096>>();
+        run("mpsc_ring", *ring, 1, 1);
+        run("mpsc_ring", *ring, 4, 1);
+    }
+    {
+        const auto ring = std::make_unique<mtl::mpmc_ring<int, 4096>>();
+        run("mpmc_ring", *ring, 1, 1);
+        run("mpmc_ring", *ring, 4, 4);
+    }
+}
@@ -0,0 +1,283 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <metal/sort.hpp>
+#include <random>
+#include <unittest.hpp>
+#include <vector>
+
+namespace
+{
+    using Pattern = std::function<std::vector<int>(size_t size, std::mt19937& random)>;
+
+    const std::pair<const char*, Pattern> kPatterns[] = {
+        {"random",
+         [](size_t size, std::mt19937& random) {
+             std::vector<int> data(size);
+             for (auto& value : data)
+                 value = random();
+             return data;
+         }},
+        {"few unique",
+         [](size_t size, std::mt19937& random) {
+             std::vector<int> data(size);
+             for (auto& value : data)
+                 value = random() % 4;
+             return data;
+         }},
+        {"all equal", [](size_t size, std::mt19937&) { return std::vector<int>(size, 42); }},
+        {"sorted",
+         [](size_t size, std::mt19937&) {
+             std::vector<int> data(size);
+             for (size_t i = 0; i != size; ++i)
+                 data[i] = i;
+             return data;
+         }},
+        {"reversed",
+         [](size_t size, std::mt19937&) {
+             std::vector<int> data(size);
+             for (size_t i = 0; i != size; ++i)
+                 data[i] = size - i;
+             return data;
+         }},
+        {"organ pipe",
+         [](size_t size, std::mt19937&) {
+             std::vector<int> data(size);
+             for (size_t i = 0; i != size; ++i)
+                 data[i] = std::min(i, size - i);
+             return data;
+         }},
+        {"sawtooth",
+         [](size_t size, std::mt19937&) {
+             std::vector<int> data(size);
+             for (size_t i = 0; i != size; ++i)
+                 data[i] = i % 32;
+             return data;
+         }},
+        {"sorted with noise",
+         [](size_t size, std::mt19937& random) {
+             std::vector<int> data(size);
+             for (size_t i = 0; i != size; ++i)
+                 data[i] = i;
+             for (size_t i = 0; i < size / 100 + 1 && size > 0; ++i)
+                 std::swap(data[random() % size], data[random() % size]);
+             return data;
+         }},
+    };
+
+    const size_t kSizes[] = {0, 1, 2, 3, 10, 23, 24, 25, 100, 128, 129, 1000, 10000};
+
+    // Comparisons needed to sort n elements shouldn't be much more than n log2(n)
+    size_t MaxComparisons(size_t size)
+    {
+        size_t log = 1;
+        while ((size_t{1} << log) < size)
+            ++log;
+        return 4 * size * log + 100;
+    }
+} // namespace
+
+TEST_CASE("sort", "[sort]")
+{
+    std::mt19937 random(1234);
+
+    for (const auto& [name, pattern] : kPatterns)
+    {
+        for (const auto size : kSizes)
+        {
+            INFO(name << ", size " << size);
+
+            auto data = pattern(size, random);
+            auto expected = data;
+            std::sort(expected.begin(), expected.end());
+
+            size_t comparisons = 0;
+            mtl::sort(data.begin(), data.end(), [&](int a, int b) {
+                ++comparisons;
+                return a < b;
+            });
+
+            REQUIRE(data == expected);
+            REQUIRE(comparisons <= MaxComparisons(size));
+        }
+    }
+}
+
+TEST_CASE("sort - median of 3 killer", "[sort]")
+{
+    // Musser's sequence that makes a median of 3 quicksort go quadratic
+    const int size = 10000;
+    const int k = size / 2;
+    std::vector<int> data(size);
+    for (int i = 1; i <= k; ++i)
+    {
+        data[i - 1] = (i % 2) ? i : k + i - 1;
+        data[k + i - 1] = 2 * i;
+    }
+
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    size_t comparisons = 0;
+    mtl::sort(data.begin(), data.end(), [&](int a, int b) {
+        ++comparisons;
+        return a < b;
+    });
+
+    REQUIRE(data == expected);
+    REQUIRE(comparisons <= MaxComparisons(size));
+}
+
+TEST_CASE("stable_sort", "[sort]")
+{
+    struct Item
+    {
+        int key;
+        size_t index;
+    };
+
+    std::mt19937 random(5678);
+
+    for (const auto& [name, pattern] : kPatterns)
+    {
+        for (const auto size : kSizes)
+        {
+            INFO(name << ", size " << size);
+
+            const auto keys = pattern(size, random);
+            std::vector<Item> data(size);
+            for (size_t i = 0; i != size; ++i)
+                data[i] = {keys[i] % 16, i};
+
+            auto expected = data;
+            std::stable_sort(expected.begin(), expected.end(), [](const Item& a, const Item& b) { return a.key < b.key; });
+
+            mtl::stable_sort(data.begin(), data.end(), [](const Item& a, const Item& b) { return a.key < b.key; });
+
+            for (size_t i = 0; i != size; ++i)
+            {
+                REQUIRE(data[i].key == expected[i].key);
+                REQUIRE(data[i].index == expected[i].index);
+            }
+        }
+    }
+}
+
+TEST_CASE("partial_sort", "[sort]")
+{
+    std::mt19937 random(91011);
+
+    for (const auto& [name, pattern] : kPatterns)
+    {
+        for (const auto size : kSizes)
+        {
+            for (const auto count : {size_t{0}, std::min<size_t>(1, size), size / 3, size})
+            {
+                INFO(name << ", size " << size << ", count " << count);
+
+                auto data = pattern(size, random);
+                auto expected = data;
+                std::sort(expected.begin(), expected.end());
+
+                mtl::partial_sort(data.begin(), data.begin() + count, data.end());
+
+                REQUIRE(std::equal(data.begin(), data.begin() + count, expected.begin()));
+                std::sort(data.begin(), data.end());
+                REQUIRE(data == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE("nth_element", "[sort]")
+{
+    std::mt19937 random(121314);
+
+    for (const auto& [name, pattern] : kPatterns)
+    {
+        for (const auto size : kSizes)
+        {
+            if (size == 0)
+                continue;
+
+            for (const auto n : {size_t{0}, size / 2, size - 1, size_t(random() % size)})
+            {
+                INFO(name << ", size " << size << ", n " << n);
+
+                auto data = pattern(size, random);
+                auto expected = data;
+                std::sort(expected.begin(), expected.end());
+
+                size_t comparisons = 0;
+                mtl::nth_element(data.begin(), data.begin() + n, data.end(), [&](int a, int b) {
+                    ++comparisons;
+                    return a < b;
+                });
+
+                REQUIRE(data[n] == expected[n]);
+                for (size_t i = 0; i != n; ++i)
+                    REQUIRE(data[i] <= data[n]);
+                for (size_t i = n + 1; i != size; ++i)
+                    REQUIRE(data[n] <= data[i]);
+                REQUIRE(comparisons <= MaxComparisons(size));
+            }
+        }
+    }
+}
+
+// Run with: metal_tests "[benchmark]"
+TEST_CASE("sort benchmark", "[.][benchmark]")
+{
+    using Clock = std::chrono::steady_clock;
+
+    const size_t size = 1000000;
+    std::mt19937 random(1);
+
+    const auto measure = [](std::vector<int> data, auto&& sort) {
+        const auto start = Clock::now();
+        sort(data.begin(), data.end());
+        const auto end = Clock::now();
+        REQUIRE(std::is_sorted(data.begin(), data.end()));
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+
+    for (const auto& [name, pattern] : kPatterns)
+    {
+        const auto data = pattern(size, random);
+
+        const auto mtlSort = measure(data, [](auto first, auto last) { mtl::sort(first, last); });
+        const auto stdSort = measure(data, [](auto first, auto last) { std::sort(first, last); });
+        const auto mtlStableSort = measure(data, [](auto first, auto last) { mtl::stable_sort(first, last); });
+        const auto stdStableSort = measure(data, [](auto first, auto last) { std::stable_sort(first, last); });
+
+        printf("%-20s sort: %8.2f ms (std: %8.2f ms)   stable_sort: %8.2f ms (std: %8.2f ms)\n", name, mtlSort, stdSort,
+               mtlStableSort, stdStableSort);
+    }
+}
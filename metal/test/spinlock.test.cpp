@@ -0,0 +1,309 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <metal/spinlock.hpp>
+#include <thread>
+#include <unittest.hpp>
+#include <vector>
+
+namespace
+{
+    // There might be fewer CPUs than threads, give the lock holder a chance to run
+    struct Yield
+    {
+        void operator()() const { std::this_thread::yield(); }
+    };
+
+    // Signals that a waiter has queued itself on the lock
+    struct SignalAndYield
+    {
+        std::atomic<bool>* queued;
+
+        void operator()() const
+        {
+            queued->store(true);
+            std::this_thread::yield();
+        }
+    };
+
+    // Uniform interface over the different locks so tests can be shared
+    struct TicketLock
+    {
+        using Node = int;
+
+        template <typename Pause>
+        uint32_t lock(Node&, Pause pause)
+        {
+            return impl.lock(pause);
+        }
+        bool try_lock(Node&) { return impl.try_lock(); }
+        void unlock(Node&) { impl.unlock(); }
+        bool is_locked() const { return impl.is_locked(); }
+
+        mtl::ticket_lock impl;
+    };
+
+    struct McsLock
+    {
+        using Node = mtl::mcs_lock::node;
+
+        template <typename Pause>
+        uint32_t lock(Node& node, Pause pause)
+        {
+            return impl.lock(node, pause);
+        }
+        bool try_lock(Node& node) { return impl.try_lock(node); }
+        void unlock(Node& node) { impl.unlock(node, Yield{}); }
+        bool is_locked() const { return impl.is_locked(); }
+
+        mtl::mcs_lock impl;
+    };
+
+    // Test-and-test-and-set lock, the old kernel Spinlock, used as a baseline
+    struct TtasLock
+    {
+        using Node = int;
+
+        template <typename Pause>
+        uint32_t lock(Node&, Pause pause)
+        {
+            uint32_t spins = 0;
+            while (locked.exchange(true, mtl::memory_order_acquire))
+            {
+                while (locked.load(mtl::memory_order_relaxed))
+                {
+                    pause();
+                    ++spins;
+                }
+            }
+            return spins;
+        }
+        bool try_lock(Node&) { return !locked.exchange(true, mtl::memory_order_acquire); }
+        void unlock(Node&) { locked.store(false, mtl::memory_order_release); }
+        bool is_locked() const { return locked.load(mtl::memory_order_relaxed); }
+
+        mtl::atomic<bool> locked{false};
+    };
+
+    template <typename Lock>
+    void TestMutualExclusion()
+    {
+        constexpr int kThreadCount = 4;
+        constexpr int kIterations = 20000;
+
+        Lock lock;
+        int counter = 0; // Not atomic on purpose
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i != kThreadCount; ++i)
+        {
+            threads.emplace_back([&] {
+                for (int j = 0; j != kIterations; ++j)
+                {
+                    typename Lock::Node node{};
+                    lock.lock(node, Yield{});
+                    ++counter;
+                    lock.unlock(node);
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        REQUIRE(counter == kThreadCount * kIterations);
+        REQUIRE(!lock.is_locked());
+    }
+
+    template <typename Lock>
+    void TestTryLock()
+    {
+        Lock lock;
+        typename Lock::Node a{}, b{};
+
+        REQUIRE(lock.try_lock(a));
+        REQUIRE(lock.is_locked());
+        REQUIRE(!lock.try_lock(b));
+
+        lock.unlock(a);
+        REQUIRE(!lock.is_locked());
+
+        REQUIRE(lock.try_lock(b));
+        lock.unlock(b);
+        REQUIRE(lock.lock(a, Yield{}) == 0);
+        lock.unlock(a);
+    }
+
+    // Waiters must get the lock in the order they asked for it
+    template <typename Lock>
+    void TestFairness()
+    {
+        constexpr int kWaiterCount = 6;
+
+        Lock lock;
+        typename Lock::Node mainNode{};
+        std::atomic<bool> queued[kWaiterCount]{};
+        std::vector<int> order;
+
+        lock.lock(mainNode, Yield{});
+
+        // Start waiters one at a time and only start the next one once the previous one is spinning on the lock
+        std::vector<std::thread> threads;
+        for (int i = 0; i != kWaiterCount; ++i)
+        {
+            threads.emplace_back([&, i] {
+                typename Lock::Node node{};
+                lock.lock(node, SignalAndYield{&queued[i]});
+                order.push_back(i);
+                lock.unlock(node);
+            });
+
+            while (!queued[i].load())
+                std::this_thread::yield();
+        }
+
+        lock.unlock(mainNode);
+
+        for (auto& thread : threads)
+            thread.join();
+
+        REQUIRE(order == std::vector<int>{0, 1, 2, 3, 4, 5});
+    }
+
+    template <typename Lock>
+    void Benchmark(const char* name, int threadCount)
+    {
+        using namespace std::chrono;
+        constexpr auto kDuration = milliseconds(200);
+
+        Lock lock;
+        std::atomic<bool> stop{false};
+        std::vector<uint64_t> acquisitions(threadCount);
+        std::vector<uint64_t> spinCounts(threadCount);
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i != threadCount; ++i)
+        {
+            threads.emplace_back([&, i] {
+                uint64_t count = 0, spins = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    typename Lock::Node node{};
+                    spins += lock.lock(node, Yield{});
+                    ++count;
+                    lock.unlock(node);
+                }
+                acquisitions[i] = count;
+                spinCounts[i] = spins;
+            });
+        }
+
+        std::this_thread::sleep_for(kDuration);
+        stop = true;
+
+        for (auto& thread : threads)
+            thread.join();
+
+        uint64_t total = 0, spins = 0, least = UINT64_MAX, most = 0;
+        for (int i = 0; i != threadCount; ++i)
+        {
+            const auto count = acquisitions[i];
+            total += count;
+            spins += spinCounts[i];
+            least = std::min(least, count);
+            most = std::max(most, count);
+        }
+
+        printf("%-8s %d threads: %8.2f Mops/s, spins/op %6.2f, least/most per thread %.2f\n", name, threadCount,
+               total / duration<double, std::micro>(kDuration).count(), total ? double(spins) / total : 0.0,
+               most ? double(least) / most : 0.0);
+    }
+} // namespace
+
+TEST_CASE("ticket_lock mutual exclusion", "[spinlock]")
+{
+    TestMutualExclusion<TicketLock>();
+}
+
+TEST_CASE("ticket_lock try_lock", "[spinlock]")
+{
+    TestTryLock<TicketLock>();
+}
+
+TEST_CASE("ticket_lock is contended", "[spinlock]")
+{
+    mtl::ticket_lock lock;
+    REQUIRE(!lock.is_contended());
+
+    lock.lock();
+    REQUIRE(!lock.is_contended());
+
+    std::thread waiter([&] {
+        lock.lock(Yield{});
+        lock.unlock();
+    });
+
+    while (!lock.is_contended())
+        std::this_thread::yield();
+
+    lock.unlock();
+    waiter.join();
+    REQUIRE(!lock.is_locked());
+}
+
+TEST_CASE("ticket_lock is fair", "[spinlock]")
+{
+    TestFairness<TicketLock>();
+}
+
+TEST_CASE("mcs_lock mutual exclusion", "[spinlock]")
+{
+    TestMutualExclusion<McsLock>();
+}
+
+TEST_CASE("mcs_lock try_lock", "[spinlock]")
+{
+    TestTryLock<McsLock>();
+}
+
+TEST_CASE("mcs_lock is fair", "[spinlock]")
+{
+    TestFairness<McsLock>();
+}
+
+TEST_CASE("Spinlock benchmark", "[.][benchmark]")
+{
+    for (int threadCount : {1, 2, 4, 8})
+    {
+        Benchmark<TtasLock>("ttas", threadCount);
+        Benchmark<TicketLock>("ticket", threadCount);
+        Benchmark<McsLock>("mcs", threadCount);
+    }
+}
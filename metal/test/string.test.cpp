@@ -104,6 +104,61 @@ TEST_CASE("Move", "[string]")
     }
 }
 
+TEST_CASE("Append", "[string]")
+{
+    SECTION("small string")
+    {
+        mtl::string s("abc");
+        s.append("def", 3);
+        s.push_back('g');
+        CHECK_THAT(s.c_str(), Equals("abcdefg"));
+        CHECK(s.length() == 7);
+        CHECK(s.capacity() == 23);
+    }
+
+    SECTION("small string to max capacity")
+    {
+        mtl::string s("abcdefghijklmnopqrstuv");
+        s.push_back('w');
+        CHECK(s == "abcdefghijklmnopqrstuvw");
+        CHECK(s.capacity() == 23);
+    }
+
+    SECTION("small string to large string")
+    {
+        mtl::string s("abcdefghijklmnopqrstuvw");
+        s.push_back('x');
+        CHECK_THAT(s.c_str(), Equals("abcdefghijklmnopqrstuvwx"));
+        CHECK(s.length() == 24);
+        CHECK(s.capacity() >= 46);
+    }
+
+    SECTION("large string")
+    {
+        mtl::string s;
+        for (int i = 0; i != 1000; ++i)
+            s.push_back('a' + i % 26);
+
+        CHECK(s.length() == 1000);
+        for (int i = 0; i != 1000; ++i)
+            CHECK(s.data()[i] == 'a' + i % 26);
+        CHECK(s.data()[1000] == 0);
+    }
+
+    SECTION("reserve")
+    {
+        mtl::string s("abc");
+        s.reserve(100);
+        CHECK(s.capacity() >= 100);
+        CHECK_THAT(s.c_str(), Equals("abc"));
+
+        const auto data = s.data();
+        s.append("0123456789012345678901234567890123456789", 40);
+        CHECK(s.data() == data);
+        CHECK(s.length() == 43);
+    }
+}
+
 TEST_CASE("u16string", "[string]")
 {
     SECTION("Default constructor")
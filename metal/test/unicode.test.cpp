@@ -25,6 +25,8 @@
 */
 
 #include <metal/unicode.hpp>
+#include <random>
+#include <string>
 #include <string_view>
 #include <unittest.hpp>
 
@@ -204,3 +206,191 @@ TEST_CASE("ToU16String()", "[unicode]")
         REQUIRE(string == u"\uFFFD");
     }
 }
+
+TEST_CASE("Utf8ToCodePoint() - malformed sequences", "[unicode]")
+{
+    const auto decode = [](mtl::string_view bytes, int expected, size_t consumed) {
+        auto start = (const char8_t*)bytes.cbegin();
+        const auto codepoint = Utf8ToCodePoint(start, (const char8_t*)bytes.cend());
+        REQUIRE(codepoint == expected);
+        REQUIRE(start == (const char8_t*)bytes.cbegin() + consumed);
+    };
+
+    decode("\x80"sv, -1, 1);             // Unexpected continuation byte
+    decode("\xC3" "A"sv, -1, 1);         // Missing continuation byte
+    decode("\xE2\x88" "A"sv, -1, 2);     // Missing continuation byte
+    decode("\xC0\x80"sv, -1, 2);         // Overlong NUL
+    decode("\xE0\x80\xAF"sv, -1, 3);     // Overlong '/'
+    decode("\xF0\x80\x80\xAF"sv, -1, 4); // Overlong '/'
+    decode("\xF4\x90\x80\x80"sv, -1, 4); // U+110000
+    decode("\xED\xA0\x80"sv, -1, 3);     // U+D800, lead surrogate
+    decode("\xED\xBF\xBF"sv, -1, 3);     // U+DFFF, trail surrogate
+    decode("\xED\x9F\xBF"sv, 0xD7FF, 3); // Last code point before the surrogates
+    decode("\xEE\x80\x80"sv, 0xE000, 3); // First code point after the surrogates
+    decode("\xF8\x88\x80\x80\x80"sv, -1, 1);
+}
+
+namespace
+{
+    // Straightforward encoders used as references for the fuzz tests
+    void AppendUtf8(std::u8string& out, int codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            out += (char8_t)codePoint;
+        }
+        else if (codePoint < 0x800)
+        {
+            out += (char8_t)(0xC0 | (codePoint >> 6));
+            out += (char8_t)(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            out += (char8_t)(0xE0 | (codePoint >> 12));
+            out += (char8_t)(0x80 | ((codePoint >> 6) & 0x3F));
+            out += (char8_t)(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            out += (char8_t)(0xF0 | (codePoint >> 18));
+            out += (char8_t)(0x80 | ((codePoint >> 12) & 0x3F));
+            out += (char8_t)(0x80 | ((codePoint >> 6) & 0x3F));
+            out += (char8_t)(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    void AppendUtf16(std::u16string& out, int codePoint)
+    {
+        if (codePoint < 0x10000)
+        {
+            out += (char16_t)codePoint;
+        }
+        else
+        {
+            out += (char16_t)(0xD800 + ((codePoint - 0x10000) >> 10));
+            out += (char16_t)(0xDC00 + (codePoint & 0x3FF));
+        }
+    }
+
+    // Mostly ASCII runs of random length, to exercise the word at a time fast path and its tail handling
+    int RandomCodePoint(std::mt19937& random)
+    {
+        switch (random() % 8)
+        {
+        case 0:
+            return 0x80 + random() % (0x800 - 0x80);
+        case 1:
+            return 0x800 + random() % (0xD800 - 0x800);
+        case 2:
+            return 0xE000 + random() % (0x10000 - 0xE000);
+        case 3:
+            return 0x10000 + random() % (0x110000 - 0x10000);
+        default:
+            return random() % 0x80;
+        }
+    }
+
+    template <typename T>
+    std::basic_string<T> ToStd(const mtl::basic_string<T>& string)
+    {
+        return std::basic_string<T>(string.data(), string.length());
+    }
+} // namespace
+
+TEST_CASE("Transcoding - fuzz valid strings", "[unicode]")
+{
+    std::mt19937 random(1234);
+
+    for (int i = 0; i != 2000; ++i)
+    {
+        std::u8string utf8;
+        std::u16string utf16;
+        const int length = random() % 100;
+        for (int j = 0; j != length; ++j)
+        {
+            const auto codePoint = RandomCodePoint(random);
+            AppendUtf8(utf8, codePoint);
+            AppendUtf16(utf16, codePoint);
+        }
+
+        REQUIRE(ToStd(ToU8String(mtl::u16string_view(utf16.data(), utf16.size()))) == utf8);
+        REQUIRE(ToStd(ToU16String(mtl::u8string_view(utf8.data(), utf8.size()))) == utf16);
+    }
+}
+
+TEST_CASE("Transcoding - fuzz random UTF-8 bytes", "[unicode]")
+{
+    std::mt19937 random(5678);
+
+    for (int i = 0; i != 5000; ++i)
+    {
+        // Bias towards ASCII so that valid sequences and long ASCII runs show up
+        std::u8string bytes;
+        const int length = random() % 64;
+        for (int j = 0; j != length; ++j)
+            bytes += (char8_t)(random() % 2 ? random() % 0x80 : random() % 0x100);
+
+        // Reference: decode one code point at a time
+        std::u16string expected;
+        std::u16string expectedUcs2;
+        for (const char8_t *text = bytes.data(), *end = bytes.data() + bytes.size(); text != end;)
+        {
+            const auto codePoint = Utf8ToCodePoint(text, end);
+            AppendUtf16(expected, codePoint < 0 ? 0xFFFD : codePoint);
+            expectedUcs2 += IsValidUcs2CodePoint(codePoint) ? (char16_t)codePoint : u'\uFFFD';
+        }
+
+        const mtl::u8string_view view(bytes.data(), bytes.size());
+        REQUIRE(ToStd(ToU16String(view)) == expected);
+        REQUIRE(ToStd(ToU16String(view, mtl::Ucs2)) == expectedUcs2);
+    }
+}
+
+TEST_CASE("Transcoding - fuzz random UTF-16 code units", "[unicode]")
+{
+    std::mt19937 random(9012);
+
+    for (int i = 0; i != 5000; ++i)
+    {
+        std::u16string units;
+        const int length = random() % 64;
+        for (int j = 0; j != length; ++j)
+        {
+            // Plenty of surrogates, paired or not
+            switch (random() % 4)
+            {
+            case 0:
+                units += (char16_t)(0xD800 + random() % 0x800);
+                break;
+            case 1:
+                units += (char16_t)(random() % 0x10000);
+                break;
+            default:
+                units += (char16_t)(random() % 0x80);
+            }
+        }
+
+        // Reference: unpaired surrogates become U+FFFD
+        std::u8string expected;
+        for (size_t j = 0; j != units.size(); ++j)
+        {
+            int codePoint = units[j];
+            if (codePoint >= 0xD800 && codePoint <= 0xDBFF && j + 1 != units.size() && units[j + 1] >= 0xDC00 &&
+                units[j + 1] <= 0xDFFF)
+            {
+                codePoint = SurrogatesToCodePoint(units[j], units[j + 1]);
+                ++j;
+            }
+            else if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+            {
+                codePoint = 0xFFFD;
+            }
+
+            AppendUtf8(expected, codePoint);
+        }
+
+        const auto string = ToU8String(mtl::u16string_view(units.data(), units.size()));
+        REQUIRE(ToStd(string) == expected);
+        REQUIRE(string.data()[string.length()] == 0);
+    }
+}
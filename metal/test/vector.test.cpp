@@ -0,0 +1,282 @@
+/*
+    Copyright (c) 2024, Thierry Tremblay
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this
+      list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <metal/shared_ptr.hpp>
+#include <metal/vector.hpp>
+#include <string>
+#include <unittest.hpp>
+
+namespace
+{
+    // Not trivially relocatable: keeps track of live instances
+    struct Tracked
+    {
+        static inline int s_count = 0;
+
+        Tracked(int v = 0) : value(v), self(this) { ++s_count; }
+        Tracked(const Tracked& other) : value(other.value), self(this) { ++s_count; }
+        Tracked(Tracked&& other) : value(other.value), self(this)
+        {
+            other.value = -1;
+            ++s_count;
+        }
+        ~Tracked()
+        {
+            REQUIRE(self == this);
+            --s_count;
+        }
+
+        Tracked& operator=(const Tracked& other)
+        {
+            value = other.value;
+            return *this;
+        }
+
+        int value;
+        Tracked* self;
+    };
+
+    template <typename V>
+    void Fill(V& vector, int count)
+    {
+        for (int i = 0; i != count; ++i)
+            vector.emplace_back(i);
+    }
+
+    template <typename V>
+    bool IsSequence(const V& vector, int count)
+    {
+        if (vector.size() != size_t(count))
+            return false;
+
+        for (int i = 0; i != count; ++i)
+        {
+            if (int(vector[i]) != i)
+                return false;
+        }
+
+        return true;
+    }
+
+    template <typename V>
+    bool IsTrackedSequence(const V& vector, int count)
+    {
+        if (vector.size() != size_t(count))
+            return false;
+
+        for (int i = 0; i != count; ++i)
+        {
+            if (vector[i].value != i || vector[i].self != &vector[i])
+                return false;
+        }
+
+        return true;
+    }
+} // namespace
+
+static_assert(sizeof(mtl::vector<int>) == 3 * sizeof(void*));
+static_assert(mtl::is_trivially_relocatable_v<int>);
+static_assert(mtl::is_trivially_relocatable_v<mtl::shared_ptr<int>>);
+static_assert(!mtl::is_trivially_relocatable_v<Tracked>);
+
+TEST_CASE("vector copy", "[vector]")
+{
+    mtl::vector<int> a;
+    Fill(a, 100);
+
+    mtl::vector<int> b(a);
+    REQUIRE(IsSequence(a, 100));
+    REQUIRE(IsSequence(b, 100));
+    REQUIRE(a.data() != b.data());
+
+    mtl::vector<int> c{1, 2, 3};
+    c = a;
+    REQUIRE(IsSequence(c, 100));
+
+    c = c;
+    REQUIRE(IsSequence(c, 100));
+}
+
+TEST_CASE("vector copy of non trivial elements", "[vector]")
+{
+    {
+        mtl::vector<Tracked> a;
+        Fill(a, 50);
+
+        mtl::vector<Tracked> b;
+        b = a;
+        REQUIRE(IsTrackedSequence(a, 50));
+        REQUIRE(IsTrackedSequence(b, 50));
+        REQUIRE(Tracked::s_count == 100);
+    }
+
+    REQUIRE(Tracked::s_count == 0);
+}
+
+TEST_CASE("vector growth", "[vector]")
+{
+    mtl::vector<int> trivial;
+    Fill(trivial, 1000);
+    REQUIRE(IsSequence(trivial, 1000));
+
+    {
+        mtl::vector<Tracked> tracked;
+        Fill(tracked, 1000);
+        REQUIRE(IsTrackedSequence(tracked, 1000));
+        REQUIRE(Tracked::s_count == 1000);
+    }
+
+    REQUIRE(Tracked::s_count == 0);
+
+    mtl::vector<mtl::shared_ptr<int>> pointers;
+    for (int i = 0; i != 100; ++i)
+        pointers.emplace_back(mtl::make_shared<int>(i));
+
+    for (int i = 0; i != 100; ++i)
+    {
+        REQUIRE(*pointers[i] == i);
+        REQUIRE(pointers[i].use_count() == 1);
+    }
+}
+
+TEST_CASE("vector shrink_to_fit", "[vector]")
+{
+    mtl::vector<int> a;
+    Fill(a, 100);
+    REQUIRE(a.capacity() > 100);
+
+    a.shrink_to_fit();
+    REQUIRE(a.capacity() == 100);
+    REQUIRE(IsSequence(a, 100));
+
+    a.resize(10);
+    a.shrink_to_fit();
+    REQUIRE(a.capacity() == 10);
+    REQUIRE(IsSequence(a, 10));
+
+    a.resize(0);
+    a.shrink_to_fit();
+    REQUIRE(a.capacity() == 0);
+    REQUIRE(a.data() == nullptr);
+}
+
+TEST_CASE("small_vector stays inline", "[small_vector]")
+{
+    mtl::small_vector<int, 8> a;
+    REQUIRE(a.capacity() == 8);
+
+    const auto inlineData = a.data();
+    REQUIRE((void*)inlineData >= (void*)&a);
+    REQUIRE((void*)inlineData < (void*)(&a + 1));
+
+    Fill(a, 8);
+    REQUIRE(a.data() == inlineData);
+    REQUIRE(IsSequence(a, 8));
+
+    // Spill to the heap
+    a.emplace_back(8);
+    REQUIRE(a.data() != inlineData);
+    REQUIRE(a.capacity() >= 9);
+    REQUIRE(IsSequence(a, 9));
+
+    // Shrinking brings the elements back inline
+    a.pop_back();
+    a.shrink_to_fit();
+    REQUIRE(a.data() == inlineData);
+    REQUIRE(IsSequence(a, 8));
+
+    a.clear();
+    REQUIRE(a.empty());
+    REQUIRE(a.capacity() == 8);
+}
+
+TEST_CASE("small_vector copy and move", "[small_vector]")
+{
+    for (int count : {0, 3, 4, 5, 100})
+    {
+        {
+            mtl::small_vector<Tracked, 4> a;
+            Fill(a, count);
+
+            mtl::small_vector<Tracked, 4> b(a);
+            REQUIRE(IsTrackedSequence(a, count));
+            REQUIRE(IsTrackedSequence(b, count));
+
+            mtl::small_vector<Tracked, 4> c(std::move(b));
+            REQUIRE(IsTrackedSequence(c, count));
+            REQUIRE(b.empty());
+
+            mtl::small_vector<Tracked, 4> d;
+            Fill(d, 2);
+            d = std::move(c);
+            REQUIRE(IsTrackedSequence(d, count));
+            REQUIRE(c.empty());
+
+            d = a;
+            REQUIRE(IsTrackedSequence(d, count));
+            REQUIRE(Tracked::s_count == 2 * count);
+        }
+
+        REQUIRE(Tracked::s_count == 0);
+    }
+}
+
+TEST_CASE("small_vector swap", "[small_vector]")
+{
+    for (int countA : {0, 2, 10})
+    {
+        for (int countB : {0, 3, 20})
+        {
+            {
+                mtl::small_vector<Tracked, 4> a;
+                mtl::small_vector<Tracked, 4> b;
+                Fill(a, countA);
+                Fill(b, countB);
+
+                swap(a, b);
+                REQUIRE(IsTrackedSequence(a, countB));
+                REQUIRE(IsTrackedSequence(b, countA));
+            }
+
+            REQUIRE(Tracked::s_count == 0);
+        }
+    }
+}
+
+TEST_CASE("small_vector with strings", "[small_vector]")
+{
+    mtl::small_vector<std::string, 2> strings;
+    for (int i = 0; i != 20; ++i)
+        strings.push_back(std::string(40, 'a' + i));
+
+    for (int i = 0; i != 20; ++i)
+        REQUIRE(strings[i] == std::string(40, 'a' + i));
+
+    strings.resize(2);
+    strings.shrink_to_fit();
+    REQUIRE(strings.capacity() == 2);
+    REQUIRE(strings[1] == std::string(40, 'b'));
+}